@@ -40,6 +40,53 @@ rstrnt_bkr_env_exists (void)
     return (int) g_file_test (BKR_ENV_FILE, G_FILE_TEST_EXISTS);
 }
 
+typedef struct {
+    bkr_health_callback_t callback;
+    gpointer user_data;
+    gint64 started;
+} BkrHealthCheck;
+
+static bkr_health_stats_t health_stats;
+
+/*
+ * Classifies the response to a HEAD on the recipe and records it.
+ */
+static bkr_health_status_t
+bkr_health_status (SoupMessage *msg, gint64 started)
+{
+    SoupStatus status = msg->status_code;
+    gint64 elapsed = g_get_monotonic_time () - started;
+    bkr_health_status_t health;
+
+    if (SOUP_STATUS_IS_SUCCESSFUL (status)
+        && soup_message_headers_header_equals (msg->response_headers, "Content-Type", "application/xml")
+        && soup_message_headers_get_content_length (msg->response_headers) > 0)
+        health = BKR_HEALTH_STATUS_GOOD;
+    else if (status == SOUP_STATUS_NONE || SOUP_STATUS_IS_TRANSPORT_ERROR (status))
+        health = BKR_HEALTH_STATUS_UNKNOWN;
+    else
+        health = BKR_HEALTH_STATUS_BAD;
+
+    health_stats.checks++;
+    switch (health) {
+        case BKR_HEALTH_STATUS_GOOD:
+            health_stats.good++;
+            break;
+        case BKR_HEALTH_STATUS_BAD:
+            health_stats.bad++;
+            break;
+        default:
+            health_stats.unknown++;
+            break;
+    }
+    health_stats.last_us = elapsed;
+    health_stats.total_us += elapsed;
+    if (elapsed > health_stats.max_us)
+        health_stats.max_us = elapsed;
+
+    return health;
+}
+
 /*
  * Checks if recipe_url is reachable and points to a valid recipe
  * endpoint.
@@ -54,7 +101,7 @@ rstrnt_bkr_env_exists (void)
 bkr_health_status_t
 rstrnt_bkr_check_recipe (const char *recipe_url)
 {
-    SoupStatus              status;
+    gint64                  started;
     g_autoptr (SoupMessage) msg = NULL;
     g_autoptr (SoupSession) session = NULL;
 
@@ -69,15 +116,75 @@ rstrnt_bkr_check_recipe (const char *recipe_url)
                                              "ssl-strict", FALSE,
                                              NULL);
 
-    status = soup_session_send_message (session, msg);
+    started = g_get_monotonic_time ();
+    soup_session_send_message (session, msg);
 
-    if (SOUP_STATUS_IS_SUCCESSFUL (status)
-        && soup_message_headers_header_equals (msg->response_headers, "Content-Type", "application/xml")
-        && soup_message_headers_get_content_length (msg->response_headers) > 0)
-        return BKR_HEALTH_STATUS_GOOD;
+    return bkr_health_status (msg, started);
+}
 
-    if (status == SOUP_STATUS_NONE || SOUP_STATUS_IS_TRANSPORT_ERROR (status))
-        return BKR_HEALTH_STATUS_UNKNOWN;
+static void
+bkr_check_recipe_cb (SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+    BkrHealthCheck *check = user_data;
+
+    check->callback (bkr_health_status (msg, check->started), check->user_data);
+    g_slice_free (BkrHealthCheck, check);
+}
+
+static gboolean
+bkr_check_recipe_invalid (gpointer user_data)
+{
+    BkrHealthCheck *check = user_data;
 
-    return BKR_HEALTH_STATUS_BAD;
+    check->callback (BKR_HEALTH_STATUS_UNKNOWN, check->user_data);
+    g_slice_free (BkrHealthCheck, check);
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Same as rstrnt_bkr_check_recipe but queued on session, callback is
+ * always invoked later from the main loop with the result.
+ */
+void
+rstrnt_bkr_check_recipe_async (SoupSession *session,
+                               const char *recipe_url,
+                               bkr_health_callback_t callback,
+                               gpointer user_data)
+{
+    SoupMessage *msg = NULL;
+    BkrHealthCheck *check = g_slice_new0 (BkrHealthCheck);
+
+    check->callback = callback;
+    check->user_data = user_data;
+    check->started = g_get_monotonic_time ();
+
+    if (!STREMPTY (recipe_url))
+        msg = soup_message_new ("HEAD", recipe_url);
+
+    /* msg will be NULL if the URL cannot be parsed */
+    if (msg == NULL) {
+        g_idle_add (bkr_check_recipe_invalid, check);
+        return;
+    }
+
+    soup_session_queue_message (session, msg, bkr_check_recipe_cb, check);
+}
+
+/*
+ * Seconds to wait before checking again, doubling from BKR_WAIT_MIN up to
+ * BKR_WAIT_MAX while the lab controller stays unhealthy.
+ */
+guint
+rstrnt_bkr_backoff (guint previous)
+{
+    if (previous == 0)
+        return BKR_WAIT_MIN;
+
+    return MIN (previous * 2, BKR_WAIT_MAX);
+}
+
+const bkr_health_stats_t *
+rstrnt_bkr_health_stats (void)
+{
+    return &health_stats;
 }
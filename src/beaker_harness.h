@@ -18,8 +18,13 @@
 #ifndef _RESTRAINT_BEAKER_HARNESS_H
 #define _RESTRAINT_BEAKER_HARNESS_H
 
+#include <libsoup/soup.h>
+
 #define BKR_MAX_CONTENT_LENGTH 10 * 1024 * 1024  /* 10MB */
 
+#define BKR_WAIT_MIN 15   /* Seconds */
+#define BKR_WAIT_MAX 300  /* Seconds */
+
 #define BKR_ENV_EXISTS()           (rstrnt_bkr_env_exists () != 0)
 #define BKR_RECIPE_IS_HEALTHY(url) (BKR_HEALTH_STATUS_GOOD == rstrnt_bkr_check_recipe (url))
 
@@ -29,7 +34,27 @@ typedef enum bkr_health_status {
     BKR_HEALTH_STATUS_BAD,     /* Un-expected response from lab controller */
 } bkr_health_status_t;
 
+typedef void (*bkr_health_callback_t) (bkr_health_status_t status,
+                                       gpointer user_data);
+
+/* Outcomes and latency of every health check done so far */
+typedef struct bkr_health_stats {
+    guint64 checks;
+    guint64 good;
+    guint64 bad;
+    guint64 unknown;
+    gint64 last_us;
+    gint64 max_us;
+    gint64 total_us;
+} bkr_health_stats_t;
+
 bkr_health_status_t rstrnt_bkr_check_recipe (const char *recipe_url);
+void rstrnt_bkr_check_recipe_async (SoupSession *session,
+                                    const char *recipe_url,
+                                    bkr_health_callback_t callback,
+                                    gpointer user_data);
+guint rstrnt_bkr_backoff (guint previous);
+const bkr_health_stats_t *rstrnt_bkr_health_stats (void);
 
 int rstrnt_bkr_env_exists (void);
 
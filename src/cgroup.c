@@ -0,0 +1,433 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+
+/* Where the task cgroups are made, NULL when cgroups are not used */
+static gchar *cgroup_base = NULL;
+
+static void
+cgroup_set_errno_error (GError **error, gint errsv, const gchar *action,
+                        const gchar *path)
+{
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                 "Failed to %s %s: %s", action, path, g_strerror (errsv));
+}
+
+static gboolean
+cgroup_write_fd (gint fd, const gchar *value)
+{
+    gsize len = strlen (value);
+    gboolean ret = write (fd, value, len) == (gssize) len;
+
+    close (fd);
+    return ret;
+}
+
+static gboolean
+cgroup_write_path (const gchar *path, const gchar *value, GError **error)
+{
+    gint fd = open (path, O_WRONLY | O_CLOEXEC);
+
+    if (fd < 0 || !cgroup_write_fd (fd, value)) {
+        cgroup_set_errno_error (error, errno, "write", path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gchar *
+cgroup_read (RstrntCgroup *cgroup, const gchar *file)
+{
+    GString *contents;
+    gchar buf[4096];
+    gssize len;
+    gint fd;
+
+    fd = openat (cgroup->fd, file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    contents = g_string_new (NULL);
+    while ((len = read (fd, buf, sizeof (buf))) > 0) {
+        g_string_append_len (contents, buf, len);
+    }
+    close (fd);
+
+    return g_string_free (contents, len < 0);
+}
+
+/* Value of key in a flat keyed file, "key value" lines */
+static guint64
+cgroup_flat_keyed (const gchar *contents, const gchar *key)
+{
+    g_auto (GStrv) lines = g_strsplit (contents ? contents : "", "\n", -1);
+
+    for (gchar **line = lines; *line; line++) {
+        g_auto (GStrv) fields = g_strsplit (*line, " ", 2);
+
+        if (fields[0] && fields[1] && g_strcmp0 (fields[0], key) == 0) {
+            return g_ascii_strtoull (fields[1], NULL, 10);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Sum of key over the lines of a nested keyed file, "name key=value ..."
+ * lines.  Only lines named prefix are counted unless prefix is NULL.
+ */
+static guint64
+cgroup_nested_keyed (const gchar *contents, const gchar *prefix,
+                     const gchar *key)
+{
+    g_auto (GStrv) lines = g_strsplit (contents ? contents : "", "\n", -1);
+    gsize key_len = strlen (key);
+    guint64 sum = 0;
+
+    for (gchar **line = lines; *line; line++) {
+        g_auto (GStrv) fields = g_strsplit (*line, " ", -1);
+
+        if (fields[0] == NULL || (prefix && g_strcmp0 (fields[0], prefix) != 0)) {
+            continue;
+        }
+        for (gchar **field = fields + 1; *field; field++) {
+            if (strncmp (*field, key, key_len) == 0 && (*field)[key_len] == '=') {
+                sum += g_ascii_strtoull (*field + key_len + 1, NULL, 10);
+            }
+        }
+    }
+    return sum;
+}
+
+static void
+cgroup_enable_controllers (const gchar *path)
+{
+    const gchar *controllers[] = { CGROUP_CONTROLLERS, NULL };
+    gchar *subtree_control = g_build_filename (path, "cgroup.subtree_control", NULL);
+
+    // Best effort, a controller missing from the kernel is not accounted
+    for (const gchar **controller = controllers; *controller; controller++) {
+        gchar *value = g_strdup_printf ("+%s", *controller);
+        GError *error = NULL;
+
+        if (!cgroup_write_path (subtree_control, value, &error)) {
+            g_debug ("%s", error->message);
+            g_clear_error (&error);
+        }
+        g_free (value);
+    }
+    g_free (subtree_control);
+}
+
+/*
+ * Looks up the cgroup v2 restraintd was started in and gets it ready to
+ * hold one cgroup per task.  The no internal process rule of cgroup v2
+ * means restraintd first moves itself to a leaf of its own.  restraintd
+ * must be given the cgroup, see Delegate= in systemd.resource-control(5).
+ */
+gboolean
+rstrnt_cgroup_init (GError **error)
+{
+    g_autofree gchar *contents = NULL;
+    g_autofree gchar *own = NULL;
+    g_autofree gchar *daemon = NULL;
+    g_autofree gchar *procs = NULL;
+    g_autofree gchar *pid = NULL;
+    gchar *base;
+
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    if (!g_file_test (CGROUP_MOUNT "/cgroup.controllers", G_FILE_TEST_EXISTS)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOSYS,
+                     "No cgroup v2 hierarchy mounted on %s", CGROUP_MOUNT);
+        return FALSE;
+    }
+    if (!g_file_get_contents ("/proc/self/cgroup", &contents, NULL, error)) {
+        return FALSE;
+    }
+    g_auto (GStrv) lines = g_strsplit (contents, "\n", -1);
+    for (gchar **line = lines; *line; line++) {
+        if (g_str_has_prefix (*line, "0::")) {
+            own = g_strdup (*line + 3);
+            break;
+        }
+    }
+    if (own == NULL) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOSYS,
+                     "restraintd is not in a cgroup v2");
+        return FALSE;
+    }
+
+    if (g_strcmp0 (own, "/") == 0) {
+        // Processes may stay in the root cgroup, make a subtree beside them
+        cgroup_enable_controllers (CGROUP_MOUNT);
+        base = g_build_filename (CGROUP_MOUNT, "restraint", NULL);
+    } else {
+        // A restarted restraintd is already in its leaf
+        if (g_str_has_suffix (own, "/" CGROUP_DAEMON_LEAF)) {
+            own[strlen (own) - strlen ("/" CGROUP_DAEMON_LEAF)] = '\0';
+        }
+        base = g_build_filename (CGROUP_MOUNT, own, NULL);
+        daemon = g_build_filename (base, CGROUP_DAEMON_LEAF, NULL);
+        if (g_mkdir (daemon, 0755) != 0 && errno != EEXIST) {
+            cgroup_set_errno_error (error, errno, "create", daemon);
+            g_free (base);
+            return FALSE;
+        }
+        procs = g_build_filename (daemon, "cgroup.procs", NULL);
+        pid = g_strdup_printf ("%d", getpid ());
+        if (!cgroup_write_path (procs, pid, error)) {
+            g_free (base);
+            return FALSE;
+        }
+    }
+    if (g_mkdir (base, 0755) != 0 && errno != EEXIST) {
+        cgroup_set_errno_error (error, errno, "create", base);
+        g_free (base);
+        return FALSE;
+    }
+    cgroup_enable_controllers (base);
+
+    g_free (cgroup_base);
+    cgroup_base = base;
+    return TRUE;
+}
+
+gboolean
+rstrnt_cgroup_enabled (void)
+{
+    return cgroup_base != NULL;
+}
+
+RstrntCgroup *
+rstrnt_cgroup_open (const gchar *path, GError **error)
+{
+    RstrntCgroup *cgroup;
+    gint fd;
+
+    g_return_val_if_fail (path != NULL, NULL);
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        cgroup_set_errno_error (error, errno, "open", path);
+        return NULL;
+    }
+    cgroup = g_slice_new0 (RstrntCgroup);
+    cgroup->ref_count = 1;
+    cgroup->path = g_strdup (path);
+    cgroup->fd = fd;
+
+    return cgroup;
+}
+
+/* Makes the leaf name under the cgroup of restraintd */
+RstrntCgroup *
+rstrnt_cgroup_new (const gchar *name, GError **error)
+{
+    RstrntCgroup *cgroup;
+    gchar *path;
+
+    g_return_val_if_fail (name != NULL, NULL);
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    if (cgroup_base == NULL) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOSYS,
+                     "cgroups are not enabled");
+        return NULL;
+    }
+    path = g_build_filename (cgroup_base, name, NULL);
+    if (g_mkdir (path, 0755) != 0 && errno != EEXIST) {
+        cgroup_set_errno_error (error, errno, "create", path);
+        g_free (path);
+        return NULL;
+    }
+    cgroup = rstrnt_cgroup_open (path, error);
+    if (cgroup != NULL) {
+        cgroup->owned = TRUE;
+    } else {
+        g_rmdir (path);
+    }
+    g_free (path);
+
+    return cgroup;
+}
+
+RstrntCgroup *
+rstrnt_cgroup_ref (RstrntCgroup *cgroup)
+{
+    g_return_val_if_fail (cgroup != NULL, NULL);
+
+    cgroup->ref_count++;
+    return cgroup;
+}
+
+void
+rstrnt_cgroup_unref (RstrntCgroup *cgroup)
+{
+    if (cgroup == NULL || --cgroup->ref_count > 0) {
+        return;
+    }
+    close (cgroup->fd);
+    // Fails with EBUSY while processes are left, the cgroup is kept then
+    if (cgroup->owned && g_rmdir (cgroup->path) != 0) {
+        g_debug ("Keeping cgroup %s: %s", cgroup->path, g_strerror (errno));
+    }
+    g_free (cgroup->path);
+    g_slice_free (RstrntCgroup, cgroup);
+}
+
+/* Writes value to one of the interface files, memory.max for instance */
+gboolean
+rstrnt_cgroup_set (RstrntCgroup *cgroup, const gchar *file,
+                   const gchar *value, GError **error)
+{
+    gint fd;
+
+    g_return_val_if_fail (cgroup != NULL && file != NULL && value != NULL, FALSE);
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    fd = openat (cgroup->fd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || !cgroup_write_fd (fd, value)) {
+        gint errsv = errno;
+        gchar *path = g_build_filename (cgroup->path, file, NULL);
+
+        cgroup_set_errno_error (error, errsv, "write", path);
+        g_free (path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Moves the calling process into cgroup.  Meant for a forked child before
+ * its exec, so only async-signal-safe calls are made.
+ */
+gboolean
+rstrnt_cgroup_attach_self (RstrntCgroup *cgroup)
+{
+    gint fd = openat (cgroup->fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+
+    return fd >= 0 && cgroup_write_fd (fd, "0");
+}
+
+gboolean
+rstrnt_cgroup_populated (RstrntCgroup *cgroup)
+{
+    g_autofree gchar *events = cgroup_read (cgroup, "cgroup.events");
+
+    return cgroup_flat_keyed (events, "populated") != 0;
+}
+
+/*
+ * Kills every process of the cgroup.  Kernels before 5.14 have no
+ * cgroup.kill, the processes are then killed one by one, a few rounds
+ * to catch what was forked meanwhile.
+ */
+gboolean
+rstrnt_cgroup_kill (RstrntCgroup *cgroup, GError **error)
+{
+    g_return_val_if_fail (cgroup != NULL, FALSE);
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    if (rstrnt_cgroup_set (cgroup, "cgroup.kill", "1", NULL)) {
+        return TRUE;
+    }
+    for (guint round = 0; round < 10; round++) {
+        g_autofree gchar *procs = cgroup_read (cgroup, "cgroup.procs");
+        gboolean found = FALSE;
+
+        if (procs == NULL) {
+            cgroup_set_errno_error (error, errno, "read", cgroup->path);
+            return FALSE;
+        }
+        g_auto (GStrv) pids = g_strsplit (procs, "\n", -1);
+        for (gchar **pid = pids; *pid; pid++) {
+            if (**pid != '\0') {
+                found = TRUE;
+                kill ((pid_t) g_ascii_strtoll (*pid, NULL, 10), SIGKILL);
+            }
+        }
+        if (!found) {
+            break;
+        }
+    }
+    return TRUE;
+}
+
+/* Time some of the processes stalled on a resource, from a PSI file */
+static guint64
+cgroup_pressure (RstrntCgroup *cgroup, const gchar *file)
+{
+    g_autofree gchar *contents = cgroup_read (cgroup, file);
+
+    return cgroup_nested_keyed (contents, "some", "total");
+}
+
+void
+rstrnt_cgroup_read_stats (RstrntCgroup *cgroup, RstrntCgroupStats *stats)
+{
+    gchar *contents;
+
+    g_return_if_fail (cgroup != NULL && stats != NULL);
+
+    contents = cgroup_read (cgroup, "cpu.stat");
+    stats->cpu_usec = cgroup_flat_keyed (contents, "usage_usec");
+    g_free (contents);
+
+    contents = cgroup_read (cgroup, "memory.peak");
+    stats->memory_peak = contents ? g_ascii_strtoull (contents, NULL, 10) : 0;
+    g_free (contents);
+
+    contents = cgroup_read (cgroup, "io.stat");
+    stats->io_rbytes = cgroup_nested_keyed (contents, NULL, "rbytes");
+    stats->io_wbytes = cgroup_nested_keyed (contents, NULL, "wbytes");
+    g_free (contents);
+
+    stats->cpu_pressure_usec = cgroup_pressure (cgroup, "cpu.pressure");
+    stats->memory_pressure_usec = cgroup_pressure (cgroup, "memory.pressure");
+    stats->io_pressure_usec = cgroup_pressure (cgroup, "io.pressure");
+}
+
+gchar *
+rstrnt_cgroup_stats_to_string (const RstrntCgroupStats *stats)
+{
+    g_return_val_if_fail (stats != NULL, NULL);
+
+    return g_strdup_printf ("cpu_usec=%" G_GUINT64_FORMAT
+                            " memory_peak=%" G_GUINT64_FORMAT
+                            " io_rbytes=%" G_GUINT64_FORMAT
+                            " io_wbytes=%" G_GUINT64_FORMAT
+                            " cpu_pressure_usec=%" G_GUINT64_FORMAT
+                            " memory_pressure_usec=%" G_GUINT64_FORMAT
+                            " io_pressure_usec=%" G_GUINT64_FORMAT,
+                            stats->cpu_usec, stats->memory_peak,
+                            stats->io_rbytes, stats->io_wbytes,
+                            stats->cpu_pressure_usec,
+                            stats->memory_pressure_usec,
+                            stats->io_pressure_usec);
+}
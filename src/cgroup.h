@@ -0,0 +1,64 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_CGROUP_H
+#define _RESTRAINT_CGROUP_H
+
+#include <glib.h>
+
+#define CGROUP_MOUNT "/sys/fs/cgroup"
+#define CGROUP_DAEMON_LEAF "restraintd"  /* restraintd itself lives here */
+#define CGROUP_CONTROLLERS "cpu", "memory", "io", "pids"
+
+/*
+ * A cgroup v2 leaf holding one process tree.  A cgroup made with
+ * rstrnt_cgroup_new() is removed once the last reference is gone, if
+ * nothing is left running in it.
+ */
+typedef struct {
+    gint ref_count;
+    gchar *path;
+    gint fd;         /* the cgroup directory */
+    gboolean owned;  /* made by us, rmdir when unreferenced */
+} RstrntCgroup;
+
+/* What the processes of a cgroup used, 0 for a disabled controller */
+typedef struct {
+    guint64 cpu_usec;
+    guint64 memory_peak;         /* bytes */
+    guint64 io_rbytes;
+    guint64 io_wbytes;
+    guint64 cpu_pressure_usec;   /* time some of the processes stalled */
+    guint64 memory_pressure_usec;
+    guint64 io_pressure_usec;
+} RstrntCgroupStats;
+
+gboolean rstrnt_cgroup_init (GError **error);
+gboolean rstrnt_cgroup_enabled (void);
+RstrntCgroup *rstrnt_cgroup_open (const gchar *path, GError **error);
+RstrntCgroup *rstrnt_cgroup_new (const gchar *name, GError **error);
+RstrntCgroup *rstrnt_cgroup_ref (RstrntCgroup *cgroup);
+void rstrnt_cgroup_unref (RstrntCgroup *cgroup);
+gboolean rstrnt_cgroup_set (RstrntCgroup *cgroup, const gchar *file,
+                            const gchar *value, GError **error);
+gboolean rstrnt_cgroup_attach_self (RstrntCgroup *cgroup);
+gboolean rstrnt_cgroup_populated (RstrntCgroup *cgroup);
+gboolean rstrnt_cgroup_kill (RstrntCgroup *cgroup, GError **error);
+void rstrnt_cgroup_read_stats (RstrntCgroup *cgroup, RstrntCgroupStats *stats);
+gchar *rstrnt_cgroup_stats_to_string (const RstrntCgroupStats *stats);
+
+#endif
@@ -21,6 +21,7 @@
 
 #include "cmd_utils.h"
 #include "cmd_abort.h"
+#include "local_socket.h"
 #include "errors.h"
 
 void
@@ -99,12 +100,17 @@ upload_abort (AbortAppData *app_data, GError **error)
         result = FALSE;
         goto upload_cleanup;
     }
-    session = soup_session_new_with_options("timeout", 3600, NULL);
     SoupMessage *msg = soup_message_new_from_uri("POST", server_uri);
     char *form = soup_form_encode("status", "Aborted", NULL);
     soup_message_set_request (msg, "application/x-www-form-urlencoded",
                               SOUP_MEMORY_TAKE, form, strlen (form));
-    ret = soup_session_send_message(session, msg);
+    ret = rstrnt_local_send_message(msg);
+    if (ret == SOUP_STATUS_NONE) {
+        session = soup_session_new_with_options("timeout", 3600, NULL);
+        ret = soup_session_send_message(session, msg);
+        soup_session_abort(session);
+        g_object_unref(session);
+    }
     if (!SOUP_STATUS_IS_SUCCESSFUL(ret)) {
         g_warning ("Failed to abort job, status: %d Message: %s\n", ret,
                    msg->reason_phrase);
@@ -112,8 +118,6 @@ upload_abort (AbortAppData *app_data, GError **error)
     }
 
     g_object_unref(msg);
-    soup_session_abort(session);
-    g_object_unref(session);
 
 upload_cleanup:
 
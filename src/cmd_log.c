@@ -21,6 +21,7 @@
 #include "cmd_log.h"
 #include "cmd_utils.h"
 #include "errors.h"
+#include "local_socket.h"
 #include "upload.h"
 #include "utils.h"
 
@@ -45,6 +46,8 @@ parse_log_arguments(LogAppData *app_data, int argc, char *argv[], GError **error
             "Server to connect to", "URL" },
         { "filename", 'l', 0, G_OPTION_ARG_STRING, &app_data->filename,
             "Log to upload", "FILE" },
+        { "resume", 0, 0, G_OPTION_ARG_NONE, &app_data->resume,
+            "Only upload what the server does not have yet", NULL },
         {"deprecated1", 'S', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &app_data->deprecated1,
             "deprecated option", NULL},
         {"deprecated2", 'T', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &app_data->deprecated2,
@@ -97,7 +100,7 @@ parse_cleanup:
 gboolean
 upload_log (LogAppData *app_data, GError **error)
 {
-    SoupSession *session;
+    SoupSession *session = NULL;
     SoupURI *result_uri = NULL;
     gchar *basename = NULL;
     gboolean ret = TRUE;
@@ -110,17 +113,27 @@ upload_log (LogAppData *app_data, GError **error)
         ret = FALSE;
         goto upload_cleanup;
     }
-    session = soup_session_new_with_options("timeout", 3600, NULL);
-
     basename = g_filename_display_basename (app_data->filename);
     gchar *location = g_strdup_printf ("%s/logs/%s", app_data->s.server, basename);
     soup_uri_free(result_uri);
     result_uri = soup_uri_new (location);
     g_free (location);
+    if (!rstrnt_local_available (result_uri)) {
+        session = soup_session_new_with_options("timeout", 3600,
+                                                "max-conns-per-host", UPLOAD_INFLIGHT,
+                                                NULL);
+    }
     if (g_file_test (app_data->filename, G_FILE_TEST_EXISTS))
     {
+        UploadOptions options = {
+            .inflight = UPLOAD_INFLIGHT,
+            .retries = UPLOAD_RETRIES,
+            .resume = app_data->resume,
+        };
+
         g_print ("Uploading %s ", basename);
-        if (upload_file (session, app_data->filename, basename, result_uri, error)) {
+        if (upload_file_full (session, app_data->filename, basename, result_uri,
+                              &options, NULL, error)) {
             g_print ("done\n");
         } else {
             ret = FALSE;
@@ -128,8 +141,10 @@ upload_log (LogAppData *app_data, GError **error)
         }
     }
     g_free(basename);
-    soup_session_abort(session);
-    g_object_unref(session);
+    if (session != NULL) {
+        soup_session_abort(session);
+        g_object_unref(session);
+    }
 
 upload_cleanup:
     if (result_uri != NULL) {
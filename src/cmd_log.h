@@ -9,6 +9,7 @@ typedef struct {
     gchar *filename;
     gchar *deprecated1;
     gchar *deprecated2;
+    gboolean resume;
 } LogAppData;
 
 gboolean upload_log (LogAppData *app_data, GError **error);
@@ -17,9 +17,12 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <gio/gunixinputstream.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <string.h>
 #include <libsoup/soup.h>
+#include "local_socket.h"
 #include "upload.h"
 #include "utils.h"
 #include "errors.h"
@@ -78,6 +81,7 @@ void restraint_free_appdata(AppData *app_data)
     g_free(app_data->test_name);
     g_free(app_data->test_result);
     g_free(app_data->score);
+    g_free(app_data->batch);
 
     clear_server_data(&app_data->s);
 
@@ -129,6 +133,9 @@ gboolean parse_arguments_rstrnt(AppData *app_data, int argc, char *argv[])
             "don't run plugin on server side", "PLUGIN" },
         { "no-plugins", 0, 0, G_OPTION_ARG_NONE, &app_data->no_plugins,
             "don't run any plugins on server side", NULL },
+        { "batch", 'b', 0, G_OPTION_ARG_FILENAME, &app_data->batch,
+            "Report the results listed in FILE, one JSON object per line. "
+            "Use - to read them from stdin", "FILE" },
         { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &positional_args,
             NULL, NULL},
         { NULL }
@@ -145,7 +152,10 @@ gboolean parse_arguments_rstrnt(AppData *app_data, int argc, char *argv[])
             "Report results to lab controller. if you don't specify --port or\n"
             "the server url you must have RECIPE_URL and TASKID defined.\n"
             "If HARNESS_PREFIX is defined then the value of that must be\n"
-            "prefixed to RECIPE_URL and TASKID");
+            "prefixed to RECIPE_URL and TASKID\n"
+            "With --batch no positional arguments are taken, each line holds\n"
+            "{\"path\": ..., \"result\": ..., \"score\": ..., \"message\": ...,\n"
+            " \"outputfile\": ...} and only path and result are required.");
     g_option_context_set_main_group (context, option_group);
 
     gboolean parse_succeeded = g_option_context_parse(context,
@@ -168,6 +178,17 @@ gboolean parse_arguments_rstrnt(AppData *app_data, int argc, char *argv[])
         positional_arg_count = g_strv_length(positional_args);
     }
 
+    // Results come from the batch file instead
+    if (app_data->batch != NULL) {
+        if (positional_arg_count != 0) {
+            cmd_usage(context);
+            rc = FALSE;
+        } else {
+            rc = TRUE;
+        }
+        goto cleanup;
+    }
+
     if( positional_args == NULL ||
         app_data->s.server == NULL ||
         positional_arg_count > 4 ||
@@ -257,17 +278,387 @@ gboolean parse_arguments(AppData *app_data, int argc, char *argv[])
     }
 }
 
+/*
+ * The session is only set up when restraintd's local socket cannot be
+ * used, that is most of the cost of a call.
+ */
+static SoupSession *
+result_session (SoupSession **session)
+{
+    if (*session == NULL) {
+        *session = soup_session_new_with_options("timeout", 3600,
+                                                 "max-conns-per-host", UPLOAD_INFLIGHT,
+                                                 NULL);
+    }
+    return *session;
+}
+
+static guint
+result_send_message (SoupSession **session, SoupMessage *msg)
+{
+    guint ret = rstrnt_local_send_message (msg);
+
+    if (ret == SOUP_STATUS_NONE) {
+        ret = soup_session_send_message (result_session (session), msg);
+    }
+    return ret;
+}
+
+/*
+ * Plugins the server should skip, space separated, or NULL when
+ * all of them may run.
+ */
+static gchar *
+result_disabled_plugins (AppData *app_data)
+{
+    // if AVC_ERROR=+no_avc_check then disable the selinux check plugin
+    // This is for legacy rhts tests.. please use --disable-plugin
+    gchar *avc_error = getenv("AVC_ERROR");
+    if (g_strcmp0 (avc_error, "+no_avc_check") == 0) {
+        g_ptr_array_add (app_data->disable_plugin, g_strdup ("10_avc_check"));
+    }
+
+    if (app_data->disable_plugin->len == 0) {
+        return NULL;
+    }
+    g_ptr_array_add (app_data->disable_plugin, NULL);
+    return g_strjoinv (" ", (gchar **)app_data->disable_plugin->pdata);
+}
+
+static json_object *
+result_batch_entry (const gchar *line, guint lineno, GError **error)
+{
+    static const gchar *const fields[] = {
+        "path", "result", "score", "message", "outputfile", NULL
+    };
+    json_object *jobj;
+    json_object *entry;
+    json_object *val;
+
+    jobj = json_tokener_parse (line);
+    if (jobj == NULL || !json_object_is_type (jobj, json_type_object)) {
+        g_set_error (error, RESTRAINT_ERROR,
+                     RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                     "Line %u: expected a JSON object", lineno);
+        json_object_put (jobj);
+        return NULL;
+    }
+
+    entry = json_object_new_object ();
+    for (guint i = 0; fields[i] != NULL; i++) {
+        if (!json_object_object_get_ex (jobj, fields[i], &val) ||
+            json_object_is_type (val, json_type_null)) {
+            continue;
+        }
+        // Scores are often written as plain numbers
+        if (!json_object_is_type (val, json_type_string) &&
+            !json_object_is_type (val, json_type_int) &&
+            !json_object_is_type (val, json_type_double)) {
+            g_set_error (error, RESTRAINT_ERROR,
+                         RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                         "Line %u: %s must be a string", lineno, fields[i]);
+            goto error;
+        }
+        json_object_object_add (entry, fields[i],
+                                json_object_new_string (json_object_get_string (val)));
+    }
+
+    if (!json_object_object_get_ex (entry, "path", NULL) ||
+        !json_object_object_get_ex (entry, "result", NULL)) {
+        g_set_error (error, RESTRAINT_ERROR,
+                     RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                     "Line %u: path and result are required", lineno);
+        goto error;
+    }
+    json_object_put (jobj);
+    return entry;
+
+error:
+    json_object_put (entry);
+    json_object_put (jobj);
+    return NULL;
+}
+
+/*
+ * Read the JSON lines of a batch into an array of result objects,
+ * every value converted to a string.  Blank lines are skipped.
+ */
+json_object *
+rstrnt_result_batch_read (GInputStream *stream, GError **error)
+{
+    GDataInputStream *data_stream;
+    GError *tmp_error = NULL;
+    json_object *results;
+    json_object *entry;
+    gchar *line;
+    guint lineno = 0;
+
+    g_return_val_if_fail (G_IS_INPUT_STREAM (stream), NULL);
+
+    results = json_object_new_array ();
+    data_stream = g_data_input_stream_new (stream);
+    while ((line = g_data_input_stream_read_line_utf8 (data_stream, NULL,
+                                                       NULL, &tmp_error)) != NULL) {
+        lineno++;
+        g_strstrip (line);
+        if (*line == '\0') {
+            g_free (line);
+            continue;
+        }
+        entry = result_batch_entry (line, lineno, &tmp_error);
+        g_free (line);
+        if (entry == NULL) {
+            break;
+        }
+        json_object_array_add (results, entry);
+    }
+    g_object_unref (data_stream);
+
+    if (tmp_error != NULL) {
+        g_propagate_error (error, tmp_error);
+        json_object_put (results);
+        return NULL;
+    }
+    return results;
+}
+
+static const gchar *
+result_batch_get (json_object *entry, const gchar *key)
+{
+    json_object *val;
+
+    if (!json_object_object_get_ex (entry, key, &val)) {
+        return NULL;
+    }
+    return json_object_get_string (val);
+}
+
+static GInputStream *
+result_batch_open (const gchar *batch, GError **error)
+{
+    GFileInputStream *stream;
+    GFile *file;
+
+    if (g_strcmp0 (batch, RESULT_BATCH_STDIN) == 0) {
+        return g_unix_input_stream_new (STDIN_FILENO, FALSE);
+    }
+    file = g_file_new_for_commandline_arg (batch);
+    stream = g_file_read (file, NULL, error);
+    g_object_unref (file);
+    return (GInputStream *) stream;
+}
+
+typedef struct {
+    gchar *outputfile;
+    gchar *filename;
+    SoupURI *logs_uri;
+    gboolean uploaded;
+    GError *error;
+} BatchUpload;
+
+static void
+batch_upload_free (gpointer data)
+{
+    BatchUpload *upload = (BatchUpload *) data;
+
+    g_free (upload->outputfile);
+    g_free (upload->filename);
+    soup_uri_free (upload->logs_uri);
+    g_clear_error (&upload->error);
+    g_slice_free (BatchUpload, upload);
+}
+
+/* Runs in the upload pool, each upload makes its own session if needed */
+static void
+batch_upload_run (gpointer data, gpointer user_data)
+{
+    BatchUpload *upload = (BatchUpload *) data;
+
+    upload->uploaded = upload_file (NULL, upload->outputfile, upload->filename,
+                                    upload->logs_uri, &upload->error);
+}
+
+/*
+ * Send every result of the batch in one POST to restraintd, which
+ * forwards them and runs the report plugins once.  The reply lists the
+ * status and Location of each result in the order they were sent, the
+ * output files are then uploaded UPLOAD_INFLIGHT at a time.
+ */
+static gboolean
+upload_batch (AppData *app_data, SoupURI *result_uri, GError **error)
+{
+    GInputStream *stream;
+    SoupSession *session = NULL;
+    SoupMessage *server_msg = NULL;
+    SoupURI *batch_uri = NULL;
+    json_object *results = NULL;
+    json_object *request = NULL;
+    json_object *response = NULL;
+    json_object *items;
+    json_object *statuses;
+    GPtrArray *uploads = NULL;
+    GThreadPool *pool;
+    const gchar *body;
+    gchar *disabled;
+    gboolean rc = TRUE;
+    guint ret;
+    guint count;
+
+    stream = result_batch_open (app_data->batch, error);
+    if (stream == NULL) {
+        return FALSE;
+    }
+    results = rstrnt_result_batch_read (stream, error);
+    g_object_unref (stream);
+    if (results == NULL) {
+        return FALSE;
+    }
+    count = json_object_array_length (results);
+    if (count == 0) {
+        g_set_error (error, RESTRAINT_ERROR,
+                     RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                     "No results found in %s", app_data->batch);
+        rc = FALSE;
+        goto cleanup;
+    }
+
+    request = json_object_new_object ();
+    items = json_object_new_array ();
+    for (guint i = 0; i < count; i++) {
+        json_object *entry = json_object_array_get_idx (results, i);
+        json_object *item = json_object_new_object ();
+        const gchar *const keys[] = { "path", "result", "score", "message", NULL };
+
+        for (guint k = 0; keys[k] != NULL; k++) {
+            const gchar *value = result_batch_get (entry, keys[k]);
+            if (value != NULL) {
+                json_object_object_add (item, keys[k], json_object_new_string (value));
+            }
+        }
+        json_object_array_add (items, item);
+    }
+    json_object_object_add (request, "results", items);
+    disabled = result_disabled_plugins (app_data);
+    if (disabled != NULL) {
+        json_object_object_add (request, "disable_plugin", json_object_new_string (disabled));
+        g_free (disabled);
+    }
+    if (app_data->no_plugins) {
+        json_object_object_add (request, "no_plugins", json_object_new_boolean (TRUE));
+    }
+
+    batch_uri = soup_uri_new_with_base (result_uri, "batch");
+    server_msg = soup_message_new_from_uri ("POST", batch_uri);
+    body = json_object_to_json_string_ext (request, JSON_C_TO_STRING_PLAIN);
+    soup_message_set_request (server_msg, "application/json",
+                              SOUP_MEMORY_COPY, body, strlen (body));
+
+    ret = result_send_message (&session, server_msg);
+    if (!SOUP_STATUS_IS_SUCCESSFUL (ret)) {
+        g_warning ("Failed to submit results, status: %d Message: %s\n", ret, server_msg->reason_phrase);
+        rc = FALSE;
+        goto cleanup;
+    }
+
+    response = json_tokener_parse (server_msg->response_body->data);
+    if (response == NULL ||
+        !json_object_object_get_ex (response, "results", &statuses) ||
+        !json_object_is_type (statuses, json_type_array) ||
+        json_object_array_length (statuses) != count) {
+        g_set_error (error, RESTRAINT_ERROR,
+                     RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                     "Malformed reply to result batch");
+        rc = FALSE;
+        goto cleanup;
+    }
+
+    uploads = g_ptr_array_new_with_free_func (batch_upload_free);
+    for (guint i = 0; i < count; i++) {
+        json_object *entry = json_object_array_get_idx (results, i);
+        json_object *status = json_object_array_get_idx (statuses, i);
+        const gchar *score = result_batch_get (entry, "score");
+        const gchar *outputfile = result_batch_get (entry, "outputfile");
+        const gchar *location = result_batch_get (status, "location");
+        guint status_code = json_object_get_int (json_object_object_get (status, "status"));
+
+        g_print ("** %s %s Score:%s\n", result_batch_get (entry, "path"),
+                 result_batch_get (entry, "result"),
+                 score != NULL ? score : "N/A");
+        if (!SOUP_STATUS_IS_SUCCESSFUL (status_code) || location == NULL) {
+            g_warning ("Failed to submit result, status: %u\n", status_code);
+            rc = FALSE;
+            continue;
+        }
+        if (outputfile != NULL &&
+            g_file_test (outputfile, G_FILE_TEST_EXISTS))
+        {
+            gchar *logs = g_strdup_printf ("%s/logs/", location);
+            SoupURI *logs_uri = soup_uri_new (logs);
+
+            g_free (logs);
+            if (logs_uri == NULL) {
+                g_printerr ("Invalid location %s\n", location);
+                rc = FALSE;
+                continue;
+            }
+            BatchUpload *upload = g_slice_new0 (BatchUpload);
+            upload->outputfile = g_strdup (outputfile);
+            upload->filename = g_filename_display_basename (outputfile);
+            upload->logs_uri = logs_uri;
+            g_ptr_array_add (uploads, upload);
+        }
+    }
+
+    // Several small files are the common case, keep a few going at once
+    pool = g_thread_pool_new (batch_upload_run, NULL, UPLOAD_INFLIGHT, FALSE, NULL);
+    for (guint i = 0; i < uploads->len; i++) {
+        g_thread_pool_push (pool, g_ptr_array_index (uploads, i), NULL);
+    }
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+    for (guint i = 0; i < uploads->len; i++) {
+        BatchUpload *upload = g_ptr_array_index (uploads, i);
+
+        g_print ("Uploading %s %s\n", upload->filename,
+                 upload->uploaded ? "done" : "failed");
+        if (upload->error != NULL) {
+            g_printerr ("%s\n", upload->error->message);
+        }
+        rc = rc && upload->uploaded;
+    }
+
+cleanup:
+    if (uploads != NULL) {
+        g_ptr_array_free (uploads, TRUE);
+    }
+    if (server_msg != NULL) {
+        g_object_unref (server_msg);
+    }
+    if (session != NULL) {
+        soup_session_abort (session);
+        g_object_unref (session);
+    }
+    if (batch_uri != NULL) {
+        soup_uri_free (batch_uri);
+    }
+    json_object_put (response);
+    json_object_put (request);
+    json_object_put (results);
+    return rc;
+}
+
 gboolean upload_results(AppData *app_data) {
     GError *error = NULL;
     SoupURI *result_uri = NULL;
 
     guint ret = 0;
 
-    SoupSession *session;
+    SoupSession *session = NULL;
     SoupMessage *server_msg;
-    SoupRequest *request;
 
     gchar *form_data;
+    gchar *disabled = NULL;
+    gboolean rc = TRUE;
     GHashTable *data_table = g_hash_table_new (NULL, NULL);
 
     result_uri = soup_uri_new (app_data->s.server);
@@ -277,23 +668,16 @@ gboolean upload_results(AppData *app_data) {
                      "Malformed server url: %s", app_data->s.server);
         goto cleanup;
     }
-    session = soup_session_new_with_options("timeout", 3600, NULL);
-
+    if (app_data->batch != NULL) {
+        rc = upload_batch (app_data, result_uri, &error);
+        goto cleanup;
+    }
     g_hash_table_insert (data_table, "path", app_data->test_name);
     g_hash_table_insert (data_table, "result", app_data->test_result);
 
-    // if AVC_ERROR=+no_avc_check then disable the selinux check plugin
-    // This is for legacy rhts tests.. please use --disable-plugin
-    gchar *avc_error = getenv("AVC_ERROR");
-    if (g_strcmp0 (avc_error, "+no_avc_check") == 0) {
-        g_ptr_array_add (app_data->disable_plugin, g_strdup ("10_avc_check"));
-    }
-
-    if (app_data->disable_plugin->pdata) {
-        g_ptr_array_add (app_data->disable_plugin, NULL);
-        g_hash_table_insert (data_table, "disable_plugin",
-                             g_strjoinv (" ", (gchar **)app_data->disable_plugin->pdata));
-    }
+    disabled = result_disabled_plugins (app_data);
+    if (disabled != NULL)
+      g_hash_table_insert (data_table, "disable_plugin", disabled);
     if (app_data->no_plugins)
       g_hash_table_insert (data_table, "no_plugins", &app_data->no_plugins);
     if (app_data->score)
@@ -301,16 +685,14 @@ gboolean upload_results(AppData *app_data) {
     if (app_data->result_msg)
       g_hash_table_insert (data_table, "message", app_data->result_msg);
 
-    request = (SoupRequest *)soup_session_request_http_uri (session, "POST", result_uri, &error);
-    server_msg = soup_request_http_get_message (SOUP_REQUEST_HTTP (request));
-    g_object_unref(request);
+    server_msg = soup_message_new_from_uri ("POST", result_uri);
     form_data = soup_form_encode_hash (data_table);
     soup_message_set_request (server_msg, "application/x-www-form-urlencoded",
                               SOUP_MEMORY_TAKE, form_data, strlen (form_data));
     g_print ("** %s %s Score:%s\n", app_data->test_name, app_data->test_result,
         app_data->score != NULL ? app_data->score : "N/A");
 
-    ret = soup_session_send_message (session, server_msg);
+    ret = result_send_message (&session, server_msg);
     if (SOUP_STATUS_IS_SUCCESSFUL (ret)) {
         gchar *location = g_strdup_printf ("%s/logs/",
                                            soup_message_headers_get_one (server_msg->response_headers, "Location"));
@@ -321,7 +703,8 @@ gboolean upload_results(AppData *app_data) {
             g_file_test (app_data->outputfile, G_FILE_TEST_EXISTS))
         {
             g_print ("Uploading %s ", app_data->filename);
-            if (upload_file (session, app_data->outputfile, app_data->filename, result_uri, &error)) {
+            if (upload_file (rstrnt_local_available (result_uri) ? session : result_session (&session),
+                             app_data->outputfile, app_data->filename, result_uri, &error)) {
                 g_print ("done\n");
             } else {
                 g_print ("failed\n");
@@ -331,11 +714,14 @@ gboolean upload_results(AppData *app_data) {
        g_warning ("Failed to submit result, status: %d Message: %s\n", ret, server_msg->reason_phrase);
     }
     g_object_unref(server_msg);
-    soup_session_abort(session);
-    g_object_unref(session);
+    if (session != NULL) {
+        soup_session_abort(session);
+        g_object_unref(session);
+    }
 
 cleanup:
     g_hash_table_destroy(data_table);
+    g_free(disabled);
     if (result_uri != NULL) {
         soup_uri_free (result_uri);
     }
@@ -346,6 +732,6 @@ cleanup:
         g_clear_error(&error);
         return FALSE;
     } else {
-        return TRUE;
+        return rc;
     }
 }
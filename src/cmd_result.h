@@ -2,8 +2,12 @@
 #define RESTRAINT_CMD_RESULT
 
 #include <glib.h>
+#include <gio/gio.h>
+#include <json.h>
 #include "cmd_utils.h"
 
+#define RESULT_BATCH_STDIN "-"
+
 typedef struct {
     ServerData s;
     gchar *filename;
@@ -18,6 +22,9 @@ typedef struct {
     gchar *test_result;
     gchar *score;
 
+    /* JSON lines file of results to report in one request */
+    gchar *batch;
+
     gboolean no_plugins;
     gboolean rhts_compat;
 } AppData;
@@ -26,5 +33,6 @@ gboolean parse_arguments(AppData *app_data, int argc, char *argv[]);
 void restraint_free_appdata(AppData *app_data);
 AppData* restraint_create_appdata();
 gboolean upload_results(AppData *app_data);
+json_object *rstrnt_result_batch_read(GInputStream *stream, GError **error);
 
 #endif
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netdb.h>
@@ -6,6 +8,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/select.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
@@ -14,32 +17,15 @@
 #include <glib/gprintf.h>
 #include <glib-unix.h>
 
-#define USOCKET_PATH "/tmp/rstrntsync.sock"
-#define PORT 6776
-#define BUFSIZE 256
-
-struct sdata {
-  GHashTable *events;
-  GSList *wlist;
-};
+#include "sync_server.h"
 
-struct wentry {
-  char *event;
-  int sockfd;
-};
-
-static void wentry_free(struct wentry *w)
-{
-  g_free(w->event);
-  close(w->sockfd);
-  g_free(w);
-}
+#define USOCKET_PATH "/tmp/rstrntsync.sock"
 
 static void usage(char *ename)
 {
   g_print("usage:\n"
-          "\t%s set <event>\n"
-          "\t%s block <event> <host> [timeout]\n",
+          "\t%s set <event> [<event>...]\n"
+          "\t%s block [--also <event>...] <event> <host> [timeout]\n",
           ename, ename);
 }
 
@@ -57,129 +43,77 @@ static gboolean on_term_signal(gpointer data)
 }
 
 /*
- * handle_rconn
- * ------------
- * Handles receipt of 'block' operations.
- * If a set operation was previous called, respond back to client.
- * If set operation not previously called, put this client
- *   on a pending list so we can respond back when the 'set'
- *   comes in.
- * Before we do any of this checking, make sure there are no
- * stale 'blocked clients' sockets since these can timeout
- * and go away.
+ * Sends every event as its own frame, in as few writes as possible.
  */
-static gboolean handle_rconn(GIOChannel *source, GIOCondition condition,
-                             gpointer data)
+static int send_events(int sockfd, char **events)
 {
-  struct sdata *sd = (struct sdata*)data;
-  int sockfd = g_io_channel_unix_get_fd(source);
-  ssize_t rcv = 0;
-  ssize_t bytes_sent = 0;
-  char buf[BUFSIZE];
-  int rsock;
-  struct sockaddr addr;
-  unsigned int len = sizeof(addr);
-  GSList *rlist = NULL;
-
-  if ((rsock = accept(sockfd, &addr, &len)) < 0) {
-    perror("Failed to accept connection");
-    return TRUE;
-  }
-
-  rcv = recv(rsock, buf, BUFSIZE, 0);
-  if (rcv < 0) {
-    perror("Failed to receive");
-    close(rsock);
-    return TRUE;
-  }
+  GString *frames = g_string_new(NULL);
+  gsize sent = 0;
 
-  /* Verify current sockets are still active */
-  for (GSList *l = sd->wlist; l; l = g_slist_next(l)) {
-    struct wentry *w = (struct wentry*)l->data;
-    bytes_sent = send(w->sockfd, "PING", 5, MSG_NOSIGNAL);
-    if (bytes_sent == -1) {
-        rlist = g_slist_prepend(rlist, w);
+  for (char **event = events; *event != NULL; event++) {
+    if (**event != '\0') {
+      g_string_append_len(frames, *event, strlen(*event) + 1);
     }
   }
-  for (GSList *l = rlist; l; l = g_slist_next(l)) {
-    sd->wlist = g_slist_remove(sd->wlist, l->data);
-    wentry_free((struct wentry*)l->data);
-  }
-  g_slist_free(rlist);
-
-  /* Now check for match */
-  if (g_hash_table_contains(sd->events, buf)) {
-    send(rsock, buf, rcv, MSG_NOSIGNAL);
-    close(rsock);
-  } else {
-    struct wentry *w = malloc(sizeof(struct wentry));
-    w->event = g_strdup(buf);
-    w->sockfd = rsock;
-    sd->wlist = g_slist_prepend(sd->wlist, w);
+  while (sent < frames->len) {
+    ssize_t bytes = send(sockfd, frames->str + sent, frames->len - sent,
+                         MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Failed to send");
+      g_string_free(frames, TRUE);
+      return -1;
+    }
+    sent += bytes;
   }
-
-  return TRUE;
+  g_string_free(frames, TRUE);
+  return 0;
 }
 
 /*
- * handle_lconn
- * ------------
- *
- * This handles receipt of 'set' operations.
- * This stores the 'set state' which is transmitted by the client.
- * Afterwards, it checks to determine if there are clients
- * 'blocked' waiting for this 'state' to be 'set'.
- * If there are, we acknowledge back to those clients and
- * remove it from the 'block pending' list.
+ * Connects to the sync server on host, trying every address it resolves
+ * to.
  */
-static gboolean handle_lconn(GIOChannel *source, GIOCondition condition,
-                             gpointer data)
+static int connect_remote(const char *host)
 {
-  struct sdata *sd = (struct sdata*)data;
-  int sockfd = g_io_channel_unix_get_fd(source);
-  int rsock;
-  struct sockaddr addr;
-  unsigned int len = sizeof(addr);
-  ssize_t rcv = 0;
-  char buf[BUFSIZE];
-
-  if ((rsock = accept(sockfd, &addr, &len)) < 0) {
-    perror("Failed to accept connection");
-    return TRUE;
-  }
-
-  rcv = recv(rsock, buf, BUFSIZE, 0);
-  if (rcv < 0) {
-    perror("Failed to receive");
-    close(rsock);
-    return TRUE;
+  struct addrinfo hints = { 0 };
+  struct addrinfo *result, *rp;
+  char port[8];
+  int sockfd = -1;
+  int ret;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  g_snprintf(port, sizeof(port), "%d", SYNC_PORT);
+
+  ret = getaddrinfo(host, port, &hints, &result);
+  if (ret != 0) {
+    g_fprintf(stderr, "Failed to resolve hostname '%s': %s\n", host,
+              gai_strerror(ret));
+    return -1;
   }
-
-  g_hash_table_add(sd->events, g_strdup(buf));
-
-  close(rsock);
-
-  GSList *rlist = NULL;
-  for (GSList *l = sd->wlist; l; l = g_slist_next(l)) {
-    struct wentry *w = (struct wentry*)l->data;
-    if (g_strcmp0(w->event, buf) == 0) {
-      send(w->sockfd, buf, rcv, MSG_NOSIGNAL);
-      rlist = g_slist_prepend(rlist, w);
+  for (rp = result; rp != NULL; rp = rp->ai_next) {
+    sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    if (sockfd < 0) {
+      ret = errno;
+      continue;
     }
+    if (connect(sockfd, rp->ai_addr, rp->ai_addrlen) == 0) {
+      break;
+    }
+    ret = errno;
+    close(sockfd);
+    sockfd = -1;
   }
+  freeaddrinfo(result);
 
-  for (GSList *l = rlist; l; l = g_slist_next(l)) {
-    sd->wlist = g_slist_remove(sd->wlist, l->data);
-    wentry_free((struct wentry*)l->data);
+  if (sockfd < 0) {
+    g_fprintf(stderr, "Failed to connect to remote server %s: %s\n",
+              host, strerror(ret));
   }
-  g_slist_free(rlist);
-
-  return TRUE;
-}
-
-static void setevent(int sockfd, char *event)
-{
-  send(sockfd, event, strlen(event) + 1, 0);
+  return sockfd;
 }
 
 static int listen_local(void)
@@ -221,7 +155,7 @@ static int listen_remote(void)
   }
 
   saddr.sin_family = AF_INET;
-  saddr.sin_port = htons(PORT);
+  saddr.sin_port = htons(SYNC_PORT);
   saddr.sin_addr.s_addr = htonl(INADDR_ANY);
 
   if (bind(sockfd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
@@ -249,9 +183,7 @@ static int listen_remote(void)
  */
 void handler(void)
 {
-  struct sdata *sd = g_new0(struct sdata, 1);
-  sd->events = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                     g_free, NULL);
+  RstrntSyncServer *server;
   int lsock, rsock;
 
   signal(SIGPIPE, SIG_IGN);
@@ -266,20 +198,23 @@ void handler(void)
     goto rerror;
   }
 
+  server = rstrnt_sync_server_new(NULL);
+  if (server == NULL) {
+    goto serror;
+  }
+
   GMainLoop *mloop = g_main_loop_new(NULL, FALSE);
-  GIOChannel *lchan = g_io_channel_unix_new(lsock);
-  GIOChannel *rchan = g_io_channel_unix_new(rsock);
 
-  g_io_add_watch(lchan, G_IO_IN, handle_lconn, sd);
-  g_io_add_watch(rchan, G_IO_IN, handle_rconn, sd);
+  rstrnt_sync_server_listen(server, lsock, TRUE);
+  rstrnt_sync_server_listen(server, rsock, FALSE);
   g_unix_signal_add(SIGINT, on_term_signal, mloop);
   g_unix_signal_add(SIGTERM, on_term_signal, mloop);
 
   g_main_loop_run(mloop);
 
-  g_hash_table_destroy(sd->events);
-  g_slist_free_full(sd->wlist, (GDestroyNotify)wentry_free);
-  g_free(sd);
+  rstrnt_sync_server_free(server);
+  g_main_loop_unref(mloop);
+serror:
   close(rsock);
 rerror:
   close(lsock);
@@ -294,6 +229,7 @@ int main(int argc, char **argv)
     usage(argv[0]);
     return 1;
   }
+  char **events = NULL;
 
   if (g_strcmp0(argv[1], "set") == 0) {
     int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -328,17 +264,18 @@ int main(int argc, char **argv)
           close(sockfd);
           return 1;
         }
-        setevent(sockfd, argv[2]);
+        send_events(sockfd, argv + 2);
       }
     } else {
-      setevent(sockfd, argv[2]);
+      send_events(sockfd, argv + 2);
     }
     close(sockfd);
   } else if (g_strcmp0(argv[1], "block") == 0) {
-    char buf[BUFSIZE] = "";
-    struct sockaddr_in saddr;
-    struct hostent *he;
+    char buf[SYNC_FRAME_MAX];
+    GString *frame = g_string_new(NULL);
+    GPtrArray *wanted = g_ptr_array_new();
     int sockfd, ret=0, result, bytes=0, time_rcvd=0;
+    int arg = 2;
     fd_set rset;
     struct timeval timeout = { 0, 0 };
     time_t start_time, end_time;
@@ -346,71 +283,82 @@ int main(int argc, char **argv)
     unsigned int ping_count = 0;
     unsigned int non_match_count = 0;
 
-    if (argc < 4) {
+    // Any of the --also events will do as well
+    while (arg + 1 < argc && g_strcmp0(argv[arg], "--also") == 0) {
+      g_ptr_array_add(wanted, g_strdup(argv[arg + 1]));
+      arg += 2;
+    }
+
+    if (argc - arg < 2) {
+      g_ptr_array_free(wanted, TRUE);
+      g_string_free(frame, TRUE);
       usage(argv[0]);
       return 1;
     }
 
-    if (argc == 5) {
-      time_rcvd = atoi(argv[4]);
+    if (argc - arg == 3) {
+      time_rcvd = atoi(argv[arg + 2]);
       timeout.tv_sec = time_rcvd;
       time(&start_time);
       time(&end_time);
       diff_time = time_rcvd;
     }
 
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-      perror("Failed to open local socket");
-      return 1;
-    }
+    // The positional event is taken as is, spaces and all
+    g_ptr_array_insert(wanted, 0, g_strdup(argv[arg]));
+    g_ptr_array_add(wanted, NULL);
+    events = (char **) g_ptr_array_free(wanted, FALSE);
 
-    he = gethostbyname(argv[3]);
-    if (he == NULL) {
-      g_fprintf(stderr, "Failed to resolve hostname '%s'.\n",
-               argv[3]);
+    if ((sockfd = connect_remote(argv[arg + 1])) < 0) {
+      g_strfreev(events);
       return 1;
     }
-    saddr.sin_family = AF_INET;
-    saddr.sin_port = htons(PORT);
-    memcpy(&(saddr.sin_addr.s_addr), he->h_addr_list[0], he->h_length);
 
-    if (connect(sockfd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
-      g_fprintf(stderr, "Failed to connect to remote server %s: %s\n",
-                argv[3], strerror(errno));
+    if (send_events(sockfd, events) < 0) {
       close(sockfd);
+      g_strfreev(events);
       return 1;
     }
 
-    send(sockfd, argv[2], strlen(argv[2]) + 1, 0);
-
     result = 1;
-    FD_ZERO(&rset);
-    FD_SET(sockfd, &rset);
     while ((time_rcvd == 0) || (diff_time > 0)) {
         if (timeout.tv_sec > 0) {
+          FD_ZERO(&rset);
+          FD_SET(sockfd, &rset);
           ret = select(sockfd + 1, &rset, NULL, NULL, &timeout);
           if (ret <= 0) {
               // Error or peer is gone or nothing to read.
               break;
           }
         }
-        bytes = recv(sockfd, buf, BUFSIZE, 0);
+        bytes = recv(sockfd, buf, sizeof(buf), 0);
         if (bytes <= 0) {
             // Error or peer disconnected
             break;
         }
 
-        // if server not testing the socket with PING
-        // and we match the state, quit with success.
-        if ((g_strcmp0("PING", buf) != 0)  &&
-             (g_strcmp0(argv[2], buf) == 0)) {
-            result = 0;
-            break;
+        // A frame may arrive in pieces, or several in one read
+        for (char *start = buf; start < buf + bytes;) {
+            char *nul = memchr(start, '\0', buf + bytes - start);
+            if (nul == NULL) {
+                g_string_append_len(frame, start, buf + bytes - start);
+                break;
+            }
+            g_string_append_len(frame, start, nul - start);
+            start = nul + 1;
+            // Older servers check on us with PING
+            if (g_strcmp0("PING", frame->str) == 0) {
+                ping_count++;
+            } else if (g_strv_contains((const gchar * const *) events,
+                                       frame->str)) {
+                result = 0;
+            } else {
+                non_match_count++;
+            }
+            g_string_truncate(frame, 0);
         }
-        if (g_strcmp0("PING", buf) == 0) {
-            ping_count++;
-        } else {
-            non_match_count++;
+        if (result == 0) {
+            break;
         }
         if (time_rcvd != 0) {
           time(&end_time);
@@ -421,10 +369,13 @@ int main(int argc, char **argv)
         }
     }
     close(sockfd);
+    g_string_free(frame, TRUE);
+    g_strfreev(events);
     if (result == 1) {
           g_fprintf(stderr, "Server %s not reported state %s for Multihost "
                             "Sync rcvd %d bytes, ret %d [%d, %d]\n",
-                    argv[3], argv[2], bytes, ret, ping_count, non_match_count);
+                    argv[arg + 1], argv[arg], bytes, ret, ping_count,
+                    non_match_count);
      }
     return(result);
 
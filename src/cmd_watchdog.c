@@ -24,6 +24,7 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include "cmd_watchdog.h"
+#include "local_socket.h"
 #include "cmd_utils.h"
 #include "errors.h"
 #include "process.h"
@@ -120,7 +121,6 @@ upload_watchdog (WatchdogAppData *app_data, GError **error)
         result = FALSE;
         goto cleanup;
     }
-    session = soup_session_new_with_options("timeout", 3600, NULL);
     SoupMessage *server_msg = soup_message_new_from_uri ("POST", watchdog_uri);
     form_seconds = g_strdup_printf ("%" G_GUINT64_FORMAT, app_data->seconds);
     g_hash_table_insert (data_table, "seconds", form_seconds);
@@ -129,21 +129,20 @@ upload_watchdog (WatchdogAppData *app_data, GError **error)
     soup_message_set_request (server_msg, "application/x-www-form-urlencoded",
                               SOUP_MEMORY_TAKE, form_data, strlen (form_data));
 
-    ret = soup_session_send_message (session, server_msg);
-    if (SOUP_STATUS_IS_SUCCESSFUL (ret)) {
-        if (app_data->seconds < HEARTBEAT) {
-            g_warning ("Expect up to a 1 minute delay for watchdog thread to notice change.\n");
-        }
-    } else {
+    ret = rstrnt_local_send_message (server_msg);
+    if (ret == SOUP_STATUS_NONE) {
+        session = soup_session_new_with_options("timeout", 3600, NULL);
+        ret = soup_session_send_message (session, server_msg);
+        soup_session_abort(session);
+        g_object_unref(session);
+    }
+    if (!SOUP_STATUS_IS_SUCCESSFUL (ret)) {
         result = FALSE;
         g_warning ("Failed to adjust watchdog, status: %d Message: %s\n", ret,
                    server_msg->reason_phrase);
     }
     g_object_unref(server_msg);
 
-    soup_session_abort(session);
-    g_object_unref(session);
-
 cleanup:
     g_hash_table_destroy(data_table);
 
@@ -28,6 +28,7 @@
 
 #include "errors.h"
 #include "config.h"
+#include "metrics.h"
 
 #define is_key_file_not_found_error(e) (G_KEY_FILE_ERROR_KEY_NOT_FOUND == e->code \
                                         || G_KEY_FILE_ERROR_GROUP_NOT_FOUND == e->code)
@@ -274,6 +275,7 @@ restraint_config_set (gchar *config_file, const gchar *section,
     gsize length;
     g_autoptr (GKeyFile) keyfile = NULL;
     GError *tmp_error = NULL;
+    gint64 started = g_get_monotonic_time ();
 
     restraint_mkdir_parent (config_file);
 
@@ -336,6 +338,10 @@ restraint_config_set (gchar *config_file, const gchar *section,
     if (!g_file_set_contents (config_file, s_data, length,  &tmp_error))
         goto error;
 
+    rstrnt_metrics_inc (METRIC_CONFIG_WRITES);
+    rstrnt_metrics_add (METRIC_CONFIG_WRITE_BYTES, length);
+    rstrnt_metrics_observe (METRIC_CONFIG_WRITE_DURATION,
+                            g_get_monotonic_time () - started);
     return;
 
   error:
@@ -24,29 +24,169 @@
 #include "fetch_git.h"
 #include "fetch_uri.h"
 
+/* How many repoRequires may be fetched at the same time */
+#define DEPENDENCY_FETCH_MAX 4
+
 typedef struct {
     SoupURI *url;
-    gchar *path;
+    RstrntDepNode *node;
+    MetaData *metadata;
     DependencyData *dependency_data;
 } RepoDepData;
 
-typedef struct {
-    char *path;
-    MetaData *tmp_meta;
-    DependencyData *dependency_data;
-} MetadataFetchInfo;
-
 static void dependency_handler (gpointer user_data);
 static void restraint_fetch_repodeps(DependencyData *dependency_data);
+static void dependency_plan_ready(DependencyData *dependency_data);
+static gboolean dependency_promoted (DependencyData *dependency_data,
+                                     const gchar *package_name);
 static void dependency_batch_rpms(DependencyData *dependency_data);
 
+enum {
+    DEPENDENCY_PLAN_HARD = 1,
+    DEPENDENCY_PLAN_SOFT,
+};
+
+static DependencyPlan *
+dependency_plan_new (void)
+{
+    DependencyPlan *plan = g_slice_new0 (DependencyPlan);
+    plan->seen = g_hash_table_new (g_str_hash, g_str_equal);
+    return plan;
+}
+
 static void
-mtfi_archive_entry_callback (const gchar *entry, gpointer user_data)
+dependency_plan_free (DependencyPlan *plan)
 {
-    MetadataFetchInfo *mtfi = (MetadataFetchInfo*)user_data;
-    DependencyData *dependency_data = mtfi->dependency_data;
-    if (dependency_data->archive_entry_callback != NULL) {
-        return dependency_data->archive_entry_callback (entry, dependency_data->user_data);
+    // keys of seen are owned by the lists
+    g_hash_table_destroy (plan->seen);
+    g_slist_free_full (plan->dependencies, g_free);
+    g_slist_free_full (plan->softdependencies, g_free);
+    g_slice_free (DependencyPlan, plan);
+}
+
+/*
+ * Installing package_name would be a no-op, either an earlier task of this
+ * recipe installed it or the rpmdb already has it.  Removals always go to
+ * the package manager.
+ */
+static gboolean
+dependency_installed (DependencyData *dependency_data, const gchar *package_name)
+{
+    if (dependency_data->installed_deps != NULL &&
+            g_hash_table_contains (dependency_data->installed_deps, package_name)) {
+        g_debug ("%s: %s already installed for this recipe", __func__,
+                 package_name);
+        return TRUE;
+    }
+    if (g_str_has_prefix (package_name, "-") == FALSE &&
+            rstrnt_package_cache_contains (dependency_data->packages,
+                                           package_name)) {
+        g_debug ("%s: %s already installed", __func__, package_name);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Merge packages into the plan. A package is only listed once for the
+ * whole dependency tree of a task, a soft dependency which is also
+ * required by someone else is promoted to a hard one and packages which are
+ * already installed are skipped altogether, unless RSTRNT_FORCE_REINSTALL
+ * is set.
+ * The lists are built in reverse and flipped by dependency_plan_ready().
+ */
+static void
+dependency_plan_add (DependencyData *dependency_data, GSList *packages,
+                     gboolean soft)
+{
+    DependencyPlan *plan = dependency_data->plan;
+    gint kind = soft ? DEPENDENCY_PLAN_SOFT : DEPENDENCY_PLAN_HARD;
+
+    for (GSList *l = packages; l; l = g_slist_next (l)) {
+        const gchar *package_name = l->data;
+        gint seen = GPOINTER_TO_INT (g_hash_table_lookup (plan->seen,
+                                                          package_name));
+
+        if (seen == DEPENDENCY_PLAN_HARD ||
+                (seen == DEPENDENCY_PLAN_SOFT && soft)) {
+            continue;
+        }
+        if (!dependency_data->force_reinstall &&
+                dependency_installed (dependency_data, package_name)) {
+            continue;
+        }
+
+        gchar *name = g_strdup (package_name);
+        if (soft) {
+            plan->softdependencies = g_slist_prepend (plan->softdependencies,
+                                                      name);
+        } else {
+            plan->dependencies = g_slist_prepend (plan->dependencies, name);
+        }
+        g_hash_table_insert (plan->seen, name, GINT_TO_POINTER (kind));
+    }
+}
+
+static void
+dependency_plan_add_metadata (DependencyData *dependency_data,
+                              MetaData *metadata)
+{
+    dependency_plan_add (dependency_data, metadata->dependencies, FALSE);
+    dependency_plan_add (dependency_data, metadata->softdependencies, TRUE);
+}
+
+static void
+dependency_data_free (DependencyData *dependency_data)
+{
+    if (dependency_data->remove_rpms != NULL) {
+        g_string_free(dependency_data->remove_rpms, TRUE);
+    }
+    if (dependency_data->install_rpms != NULL) {
+        g_string_free(dependency_data->install_rpms, TRUE);
+    }
+    if (dependency_data->plan != NULL) {
+        dependency_plan_free (dependency_data->plan);
+    }
+    g_queue_clear (&dependency_data->fetch_queue);
+    g_clear_error (&dependency_data->fetch_error);
+    rstrnt_dep_graph_free (dependency_data->graph);
+    g_slice_free (DependencyData, dependency_data);
+}
+
+/*
+ * Remember what has been installed or removed so later tasks in the same
+ * recipe don't pay for another package manager transaction.
+ */
+static void
+dependency_record (DependencyData *dependency_data, const gchar *package_name)
+{
+    if (g_str_has_prefix (package_name, "-") == TRUE) {
+        rstrnt_package_cache_remove (dependency_data->packages, &package_name[1]);
+    } else {
+        rstrnt_package_cache_add (dependency_data->packages, package_name);
+    }
+    if (dependency_data->installed_deps == NULL) {
+        return;
+    }
+    // Which of the spellings installed before name the removed package
+    // can't be told, start over rather than skip a needed install.
+    if (g_str_has_prefix (package_name, "-") == TRUE) {
+        g_hash_table_remove_all (dependency_data->installed_deps);
+    } else {
+        g_hash_table_add (dependency_data->installed_deps,
+                          g_strdup (package_name));
+    }
+}
+
+static void
+dependency_record_list (DependencyData *dependency_data, GSList *packages,
+                        gboolean removed)
+{
+    for (GSList *l = packages; l; l = g_slist_next (l)) {
+        const gchar *package_name = l->data;
+        if (g_str_has_prefix (package_name, "-") == removed) {
+            dependency_record (dependency_data, package_name);
+        }
     }
 }
 
@@ -68,10 +208,10 @@ dependency_io_callback (GIOChannel *io, GIOCondition condition, gpointer user_da
 }
 
 static gboolean
-mtfi_io_callback (GIOChannel *io, GIOCondition condition, gpointer user_data)
+repo_dep_data_io_callback (GIOChannel *io, GIOCondition condition, gpointer user_data)
 {
-    MetadataFetchInfo *mtfi_data = (MetadataFetchInfo *) user_data;
-    return dependency_io_callback (io, condition, mtfi_data->dependency_data);
+    RepoDepData *rd_data = (RepoDepData *) user_data;
+    return dependency_io_callback (io, condition, rd_data->dependency_data);
 }
 
 static gboolean dependency_process_errors(DependencyData *dependency_data,
@@ -82,16 +222,7 @@ static gboolean dependency_process_errors(DependencyData *dependency_data,
             dependency_data->finish_cb (dependency_data->user_data, error);
         }
 
-        if (dependency_data->remove_rpms != NULL) {
-            g_string_free(dependency_data->remove_rpms, TRUE);
-            dependency_data->remove_rpms = NULL;
-        }
-        if (dependency_data->install_rpms != NULL) {
-            g_string_free(dependency_data->install_rpms, TRUE);
-            dependency_data->install_rpms = NULL;
-        }
-        g_slist_free_full(dependency_data->processed_deps, g_free);
-        g_slice_free (DependencyData, dependency_data);
+        dependency_data_free (dependency_data);
         return FALSE;
     } else if (dependency_data->ignore_failed_install != TRUE && pid_result != 0) {
         // If running in rhts_compat mode we don't check whether a packge installed
@@ -104,16 +235,7 @@ static gboolean dependency_process_errors(DependencyData *dependency_data,
             dependency_data->finish_cb (dependency_data->user_data, error);
         }
 
-        if (dependency_data->remove_rpms != NULL) {
-            g_string_free(dependency_data->remove_rpms, TRUE);
-            dependency_data->remove_rpms = NULL;
-        }
-        if (dependency_data->install_rpms != NULL) {
-            g_string_free(dependency_data->install_rpms, TRUE);
-            dependency_data->install_rpms = NULL;
-        }
-        g_slist_free_full(dependency_data->processed_deps, g_free);
-        g_slice_free (DependencyData, dependency_data);
+        dependency_data_free (dependency_data);
         return FALSE;
     } else {
         return TRUE;
@@ -128,6 +250,10 @@ dependency_callback (gint pid_result, gboolean localwatchdog, gpointer user_data
     g_cancellable_set_error_if_cancelled (dependency_data->cancellable, &error);
 
     if (dependency_process_errors(dependency_data, error, pid_result)) {
+        if (pid_result == 0) {
+            dependency_record (dependency_data,
+                               dependency_data->dependencies->data);
+        }
         dependency_data->dependencies = dependency_data->dependencies->next;
         dependency_handler (dependency_data);
     }
@@ -157,6 +283,8 @@ static void dependency_batch_remove_cb(gint pid_result,
             dependency_data->state = DEPENDENCY_SINGLE_RPM;
             dependency_handler(dependency_data);
         } else {
+            dependency_record_list(dependency_data,
+                                   dependency_data->dependencies, TRUE);
             g_string_free(dependency_data->remove_rpms, TRUE);
             dependency_data->remove_rpms = NULL;
             dependency_batch_rpms(dependency_data);
@@ -188,6 +316,10 @@ static void dependency_batch_install_cb(gint pid_result,
             dependency_data->state = DEPENDENCY_SINGLE_RPM;
             dependency_handler(dependency_data);
         } else {
+            if (pid_result == 0) {
+                dependency_record_list(dependency_data,
+                                       dependency_data->dependencies, FALSE);
+            }
             g_string_free(dependency_data->install_rpms, TRUE);
             dependency_data->install_rpms = NULL;
 
@@ -222,6 +354,8 @@ dependency_batch_rpms(DependencyData *dependency_data)
                          dependency_data);
             g_free (command);
         } else {
+            dependency_record_list(dependency_data,
+                                   dependency_data->dependencies, TRUE);
             g_string_free(dependency_data->remove_rpms, TRUE);
             dependency_data->remove_rpms = NULL;
             dependency_batch_rpms(dependency_data);
@@ -268,14 +402,56 @@ softdependency_callback (gint pid_result, gboolean localwatchdog, gpointer user_
             dependency_data->finish_cb (dependency_data->user_data, error);
         }
 
-        g_slist_free_full(dependency_data->processed_deps, g_free);
-        g_slice_free (DependencyData, dependency_data);
+        dependency_data_free (dependency_data);
     } else {
+        if (pid_result == 0) {
+            dependency_record (dependency_data,
+                               dependency_data->softdependencies->data);
+        }
         dependency_data->softdependencies = dependency_data->softdependencies->next;
         dependency_handler (dependency_data);
     }
 }
 
+static void
+softdependency_batch_cb (gint pid_result, gboolean localwatchdog,
+                         gpointer user_data, GError *error)
+{
+    DependencyData *dependency_data = (DependencyData *) user_data;
+
+    g_cancellable_set_error_if_cancelled (dependency_data->cancellable, &error);
+
+    if (error) {
+        if (dependency_data->finish_cb) {
+            dependency_data->finish_cb (dependency_data->user_data, error);
+        }
+        dependency_data_free (dependency_data);
+    } else {
+        // On failure we can't tell which package was the culprit, so fall
+        // back to installing them one at a time.
+        dependency_data->soft_batch_ok = (pid_result == 0);
+        if (dependency_data->soft_batch_ok) {
+            dependency_record_list (dependency_data,
+                                    dependency_data->softdependencies, FALSE);
+        }
+        dependency_handler (dependency_data);
+    }
+}
+
+/*
+ * A soft dependency which some other piece of the dependency tree requires
+ * is installed together with the hard ones.
+ */
+static gboolean
+dependency_promoted (DependencyData *dependency_data, const gchar *package_name)
+{
+    if (dependency_data->plan == NULL) {
+        return FALSE;
+    }
+    return GPOINTER_TO_INT (g_hash_table_lookup (dependency_data->plan->seen,
+                                                 package_name)) == DEPENDENCY_PLAN_HARD;
+}
+
 static void
 dependency_rpm(DependencyData *dependency_data)
 {
@@ -312,6 +488,54 @@ dependency_soft_rpm(DependencyData *dependency_data)
 {
     GError *error = NULL;
 
+    if (!dependency_data->soft_batch_tried) {
+        // Try all soft installs in a single transaction first
+        GString *packages = g_string_new (NULL);
+        guint count = 0;
+
+        dependency_data->soft_batch_tried = TRUE;
+        for (GSList *l = dependency_data->softdependencies; l; l = g_slist_next (l)) {
+            gchar *package_name = l->data;
+            if (g_str_has_prefix (package_name, "-") == FALSE &&
+                    !dependency_promoted (dependency_data, package_name)) {
+                g_string_append_printf (packages, " %s", package_name);
+                count++;
+            }
+        }
+        if (count > 1) {
+            gchar *command = g_strdup_printf ("rstrnt-package install%s",
+                                              packages->str);
+            process_run ((const gchar *)command,
+                         NULL,
+                         NULL,
+                         FALSE,
+                         0,
+                         NULL,
+                         dependency_io_callback,
+                         softdependency_batch_cb,
+                         NULL,
+                         0,
+                         FALSE,
+                         dependency_data->cancellable,
+                         dependency_data);
+            g_free (command);
+            g_string_free (packages, TRUE);
+            return;
+        }
+        g_string_free (packages, TRUE);
+    }
+
+    // Skip whatever the batch already took care of
+    while (dependency_data->softdependencies) {
+        gchar *package_name = dependency_data->softdependencies->data;
+        gboolean removal = g_str_has_prefix (package_name, "-");
+        if (!dependency_promoted (dependency_data, package_name) &&
+                (removal || !dependency_data->soft_batch_ok)) {
+            break;
+        }
+        dependency_data->softdependencies = dependency_data->softdependencies->next;
+    }
+
     if (dependency_data->softdependencies) {
         gchar *package_name = dependency_data->softdependencies->data;
         gchar *command;
@@ -382,66 +606,107 @@ dependency_single_rpm(DependencyData *dependency_data)
 
 }
 
-static void ldep_finish_cb(gpointer user_data, GError *error)
+static void
+repo_dep_data_free (RepoDepData *rd_data)
 {
-    MetadataFetchInfo *mtfi = (MetadataFetchInfo*)user_data;
-    DependencyData *dependency_data = mtfi->dependency_data;
+    restraint_metadata_free (rd_data->metadata);
+    soup_uri_free (rd_data->url);
+    g_slice_free (RepoDepData, rd_data);
+}
 
-    if (error) {
-        if (dependency_data->finish_cb) {
-            dependency_data->finish_cb (dependency_data->user_data, error);
+/*
+ * Where the tree of repodep name is fetched to, this also identifies the
+ * node in the dependency graph.
+ */
+static gchar *
+dependency_repodep_path (DependencyData *dependency_data, const gchar *name)
+{
+    SoupURI *url = dependency_data->fetch_url;
+    return g_build_filename (dependency_data->base_path, url->host, url->path,
+                             name, NULL);
+}
+
+/*
+ * Add the repoRequires of node to the graph and queue the ones never seen
+ * before for fetching.  Trees already in the graph, whether fetched or
+ * still in flight, only gain an edge.
+ */
+static void
+dependency_graph_expand (DependencyData *dependency_data, RstrntDepNode *node)
+{
+    for (GSList *l = node->metadata->repodeps; l; l = g_slist_next (l)) {
+        const gchar *name = l->data;
+        gchar *path = dependency_repodep_path (dependency_data, name);
+        gboolean created = FALSE;
+        RstrntDepNode *dep = rstrnt_dep_graph_add (dependency_data->graph,
+                                                   node, name, path, &created);
+        if (created) {
+            g_queue_push_tail (&dependency_data->fetch_queue, dep);
         }
-        g_slist_free_full(dependency_data->processed_deps, g_free);
-        g_slice_free (DependencyData, dependency_data);
-    } else {
-        dependency_data->repodeps = g_slist_next(dependency_data->repodeps);
-        restraint_fetch_repodeps(dependency_data);
+        g_free (path);
     }
+}
 
-    g_free(mtfi->path);
-    restraint_metadata_free(mtfi->tmp_meta);
-    g_slice_free(MetadataFetchInfo, mtfi);
+/*
+ * The whole graph is known, merge the packages of every node into the plan
+ * so that a tree's dependencies come before the ones of the trees
+ * requiring it.
+ */
+static void
+dependency_plan_build (DependencyData *dependency_data)
+{
+    GSList *cycles = NULL;
+    GPtrArray *order = rstrnt_dep_graph_sort (dependency_data->graph, &cycles);
+
+    for (GSList *l = cycles; l; l = g_slist_next (l)) {
+        g_warning ("%s: circular repoRequires %s", dependency_data->main_task_name,
+                   (gchar *) l->data);
+    }
+    g_slist_free_full (cycles, g_free);
+
+    for (guint i = 0; i < order->len; i++) {
+        RstrntDepNode *node = g_ptr_array_index (order, i);
+        if (node->metadata != NULL) {
+            dependency_plan_add_metadata (dependency_data, node->metadata);
+        }
+    }
+    g_ptr_array_free (order, TRUE);
+
+    dependency_plan_ready (dependency_data);
 }
 
-static gboolean ldep_io_cb(GIOChannel *io, GIOCondition condition,
-                           gpointer user_data)
+static void
+dependency_fetch_done (RepoDepData *rd_data, GError *error)
 {
-    MetadataFetchInfo *mtfi = (MetadataFetchInfo*)user_data;
-    DependencyData *dependency_data = mtfi->dependency_data;
-    return dependency_data->io_callback(io, condition,
-                                        dependency_data->user_data);
+    DependencyData *dependency_data = rd_data->dependency_data;
+
+    // Only the first failure is reported, the rest is noise
+    if (error != NULL && dependency_data->fetch_error == NULL) {
+        g_propagate_error (&dependency_data->fetch_error, error);
+    } else {
+        g_clear_error (&error);
+    }
+    dependency_data->fetches_running--;
+    repo_dep_data_free (rd_data);
+    restraint_fetch_repodeps (dependency_data);
 }
 
-static void dep_mtdata_finish_cb(gpointer user_data, GError *error)
+static void
+dep_mtdata_finish_cb (gpointer user_data, GError *error)
 {
-    MetadataFetchInfo *mtfi = (MetadataFetchInfo*)user_data;
-    DependencyData *dependency_data = mtfi->dependency_data;
+    RepoDepData *rd_data = (RepoDepData *) user_data;
+    DependencyData *dependency_data = rd_data->dependency_data;
 
-    if (error) {
-        if (dependency_data->finish_cb) {
-            dependency_data->finish_cb(dependency_data->user_data, error);
+    if (error == NULL) {
+        if (rd_data->metadata != NULL) {
+            rstrnt_dep_node_set_metadata (rd_data->node,
+                                          g_steal_pointer (&rd_data->metadata));
+            dependency_graph_expand (dependency_data, rd_data->node);
+        } else {
+            g_warning ("No metadata for dependency '%s'\n", rd_data->node->path);
         }
-        g_free(mtfi->path);
-        g_slice_free(MetadataFetchInfo, mtfi);
-    } else if (mtfi->tmp_meta != NULL) {
-        DependencyData *newdd = g_slice_dup(DependencyData, dependency_data);
-        newdd->dependencies = mtfi->tmp_meta->dependencies;
-        newdd->repodeps = mtfi->tmp_meta->repodeps;
-        newdd->finish_cb = ldep_finish_cb;
-        newdd->io_callback = ldep_io_cb;
-        newdd->archive_entry_callback = mtfi_archive_entry_callback;
-        newdd->user_data = mtfi;
-        newdd->processed_deps = g_slist_copy_deep(
-                                    dependency_data->processed_deps,
-                                    (GCopyFunc)g_strdup, NULL);
-        restraint_fetch_repodeps(newdd);
-    } else {
-        g_warning("No metadata for dependency '%s'\n", mtfi->path);
-        g_free(mtfi->path);
-        g_slice_free(MetadataFetchInfo, mtfi);
-        dependency_data->repodeps = g_slist_next(dependency_data->repodeps);
-        restraint_fetch_repodeps(dependency_data);
     }
+    dependency_fetch_done (rd_data, error);
 }
 
 static void
@@ -451,59 +716,83 @@ fetch_repodeps_finish_callback(GError *error, guint32 match_cnt,
     RepoDepData *rd_data = (RepoDepData*)user_data;
     DependencyData *dependency_data = rd_data->dependency_data;
 
-    GSList *pdep = g_slist_find_custom(dependency_data->processed_deps, rd_data->path, (GCompareFunc)g_strcmp0);
-    if (error) {
-        if (dependency_data->finish_cb) {
-            dependency_data->finish_cb (dependency_data->user_data, error);
-        }
-        g_slist_free_full(dependency_data->processed_deps, g_free);
-        g_slice_free (DependencyData, dependency_data);
-    } else if (pdep == NULL) {
-        MetadataFetchInfo *mtfi = g_slice_new0(MetadataFetchInfo);
-        dependency_data->processed_deps = g_slist_prepend(
-                                            dependency_data->processed_deps,
-                                            g_strdup(rd_data->path));
-        mtfi->path = g_strdup(rd_data->path);
-        mtfi->dependency_data = dependency_data;
-        restraint_get_metadata(mtfi->path, dependency_data->osmajor,
-                               &mtfi->tmp_meta,
-                               dependency_data->cancellable,
-                               dep_mtdata_finish_cb, mtfi_io_callback, mtfi);
+    if (error || dependency_data->fetch_error) {
+        dependency_fetch_done (rd_data, error);
     } else {
-        dependency_data->repodeps = g_slist_next(dependency_data->repodeps);
-        restraint_fetch_repodeps(dependency_data);
+        restraint_get_metadata (rd_data->node->path, dependency_data->osmajor,
+                                &rd_data->metadata,
+                                dependency_data->cancellable,
+                                dep_mtdata_finish_cb, repo_dep_data_io_callback,
+                                rd_data);
     }
-    soup_uri_free(rd_data->url);
-    g_free(rd_data->path);
-    g_slice_free(RepoDepData, rd_data);
 }
 
+/*
+ * Every repodep has been fetched and merged into the plan, install the
+ * whole lot.
+ */
+static void
+dependency_plan_ready(DependencyData *dependency_data)
+{
+    DependencyPlan *plan = dependency_data->plan;
+
+    plan->dependencies = g_slist_reverse(plan->dependencies);
+    plan->softdependencies = g_slist_reverse(plan->softdependencies);
+    dependency_data->dependencies = plan->dependencies;
+    dependency_data->softdependencies = plan->softdependencies;
+    dependency_data->state = DEPENDENCY_RPM;
+    dependency_handler(dependency_data);
+}
+
+static void
+restraint_fetch_repodeps_one (DependencyData *dependency_data,
+                              RstrntDepNode *node)
+{
+    RepoDepData *rd_data = g_slice_new0(RepoDepData);
+    rd_data->dependency_data = dependency_data;
+    rd_data->node = node;
+    rd_data->url = soup_uri_copy(dependency_data->fetch_url);
+    g_free(rd_data->url->fragment);
+    rd_data->url->fragment = g_strdup(node->name);
+
+    dependency_data->fetches_running++;
+    if (g_strcmp0(rd_data->url->scheme, "git") == 0) {
+        restraint_fetch_git(rd_data->url, node->path,
+                            dependency_data->keepchanges, repo_dep_data_archive_callback,
+                            fetch_repodeps_finish_callback, rd_data);
+    } else {
+        restraint_fetch_uri(rd_data->url, node->path,
+                             dependency_data->keepchanges, dependency_data->ssl_verify, repo_dep_data_archive_callback,
+                             fetch_repodeps_finish_callback, rd_data);
+    }
+}
+
+/*
+ * Walk the repoRequires breadth first, independent branches are fetched in
+ * parallel.  Once a fetch failed nothing new is started and the error is
+ * reported after the ones in flight have finished.
+ */
 static void
 restraint_fetch_repodeps(DependencyData *dependency_data)
 {
-    if (dependency_data->repodeps != NULL) {
-        RepoDepData *rd_data = g_slice_new0(RepoDepData);
-        rd_data->dependency_data = dependency_data;
-        rd_data->url = soup_uri_copy(dependency_data->fetch_url);
-        g_free(rd_data->url->fragment);
-        rd_data->url->fragment = g_strdup((char *)dependency_data->repodeps->data);
-        rd_data->path = g_build_filename(dependency_data->base_path,
-                                         rd_data->url->host,
-                                         rd_data->url->path,
-                                         rd_data->url->fragment,
-                                         NULL);
-        if (g_strcmp0(rd_data->url->scheme, "git") == 0) {
-            restraint_fetch_git(rd_data->url, rd_data->path,
-                                dependency_data->keepchanges, repo_dep_data_archive_callback,
-                                fetch_repodeps_finish_callback, rd_data);
-        } else {
-            restraint_fetch_uri(rd_data->url, rd_data->path,
-                                 dependency_data->keepchanges, dependency_data->ssl_verify, repo_dep_data_archive_callback,
-                                 fetch_repodeps_finish_callback, rd_data);
+    while (dependency_data->fetch_error == NULL &&
+           dependency_data->fetches_running < DEPENDENCY_FETCH_MAX &&
+           !g_queue_is_empty (&dependency_data->fetch_queue)) {
+        restraint_fetch_repodeps_one (dependency_data,
+                                      g_queue_pop_head (&dependency_data->fetch_queue));
+    }
+
+    if (dependency_data->fetches_running > 0) {
+        return;
+    }
+    if (dependency_data->fetch_error != NULL) {
+        if (dependency_data->finish_cb) {
+            dependency_data->finish_cb (dependency_data->user_data,
+                                        g_steal_pointer (&dependency_data->fetch_error));
         }
+        dependency_data_free (dependency_data);
     } else {
-        dependency_data->state = DEPENDENCY_RPM;
-        dependency_handler(dependency_data);
+        dependency_plan_build (dependency_data);
     }
 }
 
@@ -528,14 +817,44 @@ dependency_handler (gpointer user_data)
             if (dependency_data->finish_cb) {
                 dependency_data->finish_cb(dependency_data->user_data, NULL);
             }
-            g_slist_free_full(dependency_data->processed_deps, g_free);
-            g_slice_free (DependencyData, dependency_data);
+            dependency_data_free (dependency_data);
             break;
         default:
             break;
     }
 }
 
+static void
+dependency_start (gpointer user_data)
+{
+    DependencyData *dependency_data = (DependencyData *) user_data;
+    Task *task = dependency_data->task;
+
+    dependency_data->task = NULL;
+    switch (task->fetch_method) {
+        case TASK_FETCH_UNPACK: {
+            dependency_data->fetch_url = task->fetch.url;
+            gchar *path = dependency_repodep_path (dependency_data,
+                                                   task->fetch.url->fragment);
+            dependency_data->graph = rstrnt_dep_graph_new (task->name, path,
+                                                           task->metadata);
+            dependency_graph_expand (dependency_data, dependency_data->graph->root);
+            dependency_data->state = DEPENDENCY_REPO;
+            g_free (path);
+            break;
+        }
+        case TASK_FETCH_INSTALL_PACKAGE:
+            // Packaged tasks pull in their repoRequires through rpm
+            dependency_plan_add_metadata (dependency_data, task->metadata);
+            dependency_plan_ready (dependency_data);
+            return;
+        default:
+            dependency_data->state = DEPENDENCY_DONE;
+            break;
+    }
+    dependency_handler (dependency_data);
+}
+
 void
 restraint_install_dependencies (Task *task,
                                 GIOFunc io_callback,
@@ -547,9 +866,11 @@ restraint_install_dependencies (Task *task,
     DependencyData *dependency_data;
     dependency_data = g_slice_new0 (DependencyData);
     dependency_data->user_data = user_data;
-    dependency_data->dependencies = task->metadata->dependencies;
-    dependency_data->softdependencies = task->metadata->softdependencies;
-    dependency_data->repodeps = task->metadata->repodeps;
+    dependency_data->installed_deps = task->recipe->installed_deps;
+    dependency_data->packages = task->recipe->packages;
+    dependency_data->force_reinstall =
+        rstrnt_package_force_reinstall (task->recipe->params, task->params);
+    dependency_data->plan = dependency_plan_new ();
     dependency_data->main_task_name = task->name;
     dependency_data->base_path = task->recipe->base_path;
     dependency_data->ignore_failed_install = task->rhts_compat;
@@ -560,17 +881,13 @@ restraint_install_dependencies (Task *task,
     dependency_data->cancellable = cancellable;
     dependency_data->osmajor = task->recipe->osmajor;
     dependency_data->ssl_verify = task->ssl_verify;
-    switch (task->fetch_method) {
-        case TASK_FETCH_UNPACK:
-            dependency_data->fetch_url = task->fetch.url;
-            dependency_data->state = DEPENDENCY_REPO;
-            break;
-        case TASK_FETCH_INSTALL_PACKAGE:
-            dependency_data->state = DEPENDENCY_RPM;
-            break;
-        default:
-            dependency_data->state = DEPENDENCY_DONE;
-            break;
+    dependency_data->task = task;
+
+    if (dependency_data->packages == NULL || dependency_data->force_reinstall) {
+        dependency_start (dependency_data);
+    } else {
+        // The plan skips what is installed, rpm is queried from the main loop
+        rstrnt_package_cache_load (dependency_data->packages, cancellable,
+                                   dependency_start, dependency_data);
     }
-    dependency_handler (dependency_data);
 }
@@ -23,6 +23,7 @@
 #include "recipe.h"
 #include "task.h"
 #include "fetch.h"
+#include "dependency_graph.h"
 
 typedef void (*DependencyCallback)   (gpointer user_data, GError *error);
 
@@ -34,11 +35,15 @@ typedef enum {
     DEPENDENCY_DONE
 } DependencyState;
 
+typedef struct {
+    GSList *dependencies;     // list of gchar *, owned by the plan
+    GSList *softdependencies; // list of gchar *, owned by the plan
+    GHashTable *seen;         // dedup index into the two lists above
+} DependencyPlan;
+
 typedef struct {
     GSList *dependencies;
     GSList *softdependencies;
-    GSList *repodeps;
-    GSList *processed_deps;
     SoupURI *fetch_url;
     gboolean keepchanges;
     const gchar *main_task_name;
@@ -54,6 +59,17 @@ typedef struct {
     GString *install_rpms;
     GString *remove_rpms;
     gboolean ssl_verify;
+    DependencyPlan *plan;        // covers the task and all of its repodeps
+    RstrntDepGraph *graph;       // repoRequires of the task, NULL for packages
+    GQueue fetch_queue;          // nodes of graph waiting to be fetched
+    guint fetches_running;
+    GError *fetch_error;         // first failure while walking the graph
+    GHashTable *installed_deps;  // recipe wide, may be NULL
+    RstrntPackageCache *packages; // recipe wide, may be NULL
+    gboolean force_reinstall;    // ignore both of the above
+    gboolean soft_batch_tried;
+    gboolean soft_batch_ok;
+    Task *task;                  // until the package cache is loaded
 } DependencyData;
 
 void restraint_install_dependencies (Task *task, GIOFunc io_callback,
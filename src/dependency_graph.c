@@ -0,0 +1,186 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dependency_graph.h"
+
+/*
+ * The repoRequires of a task form a directed graph, nodes are identified by
+ * the path their tree is fetched to.  Every node is only ever added once so
+ * diamonds are fetched and parsed a single time, and sorting it yields the
+ * order in which their packages should be installed.
+ */
+
+enum {
+    NODE_UNVISITED,
+    NODE_VISITING,
+    NODE_VISITED,
+};
+
+static RstrntDepNode *
+dep_node_new (const gchar *name, const gchar *path)
+{
+    RstrntDepNode *node = g_slice_new0 (RstrntDepNode);
+    node->name = g_strdup (name);
+    node->path = g_strdup (path);
+    node->requires = g_ptr_array_new ();
+    return node;
+}
+
+static void
+dep_node_free (RstrntDepNode *node)
+{
+    if (node->owns_metadata) {
+        restraint_metadata_free (node->metadata);
+    }
+    g_ptr_array_free (node->requires, TRUE);
+    g_free (node->name);
+    g_free (node->path);
+    g_slice_free (RstrntDepNode, node);
+}
+
+/*
+ * The root is the task itself, its metadata is borrowed.
+ */
+RstrntDepGraph *
+rstrnt_dep_graph_new (const gchar *name, const gchar *path, MetaData *metadata)
+{
+    RstrntDepGraph *graph = g_slice_new0 (RstrntDepGraph);
+
+    graph->nodes = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) dep_node_free);
+    graph->root = dep_node_new (name, path);
+    graph->root->metadata = metadata;
+    g_hash_table_insert (graph->nodes, graph->root->path, graph->root);
+    return graph;
+}
+
+void
+rstrnt_dep_graph_free (RstrntDepGraph *graph)
+{
+    if (graph == NULL) {
+        return;
+    }
+    g_hash_table_destroy (graph->nodes);
+    g_slice_free (RstrntDepGraph, graph);
+}
+
+/*
+ * Record that from requires the tree at path.  The node is created on first
+ * sight, which is reported through created so the caller knows it has to be
+ * fetched.
+ */
+RstrntDepNode *
+rstrnt_dep_graph_add (RstrntDepGraph *graph, RstrntDepNode *from,
+                      const gchar *name, const gchar *path, gboolean *created)
+{
+    g_return_val_if_fail (graph != NULL && from != NULL, NULL);
+
+    RstrntDepNode *node = g_hash_table_lookup (graph->nodes, path);
+
+    if (created != NULL) {
+        *created = (node == NULL);
+    }
+    if (node == NULL) {
+        node = dep_node_new (name, path);
+        g_hash_table_insert (graph->nodes, node->path, node);
+    }
+    for (guint i = 0; i < from->requires->len; i++) {
+        if (g_ptr_array_index (from->requires, i) == node) {
+            return node;
+        }
+    }
+    g_ptr_array_add (from->requires, node);
+    return node;
+}
+
+void
+rstrnt_dep_node_set_metadata (RstrntDepNode *node, MetaData *metadata)
+{
+    if (node->owns_metadata) {
+        restraint_metadata_free (node->metadata);
+    }
+    node->metadata = metadata;
+    node->owns_metadata = TRUE;
+}
+
+static gchar *
+dep_graph_describe_cycle (GPtrArray *stack, RstrntDepNode *node)
+{
+    GString *cycle = g_string_new (NULL);
+    guint start = 0;
+
+    while (start < stack->len && g_ptr_array_index (stack, start) != node) {
+        start++;
+    }
+    for (guint i = start; i < stack->len; i++) {
+        RstrntDepNode *n = g_ptr_array_index (stack, i);
+        g_string_append_printf (cycle, "%s -> ", n->name);
+    }
+    g_string_append (cycle, node->name);
+    return g_string_free (cycle, FALSE);
+}
+
+static void
+dep_graph_visit (RstrntDepNode *node, GPtrArray *stack, GPtrArray *order,
+                 GSList **cycles)
+{
+    node->mark = NODE_VISITING;
+    g_ptr_array_add (stack, node);
+
+    for (guint i = 0; i < node->requires->len; i++) {
+        RstrntDepNode *next = g_ptr_array_index (node->requires, i);
+        if (next->mark == NODE_VISITING) {
+            // Back edge, leave it out of the ordering
+            if (cycles != NULL) {
+                *cycles = g_slist_append (*cycles,
+                                          dep_graph_describe_cycle (stack, next));
+            }
+        } else if (next->mark == NODE_UNVISITED) {
+            dep_graph_visit (next, stack, order, cycles);
+        }
+    }
+
+    g_ptr_array_remove_index (stack, stack->len - 1);
+    node->mark = NODE_VISITED;
+    g_ptr_array_add (order, node);
+}
+
+/*
+ * Return all nodes reachable from the root, every node after the ones it
+ * requires and the root last.  Cycles don't stop the sort, each one is
+ * broken at the edge closing it and described in cycles as
+ * "a -> b -> a", caller frees the list with g_slist_free_full (cycles,
+ * g_free).
+ */
+GPtrArray *
+rstrnt_dep_graph_sort (RstrntDepGraph *graph, GSList **cycles)
+{
+    GHashTableIter iter;
+    gpointer value;
+    GPtrArray *order = g_ptr_array_sized_new (g_hash_table_size (graph->nodes));
+    GPtrArray *stack = g_ptr_array_new ();
+
+    g_hash_table_iter_init (&iter, graph->nodes);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        ((RstrntDepNode *) value)->mark = NODE_UNVISITED;
+    }
+
+    dep_graph_visit (graph->root, stack, order, cycles);
+
+    g_ptr_array_free (stack, TRUE);
+    return order;
+}
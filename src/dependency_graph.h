@@ -0,0 +1,51 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_DEPENDENCY_GRAPH_H
+#define _RESTRAINT_DEPENDENCY_GRAPH_H
+
+#include <glib.h>
+#include "metadata.h"
+
+typedef struct _RstrntDepNode RstrntDepNode;
+
+struct _RstrntDepNode {
+    gchar *name;          /* as listed in repoRequires, task name for the root */
+    gchar *path;          /* where the tree lives, unique within the graph */
+    MetaData *metadata;   /* NULL until fetched */
+    gboolean owns_metadata;
+    GPtrArray *requires;  /* RstrntDepNode * */
+    guint mark;           /* used while sorting */
+};
+
+typedef struct {
+    GHashTable *nodes;    /* path -> RstrntDepNode * */
+    RstrntDepNode *root;
+} RstrntDepGraph;
+
+RstrntDepGraph *rstrnt_dep_graph_new (const gchar *name, const gchar *path,
+                                      MetaData *metadata);
+void rstrnt_dep_graph_free (RstrntDepGraph *graph);
+RstrntDepNode *rstrnt_dep_graph_add (RstrntDepGraph *graph,
+                                     RstrntDepNode *from,
+                                     const gchar *name,
+                                     const gchar *path,
+                                     gboolean *created);
+void rstrnt_dep_node_set_metadata (RstrntDepNode *node, MetaData *metadata);
+GPtrArray *rstrnt_dep_graph_sort (RstrntDepGraph *graph, GSList **cycles);
+
+#endif
@@ -20,144 +20,169 @@
 #include "cmd_utils.h"
 #include "env.h"
 #include "param.h"
+#include "role.h"
 
-static void get_recipe_members(GSList **hosts, GList *rolehosts)
+/*
+ * Hosts of all roles, each once.  Later hosts come first, as they always
+ * did in RECIPE_MEMBERS.
+ */
+static gchar *
+recipe_members (GList *recipe_roles, GList *task_roles)
 {
-    for (GList *t_param = rolehosts; t_param != NULL;
-                    t_param = g_list_next(t_param)) {
-      Param *param = t_param->data;
-      if (param->value != NULL) {
-          gchar **phosts = g_strsplit(param->value, " ", -1);
-          for (gchar **chost = phosts; *chost != NULL; chost++) {
-            if (g_slist_find_custom(*hosts, *chost,
-                        (GCompareFunc)g_strcmp0) == NULL) {
-              *hosts = g_slist_prepend(*hosts, g_strdup(*chost));
+    GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+    GPtrArray *hosts = g_ptr_array_new_with_free_func (g_free);
+    GList *lists[] = { recipe_roles, task_roles };
+    GString *members = g_string_new (NULL);
+
+    for (guint i = 0; i < G_N_ELEMENTS (lists); i++) {
+        for (GList *l = lists[i]; l != NULL; l = g_list_next (l)) {
+            Role *role = l->data;
+
+            if (role->systems == NULL) {
+                continue;
             }
-          }
-          g_strfreev(phosts);
-      }
+            gchar **phosts = g_strsplit (role->systems, " ", -1);
+            for (gchar **chost = phosts; *chost != NULL; chost++) {
+                if (!g_hash_table_contains (seen, *chost)) {
+                    gchar *host = g_strdup (*chost);
+                    g_hash_table_add (seen, host);
+                    g_ptr_array_add (hosts, host);
+                }
+            }
+            g_strfreev (phosts);
+        }
     }
+    for (guint i = hosts->len; i > 0; i--) {
+        if (i < hosts->len) {
+            g_string_append_c (members, ' ');
+        }
+        g_string_append (members, hosts->pdata[i - 1]);
+    }
+    g_hash_table_destroy (seen);
+    g_ptr_array_free (hosts, TRUE);
+    return g_string_free (members, FALSE);
 }
 
 static void
-array_add (GPtrArray *array, const gchar *prefix, const gchar *variable, const gchar *value)
+env_set_roles (RstrntEnvMap *env, RstrntEnvLayer layer, GList *roles)
 {
-    if (value) {
-        if (prefix) {
-            g_ptr_array_add (array, g_strdup_printf ("%s%s=%s", prefix, variable, value));
-        } else {
-            g_ptr_array_add (array, g_strdup_printf ("%s=%s", variable, value));
-        }
+    for (GList *l = roles; l != NULL; l = g_list_next (l)) {
+        Role *role = l->data;
+        rstrnt_env_map_set (env, layer, role->value, role->systems);
     }
 }
 
-struct env_remove_t {
-    gchar *varname;
-    GPtrArray *env;
-};
-
-static void remove_env_var(gchar *evar, struct env_remove_t *er)
+static void
+env_set_params (RstrntEnvMap *env, RstrntEnvLayer layer, GList *params)
 {
-    if (evar != NULL) {
-        gchar **envval = g_strsplit(evar, "=", 2);
-        if (g_strcmp0(envval[0], er->varname) == 0) {
-            g_ptr_array_remove_fast(er->env, evar);
-        }
-        g_strfreev(envval);
+    for (GList *l = params; l != NULL; l = g_list_next (l)) {
+        Param *param = l->data;
+        rstrnt_env_map_set (env, layer, param->name, param->value);
     }
 }
 
-static void build_param_var(Param *param, GPtrArray *env) {
-    struct env_remove_t er = { .varname = param->name, .env = env };
-    g_ptr_array_foreach(env, (GFunc)remove_env_var, &er);
-    g_ptr_array_add(env, g_strdup_printf("%s=%s", param->name, param->value));
+static void
+env_set_prefixed (RstrntEnvMap *env, const gchar *variable, const gchar *value)
+{
+    gchar *name = g_strconcat (ENV_PREFIX, variable, NULL);
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, name, value);
+    g_free (name);
+}
+
+/*
+ * What only depends on the recipe, built once and shared by its tasks
+ * until the roles are refreshed.
+ */
+static RstrntEnvMap *
+recipe_env_new (const gchar *restraint_url, Recipe *recipe)
+{
+    RstrntEnvMap *env = rstrnt_env_map_new (NULL);
+    gchar *members;
+
+    env_set_roles (env, ENV_LAYER_RECIPE_ROLE, recipe->roles);
+    members = recipe_members (recipe->roles, NULL);
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "RECIPE_MEMBERS", members);
+    g_free (members);
+
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "HARNESS_PREFIX", ENV_PREFIX);
+    gchar *recipe_url = g_strdup_printf ("%s/recipes/%s", restraint_url, recipe->recipe_id);
+    env_set_prefixed (env, "RECIPE_URL", recipe_url);
+    g_free (recipe_url);
+    env_set_prefixed (env, "OWNER", recipe->owner);
+    env_set_prefixed (env, "JOBID", recipe->job_id);
+    env_set_prefixed (env, "RECIPESETID", recipe->recipe_set_id);
+    env_set_prefixed (env, "RECIPEID", recipe->recipe_id);
+    env_set_prefixed (env, "OSDISTRO", recipe->osdistro);
+    env_set_prefixed (env, "OSMAJOR", recipe->osmajor);
+    env_set_prefixed (env, "OSVARIANT", recipe->osvariant);
+    env_set_prefixed (env, "OSARCH", recipe->osarch);
+    // HOME, LANG and TERM can be overriden by user by passing it as recipe or task params.
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "HOME", "/root");
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "TERM", "vt100");
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "LANG", "en_US.UTF-8");
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "PATH", "/usr/local/bin:/usr/bin:/bin:/usr/local/sbin:/usr/sbin:/sbin");
+
+    // Override with recipe level params
+    env_set_params (env, ENV_LAYER_RECIPE_PARAM, recipe->params);
+    return env;
 }
 
 void build_env(gchar *restraint_url, guint port, Task *task) {
-    GPtrArray *env = g_ptr_array_new_with_free_func (g_free);
+    Recipe *recipe = task->recipe;
+    RstrntEnvMap *env;
     GError *error = NULL;
 
-    if (task->metadata != NULL) {
-        g_slist_foreach(task->metadata->envvars, (GFunc) build_param_var, env);
+    if (recipe->env == NULL) {
+        recipe->env = recipe_env_new (restraint_url, recipe);
     }
-    g_list_foreach(task->recipe->roles, (GFunc) build_param_var, env);
-    g_list_foreach(task->roles, (GFunc) build_param_var, env);
-
-    GSList *rmembers = NULL;
-    get_recipe_members(&rmembers, task->recipe->roles);
-    get_recipe_members(&rmembers, task->roles);
+    env = rstrnt_env_map_new (recipe->env);
 
-    gchar **hostarr = g_new0(gchar *, g_slist_length(rmembers) + 1);
-    gchar **p = hostarr;
-    gchar *hoststr = NULL;
-
-    for (GSList *host = rmembers; host != NULL; host = g_slist_next(host)) {
-      *p++ = host->data;
+    if (task->metadata != NULL) {
+        for (GSList *l = task->metadata->envvars; l != NULL; l = g_slist_next (l)) {
+            Param *param = l->data;
+            rstrnt_env_map_set (env, ENV_LAYER_METADATA, param->name, param->value);
+        }
+    }
+    env_set_roles (env, ENV_LAYER_TASK_ROLE, task->roles);
+    if (task->roles != NULL) {
+        gchar *members = recipe_members (recipe->roles, task->roles);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "RECIPE_MEMBERS", members);
+        g_free (members);
     }
-    hoststr = g_strjoinv(" ", hostarr);
-    array_add(env, NULL, "RECIPE_MEMBERS", hoststr);
-    g_free(hoststr);
-    g_strfreev(hostarr);
-    g_slist_free(rmembers);
 
-    gchar *prefix = ENV_PREFIX;
     if (task->rhts_compat == TRUE) {
-        array_add (env, NULL, "RESULT_SERVER", "LEGACY");
-        array_add (env, NULL, "SUBMITTER", task->recipe->owner);
-        array_add (env, NULL, "JOBID", task->recipe->job_id);
-        array_add (env, NULL, "RECIPESETID", task->recipe->recipe_set_id);
-        array_add (env, NULL, "RECIPEID", task->recipe->recipe_id);
-        array_add (env, NULL, "RECIPETESTID", task->task_id);
-        array_add (env, NULL, "TASKID", task->task_id);
-        array_add (env, NULL, "DISTRO", task->recipe->osdistro);
-        array_add (env, NULL, "VARIANT", task->recipe->osvariant);
-        array_add (env, NULL, "FAMILY", task->recipe->osmajor);
-        array_add (env, NULL, "ARCH", task->recipe->osarch);
-        array_add (env, NULL, "TESTNAME", task->name);
-        array_add (env, NULL, "TESTPATH", task->path);
-        g_ptr_array_add(env, g_strdup_printf("MAXTIME=%" G_GINT64_FORMAT, task->remaining_time));
-        g_ptr_array_add(env, g_strdup_printf("REBOOTCOUNT=%" G_GUINT64_FORMAT, task->reboots));
-        g_ptr_array_add(env, g_strdup_printf("TASKORDER=%d", task->order));
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "RESULT_SERVER", "LEGACY");
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "SUBMITTER", recipe->owner);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "JOBID", recipe->job_id);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "RECIPESETID", recipe->recipe_set_id);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "RECIPEID", recipe->recipe_id);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "RECIPETESTID", task->task_id);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "TASKID", task->task_id);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "DISTRO", recipe->osdistro);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "VARIANT", recipe->osvariant);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "FAMILY", recipe->osmajor);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "ARCH", recipe->osarch);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "TESTNAME", task->name);
+        rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "TESTPATH", task->path);
+        rstrnt_env_map_setf (env, ENV_LAYER_HARNESS, "MAXTIME", "%" G_GINT64_FORMAT, task->remaining_time);
+        rstrnt_env_map_setf (env, ENV_LAYER_HARNESS, "REBOOTCOUNT", "%" G_GUINT64_FORMAT, task->reboots);
+        rstrnt_env_map_setf (env, ENV_LAYER_HARNESS, "TASKORDER", "%d", task->order);
     }
     // beakerlib checks TESTID to run BEAKERLIB_COMMAND_REPORT_RESULT, so
     // export TESTID even if not in rhts_compat mode
-    array_add (env, NULL, "TESTID", task->task_id);
-    g_ptr_array_add(env, g_strdup_printf("HARNESS_PREFIX=%s", ENV_PREFIX));
-    gchar *recipe_url = g_strdup_printf ("%s/recipes/%s", restraint_url, task->recipe->recipe_id);
-    array_add (env, prefix, "RECIPE_URL", recipe_url);
-    g_free (recipe_url);
-    array_add (env, prefix, "OWNER", task->recipe->owner);
-    array_add (env, prefix, "JOBID", task->recipe->job_id);
-    array_add (env, prefix, "RECIPESETID", task->recipe->recipe_set_id);
-    array_add (env, prefix, "RECIPEID", task->recipe->recipe_id);
-    array_add (env, prefix, "TASKID", task->task_id);
-    array_add (env, prefix, "OSDISTRO", task->recipe->osdistro);
-    array_add (env, prefix, "OSMAJOR", task->recipe->osmajor);
-    array_add (env, prefix, "OSVARIANT", task->recipe->osvariant);
-    array_add (env, prefix, "OSARCH", task->recipe->osarch);
-    array_add (env, prefix, "TASKNAME", task->name);
-    array_add (env, prefix, "TASKPATH", task->path);
-    g_ptr_array_add(env, g_strdup_printf("%sMAXTIME=%" G_GINT64_FORMAT, prefix, task->remaining_time));
-    g_ptr_array_add(env, g_strdup_printf("%sREBOOTCOUNT=%" G_GUINT64_FORMAT, prefix, task->reboots));
-    //g_ptr_array_add(env, g_strdup_printf("%sLAB_CONTROLLER=", prefix));
-    g_ptr_array_add(env, g_strdup_printf("%sTASKORDER=%d", prefix, task->order));
-    // HOME, LANG and TERM can be overriden by user by passing it as recipe or task params.
-    g_ptr_array_add(env, g_strdup_printf("HOME=/root"));
-    g_ptr_array_add(env, g_strdup_printf("TERM=vt100"));
-    g_ptr_array_add(env, g_strdup_printf("LANG=en_US.UTF-8"));
-    g_ptr_array_add(env, g_strdup_printf("PATH=/usr/local/bin:/usr/bin:/bin:/usr/local/sbin:/usr/sbin:/sbin"));
+    rstrnt_env_map_set (env, ENV_LAYER_HARNESS, "TESTID", task->task_id);
+    env_set_prefixed (env, "TASKID", task->task_id);
+    env_set_prefixed (env, "TASKNAME", task->name);
+    env_set_prefixed (env, "TASKPATH", task->path);
+    rstrnt_env_map_setf (env, ENV_LAYER_HARNESS, ENV_PREFIX "MAXTIME", "%" G_GINT64_FORMAT, task->remaining_time);
+    rstrnt_env_map_setf (env, ENV_LAYER_HARNESS, ENV_PREFIX "REBOOTCOUNT", "%" G_GUINT64_FORMAT, task->reboots);
+    //rstrnt_env_map_set (env, ENV_LAYER_HARNESS, ENV_PREFIX "LAB_CONTROLLER", "");
+    rstrnt_env_map_setf (env, ENV_LAYER_HARNESS, ENV_PREFIX "TASKORDER", "%d", task->order);
 
-    // Override with recipe level params
-    g_list_foreach(task->recipe->params, (GFunc) build_param_var, env);
     // Override with task level params
-    g_list_foreach(task->params, (GFunc) build_param_var, env);
-    // Leave four NULL slots for PLUGIN variables.
-    g_ptr_array_add(env, NULL);
-    g_ptr_array_add(env, NULL);
-    g_ptr_array_add(env, NULL);
-    g_ptr_array_add(env, NULL);
-    // This terminates the array
-    g_ptr_array_add(env, NULL);
+    env_set_params (env, ENV_LAYER_TASK_PARAM, task->params);
+
+    rstrnt_env_map_unref (task->env);
     task->env = env;
     // To make it easy for user's to run restraintd commands, these environment variables
     // need to be made conveniently available to user.
@@ -168,6 +193,4 @@ void build_env(gchar *restraint_url, guint port, Task *task) {
                 g_quark_to_string(error->domain), error->code);
         g_clear_error(&error);
     }
-
-
 }
@@ -0,0 +1,181 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <glib.h>
+#include <string.h>
+
+#include "env_map.h"
+
+typedef struct {
+    RstrntEnvLayer layer;
+    gchar *entry;  /* NAME=VALUE as handed to exec */
+} RstrntEnvVar;
+
+static void
+env_var_free (RstrntEnvVar *var)
+{
+    g_free (var->entry);
+    g_slice_free (RstrntEnvVar, var);
+}
+
+RstrntEnvMap *
+rstrnt_env_map_new (RstrntEnvMap *base)
+{
+    RstrntEnvMap *map = g_slice_new0 (RstrntEnvMap);
+
+    map->ref_count = 1;
+    map->base = base != NULL ? rstrnt_env_map_ref (base) : NULL;
+    map->vars = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify) env_var_free);
+    map->names = g_ptr_array_new ();
+    return map;
+}
+
+RstrntEnvMap *
+rstrnt_env_map_ref (RstrntEnvMap *map)
+{
+    g_return_val_if_fail (map != NULL, NULL);
+
+    map->ref_count++;
+    return map;
+}
+
+void
+rstrnt_env_map_unref (RstrntEnvMap *map)
+{
+    if (map == NULL || --map->ref_count > 0) {
+        return;
+    }
+    if (map->base != NULL) {
+        rstrnt_env_map_unref (map->base);
+    }
+    // names borrows the keys of vars
+    g_ptr_array_free (map->names, TRUE);
+    g_hash_table_destroy (map->vars);
+    g_free (map->envp);
+    g_slice_free (RstrntEnvMap, map);
+}
+
+void
+rstrnt_env_map_set (RstrntEnvMap *map, RstrntEnvLayer layer,
+                    const gchar *name, const gchar *value)
+{
+    RstrntEnvVar *var;
+    gchar *key;
+
+    g_return_if_fail (map != NULL && name != NULL);
+
+    if (value == NULL) {
+        return;
+    }
+    if (g_hash_table_lookup_extended (map->vars, name, (gpointer *) &key,
+                                      (gpointer *) &var)) {
+        if (var->layer > layer) {
+            return;
+        }
+        g_free (var->entry);
+    } else {
+        var = g_slice_new (RstrntEnvVar);
+        key = g_strdup (name);
+        g_hash_table_insert (map->vars, key, var);
+        g_ptr_array_add (map->names, key);
+    }
+    var->layer = layer;
+    var->entry = g_strdup_printf ("%s=%s", name, value);
+    g_clear_pointer (&map->envp, g_free);
+}
+
+void
+rstrnt_env_map_setf (RstrntEnvMap *map, RstrntEnvLayer layer,
+                     const gchar *name, const gchar *format, ...)
+{
+    va_list args;
+    gchar *value;
+
+    va_start (args, format);
+    value = g_strdup_vprintf (format, args);
+    va_end (args);
+
+    rstrnt_env_map_set (map, layer, name, value);
+    g_free (value);
+}
+
+/* The variable that wins over the whole chain, ties go to the top */
+static RstrntEnvVar *
+env_map_lookup (RstrntEnvMap *map, const gchar *name)
+{
+    RstrntEnvVar *best = NULL;
+
+    for (RstrntEnvMap *m = map; m != NULL; m = m->base) {
+        RstrntEnvVar *var = g_hash_table_lookup (m->vars, name);
+
+        if (var != NULL && (best == NULL || var->layer > best->layer)) {
+            best = var;
+        }
+    }
+    return best;
+}
+
+const gchar *
+rstrnt_env_map_get (RstrntEnvMap *map, const gchar *name)
+{
+    RstrntEnvVar *var = env_map_lookup (map, name);
+
+    if (var == NULL) {
+        return NULL;
+    }
+    return var->entry + strlen (name) + 1;
+}
+
+static void
+env_map_collect (RstrntEnvMap *top, RstrntEnvMap *map, GHashTable *seen,
+                 GPtrArray *envp)
+{
+    if (map->base != NULL) {
+        env_map_collect (top, map->base, seen, envp);
+    }
+    for (guint i = 0; i < map->names->len; i++) {
+        const gchar *name = map->names->pdata[i];
+
+        if (g_hash_table_add (seen, (gpointer) name)) {
+            g_ptr_array_add (envp, env_map_lookup (top, name)->entry);
+        }
+    }
+}
+
+/*
+ * The whole chain as an environment for exec, base variables first.  The
+ * strings belong to the maps, the array stays valid until the map changes.
+ */
+const gchar **
+rstrnt_env_map_envp (RstrntEnvMap *map)
+{
+    GPtrArray *envp;
+    GHashTable *seen;
+
+    g_return_val_if_fail (map != NULL, NULL);
+
+    if (map->envp != NULL) {
+        return map->envp;
+    }
+    envp = g_ptr_array_new ();
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
+    env_map_collect (map, map, seen, envp);
+    g_hash_table_destroy (seen);
+    g_ptr_array_add (envp, NULL);
+    map->envp = (const gchar **) g_ptr_array_free (envp, FALSE);
+    return map->envp;
+}
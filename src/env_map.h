@@ -0,0 +1,62 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_ENV_MAP_H
+#define _RESTRAINT_ENV_MAP_H
+
+#include <glib.h>
+
+/*
+ * Where a variable comes from.  A variable set from a higher layer
+ * replaces the one of a lower layer, whichever map of a chain holds it.
+ */
+typedef enum {
+    ENV_LAYER_HOST,         /* facts about the host, see task_plugin.h */
+    ENV_LAYER_METADATA,     /* environment= lines of the task metadata */
+    ENV_LAYER_RECIPE_ROLE,
+    ENV_LAYER_TASK_ROLE,
+    ENV_LAYER_HARNESS,      /* variables defined by restraint */
+    ENV_LAYER_LOGIN,        /* what a login shell adds */
+    ENV_LAYER_RECIPE_PARAM,
+    ENV_LAYER_TASK_PARAM,
+    ENV_LAYER_PLUGIN,       /* set for a single plugin run */
+} RstrntEnvLayer;
+
+/*
+ * Environment variables indexed by name.  A map may sit on top of a base
+ * map, it then only holds what it adds or overrides and the base is shared.
+ * A map must not be changed once other maps have been made on top of it.
+ */
+typedef struct RstrntEnvMap {
+    gint ref_count;
+    struct RstrntEnvMap *base;
+    GHashTable *vars;  /* name -> RstrntEnvVar */
+    GPtrArray *names;  /* in the order they were first set */
+    const gchar **envp;  /* NULL terminated, rebuilt after changes */
+} RstrntEnvMap;
+
+RstrntEnvMap *rstrnt_env_map_new (RstrntEnvMap *base);
+RstrntEnvMap *rstrnt_env_map_ref (RstrntEnvMap *map);
+void rstrnt_env_map_unref (RstrntEnvMap *map);
+void rstrnt_env_map_set (RstrntEnvMap *map, RstrntEnvLayer layer,
+                         const gchar *name, const gchar *value);
+void rstrnt_env_map_setf (RstrntEnvMap *map, RstrntEnvLayer layer,
+                          const gchar *name, const gchar *format, ...) G_GNUC_PRINTF (4, 5);
+const gchar *rstrnt_env_map_get (RstrntEnvMap *map, const gchar *name);
+const gchar **rstrnt_env_map_envp (RstrntEnvMap *map);
+
+#endif
@@ -56,6 +56,7 @@ typedef struct {
     gboolean ssl_verify;
     gpointer private_data;
     gchar curl_error_buf[CURL_ERROR_SIZE];
+    gint64 started;
 } FetchData;
 
 #define RESTRAINT_FETCH_ERROR restraint_fetch_error ()
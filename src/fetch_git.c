@@ -29,6 +29,7 @@
 
 #include "fetch.h"
 #include "fetch_git.h"
+#include "metrics.h"
 
 static gint
 packet_length(const gchar *linelen)
@@ -334,7 +335,13 @@ archive_finish_callback (gpointer user_data)
         if (free_result != ARCHIVE_OK)
             g_warning("Failed to free archive_write_disk");
     }
+    if (fetch_data->error != NULL) {
+        rstrnt_metrics_inc (METRIC_FETCH_GIT_ERRORS);
+    }
+    rstrnt_metrics_observe (METRIC_FETCH_GIT_DURATION,
+                            g_get_monotonic_time () - fetch_data->started);
     if (fetch_data->a != NULL) {
+        rstrnt_metrics_add (METRIC_FETCH_GIT_BYTES, archive_filter_bytes (fetch_data->a, -1));
         free_result = archive_read_free(fetch_data->a);
         if (free_result != ARCHIVE_OK)
             g_warning("Failed to free archive_read");
@@ -413,6 +420,7 @@ restraint_fetch_git (SoupURI *url,
     g_return_if_fail(base_path != NULL);
 
     FetchData *fetch_data = g_slice_new0(FetchData);
+    fetch_data->started = g_get_monotonic_time ();
     fetch_data->archive_entry_callback = archive_entry_callback;
     fetch_data->finish_callback = finish_callback;
     fetch_data->user_data = user_data;
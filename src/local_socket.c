@@ -0,0 +1,239 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#include "local_socket.h"
+#include "utils.h"
+
+static gboolean
+local_incoming (GSocketService *service, GSocketConnection *connection,
+                GObject *source_object, gpointer user_data)
+{
+    SoupServer *server = (SoupServer *) user_data;
+    GError *error = NULL;
+
+    if (!soup_server_accept_iostream (server, G_IO_STREAM (connection),
+                                      NULL, NULL, &error)) {
+        g_warning ("Unable to accept local connection: %s", error->message);
+        g_clear_error (&error);
+    }
+    return TRUE;
+}
+
+/*
+ * Listen on path for server, replacing what a previous restraintd left
+ * behind.
+ */
+GSocketService *
+rstrnt_local_listen (SoupServer *server, const gchar *path, GError **error)
+{
+    GSocketService *service;
+    GSocketAddress *address;
+    gboolean listening;
+
+    g_return_val_if_fail (SOUP_IS_SERVER (server), NULL);
+    g_return_val_if_fail (path != NULL, NULL);
+
+    g_unlink (path);
+    service = g_socket_service_new ();
+    address = g_unix_socket_address_new (path);
+    listening = g_socket_listener_add_address (G_SOCKET_LISTENER (service), address,
+                                               G_SOCKET_TYPE_STREAM,
+                                               G_SOCKET_PROTOCOL_DEFAULT,
+                                               NULL, NULL, error);
+    g_object_unref (address);
+    if (!listening) {
+        g_object_unref (service);
+        return NULL;
+    }
+    g_signal_connect (service, "incoming", G_CALLBACK (local_incoming), server);
+    g_socket_service_start (service);
+
+    return service;
+}
+
+static gchar *
+local_socket_path (SoupURI *uri)
+{
+    const gchar *host = soup_uri_get_host (uri);
+    gchar *path;
+
+    if (g_strcmp0 (host, "localhost") != 0 &&
+        g_strcmp0 (host, "127.0.0.1") != 0 &&
+        g_strcmp0 (host, "::1") != 0) {
+        return NULL;
+    }
+    path = get_local_socket_filename (soup_uri_get_port (uri));
+    if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+        g_free (path);
+        return NULL;
+    }
+    return path;
+}
+
+/*
+ * Whether requests to uri can go through the local socket.
+ */
+gboolean
+rstrnt_local_available (SoupURI *uri)
+{
+    gchar *path = local_socket_path (uri);
+
+    g_free (path);
+    return path != NULL;
+}
+
+static void
+local_append_header (const char *name, const char *value, gpointer user_data)
+{
+    GString *request = (GString *) user_data;
+
+    if (g_ascii_strcasecmp (name, "Content-Length") != 0 &&
+        g_ascii_strcasecmp (name, "Host") != 0) {
+        g_string_append_printf (request, "%s: %s\r\n", name, value);
+    }
+}
+
+static gboolean
+local_send_all (GSocket *socket, const gchar *data, gsize length, GError **error)
+{
+    while (length > 0) {
+        gssize sent = g_socket_send (socket, data, length, NULL, error);
+        if (sent < 0) {
+            return FALSE;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return TRUE;
+}
+
+static gboolean
+local_exchange (GSocket *socket, SoupMessage *msg, GString *reply, GError **error)
+{
+    SoupURI *uri = soup_message_get_uri (msg);
+    SoupBuffer *body;
+    GString *request;
+    gchar *path;
+    gboolean sent;
+    gchar buf[65536];
+    gssize received;
+
+    path = soup_uri_to_string (uri, TRUE);
+    request = g_string_new (NULL);
+    g_string_append_printf (request, "%s %s HTTP/1.0\r\nHost: %s:%u\r\n",
+                            msg->method, path, soup_uri_get_host (uri),
+                            soup_uri_get_port (uri));
+    soup_message_headers_foreach (msg->request_headers, local_append_header, request);
+    body = soup_message_body_flatten (msg->request_body);
+    g_string_append_printf (request, "Content-Length: %" G_GSIZE_FORMAT "\r\n\r\n",
+                            body->length);
+    g_free (path);
+
+    sent = local_send_all (socket, request->str, request->len, error) &&
+           local_send_all (socket, body->data, body->length, error);
+    g_string_free (request, TRUE);
+    soup_buffer_free (body);
+    if (!sent) {
+        return FALSE;
+    }
+
+    // HTTP/1.0, the server closes the connection after the reply
+    while ((received = g_socket_receive (socket, buf, sizeof (buf), NULL, error)) > 0) {
+        g_string_append_len (reply, buf, received);
+    }
+    return received == 0;
+}
+
+/*
+ * Send msg to restraintd over its unix socket and fill in the reply.
+ * Returns the status, or SOUP_STATUS_NONE when there is no local socket
+ * for the URI of msg or nothing listens on it, the caller then goes
+ * over TCP.
+ */
+guint
+rstrnt_local_send_message (SoupMessage *msg)
+{
+    GSocketAddress *address;
+    GSocket *socket;
+    GError *error = NULL;
+    GString *reply;
+    const gchar *end;
+    gchar *path;
+    gchar *reason = NULL;
+    guint status = SOUP_STATUS_NONE;
+
+    g_return_val_if_fail (SOUP_IS_MESSAGE (msg), SOUP_STATUS_NONE);
+
+    path = local_socket_path (soup_message_get_uri (msg));
+    if (path == NULL) {
+        return SOUP_STATUS_NONE;
+    }
+    address = g_unix_socket_address_new (path);
+    g_free (path);
+    socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM,
+                           G_SOCKET_PROTOCOL_DEFAULT, &error);
+    if (socket == NULL || !g_socket_connect (socket, address, NULL, &error)) {
+        // Left over by a restraintd that is gone
+        g_debug ("Local socket unusable: %s", error->message);
+        g_clear_error (&error);
+        g_object_unref (address);
+        g_clear_object (&socket);
+        return SOUP_STATUS_NONE;
+    }
+    g_object_unref (address);
+    g_socket_set_timeout (socket, LOCAL_SOCKET_TIMEOUT);
+
+    reply = g_string_new (NULL);
+    if (!local_exchange (socket, msg, reply, &error)) {
+        soup_message_set_status_full (msg, SOUP_STATUS_IO_ERROR, error->message);
+        g_clear_error (&error);
+        status = SOUP_STATUS_IO_ERROR;
+        goto cleanup;
+    }
+
+    end = g_strstr_len (reply->str, reply->len, "\r\n\r\n");
+    soup_message_headers_clear (msg->response_headers);
+    if (end == NULL ||
+        !soup_headers_parse_response (reply->str, end - reply->str + 4,
+                                      msg->response_headers, NULL,
+                                      &status, &reason)) {
+        soup_message_set_status_full (msg, SOUP_STATUS_MALFORMED,
+                                      "Malformed reply on local socket");
+        status = SOUP_STATUS_MALFORMED;
+        goto cleanup;
+    }
+    end += 4;
+    soup_message_body_truncate (msg->response_body);
+    soup_message_body_append (msg->response_body, SOUP_MEMORY_COPY, end,
+                              reply->len - (end - reply->str));
+    soup_buffer_free (soup_message_body_flatten (msg->response_body));
+    soup_message_set_status_full (msg, status, reason);
+    g_free (reason);
+
+cleanup:
+    g_string_free (reply, TRUE);
+    g_socket_close (socket, NULL);
+    g_object_unref (socket);
+    return status;
+}
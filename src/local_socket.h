@@ -0,0 +1,39 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_LOCAL_SOCKET_H
+#define _RESTRAINT_LOCAL_SOCKET_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+#define LOCAL_SOCKET_TIMEOUT 3600 /* Seconds, same as the command sessions */
+
+/*
+ * restraintd hands the connections of its unix socket to the same
+ * SoupServer as the TCP ones, so every handler works over both.  The
+ * rstrnt-* commands talk plain HTTP/1.0 over it, one request per
+ * connection, without setting up a SoupSession.
+ */
+GSocketService *rstrnt_local_listen (SoupServer *server, const gchar *path,
+                                     GError **error);
+
+gboolean rstrnt_local_available (SoupURI *uri);
+guint rstrnt_local_send_message (SoupMessage *msg);
+
+#endif
@@ -15,11 +15,16 @@
   along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <gio/gunixoutputstream.h>
 #include "logging.h"
 #include "task.h"
 #include "beaker_harness.h"
+#include "metrics.h"
 
 /* FIX: Use /var/lib/restraint/logs instead. Needs SELinux policy
    updates. */
@@ -40,6 +45,13 @@ typedef struct
 {
     GFile *file;
     GOutputStream *output_stream;
+
+    /* Written by rstrnt_log_pump(), without O_APPEND as splice()
+       refuses it. -1 until the first pump. */
+    gint pump_fd;
+    goffset pump_offset;
+    gboolean pump_no_splice;  /* source isn't a pipe, a pty for instance */
+    char *pump_buffer;
 } RstrntLogData;
 
 typedef struct
@@ -56,6 +68,12 @@ typedef struct
     GThreadPool *thread_pool;
 } RstrntTaskLogData;
 
+typedef struct
+{
+    GMappedFile *file;
+    gint64 started;
+} RstrntLogUploadData;
+
 static void
 rstrnt_log_manager_dispose (GObject *object)
 {
@@ -91,6 +109,9 @@ rstrnt_log_data_destroy (gpointer data)
 
     g_clear_object (&log_data->output_stream);
     g_clear_object (&log_data->file);
+    if (log_data->pump_fd != -1)
+        close (log_data->pump_fd);
+    g_free (log_data->pump_buffer);
 
     g_free (log_data);
 }
@@ -126,6 +147,7 @@ rstrnt_log_data_new (GFile   *file,
 
     data = g_new0 (RstrntLogData, 1);
 
+    data->pump_fd = -1;
     data->file = g_object_ref (file);
     data->output_stream = g_unix_output_stream_new(fd, TRUE);
     fcntl(fd, F_SETFD, FD_CLOEXEC);
@@ -170,6 +192,11 @@ rstrnt_write_log_func (gpointer data,
     {
         g_warning ("%s(): Failed to write out log message: %s",
                    __func__, error->message);
+        rstrnt_metrics_inc (METRIC_LOG_WRITE_ERRORS);
+    }
+    else
+    {
+        rstrnt_metrics_add (METRIC_LOG_BYTES_WRITTEN, message_length);
     }
 }
 
@@ -253,9 +280,14 @@ rstrnt_on_log_uploaded (SoupSession *session,
                         SoupMessage *msg,
                         gpointer     user_data)
 {
+    RstrntLogUploadData *upload_data = user_data;
+
     g_debug ("%s(): response code: %u", __func__, msg->status_code);
 
-    g_mapped_file_unref (user_data);
+    rstrnt_metrics_observe (METRIC_LOG_UPLOAD_LATENCY,
+                            g_get_monotonic_time () - upload_data->started);
+    g_mapped_file_unref (upload_data->file);
+    g_slice_free (RstrntLogUploadData, upload_data);
 }
 
 static void
@@ -429,6 +461,7 @@ rstrnt_upload_log (const RstrntTask    *task,
     size_t length;
     const gchar *log_path = NULL;
     RstrntLogData *log_data = NULL;
+    RstrntLogUploadData *upload_data;
     goffset *offset;
 
     manager = rstrnt_log_manager_get_instance ();
@@ -475,6 +508,11 @@ rstrnt_upload_log (const RstrntTask    *task,
 
     g_return_if_fail (msgv != NULL && msgc > 0);
 
+    rstrnt_metrics_add (METRIC_LOG_UPLOAD_BYTES, length - *offset);
+    upload_data = g_slice_new (RstrntLogUploadData);
+    upload_data->file = file;
+    upload_data->started = g_get_monotonic_time ();
+
     for (int i = 0; i < msgc - 1; i++)
         app_data->queue_message (session, msgv[i], NULL, NULL, cancellable, NULL);
 
@@ -484,7 +522,7 @@ rstrnt_upload_log (const RstrntTask    *task,
                              NULL,
                              rstrnt_on_log_uploaded,
                              cancellable,
-                             file);
+                             upload_data);
 
     /* Notice that the offset is updated in the task even if setting the
        offset in the config failed. The offset in the file is used only
@@ -573,6 +611,129 @@ rstrnt_log_bytes (const RstrntTask *task,
                                       message, message_length);
 }
 
+static gboolean
+rstrnt_log_pump_open (RstrntLogData  *log_data,
+                      GError        **error)
+{
+    g_autofree char *path = g_file_get_path (log_data->file);
+    struct stat st;
+
+    log_data->pump_fd = open (path, O_WRONLY | O_CLOEXEC);
+    if (log_data->pump_fd == -1 || fstat (log_data->pump_fd, &st) == -1)
+    {
+        int errsv = errno;
+
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "Failed to open %s: %s", path, g_strerror (errsv));
+        if (log_data->pump_fd != -1)
+        {
+            close (log_data->pump_fd);
+            log_data->pump_fd = -1;
+        }
+
+        return FALSE;
+    }
+    log_data->pump_offset = st.st_size;
+
+    return TRUE;
+}
+
+static gssize
+rstrnt_log_pump_copy (RstrntLogData *log_data,
+                      int            fd)
+{
+    gssize bytes_read;
+    gssize written = 0;
+
+    if (log_data->pump_buffer == NULL)
+        log_data->pump_buffer = g_malloc (LOG_PUMP_SIZE);
+
+    bytes_read = read (fd, log_data->pump_buffer, LOG_PUMP_SIZE);
+    while (written < bytes_read)
+    {
+        gssize ret = pwrite (log_data->pump_fd, log_data->pump_buffer + written,
+                             bytes_read - written,
+                             log_data->pump_offset + written);
+
+        if (ret == -1 && errno != EINTR)
+            return -1;
+        if (ret > 0)
+            written += ret;
+    }
+
+    return bytes_read;
+}
+
+/*
+ * Moves what fd has to offer to the log of type.  Data from a pipe is
+ * spliced into the page cache of the log file without a copy in
+ * restraintd, anything else goes through one LOG_PUMP_SIZE buffer.  The
+ * uploader reads the log file back, so nothing else has to keep the data.
+ *
+ * The pump writes the file at its own offset, the log must not be
+ * written with rstrnt_log_bytes() while it is pumped.
+ *
+ * Returns the bytes moved, 0 at the end of fd and -1 with error set
+ * otherwise.  G_IO_ERROR_WOULD_BLOCK means nothing is there right now.
+ */
+gssize
+rstrnt_log_pump (const RstrntTask  *task,
+                 RstrntLogType      type,
+                 int                fd,
+                 GError           **error)
+{
+    RstrntTaskLogData *data;
+    RstrntLogData *log_data;
+    gssize bytes = -1;
+
+    g_return_val_if_fail (NULL != task, -1);
+    g_return_val_if_fail (fd >= 0, -1);
+    g_return_val_if_fail (error == NULL || *error == NULL, -1);
+
+    data = rstrnt_log_manager_get_task_data (rstrnt_log_manager_get_instance (),
+                                             task, error);
+    if (NULL == data)
+        return -1;
+
+    log_data = rstrnt_task_log_get_data (data, type);
+    if (log_data->pump_fd == -1 && !rstrnt_log_pump_open (log_data, error))
+        return -1;
+
+    if (!log_data->pump_no_splice)
+    {
+        bytes = splice (fd, NULL, log_data->pump_fd, &log_data->pump_offset,
+                        LOG_PUMP_SPLICE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (bytes == -1 && errno == EINVAL)
+            log_data->pump_no_splice = TRUE;
+        else if (bytes >= 0)
+        {
+            rstrnt_metrics_add (METRIC_LOG_BYTES_WRITTEN, bytes);
+            return bytes;
+        }
+    }
+    if (log_data->pump_no_splice)
+    {
+        bytes = rstrnt_log_pump_copy (log_data, fd);
+        if (bytes > 0)
+        {
+            log_data->pump_offset += bytes;
+            rstrnt_metrics_add (METRIC_LOG_BYTES_WRITTEN, bytes);
+        }
+    }
+    if (bytes == -1)
+    {
+        int errsv = errno;
+
+        if (errsv != EAGAIN)
+            rstrnt_metrics_inc (METRIC_LOG_WRITE_ERRORS);
+
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "Failed to pump task output: %s", g_strerror (errsv));
+    }
+
+    return bytes;
+}
+
 void
 rstrnt_log (const RstrntTask *task,
             RstrntLogType     type,
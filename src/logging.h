@@ -25,6 +25,9 @@
 
 #define RSTRNT_TYPE_LOG_MANAGER rstrnt_log_manager_get_type ()
 
+#define LOG_PUMP_SIZE (64 * 1024)  /* Read buffer when output can't be spliced */
+#define LOG_PUMP_SPLICE_SIZE (1024 * 1024)  /* Most bytes spliced at once */
+
 G_DECLARE_FINAL_TYPE (RstrntLogManager, rstrnt_log_manager, RSTRNT, LOG_MANAGER, GObject)
 
 typedef enum
@@ -47,6 +50,11 @@ void              rstrnt_log_bytes                (const RstrntTask    *task,
                                                    const char          *message,
                                                    size_t               message_length);
 
+gssize            rstrnt_log_pump                 (const RstrntTask    *task,
+                                                   RstrntLogType        type,
+                                                   int                  fd,
+                                                   GError             **error);
+
 void              rstrnt_log                      (const RstrntTask    *task,
                                                    RstrntLogType        type,
                                                    const char          *format,
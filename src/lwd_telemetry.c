@@ -0,0 +1,272 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "errors.h"
+#include "lwd_telemetry.h"
+
+/* Start of the ring file, the records follow */
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 record_size;
+    guint32 capacity;
+    guint32 reserved;
+    guint64 count;
+    gint64 start;
+} LwdHeader;
+
+static const gchar *lwd_event_names[] = {
+    [LWD_EVENT_START] = "start",
+    [LWD_EVENT_HEARTBEAT] = "heartbeat",
+    [LWD_EVENT_ADJUST] = "adjust",
+    [LWD_EVENT_EXPIRE] = "expire",
+    [LWD_EVENT_FINISH] = "finish",
+};
+
+static void
+lwd_set_errno_error (GError **error, gint errsv, const gchar *action,
+                     const gchar *path)
+{
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                 "Failed to %s %s: %s", action, path, g_strerror (errsv));
+}
+
+static gboolean
+lwd_header_valid (LwdHeader *header)
+{
+    return memcmp (header->magic, LWD_TELEMETRY_MAGIC, sizeof (header->magic)) == 0 &&
+           header->version == LWD_TELEMETRY_VERSION &&
+           header->record_size == sizeof (RstrntLwdRecord) &&
+           header->capacity > 0;
+}
+
+static gboolean
+lwd_write_header (RstrntLwdTelemetry *telemetry, GError **error)
+{
+    LwdHeader header = {
+        .version = LWD_TELEMETRY_VERSION,
+        .record_size = sizeof (RstrntLwdRecord),
+        .capacity = telemetry->capacity,
+        .count = telemetry->count,
+        .start = telemetry->start,
+    };
+
+    memcpy (header.magic, LWD_TELEMETRY_MAGIC, sizeof (header.magic));
+    if (pwrite (telemetry->fd, &header, sizeof (header), 0) != sizeof (header)) {
+        lwd_set_errno_error (error, errno, "write", telemetry->path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gchar *
+rstrnt_lwd_telemetry_path (const gchar *dir, const gchar *task_id)
+{
+    gchar *name = g_strdup_printf ("%s.lwd", task_id);
+    gchar *path = g_build_filename (dir, name, NULL);
+
+    g_free (name);
+    return path;
+}
+
+/*
+ * Opens the ring file of a task.  Records of an earlier boot are kept, a
+ * file restraint cannot make sense of is started over.
+ */
+RstrntLwdTelemetry *
+rstrnt_lwd_telemetry_open (const gchar *path, guint32 capacity, GError **error)
+{
+    RstrntLwdTelemetry *telemetry;
+    LwdHeader header;
+    gchar *dir;
+
+    g_return_val_if_fail (path != NULL && capacity > 0, NULL);
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    dir = g_path_get_dirname (path);
+    g_mkdir_with_parents (dir, 0755);
+    g_free (dir);
+
+    telemetry = g_slice_new0 (RstrntLwdTelemetry);
+    telemetry->path = g_strdup (path);
+    telemetry->last_us = g_get_monotonic_time ();
+    telemetry->fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (telemetry->fd < 0) {
+        lwd_set_errno_error (error, errno, "open", path);
+        rstrnt_lwd_telemetry_close (telemetry);
+        return NULL;
+    }
+
+    if (pread (telemetry->fd, &header, sizeof (header), 0) == sizeof (header) &&
+            lwd_header_valid (&header)) {
+        telemetry->capacity = header.capacity;
+        telemetry->count = header.count;
+        telemetry->start = header.start;
+        return telemetry;
+    }
+
+    telemetry->capacity = capacity;
+    telemetry->start = g_get_real_time () / G_USEC_PER_SEC;
+    if (ftruncate (telemetry->fd, 0) != 0) {
+        lwd_set_errno_error (error, errno, "truncate", path);
+        rstrnt_lwd_telemetry_close (telemetry);
+        return NULL;
+    }
+    if (!lwd_write_header (telemetry, error)) {
+        rstrnt_lwd_telemetry_close (telemetry);
+        return NULL;
+    }
+    return telemetry;
+}
+
+void
+rstrnt_lwd_telemetry_close (RstrntLwdTelemetry *telemetry)
+{
+    if (telemetry == NULL) {
+        return;
+    }
+    if (telemetry->fd >= 0) {
+        close (telemetry->fd);
+    }
+    g_free (telemetry->path);
+    g_slice_free (RstrntLwdTelemetry, telemetry);
+}
+
+void
+rstrnt_lwd_telemetry_output (RstrntLwdTelemetry *telemetry, gsize bytes)
+{
+    if (telemetry != NULL) {
+        telemetry->output_bytes += bytes;
+    }
+}
+
+gboolean
+rstrnt_lwd_telemetry_record (RstrntLwdTelemetry *telemetry,
+                             RstrntLwdEvent event,
+                             gint64 remaining,
+                             gint64 adjusted,
+                             GError **error)
+{
+    RstrntLwdRecord record = { 0 };
+    gint64 now_us = g_get_monotonic_time ();
+    gint64 since_us;
+    off_t offset;
+
+    g_return_val_if_fail (telemetry != NULL, FALSE);
+
+    since_us = now_us - telemetry->last_us;
+
+    record.timestamp = g_get_real_time ();
+    record.elapsed = record.timestamp / G_USEC_PER_SEC - telemetry->start;
+    record.remaining = remaining;
+    record.adjusted = adjusted;
+    record.output_bytes = telemetry->output_bytes;
+    record.output_rate = MIN (telemetry->output_bytes * G_USEC_PER_SEC / MAX (since_us, 1),
+                              G_MAXUINT32);
+    record.event = event;
+
+    offset = sizeof (LwdHeader) + (telemetry->count % telemetry->capacity) * sizeof (record);
+    if (pwrite (telemetry->fd, &record, sizeof (record), offset) != sizeof (record)) {
+        lwd_set_errno_error (error, errno, "write", telemetry->path);
+        return FALSE;
+    }
+    telemetry->count++;
+    telemetry->output_bytes = 0;
+    telemetry->last_us = now_us;
+    return lwd_write_header (telemetry, error);
+}
+
+static json_object *
+lwd_record_to_json (RstrntLwdRecord *record)
+{
+    json_object *object = json_object_new_object ();
+    const gchar *event = "unknown";
+
+    if (record->event < G_N_ELEMENTS (lwd_event_names)) {
+        event = lwd_event_names[record->event];
+    }
+    json_object_object_add (object, "timestamp", json_object_new_int64 (record->timestamp));
+    json_object_object_add (object, "event", json_object_new_string (event));
+    json_object_object_add (object, "elapsed", json_object_new_int64 (record->elapsed));
+    json_object_object_add (object, "remaining", json_object_new_int64 (record->remaining));
+    json_object_object_add (object, "adjusted", json_object_new_int64 (record->adjusted));
+    json_object_object_add (object, "output_bytes", json_object_new_int64 (record->output_bytes));
+    json_object_object_add (object, "output_rate", json_object_new_int64 (record->output_rate));
+    return object;
+}
+
+/*
+ * The ring file as
+ * {"start": S, "count": N, "capacity": C, "records": [...]}, oldest
+ * record first.
+ */
+json_object *
+rstrnt_lwd_telemetry_read (const gchar *path, GError **error)
+{
+    json_object *object;
+    json_object *records;
+    LwdHeader header;
+    guint64 first;
+    guint64 stored;
+    gint fd;
+
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        lwd_set_errno_error (error, errno, "open", path);
+        return NULL;
+    }
+    if (pread (fd, &header, sizeof (header), 0) != sizeof (header) ||
+            !lwd_header_valid (&header)) {
+        g_set_error (error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                     "%s is not a local watchdog telemetry file", path);
+        close (fd);
+        return NULL;
+    }
+
+    stored = MIN (header.count, header.capacity);
+    first = header.count - stored;
+    records = json_object_new_array ();
+    for (guint64 i = first; i < header.count; i++) {
+        RstrntLwdRecord record;
+        off_t offset = sizeof (header) + (i % header.capacity) * sizeof (record);
+
+        if (pread (fd, &record, sizeof (record), offset) != sizeof (record)) {
+            g_set_error (error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                         "%s is truncated", path);
+            json_object_put (records);
+            close (fd);
+            return NULL;
+        }
+        json_object_array_add (records, lwd_record_to_json (&record));
+    }
+    close (fd);
+
+    object = json_object_new_object ();
+    json_object_object_add (object, "start", json_object_new_int64 (header.start));
+    json_object_object_add (object, "count", json_object_new_int64 (header.count));
+    json_object_object_add (object, "capacity", json_object_new_int64 (header.capacity));
+    json_object_object_add (object, "records", records);
+    return object;
+}
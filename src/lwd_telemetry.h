@@ -0,0 +1,71 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_LWD_TELEMETRY_H
+#define _RESTRAINT_LWD_TELEMETRY_H
+
+#include <glib.h>
+#include <json.h>
+
+#define LWD_TELEMETRY_DIR "/var/lib/restraint/lwd"
+#define LWD_TELEMETRY_RECORDS 1024  /* Kept per task, the oldest are overwritten */
+#define LWD_TELEMETRY_MAGIC "RSTRNTWD"
+#define LWD_TELEMETRY_VERSION 1
+
+typedef enum {
+    LWD_EVENT_START,
+    LWD_EVENT_HEARTBEAT,
+    LWD_EVENT_ADJUST,   /* rstrnt-adjust-watchdog */
+    LWD_EVENT_EXPIRE,   /* the local watchdog killed the task */
+    LWD_EVENT_FINISH,
+} RstrntLwdEvent;
+
+/* One record of the ring file, written as is */
+typedef struct {
+    gint64 timestamp;      /* microseconds since the epoch */
+    gint64 elapsed;        /* seconds since the task first started */
+    gint64 remaining;      /* seconds before the local watchdog expires */
+    gint64 adjusted;       /* seconds asked for by an adjustment, else 0 */
+    guint64 output_bytes;  /* task output since the previous record */
+    guint32 output_rate;   /* bytes per second since the previous record */
+    guint32 event;         /* RstrntLwdEvent */
+} RstrntLwdRecord;
+
+typedef struct {
+    gchar *path;
+    gint fd;
+    guint32 capacity;
+    guint64 count;         /* records written so far, wrapped or not */
+    gint64 start;          /* seconds since the epoch, kept across reboots */
+    guint64 output_bytes;  /* since the previous record */
+    gint64 last_us;        /* monotonic time of the previous record */
+} RstrntLwdTelemetry;
+
+gchar *rstrnt_lwd_telemetry_path (const gchar *dir, const gchar *task_id);
+RstrntLwdTelemetry *rstrnt_lwd_telemetry_open (const gchar *path,
+                                               guint32 capacity,
+                                               GError **error);
+void rstrnt_lwd_telemetry_close (RstrntLwdTelemetry *telemetry);
+void rstrnt_lwd_telemetry_output (RstrntLwdTelemetry *telemetry, gsize bytes);
+gboolean rstrnt_lwd_telemetry_record (RstrntLwdTelemetry *telemetry,
+                                      RstrntLwdEvent event,
+                                      gint64 remaining,
+                                      gint64 adjusted,
+                                      GError **error);
+json_object *rstrnt_lwd_telemetry_read (const gchar *path, GError **error);
+
+#endif
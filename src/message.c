@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include <json.h>
 #include "message.h"
+#include "metrics.h"
+#include "trace.h"
 
 static GQueue *message_queue = NULL;
 static gboolean queue_active = FALSE;
@@ -52,9 +54,14 @@ message_complete (SoupSession *sesison, SoupMessage *msg, gpointer user_data)
     MessageData *message_data = (MessageData *) user_data;
     static gint delay = 2;
 
+    rstrnt_trace_message (TRACE_OUTBOUND, message_data->msg,
+                          message_data->sent, message_data->attempt);
     if (SOUP_STATUS_IS_SUCCESSFUL (message_data->msg->status_code) ||
         SOUP_STATUS_IS_CLIENT_ERROR (message_data->msg->status_code)) {
         delay = 2;
+        rstrnt_metrics_inc (METRIC_MESSAGES_SENT);
+        rstrnt_metrics_observe (METRIC_MESSAGE_LATENCY,
+                                g_get_monotonic_time () - message_data->sent);
         if (message_data->finish_callback) {
             message_data->finish_callback (message_data->session,
                                            message_data->msg,
@@ -81,9 +88,12 @@ message_complete (SoupSession *sesison, SoupMessage *msg, gpointer user_data)
                   delay);
 
         g_free(uri);
+        rstrnt_metrics_inc (METRIC_MESSAGE_RETRIES);
+        rstrnt_metrics_observe (METRIC_MESSAGE_RETRY_DELAY, delay * G_USEC_PER_SEC);
         // push it back onto the queue.
         (void)g_object_ref (message_data->msg);
         g_queue_push_head (message_queue, message_data);
+        rstrnt_metrics_set (METRIC_MESSAGE_QUEUE_DEPTH, g_queue_get_length (message_queue));
         //g_print ("message_complete->add delay_handler\n");
         g_timeout_add_seconds_full (G_PRIORITY_DEFAULT_IDLE,
                                     delay,
@@ -103,6 +113,9 @@ message_handler (gpointer data)
         queue_active = FALSE;
     } else {
         MessageData *message_data = g_queue_pop_head (message_queue);
+        rstrnt_metrics_set (METRIC_MESSAGE_QUEUE_DEPTH, g_queue_get_length (message_queue));
+        message_data->sent = g_get_monotonic_time ();
+        message_data->attempt++;
         soup_session_queue_message (message_data->session,
                                     message_data->msg,
                                     message_complete,
@@ -135,6 +148,8 @@ restraint_queue_message (SoupSession *session,
 
     // push the message onto the queue.
     g_queue_push_tail (message_queue, message_data);
+    rstrnt_metrics_inc (METRIC_MESSAGES_QUEUED);
+    rstrnt_metrics_set (METRIC_MESSAGE_QUEUE_DEPTH, g_queue_get_length (message_queue));
 
     // Add the message handler to the main loop if it isn't running already.
     if (!queue_active) {
@@ -179,6 +194,7 @@ restraint_stdout_message (SoupSession *session,
                           gpointer user_data)
 {
     ClientData *client_data = (ClientData *) msg_data;
+    gint64 started = g_get_monotonic_time ();
     time_t result;
     result = time(NULL);
     static time_t transaction_id = 0;
@@ -253,6 +269,8 @@ restraint_stdout_message (SoupSession *session,
 
         soup_buffer_free (request);
         json_object_put (jobj); // Delete the json object
+
+        rstrnt_trace_message (TRACE_STDOUT, msg, started, 1);
     }
 
     if (finish_callback) {
@@ -35,6 +35,10 @@ typedef struct {
     SoupMessage *client_msg;
     SoupServer *server;
     gpointer user_data;
+    // monotonic time the report plugins were started
+    gint64 plugins_started;
+    // client_msg was answered before the report plugins ran, they hold a ref
+    gboolean answered;
 } ClientData;
 
 typedef struct {
@@ -48,6 +52,10 @@ typedef struct {
     MessageFinishCallback finish_callback;
     // Delay requeue by this many seconds.
     guint delay;
+    // monotonic time the message was last handed to the session
+    gint64 sent;
+    // times the message was handed to the session, retries included
+    guint attempt;
 } MessageData;
 
 void restraint_queue_message (SoupSession *session,
@@ -40,456 +40,901 @@ typedef struct _MetadataData {
     GIOFunc io_callback;
     metadata_cb finish_cb;
     void *user_data;
+    gchar *digest;
 } MetadataData;
 
+/*
+ * Parsed metadata is cached on disk so that trees which are fetched again
+ * (repodeps shared by several tasks, reruns after a reboot) don't need to
+ * be parsed again and more importantly don't need to run
+ * "make testinfo.desc".  The entry for a tree is found by its path and
+ * osmajor and is only valid while the digest of the files metadata is
+ * generated from still matches.  Fetching doesn't preserve mtimes so the
+ * digest is made of the file contents, they are tiny anyway.
+ */
+#define METADATA_CACHE_VERSION 1
+#define METADATA_CACHE_TYPE "(qsbmsmsxbbasasasa(ss))"
+
+static const gchar *metadata_sources[] = {
+    "metadata",
+    "testinfo.desc",
+    "Makefile",
+    NULL,
+};
+
+static gchar *metadata_cache_dir = NULL;
+
+void
+restraint_metadata_cache_set_dir (const gchar *dir)
+{
+    g_free (metadata_cache_dir);
+    metadata_cache_dir = g_strdup (dir);
+}
+
+static gchar *
+metadata_cache_filename (const gchar *path, const gchar *osmajor)
+{
+    g_autofree gchar *key = g_strdup_printf ("%s\n%s", path,
+                                             osmajor ? osmajor : "");
+    g_autofree gchar *name = g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+                                                            key, -1);
+    return g_build_filename (metadata_cache_dir, name, NULL);
+}
+
+static gchar *
+metadata_cache_digest (const gchar *path)
+{
+    GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+    for (const gchar **source = metadata_sources; *source; source++) {
+        g_autofree gchar *filename = g_build_filename (path, *source, NULL);
+        g_autofree gchar *contents = NULL;
+        gsize length = 0;
+
+        // Name is included so moving content between files changes the digest
+        g_checksum_update (checksum, (const guchar *) *source, -1);
+        if (g_file_get_contents (filename, &contents, &length, NULL)) {
+            g_checksum_update (checksum, (const guchar *) "+", 1);
+            g_checksum_update (checksum, (const guchar *) contents, length);
+        } else {
+            g_checksum_update (checksum, (const guchar *) "-", 1);
+        }
+    }
+
+    gchar *digest = g_strdup (g_checksum_get_string (checksum));
+    g_checksum_free (checksum);
+    return digest;
+}
+
+static GVariant *
+metadata_strv_variant (GSList *list)
+{
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
+    for (GSList *l = list; l; l = g_slist_next (l)) {
+        g_variant_builder_add (&builder, "s", (gchar *) l->data);
+    }
+    return g_variant_builder_end (&builder);
+}
+
+static GSList *
+metadata_strv_list (GVariantIter *iter)
+{
+    GSList *list = NULL;
+    const gchar *value;
+
+    while (g_variant_iter_next (iter, "&s", &value)) {
+        list = g_slist_prepend (list, (gpointer) g_intern_string (value));
+    }
+    return g_slist_reverse (list);
+}
+
+static void
+metadata_cache_store (const gchar *path, const gchar *osmajor,
+                      const gchar *digest, MetaData *metadata,
+                      gboolean rhts_compat)
+{
+    GVariantBuilder envvars;
+    GError *error = NULL;
+
+    if (metadata_cache_dir == NULL || metadata == NULL) {
+        return;
+    }
+
+    g_variant_builder_init (&envvars, G_VARIANT_TYPE ("a(ss)"));
+    for (GSList *l = metadata->envvars; l; l = g_slist_next (l)) {
+        Param *p = l->data;
+        g_variant_builder_add (&envvars, "(ss)", p->name, p->value);
+    }
+
+    GVariant *variant = g_variant_ref_sink (g_variant_new (METADATA_CACHE_TYPE,
+                            METADATA_CACHE_VERSION,
+                            digest,
+                            rhts_compat,
+                            metadata->name,
+                            metadata->entry_point,
+                            metadata->max_time,
+                            metadata->nolocalwatchdog,
+                            metadata->use_pty,
+                            metadata_strv_variant (metadata->dependencies),
+                            metadata_strv_variant (metadata->softdependencies),
+                            metadata_strv_variant (metadata->repodeps),
+                            g_variant_builder_end (&envvars)));
+
+    g_autofree gchar *filename = metadata_cache_filename (path, osmajor);
+    if (g_mkdir_with_parents (metadata_cache_dir, 0755) != 0 ||
+            !g_file_set_contents (filename, g_variant_get_data (variant),
+                                  g_variant_get_size (variant), &error)) {
+        g_warning ("%s(): Unable to cache metadata of %s: %s", __func__, path,
+                   error ? error->message : g_strerror (errno));
+        g_clear_error (&error);
+    }
+    g_variant_unref (variant);
+}
+
+static MetaData *
+metadata_cache_lookup (const gchar *path, const gchar *osmajor,
+                       const gchar *digest, gboolean *rhts_compat)
+{
+    g_autofree gchar *filename = NULL;
+    gchar *contents = NULL;
+    gsize length = 0;
+    guint16 version = 0;
+    const gchar *cached_digest = NULL;
+    GVariantIter *dependencies, *softdependencies, *repodeps, *envvars;
+    gchar *name, *value;
+
+    if (metadata_cache_dir == NULL) {
+        return NULL;
+    }
+
+    filename = metadata_cache_filename (path, osmajor);
+    if (!g_file_get_contents (filename, &contents, &length, NULL)) {
+        return NULL;
+    }
+
+    GVariant *variant = g_variant_ref_sink (g_variant_new_from_data (
+                                G_VARIANT_TYPE (METADATA_CACHE_TYPE),
+                                contents, length, FALSE, g_free, contents));
+    g_variant_get_child (variant, 0, "q", &version);
+    g_variant_get_child (variant, 1, "&s", &cached_digest);
+    if (version != METADATA_CACHE_VERSION ||
+            g_strcmp0 (cached_digest, digest) != 0) {
+        g_variant_unref (variant);
+        return NULL;
+    }
+
+    MetaData *metadata = g_slice_new0 (MetaData);
+    g_variant_get (variant, METADATA_CACHE_TYPE,
+                   NULL,
+                   NULL,
+                   rhts_compat,
+                   &metadata->name,
+                   &metadata->entry_point,
+                   &metadata->max_time,
+                   &metadata->nolocalwatchdog,
+                   &metadata->use_pty,
+                   &dependencies,
+                   &softdependencies,
+                   &repodeps,
+                   &envvars);
+    metadata->dependencies = metadata_strv_list (dependencies);
+    metadata->softdependencies = metadata_strv_list (softdependencies);
+    metadata->repodeps = metadata_strv_list (repodeps);
+    while (g_variant_iter_next (envvars, "(ss)", &name, &value)) {
+        Param *p = restraint_param_new ();
+        p->name = name;
+        p->value = value;
+        metadata->envvars = g_slist_prepend (metadata->envvars, p);
+    }
+    metadata->envvars = g_slist_reverse (metadata->envvars);
+
+    g_variant_iter_free (dependencies);
+    g_variant_iter_free (softdependencies);
+    g_variant_iter_free (repodeps);
+    g_variant_iter_free (envvars);
+    g_variant_unref (variant);
+
+    g_debug ("%s(): Using cached metadata for %s", __func__, path);
+    return metadata;
+}
+
 void
 restraint_metadata_free (MetaData *metadata)
 {
     if (metadata) {
         g_free(metadata->name);
         g_free(metadata->entry_point);
-        g_slist_free_full (metadata->dependencies, g_free);
-        g_slist_free_full (metadata->softdependencies, g_free);
-        g_slist_free_full (metadata->repodeps, g_free);
+        // dependency names are interned
+        g_slist_free (metadata->dependencies);
+        g_slist_free (metadata->softdependencies);
+        g_slist_free (metadata->repodeps);
         g_slist_free_full (metadata->envvars, (GDestroyNotify)restraint_param_free);
         g_slice_free (MetaData, metadata);
     }
 }
 
-MetaData *
-restraint_parse_metadata (gchar *filename,
-                          gchar *locale,
-                          GError **error)
+/*
+ * Both parsers read the whole file into a single buffer and tokenize it in
+ * place, separators are overwritten with NUL so no per line or per value
+ * copies are made.  Dependency names are interned, the same names show up
+ * again and again across the tasks and repodeps of a recipe, and the lists
+ * are deduplicated while they are built.  As before lists end up in reverse
+ * file order.
+ */
+
+typedef enum {
+    METADATA_KEY_UNKNOWN = -1,
+    METADATA_KEY_NAME,
+    METADATA_KEY_ENTRY_POINT,
+    METADATA_KEY_MAX_TIME,
+    METADATA_KEY_DEPENDENCIES,
+    METADATA_KEY_SOFTDEPENDENCIES,
+    METADATA_KEY_REPOREQUIRES,
+    METADATA_KEY_ENVIRONMENT,
+    METADATA_KEY_NO_LOCALWATCHDOG,
+    METADATA_KEY_USE_PTY,
+    METADATA_KEY_COUNT,
+} MetadataKey;
+
+typedef enum {
+    METADATA_SECTION_NONE,
+    METADATA_SECTION_OTHER,
+    METADATA_SECTION_GENERAL,
+    METADATA_SECTION_RESTRAINT,
+} MetadataSection;
+
+typedef enum {
+    TESTINFO_KEY_UNKNOWN,
+    TESTINFO_KEY_NAME,
+    TESTINFO_KEY_TESTTIME,
+    TESTINFO_KEY_USE_PTY,
+    TESTINFO_KEY_REQUIRES,
+    TESTINFO_KEY_REPOREQUIRES,
+    TESTINFO_KEY_ENVIRONMENT,
+} TestinfoKey;
+
+static const gchar *metadata_key_names[METADATA_KEY_COUNT] = {
+    "name",
+    "entry_point",
+    "max_time",
+    "dependencies",
+    "softDependencies",
+    "repoRequires",
+    "environment",
+    "no_localwatchdog",
+    "use_pty",
+};
+
+typedef struct {
+    MetaData *metadata;
+    const gchar *locale;
+    MetadataSection section;
+    gboolean has_general;
+    gboolean has_restraint;
+    /* Points into the buffer, a localized value beats a plain one */
+    gchar *values[METADATA_KEY_COUNT];
+    gboolean localized[METADATA_KEY_COUNT];
+    /* Created on demand, keys are interned strings */
+    GHashTable *seen_dependencies;
+    GHashTable *seen_softdependencies;
+    GHashTable *seen_repodeps;
+} MetadataParser;
+
+typedef gboolean (*MetadataLineFunc) (MetadataParser *parser, gchar *line,
+                                      GError **error);
+typedef void (*MetadataElementFunc) (MetadataParser *parser, gchar *element);
+
+static void
+metadata_parser_clear (MetadataParser *parser)
 {
-    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-    GKeyFile *keyfile;
-    GKeyFileFlags flags;
-    GError *tmp_error = NULL;
-    MetaData *metadata = g_slice_new0 (MetaData);
-
-    /* Create a new GKeyFile object and a bitwise list of flags. */
-    keyfile = g_key_file_new();
-    /* This is not really needed since I don't envision writing the file back out */
-    flags = G_KEY_FILE_KEEP_COMMENTS | G_KEY_FILE_KEEP_TRANSLATIONS;
-
-    /* Load the GKeyFile from metadata or return. */
-    if (!g_key_file_load_from_file(keyfile, filename, flags, &tmp_error)) {
-        g_propagate_error(error, tmp_error);
-        goto error;
-    }
-
-    metadata->name = g_key_file_get_locale_string(keyfile,
-                                                  "General",
-                                                  "name",
-                                                  locale,
-                                                  &tmp_error);
-    if (tmp_error != NULL && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
-    }
-    // metadata->name is present
-    if (tmp_error == NULL) {
-        metadata->name = g_strstrip(metadata->name);
-    }
-    g_clear_error (&tmp_error);
-
-    gchar *key_entry_point = g_key_file_get_locale_string(keyfile,
-                                                      "restraint",
-                                                      "entry_point",
-                                                      locale,
-                                                      &tmp_error);
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
-    }
-    g_clear_error (&tmp_error);
-    if (key_entry_point != NULL) {
-        metadata->entry_point = key_entry_point;
-    }
-
-    gchar *max_time = g_key_file_get_locale_string (keyfile,
-                                                    "restraint",
-                                                    "max_time",
-                                                    locale,
-                                                    &tmp_error);
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
-    }
-    g_clear_error (&tmp_error);
-    if (max_time != NULL) {
-        gint64 time = parse_time_string(max_time, &tmp_error);
-        g_free(max_time);
-        if (tmp_error) {
-            g_propagate_error(error, tmp_error);
-            goto error;
-        }
-        // If max_time is set it's because we read it from our run data
-        metadata->max_time = time;
-    }
-
-    gsize length;
-    gchar **dependencies = g_key_file_get_locale_string_list(keyfile,
-                                                            "restraint",
-                                                            "dependencies",
-                                                            locale,
-                                                            &length,
-                                                            &tmp_error);
-    gchar **dependency = dependencies;
-    if (dependency) {
-      while (*dependency) {
-        metadata->dependencies = g_slist_prepend (metadata->dependencies, g_strdup(*dependency));
-        dependency++;
-      }
-      g_strfreev (dependencies);
-    }
-    else
-      metadata->dependencies = NULL;
-
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
-    }
-    g_clear_error (&tmp_error);
-
-    gchar **softdependencies = g_key_file_get_locale_string_list(keyfile,
-                                                                 "restraint",
-                                                                 "softDependencies",
-                                                                 locale,
-                                                                 &length,
-                                                                 &tmp_error);
-    gchar **softdependency = softdependencies;
-    if (softdependency) {
-      while (*softdependency) {
-        metadata->softdependencies = g_slist_prepend (metadata->softdependencies, g_strdup(*softdependency));
-        softdependency++;
-      }
-      g_strfreev (softdependencies);
-    }
-    else
-      metadata->softdependencies = NULL;
-
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
-    }
-    g_clear_error (&tmp_error);
-
-    gchar **repodeps = g_key_file_get_locale_string_list(keyfile,
-                                                         "restraint",
-                                                         "repoRequires",
-                                                         locale,
-                                                         &length,
-                                                         &tmp_error);
-    gchar **repodep = repodeps;
-    if (repodep) {
-      while (*repodep) {
-        metadata->repodeps = g_slist_prepend (metadata->repodeps, g_strdup(*repodep));
-        repodep++;
-      }
-      g_strfreev (repodeps);
-    }
-    else
-      metadata->repodeps = NULL;
-
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
-    }
-    g_clear_error (&tmp_error);
-
-    gchar **envvars = g_key_file_get_locale_string_list(keyfile,
-                                                       "restraint",
-                                                       "environment",
-                                                       locale,
-                                                       &length,
-                                                       &tmp_error);
-    gchar **envvar = envvars;
-    if (envvar) {
-        while (*envvar) {
-            gchar **split = g_strsplit(*envvar, "=", 2);
-            if(split[0] != NULL && split[1] != NULL){
-                Param *p = restraint_param_new();
-                p->name = g_strdup(split[0]);
-                p->value = g_strdup(split[1]);
-                metadata->envvars = g_slist_prepend(metadata->envvars, p);
-            }
-            g_strfreev(split);
-            envvar++;
-        }
-        g_strfreev(envvars);
+    if (parser->seen_dependencies) {
+        g_hash_table_destroy (parser->seen_dependencies);
     }
-    else {
-        metadata->envvars = NULL;
+    if (parser->seen_softdependencies) {
+        g_hash_table_destroy (parser->seen_softdependencies);
     }
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
+    if (parser->seen_repodeps) {
+        g_hash_table_destroy (parser->seen_repodeps);
     }
+}
 
-    g_clear_error (&tmp_error);
-
-    metadata->nolocalwatchdog = g_key_file_get_boolean (keyfile,
-                                                    "restraint",
-                                                    "no_localwatchdog",
-                                                    &tmp_error);
+static void
+metadata_list_add (GSList **list, GHashTable **seen, const gchar *name)
+{
+    const gchar *interned = g_intern_string (name);
 
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
+    if (*seen == NULL) {
+        *seen = g_hash_table_new (g_direct_hash, g_direct_equal);
     }
-    g_clear_error (&tmp_error);
-
-    metadata->use_pty = g_key_file_get_boolean (keyfile,
-                                                "restraint",
-                                                "use_pty",
-                                                &tmp_error);
-
-    if (tmp_error && tmp_error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND) {
-        g_propagate_error(error, tmp_error);
-        goto error;
+    if (g_hash_table_add (*seen, (gpointer) interned)) {
+        *list = g_slist_prepend (*list, (gpointer) interned);
     }
-    g_clear_error (&tmp_error);
+}
 
-    g_key_file_free(keyfile);
+static void
+metadata_add_dependency (MetadataParser *parser, gchar *name)
+{
+    metadata_list_add (&parser->metadata->dependencies,
+                       &parser->seen_dependencies, name);
+}
 
-    return metadata;
+static void
+metadata_add_softdependency (MetadataParser *parser, gchar *name)
+{
+    metadata_list_add (&parser->metadata->softdependencies,
+                       &parser->seen_softdependencies, name);
+}
+
+static void
+metadata_add_repodep (MetadataParser *parser, gchar *name)
+{
+    metadata_list_add (&parser->metadata->repodeps,
+                       &parser->seen_repodeps, name);
+}
 
-error:
-    restraint_metadata_free(metadata);
-    g_key_file_free(keyfile);
-    return NULL;
+static void
+metadata_add_envvar (MetadataParser *parser, gchar *name, gchar *value)
+{
+    Param *p = restraint_param_new ();
+    p->name = g_strdup (name);
+    p->value = g_strdup (value);
+    parser->metadata->envvars = g_slist_prepend (parser->metadata->envvars, p);
 }
 
-static void parse_line(MetaData *metadata,
-                       const gchar *line,
-                       gsize length,
-                       GError **error) {
+static void
+metadata_add_keyfile_envvar (MetadataParser *parser, gchar *element)
+{
+    gchar *equals = strchr (element, '=');
+    if (equals != NULL) {
+        *equals = '\0';
+        metadata_add_envvar (parser, element, equals + 1);
+    }
+}
 
-    g_return_if_fail(metadata != NULL);
-    g_return_if_fail(error == NULL || *error == NULL);
+static gboolean
+metadata_foreach_line (MetadataParser *parser, gchar *data, gsize length,
+                       MetadataLineFunc func, GError **error)
+{
+    gchar *end = data + length;
+    gchar *line = data;
 
-    GError *tmp_error = NULL;
-    gchar **key_value = g_strsplit (line,":",2);
-    gchar *key = g_ascii_strup(g_strstrip(key_value[0]), -1);
-    gchar *value = g_strdup(g_strstrip(key_value[1]));
-    g_strfreev(key_value);
-
-    if (g_strcmp0("TESTTIME",key) == 0) {
-        guint64 time = parse_time_string(value, &tmp_error);
-        if (tmp_error) {
-            g_free(key);
-            g_free(value);
-            g_propagate_error(error, tmp_error);
-            return;
+    while (line < end) {
+        gchar *eol = memchr (line, '\n', end - line);
+        if (eol == NULL) {
+            eol = end;
         }
-        metadata->max_time = time;
-    } else if(g_strcmp0("NAME", key) == 0) {
-        metadata->name = g_strdup(g_strstrip(value));
-    } else if(g_strcmp0("USE_PTY", key) == 0) {
-        gchar *uvalue = g_ascii_strup(value, -1);
-        if (g_strcmp0("TRUE", uvalue) == 0) {
-            metadata->use_pty = TRUE;
-        } else {
-            metadata->use_pty = FALSE;
-        }
-        g_free(uvalue);
-    } else if(g_strcmp0("REQUIRES", key) == 0 ||
-              g_strcmp0("RHTSREQUIRES", key) == 0) {
-        gchar **dependencies = g_strsplit_set (value,", ", -1);
-        gchar **dependency = dependencies;
-        while (*dependency) {
-            if (g_strcmp0 (*dependency, "") != 0) {
-                metadata->dependencies = g_slist_prepend (metadata->dependencies, g_strdup(*dependency));
-            }
-            dependency++;
+        // data[length] is the terminating NUL so this is safe for the
+        // last line as well
+        *eol = '\0';
+        // remove old style ascii terminator
+        if (eol > line && eol[-1] == '\r') {
+            eol[-1] = '\0';
         }
-        // We only want to free the array not the values that it's pointing to
-        g_strfreev (dependencies);
-    } else  if(g_strcmp0("REPOREQUIRES", key) == 0) {
-        gchar **repodeps = g_strsplit_set (value,", ", -1);
-        gchar **repodep = repodeps;
-        while (*repodep) {
-            if (g_strcmp0 (*repodep, "") != 0) {
-                metadata->repodeps = g_slist_prepend (metadata->repodeps, g_strdup(*repodep));
-            }
-            repodep++;
-        }
-        // We only want to free the array not the values that it's pointing to
-        g_strfreev (repodeps);
-    } else if(g_strcmp0("ENVIRONMENT", key) == 0) {
-        gchar **envvar = g_strsplit_set (value, "= ", 2);
-        if(envvar[0] != NULL && envvar[1] != NULL){
-            Param *p = restraint_param_new();
-            p->name = g_strdup(envvar[0]);
-            p->value = g_strdup(envvar[1]);
-            metadata->envvars = g_slist_prepend(metadata->envvars, p);
+        if (!func (parser, line, error)) {
+            return FALSE;
         }
-        g_strfreev(envvar);
+        line = eol + 1;
     }
-    g_free(key);
-    g_free(value);
+    return TRUE;
 }
 
-static void flush_parse_buffer(MetaData *metadata, GString *parse_buffer, GError **error) {
-    g_return_if_fail(metadata != NULL);
-    g_return_if_fail(error == NULL || *error == NULL);
-
+static gboolean
+metadata_parse_time (gchar *value, gint64 *max_time, GError **error)
+{
     GError *tmp_error = NULL;
 
-    if (parse_buffer->len > 0) {
-        parse_line(metadata, parse_buffer->str, parse_buffer->len, &tmp_error);
-        g_string_erase(parse_buffer, 0, -1);
-        if (tmp_error) {
-            g_propagate_error(error, tmp_error);
-            return;
-        }
+    // parse_time_string() doesn't expect an empty string
+    if (*value == '\0') {
+        g_set_error_literal (error, RESTRAINT_ERROR,
+                             RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                             "Failed to parse time string: empty value");
+        return FALSE;
+    }
+    guint64 time = parse_time_string (value, &tmp_error);
+    if (tmp_error) {
+        g_propagate_error (error, tmp_error);
+        return FALSE;
+    }
+    *max_time = time;
+    return TRUE;
+}
+
+static TestinfoKey
+testinfo_key_lookup (const gchar *key, gsize length)
+{
+    // Keywords are case insensitive, dispatch on the length first
+    switch (length) {
+        case 4:
+            if (g_ascii_strncasecmp (key, "NAME", 4) == 0)
+                return TESTINFO_KEY_NAME;
+            break;
+        case 7:
+            if (g_ascii_strncasecmp (key, "USE_PTY", 7) == 0)
+                return TESTINFO_KEY_USE_PTY;
+            break;
+        case 8:
+            if (g_ascii_strncasecmp (key, "TESTTIME", 8) == 0)
+                return TESTINFO_KEY_TESTTIME;
+            if (g_ascii_strncasecmp (key, "REQUIRES", 8) == 0)
+                return TESTINFO_KEY_REQUIRES;
+            break;
+        case 11:
+            if (g_ascii_strncasecmp (key, "ENVIRONMENT", 11) == 0)
+                return TESTINFO_KEY_ENVIRONMENT;
+            break;
+        case 12:
+            if (g_ascii_strncasecmp (key, "RHTSREQUIRES", 12) == 0)
+                return TESTINFO_KEY_REQUIRES;
+            if (g_ascii_strncasecmp (key, "REPOREQUIRES", 12) == 0)
+                return TESTINFO_KEY_REPOREQUIRES;
+            break;
+        default:
+            break;
     }
+    return TESTINFO_KEY_UNKNOWN;
 }
 
-static void file_parse_data(MetaData *metadata,
-                       GString *parse_buffer,
-                       const gchar *data,
-                       gsize length,
-                       GError **error) {
-    g_return_if_fail(metadata != NULL);
-    g_return_if_fail(error == NULL || *error == NULL);
-
-    GError *parse_error;
-    gsize i;
-
-    g_return_if_fail(data != NULL || length == 0);
-
-    parse_error = NULL;
-    i = 0;
-    while (i < length) {
-        if (data[i] == '\n') {
-            /* remove old style ascii termintaor */
-            if (parse_buffer->len > 0
-                && (parse_buffer->str[parse_buffer->len - 1]
-                    == '\r'))
-                g_string_erase(parse_buffer, parse_buffer->len - 1, 1);
-            /* When a newline is encountered flush the parse buffer so that the
-             * line can be parsed.  Completely blank lines are skipped.
-             */
-            if (parse_buffer->len > 0)
-                flush_parse_buffer(metadata, parse_buffer, &parse_error);
-            if (parse_error) {
-                g_propagate_error(error, parse_error);
-                return;
+/* Split on ',' and ' ', empty elements are skipped */
+static void
+testinfo_split_list (MetadataParser *parser, gchar *value,
+                     MetadataElementFunc func)
+{
+    gchar *element = value;
+
+    for (gchar *p = value; ; p++) {
+        gboolean last = (*p == '\0');
+        if (last || *p == ',' || *p == ' ') {
+            *p = '\0';
+            if (p > element) {
+                func (parser, element);
             }
-            i++;
-        } else {
-            const gchar *start_of_line;
-            const gchar *end_of_line;
-            gsize line_length;
+            if (last) {
+                break;
+            }
+            element = p + 1;
+        }
+    }
+}
 
-            start_of_line = data + i;
-            end_of_line = memchr(start_of_line, '\n', length - i);
+static gboolean
+testinfo_parse_line (MetadataParser *parser, gchar *line, GError **error)
+{
+    MetaData *metadata = parser->metadata;
+    gchar *colon = strchr (line, ':');
 
-            if (end_of_line == NULL)
-                end_of_line = data + length;
+    if (colon == NULL) {
+        // Blank line or something we don't understand
+        return TRUE;
+    }
+    *colon = '\0';
+    gchar *key = g_strstrip (line);
+    gchar *value = g_strstrip (colon + 1);
+
+    switch (testinfo_key_lookup (key, strlen (key))) {
+        case TESTINFO_KEY_TESTTIME:
+            if (!metadata_parse_time (value, &metadata->max_time, error)) {
+                return FALSE;
+            }
+            break;
+        case TESTINFO_KEY_NAME:
+            g_free (metadata->name);
+            metadata->name = g_strdup (value);
+            break;
+        case TESTINFO_KEY_USE_PTY:
+            metadata->use_pty = (g_ascii_strcasecmp ("TRUE", value) == 0);
+            break;
+        case TESTINFO_KEY_REQUIRES:
+            testinfo_split_list (parser, value, metadata_add_dependency);
+            break;
+        case TESTINFO_KEY_REPOREQUIRES:
+            testinfo_split_list (parser, value, metadata_add_repodep);
+            break;
+        case TESTINFO_KEY_ENVIRONMENT:
+            {
+                gchar *separator = strpbrk (value, "= ");
+                if (separator != NULL) {
+                    *separator = '\0';
+                    metadata_add_envvar (parser, value, separator + 1);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return TRUE;
+}
 
-            line_length = end_of_line - start_of_line;
+static MetadataKey
+metadata_key_lookup (MetadataSection section, const gchar *key, gsize length)
+{
+    MetadataKey candidates[2] = { METADATA_KEY_UNKNOWN, METADATA_KEY_UNKNOWN };
+
+    if (section == METADATA_SECTION_GENERAL) {
+        candidates[0] = METADATA_KEY_NAME;
+    } else if (section == METADATA_SECTION_RESTRAINT) {
+        switch (length) {
+            case 7:
+                candidates[0] = METADATA_KEY_USE_PTY;
+                break;
+            case 8:
+                candidates[0] = METADATA_KEY_MAX_TIME;
+                break;
+            case 11:
+                candidates[0] = METADATA_KEY_ENTRY_POINT;
+                candidates[1] = METADATA_KEY_ENVIRONMENT;
+                break;
+            case 12:
+                candidates[0] = METADATA_KEY_DEPENDENCIES;
+                candidates[1] = METADATA_KEY_REPOREQUIRES;
+                break;
+            case 16:
+                candidates[0] = METADATA_KEY_SOFTDEPENDENCIES;
+                candidates[1] = METADATA_KEY_NO_LOCALWATCHDOG;
+                break;
+            default:
+                break;
+        }
+    }
 
-            g_string_append_len(parse_buffer, start_of_line, line_length);
-            i += line_length;
+    for (gint i = 0; i < 2 && candidates[i] != METADATA_KEY_UNKNOWN; i++) {
+        const gchar *name = metadata_key_names[candidates[i]];
+        if (strlen (name) == length && memcmp (name, key, length) == 0) {
+            return candidates[i];
         }
     }
+    return METADATA_KEY_UNKNOWN;
 }
 
-static gboolean parse_testinfo_from_fd(MetaData *metadata,
-                                       gint fd,
-                                       GError **error) {
-    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-    GError *tmp_error = NULL;
-    gssize bytes_read;
-    struct stat stat_buf;
-    gchar read_buf[4096];
-    GString *parse_buffer = g_string_sized_new(128);
-
-    if (fstat(fd, &stat_buf) < 0) {
-        g_set_error_literal(error, G_FILE_ERROR,
-                            g_file_error_from_errno(errno),
-                            g_strerror(errno));
+static gboolean
+metadata_parse_group (MetadataParser *parser, gchar *line, GError **error)
+{
+    gchar *end = strrchr (line, ']');
+
+    if (end == NULL) {
+        g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_PARSE,
+                     "Invalid group name: %s", line);
         return FALSE;
     }
+    *end = '\0';
+    line++;
+
+    if (strcmp (line, "General") == 0) {
+        parser->section = METADATA_SECTION_GENERAL;
+        parser->has_general = TRUE;
+    } else if (strcmp (line, "restraint") == 0) {
+        parser->section = METADATA_SECTION_RESTRAINT;
+        parser->has_restraint = TRUE;
+    } else {
+        parser->section = METADATA_SECTION_OTHER;
+    }
+    return TRUE;
+}
 
-    if (!S_ISREG (stat_buf.st_mode)) {
-        g_set_error_literal (error, G_FILE_ERROR,
-                             RESTRAINT_OPEN,
-                             "Not a regular file");
-      g_string_free(parse_buffer, TRUE);
-      return FALSE;
+/* Same syntax as GKeyFile, see restraint_parse_metadata_data() */
+static gboolean
+metadata_parse_line (MetadataParser *parser, gchar *line, GError **error)
+{
+    while (g_ascii_isspace (*line)) {
+        line++;
+    }
+    if (*line == '\0' || *line == '#') {
+        return TRUE;
+    }
+    if (*line == '[') {
+        return metadata_parse_group (parser, line, error);
     }
 
-    do {
-        bytes_read = read(fd, read_buf, 4096);
+    gchar *equals = strchr (line, '=');
+    if (equals == NULL) {
+        g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_PARSE,
+                     "Key file contains line '%s' which is not a key-value "
+                     "pair, group, or comment", line);
+        return FALSE;
+    }
+    if (parser->section == METADATA_SECTION_NONE) {
+        g_set_error_literal (error, G_KEY_FILE_ERROR,
+                             G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                             "Key file does not start with a group");
+        return FALSE;
+    }
+    if (parser->section == METADATA_SECTION_OTHER) {
+        return TRUE;
+    }
 
-        if (bytes_read == 0) /* End of File */
-            break;
+    gchar *value = equals + 1;
+    while (g_ascii_isspace (*value)) {
+        value++;
+    }
+    *equals = '\0';
+    gchar *key = g_strchomp (line);
+
+    // key[locale]
+    gchar *locale = NULL;
+    gchar *bracket = strchr (key, '[');
+    if (bracket != NULL) {
+        gchar *close = strchr (bracket, ']');
+        if (close != NULL) {
+            *close = '\0';
+        }
+        *bracket = '\0';
+        locale = bracket + 1;
+    }
 
-        if (bytes_read < 0) {
-            if (errno == EINTR || errno == EAGAIN)
-                continue;
+    MetadataKey id = metadata_key_lookup (parser->section, key, strlen (key));
+    if (id == METADATA_KEY_UNKNOWN) {
+        return TRUE;
+    }
 
-            g_set_error_literal(error, G_FILE_ERROR,
-                                g_file_error_from_errno(errno),
-                                g_strerror(errno));
-            g_string_free(parse_buffer, TRUE);
-            return FALSE;
+    if (locale != NULL) {
+        // booleans are never localized
+        if (id == METADATA_KEY_NO_LOCALWATCHDOG || id == METADATA_KEY_USE_PTY ||
+                g_strcmp0 (locale, parser->locale) != 0) {
+            return TRUE;
         }
-        file_parse_data(metadata,
-                        parse_buffer,
-                        read_buf,
-                        bytes_read,
-                        &tmp_error);
-    } while (!tmp_error);
+        parser->values[id] = value;
+        parser->localized[id] = TRUE;
+    } else if (!parser->localized[id]) {
+        // the last one wins
+        parser->values[id] = value;
+    }
+    return TRUE;
+}
 
-    if (tmp_error) {
-        g_propagate_error(error, tmp_error);
-        g_string_free(parse_buffer, TRUE);
+/*
+ * Unescape value in place.  When func is set the value is a ';' separated
+ * list and func is called for every element.
+ */
+static gboolean
+metadata_parse_value (MetadataParser *parser, gchar *value,
+                      MetadataElementFunc func, GError **error)
+{
+    gchar *in = value;
+    gchar *out = value;
+    gchar *element = value;
+
+    while (*in != '\0') {
+        if (*in == '\\') {
+            in++;
+            switch (*in) {
+                case 's':
+                    *out++ = ' ';
+                    break;
+                case 'n':
+                    *out++ = '\n';
+                    break;
+                case 't':
+                    *out++ = '\t';
+                    break;
+                case 'r':
+                    *out++ = '\r';
+                    break;
+                case '\\':
+                    *out++ = '\\';
+                    break;
+                case ';':
+                    *out++ = ';';
+                    break;
+                case '\0':
+                    g_set_error_literal (error, G_KEY_FILE_ERROR,
+                                         G_KEY_FILE_ERROR_INVALID_VALUE,
+                                         "Key file contains escape character "
+                                         "at end of line");
+                    return FALSE;
+                default:
+                    g_set_error (error, G_KEY_FILE_ERROR,
+                                 G_KEY_FILE_ERROR_INVALID_VALUE,
+                                 "Key file contains invalid escape "
+                                 "sequence '\\%c'", *in);
+                    return FALSE;
+            }
+            in++;
+        } else if (func != NULL && *in == ';') {
+            *out++ = '\0';
+            func (parser, element);
+            element = out;
+            in++;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+
+    if (func != NULL && out > element) {
+        func (parser, element);
+    }
+    return TRUE;
+}
+
+static gboolean
+metadata_parse_boolean (const gchar *name, gchar *value, gboolean *result,
+                        GError **error)
+{
+    g_strchomp (value);
+    if (strcmp (value, "true") == 0 || strcmp (value, "1") == 0) {
+        *result = TRUE;
+    } else if (strcmp (value, "false") == 0 || strcmp (value, "0") == 0) {
+        *result = FALSE;
+    } else {
+        g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                     "Key file contains key '%s' which has a value that "
+                     "cannot be interpreted.", name);
         return FALSE;
     }
+    return TRUE;
+}
 
-    flush_parse_buffer(metadata, parse_buffer, &tmp_error);
-    if (tmp_error) {
-        g_propagate_error(error, tmp_error);
-        g_string_free(parse_buffer, TRUE);
+static gboolean
+metadata_parse_values (MetadataParser *parser, GError **error)
+{
+    MetaData *metadata = parser->metadata;
+    gchar **values = parser->values;
+
+    if (!parser->has_general) {
+        g_set_error_literal (error, G_KEY_FILE_ERROR,
+                             G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                             "Key file does not have group 'General'");
+        return FALSE;
+    }
+    if (values[METADATA_KEY_NAME] != NULL) {
+        if (!metadata_parse_value (parser, values[METADATA_KEY_NAME], NULL, error)) {
+            return FALSE;
+        }
+        metadata->name = g_strstrip (g_strdup (values[METADATA_KEY_NAME]));
+    }
+
+    if (!parser->has_restraint) {
+        g_set_error_literal (error, G_KEY_FILE_ERROR,
+                             G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                             "Key file does not have group 'restraint'");
+        return FALSE;
+    }
+    if (values[METADATA_KEY_ENTRY_POINT] != NULL) {
+        if (!metadata_parse_value (parser, values[METADATA_KEY_ENTRY_POINT],
+                                   NULL, error)) {
+            return FALSE;
+        }
+        metadata->entry_point = g_strdup (values[METADATA_KEY_ENTRY_POINT]);
+    }
+    if (values[METADATA_KEY_MAX_TIME] != NULL) {
+        if (!metadata_parse_value (parser, values[METADATA_KEY_MAX_TIME],
+                                   NULL, error)) {
+            return FALSE;
+        }
+        // If max_time is set it's because we read it from our run data
+        if (!metadata_parse_time (values[METADATA_KEY_MAX_TIME],
+                                  &metadata->max_time, error)) {
+            return FALSE;
+        }
+    }
+    if (values[METADATA_KEY_DEPENDENCIES] != NULL &&
+            !metadata_parse_value (parser, values[METADATA_KEY_DEPENDENCIES],
+                                   metadata_add_dependency, error)) {
+        return FALSE;
+    }
+    if (values[METADATA_KEY_SOFTDEPENDENCIES] != NULL &&
+            !metadata_parse_value (parser, values[METADATA_KEY_SOFTDEPENDENCIES],
+                                   metadata_add_softdependency, error)) {
+        return FALSE;
+    }
+    if (values[METADATA_KEY_REPOREQUIRES] != NULL &&
+            !metadata_parse_value (parser, values[METADATA_KEY_REPOREQUIRES],
+                                   metadata_add_repodep, error)) {
+        return FALSE;
+    }
+    if (values[METADATA_KEY_ENVIRONMENT] != NULL &&
+            !metadata_parse_value (parser, values[METADATA_KEY_ENVIRONMENT],
+                                   metadata_add_keyfile_envvar, error)) {
+        return FALSE;
+    }
+    if (values[METADATA_KEY_NO_LOCALWATCHDOG] != NULL &&
+            !metadata_parse_boolean ("no_localwatchdog",
+                                     values[METADATA_KEY_NO_LOCALWATCHDOG],
+                                     &metadata->nolocalwatchdog, error)) {
+        return FALSE;
+    }
+    if (values[METADATA_KEY_USE_PTY] != NULL &&
+            !metadata_parse_boolean ("use_pty", values[METADATA_KEY_USE_PTY],
+                                     &metadata->use_pty, error)) {
         return FALSE;
     }
-    g_string_free(parse_buffer, TRUE);
     return TRUE;
 }
 
+/*
+ * Parse metadata in GKeyFile syntax.  Values of the keys we know about
+ * are taken from the [General] and [restraint] groups, key[locale] is
+ * preferred over key and booleans are never localized.  data has to be NUL
+ * terminated at data[length], it is modified in place.
+ */
 MetaData *
-restraint_parse_testinfo(gchar *filename,
-                         GError **error)
+restraint_parse_metadata_data (gchar *data,
+                               gsize length,
+                               const gchar *locale,
+                               GError **error)
 {
-    g_return_val_if_fail(filename != NULL, NULL);
+    g_return_val_if_fail(data != NULL, NULL);
     g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
-    GError *tmp_error = NULL;
-    gint fd;
+    MetadataParser parser = { 0 };
 
-    fd = g_open(filename, O_RDONLY, 0);
+    parser.metadata = g_slice_new0 (MetaData);
+    parser.locale = locale;
 
-    if (fd == -1) {
-        g_set_error_literal(error, G_FILE_ERROR,
-                            g_file_error_from_errno(errno),
-                            g_strerror(errno));
+    if (!metadata_foreach_line (&parser, data, length, metadata_parse_line,
+                                error) ||
+            !metadata_parse_values (&parser, error)) {
+        metadata_parser_clear (&parser);
+        restraint_metadata_free (parser.metadata);
         return NULL;
     }
 
-    MetaData *metadata = g_slice_new0(MetaData);
-    parse_testinfo_from_fd(metadata, fd, &tmp_error);
-    close(fd);
+    metadata_parser_clear (&parser);
+    return parser.metadata;
+}
 
-    if (tmp_error) {
-        g_propagate_error(error, tmp_error);
-        restraint_metadata_free(metadata);
+MetaData *
+restraint_parse_metadata (gchar *filename,
+                          gchar *locale,
+                          GError **error)
+{
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+    gchar *contents = NULL;
+    gsize length = 0;
+
+    if (!g_file_get_contents (filename, &contents, &length, error)) {
+        return NULL;
+    }
+    MetaData *metadata = restraint_parse_metadata_data (contents, length,
+                                                        locale, error);
+    g_free (contents);
+    return metadata;
+}
+
+/*
+ * Parse "Key: value" lines of testinfo.desc.  data has to be NUL
+ * terminated at data[length], it is modified in place.
+ */
+MetaData *
+restraint_parse_testinfo_data (gchar *data,
+                               gsize length,
+                               GError **error)
+{
+    g_return_val_if_fail(data != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    MetadataParser parser = { 0 };
+
+    parser.metadata = g_slice_new0 (MetaData);
+
+    if (!metadata_foreach_line (&parser, data, length, testinfo_parse_line,
+                                error)) {
+        metadata_parser_clear (&parser);
+        restraint_metadata_free (parser.metadata);
+        return NULL;
+    }
+
+    metadata_parser_clear (&parser);
+    return parser.metadata;
+}
+
+MetaData *
+restraint_parse_testinfo(gchar *filename,
+                         GError **error)
+{
+    g_return_val_if_fail(filename != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    gchar *contents = NULL;
+    gsize length = 0;
+
+    if (!g_file_get_contents (filename, &contents, &length, error)) {
         return NULL;
     }
+    MetaData *metadata = restraint_parse_testinfo_data (contents, length,
+                                                        error);
+    g_free (contents);
     return metadata;
 }
 
@@ -510,11 +955,15 @@ static void mktinfo_cb(gint pid_result, gboolean localwatchdog,
     if (error || !file_exists(testinfo_file)) {
         mtdata->finish_cb(mtdata->user_data, error);
     } else {
-        restraint_get_metadata(mtdata->path, mtdata->osmajor, mtdata->metadata,
-                               mtdata->cancellable, mtdata->finish_cb,
-                               mtdata->io_callback, mtdata->user_data);
+        *mtdata->metadata = restraint_parse_testinfo(testinfo_file, &error);
+        // Keyed on the tree as it was before make ran, that is what the
+        // next lookup will see.
+        metadata_cache_store(mtdata->path, mtdata->osmajor, mtdata->digest,
+                             *mtdata->metadata, TRUE);
+        mtdata->finish_cb(mtdata->user_data, error);
     }
     g_free (testinfo_file);
+    g_free (mtdata->digest);
     g_slice_free(MetadataData, mtdata);
 }
 
@@ -527,19 +976,31 @@ gboolean restraint_get_metadata(char *path, char *osmajor, MetaData **metadata,
     gboolean ret = TRUE;
     gchar *metadata_file = g_build_filename(path, "metadata", NULL);
     gchar *testinfo_file = g_build_filename(path, "testinfo.desc", NULL);
+    gchar *digest = NULL;
+    MetaData *cached = NULL;
+
+    if (metadata_cache_dir != NULL) {
+        digest = metadata_cache_digest(path);
+        cached = metadata_cache_lookup(path, osmajor, digest, &ret);
+    }
 
-    if (file_exists(metadata_file)) {
+    if (cached != NULL) {
+        *metadata = cached;
+        finish_cb(user_data, NULL);
+    } else if (file_exists(metadata_file)) {
         ret = FALSE;
         *metadata = restraint_parse_metadata(metadata_file, osmajor, &error);
+        metadata_cache_store(path, osmajor, digest, *metadata, ret);
         finish_cb(user_data, error);
     } else if (file_exists(testinfo_file)) {
         ret = TRUE;
         *metadata = restraint_parse_testinfo(testinfo_file, &error);
+        metadata_cache_store(path, osmajor, digest, *metadata, ret);
         finish_cb(user_data, error);
     } else {
         ret = TRUE;
 
-        const gchar *command = "make testinfo.desc";
+        const gchar *command[] = { "make", "testinfo.desc", NULL };
         MetadataData *mtdata = g_slice_new0(MetadataData);
         mtdata->path = path;
         mtdata->osmajor = osmajor;
@@ -548,12 +1009,14 @@ gboolean restraint_get_metadata(char *path, char *osmajor, MetaData **metadata,
         mtdata->io_callback = io_callback;
         mtdata->finish_cb = finish_cb;
         mtdata->user_data = user_data;
+        mtdata->digest = g_steal_pointer(&digest);
 
-        process_run(command, NULL, path, FALSE, 0,
-                    NULL, mktinfo_io_callback, mktinfo_cb,
-                    NULL, 0, FALSE, cancellable, mtdata);
+        process_run_argv(command, NULL, path, NULL, NULL, FALSE, NULL,
+                         NULL, mktinfo_io_callback, mktinfo_cb,
+                         NULL, 0, FALSE, cancellable, mtdata);
     }
 
+    g_free (digest);
     g_free (testinfo_file);
     g_free (metadata_file);
     return ret;
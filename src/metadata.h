@@ -24,11 +24,11 @@ typedef struct {
     gchar *name;
     /* entry_point, defaults to make run */
     gchar *entry_point;
-    /* List of dependencies */
+    /* List of dependencies, names are interned */
     GSList *dependencies;
-    /* List of soft or optional dependencies */
+    /* List of soft or optional dependencies, names are interned */
     GSList *softdependencies;
-    /* List of repository dependencies */
+    /* List of repository dependencies, names are interned */
     GSList *repodeps;
     /* List of environment variables, encoded as 'Param' objects */
     GSList *envvars;
@@ -42,11 +42,18 @@ typedef struct {
 
 typedef void (*metadata_cb) (gpointer user_data, GError *error);
 
+#define METADATA_CACHE_DIR "/var/lib/restraint/metadata-cache"
+
 MetaData* restraint_parse_metadata (gchar *filename, gchar *locale, GError **error);
 MetaData* restraint_parse_testinfo (gchar *filename, GError **error);
+MetaData* restraint_parse_metadata_data (gchar *data, gsize length,
+                                         const gchar *locale, GError **error);
+MetaData* restraint_parse_testinfo_data (gchar *data, gsize length,
+                                         GError **error);
 void restraint_metadata_free (MetaData *metadata);
 gboolean restraint_get_metadata(char *path, char *osmajor, MetaData **metadata,
                                 GCancellable *cancellable,
                                 metadata_cb finish_cb, GIOFunc io_callback,
                                 void *user_data);
+void restraint_metadata_cache_set_dir (const gchar *dir);
 #endif
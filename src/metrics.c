@@ -0,0 +1,362 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+typedef struct {
+    RstrntMetricType type;
+    const gchar *name;    /* the same name is one family, told apart by labels */
+    const gchar *labels;
+    const gchar *help;
+} RstrntMetricInfo;
+
+static const RstrntMetricInfo metric_info[METRIC_LAST] = {
+    [METRIC_MESSAGES_QUEUED] = { METRIC_COUNTER, "restraintd_messages_queued_total", NULL,
+        "Messages queued for the lab controller" },
+    [METRIC_MESSAGES_SENT] = { METRIC_COUNTER, "restraintd_messages_sent_total", NULL,
+        "Messages the lab controller took" },
+    [METRIC_MESSAGE_RETRIES] = { METRIC_COUNTER, "restraintd_message_retries_total", NULL,
+        "Messages queued again after failing to send" },
+    [METRIC_MESSAGE_QUEUE_DEPTH] = { METRIC_GAUGE, "restraintd_message_queue_depth", NULL,
+        "Messages waiting in the queue" },
+    [METRIC_MESSAGE_LATENCY] = { METRIC_HISTOGRAM, "restraintd_message_latency_seconds", NULL,
+        "Time from sending a message to its response" },
+    [METRIC_MESSAGE_RETRY_DELAY] = { METRIC_HISTOGRAM, "restraintd_message_retry_delay_seconds", NULL,
+        "Delay before sending a failed message again" },
+    [METRIC_LOG_BYTES_WRITTEN] = { METRIC_COUNTER, "restraintd_log_written_bytes_total", NULL,
+        "Bytes written to the task logs" },
+    [METRIC_LOG_WRITE_ERRORS] = { METRIC_COUNTER, "restraintd_log_write_errors_total", NULL,
+        "Failed writes to the task logs" },
+    [METRIC_LOG_UPLOAD_BYTES] = { METRIC_COUNTER, "restraintd_log_uploaded_bytes_total", NULL,
+        "Bytes of task logs queued for upload" },
+    [METRIC_LOG_UPLOAD_LATENCY] = { METRIC_HISTOGRAM, "restraintd_log_upload_seconds", NULL,
+        "Time to upload the new part of a task log" },
+    [METRIC_FETCH_URI_BYTES] = { METRIC_COUNTER, "restraintd_fetch_bytes_total", "method=\"uri\"",
+        "Bytes of task archives read" },
+    [METRIC_FETCH_GIT_BYTES] = { METRIC_COUNTER, "restraintd_fetch_bytes_total", "method=\"git\"",
+        "Bytes of task archives read" },
+    [METRIC_FETCH_URI_ERRORS] = { METRIC_COUNTER, "restraintd_fetch_errors_total", "method=\"uri\"",
+        "Task fetches that failed" },
+    [METRIC_FETCH_GIT_ERRORS] = { METRIC_COUNTER, "restraintd_fetch_errors_total", "method=\"git\"",
+        "Task fetches that failed" },
+    [METRIC_FETCH_URI_DURATION] = { METRIC_HISTOGRAM, "restraintd_fetch_seconds", "method=\"uri\"",
+        "Time to fetch and extract a task" },
+    [METRIC_FETCH_GIT_DURATION] = { METRIC_HISTOGRAM, "restraintd_fetch_seconds", "method=\"git\"",
+        "Time to fetch and extract a task" },
+    [METRIC_PROCESSES_SPAWNED] = { METRIC_COUNTER, "restraintd_processes_total", "launcher=\"spawn\"",
+        "Processes started" },
+    [METRIC_PROCESSES_FORKED] = { METRIC_COUNTER, "restraintd_processes_total", "launcher=\"fork\"",
+        "Processes started" },
+    [METRIC_PROCESS_LAUNCH] = { METRIC_HISTOGRAM, "restraintd_process_launch_seconds", NULL,
+        "Time for posix_spawn or fork to return" },
+    [METRIC_PROCESS_DURATION] = { METRIC_HISTOGRAM, "restraintd_process_seconds", NULL,
+        "Time from starting a process to reaping it" },
+    [METRIC_PLUGIN_DURATION] = { METRIC_HISTOGRAM, "restraintd_report_plugins_seconds", NULL,
+        "Time the report plugins held a result" },
+    [METRIC_CONFIG_WRITES] = { METRIC_COUNTER, "restraintd_config_writes_total", NULL,
+        "Writes of the run config" },
+    [METRIC_CONFIG_WRITE_BYTES] = { METRIC_COUNTER, "restraintd_config_written_bytes_total", NULL,
+        "Bytes written to the run config" },
+    [METRIC_CONFIG_WRITE_DURATION] = { METRIC_HISTOGRAM, "restraintd_config_write_seconds", NULL,
+        "Time to update the run config" },
+    [METRIC_SPOOL_PENDING] = { METRIC_GAUGE, "restraintd_spool_pending", NULL,
+        "Results spooled but not yet taken by the lab controller" },
+    [METRIC_SPOOL_FORWARD_LATENCY] = { METRIC_HISTOGRAM, "restraintd_spool_forward_seconds", NULL,
+        "Time from spooling a result to the lab controller taking it" },
+};
+
+typedef struct {
+    guint64 count;
+    guint64 sum;
+    gint64 max;
+    guint64 buckets[METRICS_BUCKETS];
+} RstrntHistogram;
+
+/* Of the counters and gauges, histograms have their own */
+static gint64 metric_values[METRIC_LAST];
+static RstrntHistogram histograms[METRIC_LAST];
+
+/* Prometheus histogram buckets, in microseconds */
+static const gint64 export_bounds[] = {
+    1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000,
+    G_GINT64_CONSTANT (60000000), G_GINT64_CONSTANT (300000000),
+    G_GINT64_CONSTANT (3600000000),
+};
+
+static RstrntHistogram *
+metrics_histogram (RstrntMetric metric)
+{
+    g_return_val_if_fail (metric < METRIC_LAST, NULL);
+    g_return_val_if_fail (metric_info[metric].type == METRIC_HISTOGRAM, NULL);
+
+    return &histograms[metric];
+}
+
+void
+rstrnt_metrics_add (RstrntMetric metric, guint64 value)
+{
+    g_return_if_fail (metric < METRIC_LAST);
+
+    __atomic_fetch_add (&metric_values[metric], value, __ATOMIC_RELAXED);
+}
+
+void
+rstrnt_metrics_set (RstrntMetric metric, gint64 value)
+{
+    g_return_if_fail (metric < METRIC_LAST);
+
+    __atomic_store_n (&metric_values[metric], value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Index of the bucket holding usec.  Below METRICS_SUB_BUCKETS each value
+ * has its own, above the top METRICS_SUB_BUCKET_BITS bits after the
+ * leading one pick it.
+ */
+guint
+rstrnt_metrics_bucket (gint64 usec)
+{
+    guint exponent;
+
+    if (usec < METRICS_SUB_BUCKETS) {
+        return usec > 0 ? usec : 0;
+    }
+    exponent = 63 - __builtin_clzll ((guint64) usec);
+    if (exponent > METRICS_MAX_EXPONENT) {
+        return METRICS_BUCKETS - 1;
+    }
+    return METRICS_SUB_BUCKETS * (exponent - METRICS_SUB_BUCKET_BITS + 1) +
+           ((usec >> (exponent - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/* The smallest value of the next bucket */
+gint64
+rstrnt_metrics_bucket_upper (guint bucket)
+{
+    guint exponent;
+    guint64 sub;
+
+    if (bucket < METRICS_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+    exponent = bucket / METRICS_SUB_BUCKETS + METRICS_SUB_BUCKET_BITS - 1;
+    sub = METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS + 1;
+    return sub << (exponent - METRICS_SUB_BUCKET_BITS);
+}
+
+void
+rstrnt_metrics_observe (RstrntMetric metric, gint64 usec)
+{
+    RstrntHistogram *histogram = metrics_histogram (metric);
+    gint64 max;
+
+    g_return_if_fail (histogram != NULL);
+
+    if (usec < 0) {
+        usec = 0;
+    }
+    __atomic_fetch_add (&histogram->buckets[rstrnt_metrics_bucket (usec)], 1,
+                        __ATOMIC_RELAXED);
+    __atomic_fetch_add (&histogram->sum, usec, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&histogram->count, 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n (&histogram->max, __ATOMIC_RELAXED);
+    while (usec > max &&
+           !__atomic_compare_exchange_n (&histogram->max, &max, usec, TRUE,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+gint64
+rstrnt_metrics_value (RstrntMetric metric)
+{
+    g_return_val_if_fail (metric < METRIC_LAST, 0);
+
+    return __atomic_load_n (&metric_values[metric], __ATOMIC_RELAXED);
+}
+
+guint64
+rstrnt_metrics_count (RstrntMetric metric)
+{
+    RstrntHistogram *histogram = metrics_histogram (metric);
+
+    g_return_val_if_fail (histogram != NULL, 0);
+
+    return __atomic_load_n (&histogram->count, __ATOMIC_RELAXED);
+}
+
+/*
+ * The value below which quantile of the observations fall, as the upper
+ * end of its bucket but never above the largest value seen.
+ */
+gint64
+rstrnt_metrics_quantile (RstrntMetric metric, gdouble quantile)
+{
+    RstrntHistogram *histogram = metrics_histogram (metric);
+    guint64 count, rank, seen = 0;
+    gint64 max;
+
+    g_return_val_if_fail (histogram != NULL, 0);
+
+    count = __atomic_load_n (&histogram->count, __ATOMIC_RELAXED);
+    max = __atomic_load_n (&histogram->max, __ATOMIC_RELAXED);
+    if (count == 0) {
+        return 0;
+    }
+    rank = (guint64) (quantile * count + 0.5);
+    rank = CLAMP (rank, 1, count);
+    for (guint i = 0; i < METRICS_BUCKETS; i++) {
+        seen += __atomic_load_n (&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            return MIN (rstrnt_metrics_bucket_upper (i) - 1, max);
+        }
+    }
+    return max;
+}
+
+void
+rstrnt_metrics_reset (void)
+{
+    memset (metric_values, 0, sizeof (metric_values));
+    memset (histograms, 0, sizeof (histograms));
+}
+
+/* Exactly, without the noise of printing a double */
+static void
+metrics_append_seconds (GString *out, gint64 usec)
+{
+    gint64 fraction = usec % G_USEC_PER_SEC;
+    gint digits = 6;
+
+    g_string_append_printf (out, "%" G_GINT64_FORMAT, usec / G_USEC_PER_SEC);
+    if (fraction == 0) {
+        return;
+    }
+    for (; fraction % 10 == 0; fraction /= 10) {
+        digits--;
+    }
+    g_string_append_printf (out, ".%0*" G_GINT64_FORMAT, digits, fraction);
+}
+
+static void
+metrics_append_sample (GString *out, const gchar *name, const gchar *suffix,
+                       const gchar *labels, const gchar *extra)
+{
+    g_string_append_printf (out, "%s%s", name, suffix);
+    if (labels != NULL || extra != NULL) {
+        g_string_append_printf (out, "{%s%s%s}", labels != NULL ? labels : "",
+                                labels != NULL && extra != NULL ? "," : "",
+                                extra != NULL ? extra : "");
+    }
+    g_string_append_c (out, ' ');
+}
+
+static void
+metrics_append_histogram (GString *out, RstrntMetric metric)
+{
+    const RstrntMetricInfo *info = &metric_info[metric];
+    RstrntHistogram *histogram = &histograms[metric];
+    guint64 cumulative = 0;
+    guint bucket = 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS (export_bounds); i++) {
+        GString *le = g_string_new ("le=\"");
+
+        // A bucket straddling the bound is left to the next one
+        for (; bucket < METRICS_BUCKETS &&
+               rstrnt_metrics_bucket_upper (bucket) <= export_bounds[i]; bucket++) {
+            cumulative += __atomic_load_n (&histogram->buckets[bucket], __ATOMIC_RELAXED);
+        }
+        metrics_append_seconds (le, export_bounds[i]);
+        g_string_append_c (le, '"');
+        metrics_append_sample (out, info->name, "_bucket", info->labels, le->str);
+        g_string_append_printf (out, "%" G_GUINT64_FORMAT "\n", cumulative);
+        g_string_free (le, TRUE);
+    }
+    metrics_append_sample (out, info->name, "_bucket", info->labels, "le=\"+Inf\"");
+    g_string_append_printf (out, "%" G_GUINT64_FORMAT "\n",
+                            __atomic_load_n (&histogram->count, __ATOMIC_RELAXED));
+    metrics_append_sample (out, info->name, "_sum", info->labels, NULL);
+    metrics_append_seconds (out, __atomic_load_n (&histogram->sum, __ATOMIC_RELAXED));
+    g_string_append_c (out, '\n');
+    metrics_append_sample (out, info->name, "_count", info->labels, NULL);
+    g_string_append_printf (out, "%" G_GUINT64_FORMAT "\n",
+                            __atomic_load_n (&histogram->count, __ATOMIC_RELAXED));
+}
+
+/* Everything in the Prometheus text format, version 0.0.4 */
+gchar *
+rstrnt_metrics_to_prometheus (void)
+{
+    static const gchar *types[] = { "counter", "gauge", "histogram" };
+    GString *out = g_string_new (NULL);
+    const gchar *family = NULL;
+
+    for (RstrntMetric metric = 0; metric < METRIC_LAST; metric++) {
+        const RstrntMetricInfo *info = &metric_info[metric];
+
+        if (g_strcmp0 (family, info->name) != 0) {
+            g_string_append_printf (out, "# HELP %s %s\n# TYPE %s %s\n",
+                                    info->name, info->help,
+                                    info->name, types[info->type]);
+            family = info->name;
+        }
+        if (info->type == METRIC_HISTOGRAM) {
+            metrics_append_histogram (out, metric);
+        } else {
+            metrics_append_sample (out, info->name, "", info->labels, NULL);
+            g_string_append_printf (out, "%" G_GINT64_FORMAT "\n",
+                                    rstrnt_metrics_value (metric));
+        }
+    }
+    return g_string_free (out, FALSE);
+}
+
+/* A few lines for the harness log */
+gchar *
+rstrnt_metrics_summary (void)
+{
+    GString *out = g_string_new ("*** restraintd metrics\n");
+
+    for (RstrntMetric metric = 0; metric < METRIC_LAST; metric++) {
+        const RstrntMetricInfo *info = &metric_info[metric];
+
+        g_string_append_printf (out, "    %s", info->name);
+        if (info->labels != NULL) {
+            g_string_append_printf (out, "{%s}", info->labels);
+        }
+        if (info->type != METRIC_HISTOGRAM) {
+            g_string_append_printf (out, " %" G_GINT64_FORMAT "\n",
+                                    rstrnt_metrics_value (metric));
+            continue;
+        }
+        g_string_append_printf (out, " count=%" G_GUINT64_FORMAT " p50=",
+                                rstrnt_metrics_count (metric));
+        metrics_append_seconds (out, rstrnt_metrics_quantile (metric, 0.5));
+        g_string_append (out, " p90=");
+        metrics_append_seconds (out, rstrnt_metrics_quantile (metric, 0.9));
+        g_string_append (out, " p99=");
+        metrics_append_seconds (out, rstrnt_metrics_quantile (metric, 0.99));
+        g_string_append (out, " max=");
+        metrics_append_seconds (out, __atomic_load_n (&histograms[metric].max,
+                                                      __ATOMIC_RELAXED));
+        g_string_append_c (out, '\n');
+    }
+    return g_string_free (out, FALSE);
+}
@@ -0,0 +1,101 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_METRICS_H
+#define _RESTRAINT_METRICS_H
+
+#include <glib.h>
+
+/*
+ * Histograms keep 16 linear buckets per power of two of microseconds, as
+ * HdrHistogram does with 4 significant bits, up to about 12 days.  Any
+ * recorded value is off by at most 1/16th.
+ */
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_EXPONENT 40
+#define METRICS_BUCKETS (METRICS_SUB_BUCKETS * \
+                         (METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 2))
+
+typedef enum {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,   /* of durations, recorded in microseconds */
+} RstrntMetricType;
+
+/*
+ * Everything restraintd counts, see the table in metrics.c.  Metrics
+ * sharing a name only differ in labels and must follow each other.
+ */
+typedef enum {
+    /* message.c */
+    METRIC_MESSAGES_QUEUED,
+    METRIC_MESSAGES_SENT,
+    METRIC_MESSAGE_RETRIES,
+    METRIC_MESSAGE_QUEUE_DEPTH,
+    METRIC_MESSAGE_LATENCY,
+    METRIC_MESSAGE_RETRY_DELAY,
+    /* logging.c */
+    METRIC_LOG_BYTES_WRITTEN,
+    METRIC_LOG_WRITE_ERRORS,
+    METRIC_LOG_UPLOAD_BYTES,
+    METRIC_LOG_UPLOAD_LATENCY,
+    /* fetch_uri.c and fetch_git.c */
+    METRIC_FETCH_URI_BYTES,
+    METRIC_FETCH_GIT_BYTES,
+    METRIC_FETCH_URI_ERRORS,
+    METRIC_FETCH_GIT_ERRORS,
+    METRIC_FETCH_URI_DURATION,
+    METRIC_FETCH_GIT_DURATION,
+    /* process.c */
+    METRIC_PROCESSES_SPAWNED,
+    METRIC_PROCESSES_FORKED,
+    METRIC_PROCESS_LAUNCH,
+    METRIC_PROCESS_DURATION,
+    /* server.c */
+    METRIC_PLUGIN_DURATION,
+    /* config.c */
+    METRIC_CONFIG_WRITES,
+    METRIC_CONFIG_WRITE_BYTES,
+    METRIC_CONFIG_WRITE_DURATION,
+    /* spool.c */
+    METRIC_SPOOL_PENDING,
+    METRIC_SPOOL_FORWARD_LATENCY,
+    METRIC_LAST
+} RstrntMetric;
+
+/*
+ * Updates are relaxed atomics, safe from the log writer threads and
+ * never blocking the main loop.
+ */
+void rstrnt_metrics_add (RstrntMetric metric, guint64 value);
+void rstrnt_metrics_set (RstrntMetric metric, gint64 value);
+void rstrnt_metrics_observe (RstrntMetric metric, gint64 usec);
+#define rstrnt_metrics_inc(metric) rstrnt_metrics_add ((metric), 1)
+
+gint64 rstrnt_metrics_value (RstrntMetric metric);
+guint64 rstrnt_metrics_count (RstrntMetric metric);
+gint64 rstrnt_metrics_quantile (RstrntMetric metric, gdouble quantile);
+void rstrnt_metrics_reset (void);
+
+guint rstrnt_metrics_bucket (gint64 usec);
+gint64 rstrnt_metrics_bucket_upper (guint bucket);
+
+gchar *rstrnt_metrics_to_prometheus (void);
+gchar *rstrnt_metrics_summary (void);
+
+#endif
@@ -0,0 +1,332 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "errors.h"
+#include "package_cache.h"
+#include "param.h"
+#include "process.h"
+#include "utils.h"
+
+/*
+ * What the rpmdb looked like, queried once per recipe and kept up to date
+ * with whatever restraintd installs or removes itself.  Lookups are exact:
+ * "foo" matches any installed foo, "foo-1.0-1" only that version.  Anything
+ * the cache can't answer, like file or capability provides, is a miss and
+ * is left to the package manager.
+ */
+
+RstrntPackageCache *
+rstrnt_package_cache_new (void)
+{
+    RstrntPackageCache *cache = g_slice_new0 (RstrntPackageCache);
+    cache->installed = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, NULL);
+    return cache;
+}
+
+void
+rstrnt_package_cache_free (RstrntPackageCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    g_hash_table_destroy (cache->installed);
+    g_slice_free (RstrntPackageCache, cache);
+}
+
+static void
+package_cache_insert (RstrntPackageCache *cache, const gchar *name,
+                      gchar *key)
+{
+    g_hash_table_replace (cache->installed, key, (gpointer) name);
+}
+
+static void
+package_cache_add_line (RstrntPackageCache *cache, gchar *line)
+{
+    gchar **fields = g_strsplit (line, " ", 0);
+
+    if (g_strv_length (fields) != 5) {
+        g_strfreev (fields);
+        return;
+    }
+
+    const gchar *name = g_intern_string (fields[0]);
+    const gchar *epoch = fields[1];
+    const gchar *version = fields[2];
+    const gchar *release = fields[3];
+    const gchar *arch = fields[4];
+    gchar *vr = g_strdup_printf ("%s-%s", version, release);
+    gchar *evr;
+
+    if (STREQ (epoch, "(none)") || STREQ (epoch, "0")) {
+        evr = g_strdup_printf ("0:%s", vr);
+    } else {
+        evr = g_strdup_printf ("%s:%s", epoch, vr);
+    }
+
+    package_cache_insert (cache, name, g_strdup (name));
+    package_cache_insert (cache, name, g_strdup_printf ("%s.%s", name, arch));
+    package_cache_insert (cache, name, g_strdup_printf ("%s-%s", name, version));
+    package_cache_insert (cache, name, g_strdup_printf ("%s-%s", name, vr));
+    package_cache_insert (cache, name, g_strdup_printf ("%s-%s.%s", name, vr, arch));
+    package_cache_insert (cache, name, g_strdup_printf ("%s-%s", name, evr));
+    package_cache_insert (cache, name, g_strdup_printf ("%s-%s.%s", name, evr, arch));
+
+    g_free (evr);
+    g_free (vr);
+    g_strfreev (fields);
+}
+
+/*
+ * Feed the output of PACKAGE_CACHE_QUERY into the cache, lines which don't
+ * look like one are ignored.
+ */
+void
+rstrnt_package_cache_parse (RstrntPackageCache *cache, const gchar *output)
+{
+    g_return_if_fail (cache != NULL && output != NULL);
+
+    gchar **lines = g_strsplit (output, "\n", 0);
+    for (gchar **line = lines; *line != NULL; line++) {
+        package_cache_add_line (cache, g_strstrip (*line));
+    }
+    g_strfreev (lines);
+
+    cache->loaded = TRUE;
+    cache->available = TRUE;
+}
+
+typedef struct {
+    RstrntPackageCache *cache;
+    GString *output;
+    RstrntPackageCacheCallback cache_callback;
+    RstrntPackageVerifyCallback verify_callback;
+    gpointer user_data;
+} PackageQuery;
+
+static gboolean
+package_query_io_cb (GIOChannel *io, GIOCondition condition, gpointer user_data)
+{
+    PackageQuery *query = (PackageQuery *) user_data;
+    gchar buf[8192];
+    gsize bytes_read;
+
+    if (condition & G_IO_IN) {
+        switch (g_io_channel_read_chars (io, buf, sizeof (buf), &bytes_read, NULL)) {
+            case G_IO_STATUS_NORMAL:
+                // rpm -V output is only read to keep the pipe from filling up
+                if (query->output != NULL) {
+                    g_string_append_len (query->output, buf, bytes_read);
+                }
+                return TRUE;
+            case G_IO_STATUS_AGAIN:
+                return TRUE;
+            default:
+                return FALSE;
+        }
+    }
+    return FALSE;
+}
+
+static void
+package_cache_load_cb (gint pid_result, gboolean localwatchdog,
+                       gpointer user_data, GError *error)
+{
+    PackageQuery *query = (PackageQuery *) user_data;
+    RstrntPackageCache *cache = query->cache;
+
+    if (error != NULL) {
+        g_warning ("Failed to query installed packages: %s", error->message);
+    } else if (pid_result != 0) {
+        g_warning ("Querying installed packages returned %i", pid_result);
+    } else {
+        // The first line holds the command, as for any process_run_argv()
+        const gchar *packages = strchr (query->output->str, '\n');
+
+        rstrnt_package_cache_parse (cache, packages ? packages + 1 : "");
+        g_debug ("%s: %u package names cached", __func__,
+                 g_hash_table_size (cache->installed));
+    }
+
+    query->cache_callback (query->user_data);
+    g_string_free (query->output, TRUE);
+    g_slice_free (PackageQuery, query);
+}
+
+/*
+ * Query the rpmdb from the main loop, only the first call does any work.
+ * callback is called once the cache can be used.  On systems without rpm
+ * the cache stays empty and every lookup misses.
+ */
+void
+rstrnt_package_cache_load (RstrntPackageCache *cache,
+                           GCancellable *cancellable,
+                           RstrntPackageCacheCallback callback,
+                           gpointer user_data)
+{
+    const gchar *const default_query[] = { PACKAGE_CACHE_QUERY, NULL };
+    PackageQuery *query;
+
+    g_return_if_fail (cache != NULL && callback != NULL);
+
+    if (cache->loaded) {
+        callback (user_data);
+        return;
+    }
+    cache->loaded = TRUE;
+
+    query = g_slice_new0 (PackageQuery);
+    query->cache = cache;
+    query->output = g_string_new (NULL);
+    query->cache_callback = callback;
+    query->user_data = user_data;
+    process_run_argv (cache->query ? cache->query : default_query,
+                      NULL, NULL, NULL, NULL, FALSE, NULL, NULL,
+                      package_query_io_cb, package_cache_load_cb,
+                      NULL, 0, FALSE, cancellable, query);
+}
+
+/* Lookups miss until rstrnt_package_cache_load() has called back */
+gboolean
+rstrnt_package_cache_contains (RstrntPackageCache *cache, const gchar *package)
+{
+    if (cache == NULL) {
+        return FALSE;
+    }
+    return g_hash_table_contains (cache->installed, package);
+}
+
+/* The package name package is spelled with, itself when the cache can't tell */
+static const gchar *
+package_cache_name (RstrntPackageCache *cache, const gchar *package)
+{
+    const gchar *name = g_hash_table_lookup (cache->installed, package);
+
+    return name != NULL ? name : g_intern_string (package);
+}
+
+/*
+ * restraintd installed package itself, the version is unknown so only the
+ * exact spelling is recorded, under its package name when that is known.
+ */
+void
+rstrnt_package_cache_add (RstrntPackageCache *cache, const gchar *package)
+{
+    if (cache == NULL || !cache->available) {
+        return;
+    }
+    package_cache_insert (cache, package_cache_name (cache, package),
+                          g_strdup (package));
+}
+
+/* spelling is name or name followed by a version or an arch */
+static gboolean
+package_spelling_of (const gchar *spelling, const gchar *name)
+{
+    gsize length = strlen (name);
+
+    return strncmp (spelling, name, length) == 0 &&
+        (spelling[length] == '\0' || spelling[length] == '-' || spelling[length] == '.');
+}
+
+static gboolean
+package_cache_match_name (gpointer key, gpointer value, gpointer user_data)
+{
+    const gchar *name = user_data;
+
+    if (value == name) {
+        return TRUE;
+    }
+    // Recorded by rstrnt_package_cache_add() without knowing the name, it
+    // may belong to the removed package either way round.
+    return STREQ (key, value) &&
+        (package_spelling_of (key, name) || package_spelling_of (name, key));
+}
+
+/*
+ * Drops every spelling that may stand for the removed package, a miss
+ * only costs a package manager run.
+ */
+void
+rstrnt_package_cache_remove (RstrntPackageCache *cache, const gchar *package)
+{
+    if (cache == NULL) {
+        return;
+    }
+    g_hash_table_foreach_remove (cache->installed, package_cache_match_name,
+                                 (gpointer) package_cache_name (cache, package));
+}
+
+static void
+package_verify_cb (gint pid_result, gboolean localwatchdog,
+                   gpointer user_data, GError *error)
+{
+    PackageQuery *query = (PackageQuery *) user_data;
+
+    query->verify_callback (error == NULL && pid_result == 0, query->user_data);
+    g_slice_free (PackageQuery, query);
+}
+
+/*
+ * Calls back with TRUE when none of the files of an installed package has
+ * been modified, reinstalling it then wouldn't change a thing.
+ */
+void
+rstrnt_package_verify (const gchar *package,
+                       GCancellable *cancellable,
+                       RstrntPackageVerifyCallback callback,
+                       gpointer user_data)
+{
+    const gchar *command[] = { "rpm", "-V", "--nodeps", "--noscripts", package, NULL };
+    PackageQuery *query = g_slice_new0 (PackageQuery);
+
+    query->verify_callback = callback;
+    query->user_data = user_data;
+    process_run_argv (command, NULL, NULL, NULL, NULL, FALSE, NULL, NULL,
+                      package_query_io_cb, package_verify_cb,
+                      NULL, 0, FALSE, cancellable, query);
+}
+
+static gboolean
+package_param_force (GList *params, gboolean force)
+{
+    for (GList *l = params; l; l = g_list_next (l)) {
+        Param *param = l->data;
+        if (STREQ (param->name, PACKAGE_FORCE_REINSTALL)) {
+            gchar *value = g_ascii_strup (param->value, -1);
+            force = STREQ (value, "1") || STREQ (value, "TRUE") ||
+                    STREQ (value, "YES");
+            g_free (value);
+        }
+    }
+    return force;
+}
+
+/*
+ * RSTRNT_FORCE_REINSTALL can be passed as recipe or task param, the task
+ * one wins.  It brings back the old behaviour of always going through the
+ * package manager.
+ */
+gboolean
+rstrnt_package_force_reinstall (GList *recipe_params, GList *task_params)
+{
+    gboolean force = package_param_force (recipe_params, FALSE);
+    return package_param_force (task_params, force);
+}
@@ -0,0 +1,60 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_PACKAGE_CACHE_H
+#define _RESTRAINT_PACKAGE_CACHE_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#define PACKAGE_CACHE_QUERY "rpm", "-qa", "--qf", "%{NAME} %{EPOCH} %{VERSION} %{RELEASE} %{ARCH}\\n"
+#define PACKAGE_FORCE_REINSTALL "RSTRNT_FORCE_REINSTALL"
+
+typedef struct {
+    /* name, name.arch, name-version, name-version-release, the same with
+     * epoch and .arch -> interned package name */
+    GHashTable *installed;
+    gboolean loaded;
+    gboolean available;  /* FALSE when the rpmdb could not be queried */
+    const gchar *const *query;  /* PACKAGE_CACHE_QUERY unless set */
+} RstrntPackageCache;
+
+typedef void (*RstrntPackageCacheCallback) (gpointer user_data);
+/* unmodified is TRUE when rpm -V found nothing to complain about */
+typedef void (*RstrntPackageVerifyCallback) (gboolean unmodified,
+                                             gpointer user_data);
+
+RstrntPackageCache *rstrnt_package_cache_new (void);
+void rstrnt_package_cache_free (RstrntPackageCache *cache);
+void rstrnt_package_cache_load (RstrntPackageCache *cache,
+                                GCancellable *cancellable,
+                                RstrntPackageCacheCallback callback,
+                                gpointer user_data);
+void rstrnt_package_cache_parse (RstrntPackageCache *cache, const gchar *output);
+gboolean rstrnt_package_cache_contains (RstrntPackageCache *cache,
+                                        const gchar *package);
+void rstrnt_package_cache_add (RstrntPackageCache *cache, const gchar *package);
+void rstrnt_package_cache_remove (RstrntPackageCache *cache,
+                                  const gchar *package);
+void rstrnt_package_verify (const gchar *package,
+                            GCancellable *cancellable,
+                            RstrntPackageVerifyCallback callback,
+                            gpointer user_data);
+gboolean rstrnt_package_force_reinstall (GList *recipe_params,
+                                         GList *task_params);
+
+#endif
@@ -15,24 +15,78 @@
     along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <pty.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
+#include "cgroup.h"
 #include "common.h"
+#include "metrics.h"
 #include "process.h"
 
+/* posix_spawn_file_actions_addchdir_np() came with glibc 2.29 */
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 29)
+#define HAVE_SPAWN_CHDIR 1
+#else
+#define HAVE_SPAWN_CHDIR 0
+#endif
+
+/* POSIX_SPAWN_SETSID came with glibc 2.26 */
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 26)
+#define HAVE_SPAWN_SETSID 1
+#else
+#define HAVE_SPAWN_SETSID 0
+#endif
+
+/* posix_spawnattr_setcgroup_np(), clone3() with CLONE_INTO_CGROUP, came with glibc 2.39 */
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 39)
+#define HAVE_SPAWN_CGROUP 1
+#else
+#define HAVE_SPAWN_CGROUP 0
+#endif
+
+/* Seconds between two calls of the heartbeat callback */
+static guint heartbeat = HEARTBEAT;
+/* How children without a pty are started */
+static ProcessLauncher launcher = PROCESS_LAUNCHER_SPAWN;
+/* Cleared once the kernel turns down CLONE_INTO_CGROUP, before 5.7 */
+static gboolean spawn_cgroup = HAVE_SPAWN_CGROUP;
+
 GQuark restraint_process_error (void)
 {
     return g_quark_from_static_string("restraint-process-error-quark");
 }
 
+void
+process_set_heartbeat (guint seconds)
+{
+    heartbeat = CLAMP (seconds, HEARTBEAT_MIN, HEARTBEAT_MAX);
+}
+
+guint
+process_get_heartbeat (void)
+{
+    return heartbeat;
+}
+
+void
+process_set_launcher (ProcessLauncher process_launcher)
+{
+    launcher = process_launcher;
+}
+
 /*
   A child process will inherit signal handlers
   from the parent.  We don't want the child processes
@@ -84,6 +138,8 @@ reset_signal_handlers(void)
 }
 static void
 process_cancelled_cb (GCancellable *cancellable, gpointer user_data);
+static void
+process_watchdog_cb (gpointer user_data);
 
 /*
   This is a modified version of forkpty() that will take a setup function
@@ -102,6 +158,14 @@ process_free (ProcessData *process_data)
     g_return_if_fail (process_data != NULL);
     g_clear_error (&process_data->error);
     g_strfreev (process_data->command);
+    if (process_data->pidfd != -1)
+        close (process_data->pidfd);
+    rstrnt_cgroup_unref (process_data->cgroup);
+    if (process_data->watchdog) {
+        if (process_data->watchdog->user_data == process_data)
+            rstrnt_watchdog_watch (process_data->watchdog, NULL, NULL);
+        rstrnt_watchdog_unref (process_data->watchdog);
+    }
     g_slice_free (ProcessData, process_data);
 }
 
@@ -228,33 +292,321 @@ restraint_fork (gint     *fd_out,
     return pid;
 }
 
-void
-process_run (const gchar *command,
-             const gchar **envp,
-             const gchar *path,
-             gboolean use_pty,
-             guint64 max_time,
-             ProcessTimeoutCallback timeout_callback,
-             GIOFunc io_callback,
-             ProcessFinishCallback finish_callback,
-             const gchar *content_input,
-             gssize content_size,
-             gboolean buffer,
-             GCancellable *cancellable,
-             gpointer user_data)
+/*
+ * The program execvp() would run once the child has switched to envp and
+ * path.  posix_spawnp() would search restraintd's own PATH instead.
+ */
+static gchar *
+process_find_program (const gchar *program, const gchar **envp,
+                      const gchar *path)
+{
+    const gchar *search;
+    gchar **dirs;
+    gchar *found = NULL;
+
+    if (strchr (program, '/') != NULL) {
+        return g_strdup (program);
+    }
+    search = g_environ_getenv ((gchar **) (envp ? envp : (const gchar **) environ), "PATH");
+    dirs = g_strsplit (search ? search : "/bin:/usr/bin", ":", -1);
+    for (gchar **dir = dirs; *dir != NULL && found == NULL; dir++) {
+        gchar *candidate = g_build_filename (**dir ? *dir : ".", program, NULL);
+        gchar *check = (path && !g_path_is_absolute (candidate)) ?
+                       g_build_filename (path, candidate, NULL) :
+                       g_strdup (candidate);
+
+        if (g_file_test (check, G_FILE_TEST_IS_REGULAR) &&
+                access (check, X_OK) == 0) {
+            found = candidate;
+            candidate = NULL;
+        }
+        g_free (check);
+        g_free (candidate);
+    }
+    g_strfreev (dirs);
+    return found;
+}
+
+static gboolean
+process_proc_write (const gchar *path, const gchar *value)
+{
+    gint fd = open (path, O_WRONLY | O_CLOEXEC);
+    gssize ret;
+
+    if (fd == -1) {
+        return FALSE;
+    }
+    ret = write (fd, value, strlen (value));
+    close (fd);
+    return ret != -1;
+}
+
+/*
+ * The SELinux context the next exec of this thread, or of a child it
+ * starts, runs in.  An empty context goes back to the default, as
+ * setexeccon (NULL) does.
+ */
+static gboolean
+process_exec_context (const gchar *context)
+{
+    gint fd = open ("/proc/thread-self/attr/exec", O_WRONLY | O_CLOEXEC);
+
+    // Before 3.17 only the main thread's, which is where we run
+    if (fd == -1) {
+        return process_proc_write ("/proc/self/attr/exec", context);
+    }
+    close (fd);
+    return process_proc_write ("/proc/thread-self/attr/exec", context);
+}
+
+/* Applies attrs in a forked child, output goes where the command's will */
+static void
+process_child_attrs (const ProcessAttrs *attrs, gboolean use_pty)
+{
+    if (attrs->banner) {
+        fputs (attrs->banner, stdout);
+    }
+    // A pty child already leads its own session
+    if (attrs->setsid && !use_pty) {
+        setsid ();
+    }
+    if (attrs->oom_score_adj &&
+        !process_proc_write ("/proc/self/oom_score_adj", attrs->oom_score_adj) &&
+        errno != ENOENT) {
+        printf ("**** -- WARNING: Failed to write %s to oom_score_adj: %s\n",
+                attrs->oom_score_adj, g_strerror (errno));
+    }
+    if (attrs->exec_context && !process_exec_context (attrs->exec_context)) {
+        printf ("**** -- WARNING: Switching to %s failed. Running in default context.\n",
+                attrs->exec_context);
+    }
+}
+
+/*
+ * posix_spawn() counterpart of restraint_fork() and the exec done by the
+ * forked child.  glibc starts the child with CLONE_VM | CLONE_VFORK, so
+ * none of restraintd's mappings are copied however large it has grown.
+ *
+ * A child with a cgroup is started in it by clone3() itself.  The
+ * child inherits the SELinux exec context of this thread, which is put
+ * back right after.  Its oom_score_adj is written once it exists.
+ *
+ * Returns the pid, or -1 with errno set when the pipes could not be made,
+ * ENOTSUP when the kernel can't start a child in a cgroup.  Returns 0
+ * when the command could not be started.  *status then holds
+ * what the forked child would have exited with and the reason has been
+ * written to fd_out.
+ */
+static pid_t
+process_spawn (ProcessData *process_data, const gchar **envp,
+               const ProcessAttrs *attrs, gboolean want_stdin, gint *status)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    short flags;
+    gboolean switched = FALSE;
+    sigset_t signals;
+    gint pipe_in[2];
+    gint pipe_out[2];
+    gchar *program = NULL;
+    gchar *header;
+    gint exit_code = 0;
+    gint ret = 0;
+    pid_t pid = 0;
+
+    if (pipe2 (pipe_out, O_CLOEXEC) == -1)
+        return -1;
+
+    if (want_stdin && pipe2 (pipe_in, O_CLOEXEC) == -1) {
+        close (pipe_out[0]);
+        close (pipe_out[1]);
+
+        return -1;
+    }
+
+    // What the forked child prints before its exec
+    if (attrs && attrs->banner)
+        dprintf (pipe_out[1], "%s", attrs->banner);
+    header = g_strjoinv (" ", process_data->command);
+    dprintf (pipe_out[1], "use_pty:FALSE %s\n", header);
+    g_free (header);
+
+    if (process_data->path && !g_file_test (process_data->path, G_FILE_TEST_IS_DIR)) {
+        dprintf (pipe_out[1], "Failed to chdir() to %s: %s\n",
+                 process_data->path, g_strerror (ENOENT));
+        exit_code = INVALID_COMMAND_PATH;
+    } else {
+        program = process_find_program (*process_data->command, envp,
+                                        process_data->path);
+        if (program == NULL) {
+            ret = ENOENT;
+            exit_code = SPAWN_COMMAND_FAILED;
+        }
+    }
+
+    if (exit_code == 0) {
+        posix_spawn_file_actions_init (&actions);
+#if HAVE_SPAWN_CHDIR
+        if (process_data->path)
+            posix_spawn_file_actions_addchdir_np (&actions, process_data->path);
+#endif
+        if (want_stdin)
+            posix_spawn_file_actions_adddup2 (&actions, pipe_in[0], STDIN_FILENO);
+        else
+            posix_spawn_file_actions_addopen (&actions, STDIN_FILENO, "/dev/null",
+                                              O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2 (&actions, pipe_out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2 (&actions, pipe_out[1], STDERR_FILENO);
+
+        // What reset_signal_handlers() does for a forked child
+        posix_spawnattr_init (&attr);
+        flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+        sigfillset (&signals);
+        posix_spawnattr_setsigdefault (&attr, &signals);
+        sigemptyset (&signals);
+        posix_spawnattr_setsigmask (&attr, &signals);
+#if HAVE_SPAWN_CGROUP
+        if (process_data->cgroup) {
+            flags |= POSIX_SPAWN_SETCGROUP;
+            posix_spawnattr_setcgroup_np (&attr, process_data->cgroup->fd);
+        }
+#endif
+#if HAVE_SPAWN_SETSID
+        if (attrs && attrs->setsid)
+            flags |= POSIX_SPAWN_SETSID;
+#endif
+        posix_spawnattr_setflags (&attr, flags);
+
+        if (attrs && attrs->exec_context) {
+            switched = process_exec_context (attrs->exec_context);
+            if (!switched)
+                dprintf (pipe_out[1],
+                         "**** -- WARNING: Switching to %s failed. Running in default context.\n",
+                         attrs->exec_context);
+        }
+        ret = posix_spawn (&pid, program, &actions, &attr, process_data->command,
+                           (gchar **) (envp ? envp : (const gchar **) environ));
+        if (switched && !process_exec_context ("")) {
+            g_warning ("Failed to reset the SELinux exec context: %s", g_strerror (errno));
+        }
+        if (ret != 0 && process_data->cgroup &&
+            (ret == ENOSYS || ret == E2BIG || ret == EINVAL)) {
+            posix_spawnattr_destroy (&attr);
+            posix_spawn_file_actions_destroy (&actions);
+            g_free (program);
+            close (pipe_out[0]);
+            close (pipe_out[1]);
+            if (want_stdin) {
+                close (pipe_in[0]);
+                close (pipe_in[1]);
+            }
+            spawn_cgroup = FALSE;
+            errno = ENOTSUP;
+            return -1;
+        }
+        if (ret != 0) {
+            pid = 0;
+            exit_code = SPAWN_COMMAND_FAILED;
+        } else if (attrs && attrs->oom_score_adj) {
+            gchar *oom_file = g_strdup_printf ("/proc/%d/oom_score_adj", pid);
+
+            // Gone already when it exited straight away
+            if (!process_proc_write (oom_file, attrs->oom_score_adj) && errno != ENOENT)
+                dprintf (pipe_out[1], "**** -- WARNING: Failed to write %s to %s: %s\n",
+                         attrs->oom_score_adj, oom_file, g_strerror (errno));
+            g_free (oom_file);
+        }
+        posix_spawnattr_destroy (&attr);
+        posix_spawn_file_actions_destroy (&actions);
+    }
+    if (exit_code == SPAWN_COMMAND_FAILED) {
+        dprintf (pipe_out[1], "Failed to exec() %s, %s error:%s\n",
+                 *process_data->command, process_data->path, g_strerror (ret));
+    }
+    g_free (program);
+
+    close (pipe_out[1]);
+    process_data->fd_out = pipe_out[0];
+    if (want_stdin) {
+        close (pipe_in[0]);
+        // Nobody would read the content input
+        if (pid == 0)
+            close (pipe_in[1]);
+        else
+            process_data->fd_in = pipe_in[1];
+    }
+    *status = W_EXITCODE (exit_code, 0);
+    return pid;
+}
+
+static gboolean
+process_pidfd_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+    ProcessData *process_data = (ProcessData *) user_data;
+    gint status;
+
+    if (waitpid (process_data->pid, &status, WNOHANG) <= 0) {
+        return G_SOURCE_CONTINUE;
+    }
+    process_data->pid_handler_id = 0;
+    process_pid_callback (process_data->pid, status, process_data);
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Follows the child through a pidfd where the kernel has them, with a
+ * child watch otherwise.
+ */
+static void
+process_watch_child (ProcessData *process_data)
+{
+#ifdef SYS_pidfd_open
+    process_data->pidfd = syscall (SYS_pidfd_open, process_data->pid, 0);
+    if (process_data->pidfd != -1) {
+        process_data->pid_handler_id = g_unix_fd_add_full (G_PRIORITY_DEFAULT,
+                                                           process_data->pidfd,
+                                                           G_IO_IN,
+                                                           process_pidfd_cb,
+                                                           process_data,
+                                                           NULL);
+        return;
+    }
+#endif
+    process_data->pid_handler_id = g_child_watch_add_full (G_PRIORITY_DEFAULT,
+                                                   process_data->pid,
+                                                   process_pid_callback,
+                                                   process_data,
+                                                   NULL);
+}
+
+static void
+process_start (gchar **command,
+               const gchar **envp,
+               const gchar *path,
+               RstrntCgroup *cgroup,
+               const ProcessAttrs *attrs,
+               gboolean use_pty,
+               RstrntWatchdog *watchdog,
+               ProcessTimeoutCallback timeout_callback,
+               GIOFunc io_callback,
+               ProcessFinishCallback finish_callback,
+               const gchar *content_input,
+               gssize content_size,
+               gboolean buffer,
+               GCancellable *cancellable,
+               gpointer user_data)
 {
     ProcessData *process_data;
     gint        *process_stdin;
-    guint64      timeout;
-
-    /* Passing content_input is not supported with PTY */
-    g_return_if_fail (!use_pty || content_input == NULL);
+    gint         spawn_status = 0;
+    gboolean     spawn;
 
     process_data = g_slice_new0 (ProcessData);
     process_data->localwatchdog = FALSE;
-    process_data->command = g_strsplit (command, " ", 0);
+    process_data->command = command;
     process_data->path = path;
-    process_data->max_time = max_time;
+    process_data->cgroup = cgroup ? rstrnt_cgroup_ref (cgroup) : NULL;
+    process_data->watchdog = watchdog ? rstrnt_watchdog_ref (watchdog) : NULL;
     process_data->timeout_callback = timeout_callback;
     process_data->io_callback = io_callback;
     process_data->finish_callback = finish_callback;
@@ -264,6 +616,7 @@ process_run (const gchar *command,
 
     process_data->fd_in = -1;
     process_data->fd_out = -1;
+    process_data->pidfd = -1;
 
     if (fflush (stdout) != 0)
         g_warning ("Failed to flush stdout: %s\n", g_strerror (errno));
@@ -277,7 +630,22 @@ process_run (const gchar *command,
     else
         process_stdin = NULL;
 
-    process_data->pid = restraint_fork (&process_data->fd_out, process_stdin, use_pty);
+    // Without clone3() the forked child moves itself into the cgroup
+    // before anything else runs, without POSIX_SPAWN_SETSID it calls
+    // setsid() itself.
+    spawn = !use_pty && launcher == PROCESS_LAUNCHER_SPAWN &&
+            (cgroup == NULL || spawn_cgroup) &&
+            (attrs == NULL || !attrs->setsid || HAVE_SPAWN_SETSID) &&
+            (path == NULL || HAVE_SPAWN_CHDIR);
+    process_data->started = g_get_monotonic_time ();
+    if (spawn) {
+        process_data->pid = process_spawn (process_data, envp, attrs,
+                                           process_stdin != NULL, &spawn_status);
+        spawn = process_data->pid >= 0 || errno != ENOTSUP;
+    }
+    if (!spawn) {
+        process_data->pid = restraint_fork (&process_data->fd_out, process_stdin, use_pty);
+    }
 
     if (process_data->pid < 0) {
         /* Failed to fork */
@@ -286,6 +654,9 @@ process_run (const gchar *command,
                      "Failed to fork: %s", g_strerror (errno));
         g_idle_add (process_pid_finish, process_data);
         return;
+    } else if (process_data->pid == 0 && spawn) {
+        /* Spawned command failed to start, finish once its output is read */
+        process_data->pid_result = spawn_status;
     } else if (process_data->pid == 0) {
         /* Child process. */
 
@@ -296,6 +667,11 @@ process_run (const gchar *command,
         setbuf (stdout, NULL);
         setbuf (stderr, NULL);
 
+        if (process_data->cgroup && !rstrnt_cgroup_attach_self (process_data->cgroup)) {
+            g_warning ("Failed to move to cgroup %s: %s\n", process_data->cgroup->path,
+                       g_strerror (errno));
+        }
+
         if (process_data->path && (chdir (process_data->path) == -1)) {
             /* command_path was supplied and we failed to chdir to it. */
             g_warning ("Failed to chdir() to %s: %s\n", process_data->path, g_strerror (errno));
@@ -304,6 +680,9 @@ process_run (const gchar *command,
         if (envp)
             environ = (gchar **) envp;
 
+        if (attrs)
+            process_child_attrs (attrs, use_pty);
+
         // Print the command being executed.
         gchar *pcommand = g_strjoinv (" ", (gchar **) process_data->command);
         printf ("use_pty:%s %s\n", use_pty ? "TRUE" : "FALSE", pcommand);
@@ -320,6 +699,9 @@ process_run (const gchar *command,
     }
 
     /* Parent process. */
+    rstrnt_metrics_inc (spawn ? METRIC_PROCESSES_SPAWNED : METRIC_PROCESSES_FORKED);
+    rstrnt_metrics_observe (METRIC_PROCESS_LAUNCH,
+                            g_get_monotonic_time () - process_data->started);
 
     // If we get the cancel signal kill any running process
     if (process_data->cancellable) {
@@ -336,18 +718,16 @@ process_run (const gchar *command,
     if (process_data->fd_in != -1 && fcntl (process_data->fd_in, F_SETFD, FD_CLOEXEC) < 0)
         g_warning ("Failed to set close on exec for fd_in");
 
-    // Localwatchdog handler
-    if (process_data->max_time < HEARTBEAT) {
-        timeout = process_data->max_time;
-    } else {
-        timeout = HEARTBEAT;
-    }
-    if (process_data->max_time != 0) {
-        process_data->timeout_handler_id = g_timeout_add_seconds_full (G_PRIORITY_DEFAULT,
-                                                               timeout,
-                                                               process_timeout_callback,
-                                                               process_data,
-                                                               NULL);
+    // Localwatchdog handler, the heartbeat only reports on it
+    if (process_data->watchdog && process_data->pid != 0) {
+        rstrnt_watchdog_watch (process_data->watchdog, process_watchdog_cb, process_data);
+        if (process_data->timeout_callback) {
+            process_data->timeout_handler_id = g_timeout_add_seconds_full (G_PRIORITY_DEFAULT,
+                                                                   heartbeat,
+                                                                   process_timeout_callback,
+                                                                   process_data,
+                                                                   NULL);
+        }
     }
 
     /* If process_stdin holds a file descriptor, there is data to pass in
@@ -378,11 +758,100 @@ process_run (const gchar *command,
                                                    process_io_finish);
     }
     // Monitor pid for return code
-    process_data->pid_handler_id = g_child_watch_add_full (G_PRIORITY_DEFAULT,
-                                                   process_data->pid,
-                                                   process_pid_callback,
-                                                   process_data,
-                                                   NULL);
+    if (process_data->pid != 0) {
+        process_watch_child (process_data);
+    } else if (process_data->io_handler_id == 0) {
+        process_pid_callback (0, spawn_status, process_data);
+    }
+}
+
+/*
+ * A watchdog killing a process after max_time seconds, a main loop
+ * timeout when no timerfd can be had.  what names the process in the
+ * warning about that.
+ */
+RstrntWatchdog *
+process_watchdog_new (guint64 max_time, const gchar *what)
+{
+    RstrntWatchdog *watchdog;
+    GError *error = NULL;
+
+    watchdog = rstrnt_watchdog_new (&error);
+    if (watchdog != NULL && !rstrnt_watchdog_set (watchdog, max_time, &error)) {
+        g_clear_pointer (&watchdog, rstrnt_watchdog_unref);
+    }
+    if (watchdog == NULL) {
+        g_warning ("Local watchdog of %s falls back to a timeout: %s", what, error->message);
+        g_clear_error (&error);
+        watchdog = rstrnt_watchdog_new_timeout ();
+        rstrnt_watchdog_set (watchdog, max_time, NULL);
+    }
+    return watchdog;
+}
+
+void
+process_run (const gchar *command,
+             const gchar **envp,
+             const gchar *path,
+             gboolean use_pty,
+             guint64 max_time,
+             ProcessTimeoutCallback timeout_callback,
+             GIOFunc io_callback,
+             ProcessFinishCallback finish_callback,
+             const gchar *content_input,
+             gssize content_size,
+             gboolean buffer,
+             GCancellable *cancellable,
+             gpointer user_data)
+{
+    RstrntWatchdog *watchdog = NULL;
+
+    /* Passing content_input is not supported with PTY */
+    g_return_if_fail (!use_pty || content_input == NULL);
+
+    if (max_time != 0) {
+        watchdog = process_watchdog_new (max_time, command);
+    }
+
+    process_start (g_strsplit (command, " ", 0), envp, path, NULL, NULL,
+                   use_pty, watchdog, timeout_callback, io_callback,
+                   finish_callback, content_input, content_size, buffer,
+                   cancellable, user_data);
+    rstrnt_watchdog_unref (watchdog);
+}
+
+/*
+ * Same as process_run() without splitting a command line on spaces.  The
+ * process tree is kept in cgroup unless it is NULL, the local watchdog
+ * and cancellation then kill the whole tree.  attrs, if not NULL, only
+ * has to last until this returns.
+ * The process is killed when watchdog expires, its deadline may be moved
+ * while the process runs.
+ */
+void
+process_run_argv (const gchar *const *argv,
+                  const gchar **envp,
+                  const gchar *path,
+                  RstrntCgroup *cgroup,
+                  const ProcessAttrs *attrs,
+                  gboolean use_pty,
+                  RstrntWatchdog *watchdog,
+                  ProcessTimeoutCallback timeout_callback,
+                  GIOFunc io_callback,
+                  ProcessFinishCallback finish_callback,
+                  const gchar *content_input,
+                  gssize content_size,
+                  gboolean buffer,
+                  GCancellable *cancellable,
+                  gpointer user_data)
+{
+    g_return_if_fail (argv != NULL && argv[0] != NULL);
+    g_return_if_fail (!use_pty || content_input == NULL);
+
+    process_start (g_strdupv ((gchar **) argv), envp, path, cgroup,
+                   attrs, use_pty,
+                   watchdog, timeout_callback, io_callback, finish_callback,
+                   content_input, content_size, buffer, cancellable, user_data);
 }
 
 void
@@ -392,6 +861,8 @@ process_pid_callback (GPid pid, gint status, gpointer user_data)
 
     process_data->pid_result = status;
     process_data->pid = 0;
+    if (process_data->watchdog && process_data->watchdog->user_data == process_data)
+        rstrnt_watchdog_watch (process_data->watchdog, NULL, NULL);
     if (process_data->fd_out != -1 ) {
         close (process_data->fd_out);
         process_data->fd_out = -1;
@@ -418,12 +889,16 @@ process_pid_finish (gpointer user_data)
         return FALSE;
     }
 
-    // Remove local watchdog handler
+    // Remove heartbeat handler
     if (process_data->timeout_handler_id != 0) {
         g_source_remove(process_data->timeout_handler_id);
         process_data->timeout_handler_id = 0;
     }
 
+    if (process_data->started != 0) {
+        rstrnt_metrics_observe (METRIC_PROCESS_DURATION,
+                                g_get_monotonic_time () - process_data->started);
+    }
     process_data->finish_callback (process_data->pid_result,
                                    process_data->localwatchdog,
                                    process_data->user_data,
@@ -444,7 +919,18 @@ process_kill (gpointer user_data)
         return;
     }
 
-    // Kill process pid
+    // Kill the process tree, or process pid without a cgroup
+    if (process_data->cgroup) {
+        GError *error = NULL;
+
+        if (rstrnt_cgroup_kill (process_data->cgroup, &error)) {
+            process_data->localwatchdog = TRUE;
+            return;
+        }
+        g_warning ("Failed to kill cgroup %s, killing %i only: %s",
+                   process_data->cgroup->path, process_data->pid, error->message);
+        g_clear_error (&error);
+    }
     if (kill (process_data->pid, SIGKILL) == 0) {
         process_data->localwatchdog = TRUE;
     } else {
@@ -468,42 +954,20 @@ process_timeout_callback (gpointer user_data)
         return FALSE;
     }
 
-    /* Execute user timeout_callback and
-     * check if timeout was changed by user. */
-    if (process_data->timeout_callback != NULL) {
-        process_data->timeout_callback(
-            process_data->user_data, &process_data->max_time);
-    } else {
-        /* if no user timeout_callback, 'process' code manages
-         * timeout period.
-         */
-        if (process_data->max_time < HEARTBEAT) {
-            process_data->max_time = 0;
-        } else {
-            process_data->max_time -= HEARTBEAT;
-        }
-    }
-
-    if (process_data->max_time > 0) {
-        // Restart new timer for remaining seconds. Release old timer.
-        if (process_data->max_time < HEARTBEAT) {
-            process_data->timeout_handler_id = g_timeout_add_seconds_full (
-                G_PRIORITY_DEFAULT,
-                process_data->max_time,
-                process_timeout_callback,
-                process_data,
-                NULL);
-            // return False to release current timeout
-            return FALSE;
-        } else {
-            return TRUE;
-        }
-    }
+    process_data->timeout_callback (process_data->user_data);
+    return TRUE;
+}
 
-    process_kill(user_data);
-    process_data->timeout_handler_id = 0;
-    return FALSE;
+static void
+process_watchdog_cb (gpointer user_data)
+{
+    ProcessData *process_data = (ProcessData *) user_data;
 
+    process_kill (user_data);
+    if (process_data->timeout_handler_id) {
+        g_source_remove (process_data->timeout_handler_id);
+        process_data->timeout_handler_id = 0;
+    }
 }
 
 static void
@@ -20,19 +20,36 @@
 
 #include <gio/gio.h>
 
+#include "cgroup.h"
+#include "watchdog.h"
+
 #define HEARTBEAT 1 * 60 // heartbeat every 1 minute
+#define HEARTBEAT_MIN 1
+#define HEARTBEAT_MAX 10 * 60
 
 /* Used for process IO callbacks */
 #define IO_BUFFER_SIZE 8192
 
-typedef void (*ProcessTimeoutCallback) (gpointer user_data,
-                                        guint64 *time_remain);
+/* Called every heartbeat while the local watchdog is armed */
+typedef void (*ProcessTimeoutCallback) (gpointer user_data);
 
 typedef void (*ProcessFinishCallback)   (gint           pid_result,
                                          gboolean       localwatchdog,
                                          gpointer       user_data,
                                          GError         *error);
 
+/*
+ * What a child gets besides its environment.  posix_spawn() and
+ * restraintd see to it for a spawned child, a forked one does it itself
+ * before exec.
+ */
+typedef struct {
+    gboolean setsid;             /* lead its own session */
+    const gchar *exec_context;   /* SELinux context to exec in, NULL to keep ours */
+    const gchar *oom_score_adj;  /* NULL to inherit ours */
+    const gchar *banner;         /* printed ahead of the command line, or NULL */
+} ProcessAttrs;
+
 #define RESTRAINT_PROCESS_ERROR restraint_process_error()
 GQuark restraint_process_error(void);
 
@@ -40,6 +57,11 @@ typedef enum {
     RESTRAINT_PROCESS_FORK_ERROR,
 } RestraintProcessError;
 
+typedef enum {
+    PROCESS_LAUNCHER_SPAWN,  /* posix_spawn(), the default */
+    PROCESS_LAUNCHER_FORK,   /* fork() and exec, always used with a pty */
+} ProcessLauncher;
+
 typedef struct {
     // Command to run
     gchar **command;
@@ -47,9 +69,14 @@ typedef struct {
     const gchar **environ;
     // The path to chdir before executing
     const gchar *path;
-    guint64 max_time;
+    // cgroup holding the process tree, NULL for none
+    RstrntCgroup *cgroup;
+    // local watchdog, NULL without one
+    RstrntWatchdog *watchdog;
     // pid of our forked process
     pid_t pid;
+    // pidfd following pid, -1 without one
+    gint pidfd;
     // file descriptors of our pty
     gint fd_out;
     gint fd_in;
@@ -63,7 +90,7 @@ typedef struct {
     guint pid_handler_id;
     // id of finish handler
     guint finish_handler_id;
-    // id of the timeout handler
+    // id of the heartbeat handler
     guint timeout_handler_id;
     // True if localwatch kicked in for this process
     gboolean localwatchdog;
@@ -76,6 +103,8 @@ typedef struct {
     GError *error;
     GCancellable *cancellable;
     gulong cancel_handler;
+    // monotonic time the process was started
+    gint64 started;
 } ProcessData;
 
 void
@@ -92,11 +121,31 @@ process_run (const gchar *command,
                       gboolean buffer,
                       GCancellable *cancellable,
                       gpointer user_data);
+void
+process_run_argv (const gchar *const *argv,
+                  const gchar **environ,
+                  const gchar *path,
+                  RstrntCgroup *cgroup,
+                  const ProcessAttrs *attrs,
+                  gboolean use_pty,
+                  RstrntWatchdog *watchdog,
+                  ProcessTimeoutCallback timeout_callback,
+                  GIOFunc io_callback,
+                  ProcessFinishCallback finish_callback,
+                  const gchar *content_input,
+                  gssize content_size,
+                  gboolean buffer,
+                  GCancellable *cancellable,
+                  gpointer user_data);
 //gboolean process_io_callback (GIOChannel *io, GIOCondition condition, gpointer user_data);
 void process_pid_callback (GPid pid, gint status, gpointer user_data);
 gboolean process_pid_finish (gpointer user_data);
 gboolean process_timeout_callback (gpointer user_data);
 //gboolean process_heartbeat_callback (gpointer user_data);
+void process_set_heartbeat (guint seconds);
+guint process_get_heartbeat (void);
+void process_set_launcher (ProcessLauncher launcher);
+RstrntWatchdog *process_watchdog_new (guint64 max_time, const gchar *what);
 void process_free (ProcessData *process_data);
 
 extern char **environ;
@@ -21,6 +21,7 @@
 #include <libxml/tree.h>
 #include <libxml/parser.h>
 #include <libxml/xpath.h>
+#include <libxml/xmlreader.h>
 
 #include "recipe.h"
 #include "param.h"
@@ -32,19 +33,12 @@
 #include "xml.h"
 #include "beaker_harness.h"
 
+static void recipe_wait_resume (gpointer user_data);
+
 GQuark restraint_recipe_parse_error_quark(void) {
     return g_quark_from_static_string("restraint-recipe-parse-error-quark");
 }
 
-static gchar *get_attribute(xmlNode *node, void *attribute) {
-    gchar *result;
-
-    xmlChar *text = xmlGetNoNsProp(node, (xmlChar *)attribute);
-    result = g_strdup((gchar *)text);
-    xmlFree(text);
-    return result;
-}
-
 static xmlNodePtr find_recipe(xmlDocPtr doc) {
     xmlXPathObjectPtr recipe_nodes;
     xmlNodePtr result = NULL;
@@ -358,10 +352,15 @@ void restraint_recipe_update_roles(Recipe *recipe, xmlDoc *doc, GError **error)
             }
             g_list_free_full(recipe->roles, (GDestroyNotify) restraint_role_free);
             recipe->roles = roles;
+            g_clear_pointer(&recipe->env, rstrnt_env_map_unref);
         }
         if (child->type == XML_ELEMENT_NODE &&
                 g_strcmp0((gchar *)child->name, "task") == 0) {
-            g_return_if_fail(tasks != NULL);
+            if (tasks == NULL) {
+                // Not built yet, its roles are refreshed when it is
+                child = child->next;
+                continue;
+            }
             Task *task = tasks->data;
             xmlNode *roles_node = first_child_with_name(child, "roles", FALSE);
             if (roles_node != NULL) {
@@ -384,6 +383,336 @@ void restraint_recipe_update_roles(Recipe *recipe, xmlDoc *doc, GError **error)
     g_warn_if_fail(!tasks);
 }
 
+/*
+ * What one candidate recipe element says about roles, collected while
+ * streaming so nothing but the <roles/> elements is ever built.
+ */
+typedef struct {
+    const gchar *element;
+    gboolean need_id;
+    gint depth;         // of the recipe element, -1 until found
+    gboolean closed;    // left it, or not needed any more
+    gboolean in_task;
+    guint tasks;        // <task/> elements seen so far
+    gboolean have_roles;
+    GList *roles;
+    GArray *task_roles; // of TaskRoles
+} RolesScope;
+
+typedef struct {
+    guint index;
+    GList *roles;
+} TaskRoles;
+
+static void
+roles_scope_clear (RolesScope *scope)
+{
+    g_list_free_full (scope->roles, (GDestroyNotify) restraint_role_free);
+    for (guint i = 0; i < scope->task_roles->len; i++) {
+        TaskRoles *task_roles = &g_array_index (scope->task_roles, TaskRoles, i);
+        g_list_free_full (task_roles->roles, (GDestroyNotify) restraint_role_free);
+    }
+    g_array_free (scope->task_roles, TRUE);
+}
+
+static void
+recipe_xml_error (GError **error, const gchar *url)
+{
+    const xmlError *xmlerr = xmlGetLastError ();
+
+    g_set_error (error, RESTRAINT_XML_PARSE_ERROR,
+                 RESTRAINT_XML_PARSE_ERROR_BAD_SYNTAX, "%s: %s", url,
+                 xmlerr != NULL ? xmlerr->message : "Unknown libxml error");
+}
+
+static gboolean
+roles_scope_parse (RolesScope *scope, Recipe *recipe, xmlTextReaderPtr reader,
+                   const gchar *url, GError **error)
+{
+    GError *tmp_error = NULL;
+    xmlNodePtr roles_node = xmlTextReaderExpand (reader);
+    GList *roles;
+
+    if (roles_node == NULL) {
+        recipe_xml_error (error, url);
+        return FALSE;
+    }
+    roles = parse_roles (roles_node, &tmp_error);
+    if (tmp_error != NULL) {
+        if (scope->in_task) {
+            Task *task = g_list_nth_data (recipe->tasks, scope->tasks - 1);
+            g_propagate_prefixed_error (error, tmp_error, "Task %s has ",
+                                        task != NULL ? task->task_id : "?");
+        } else {
+            g_propagate_prefixed_error (error, tmp_error, "Recipe %s has ",
+                                        recipe->recipe_id);
+        }
+        return FALSE;
+    }
+
+    if (scope->in_task) {
+        TaskRoles task_roles = { scope->tasks - 1, roles };
+        g_array_append_val (scope->task_roles, task_roles);
+    } else {
+        g_list_free_full (scope->roles, (GDestroyNotify) restraint_role_free);
+        scope->roles = roles;
+        scope->have_roles = TRUE;
+    }
+    return TRUE;
+}
+
+/*
+ * Looks at the element the reader is on.  Returns 1 if its children are
+ * of interest, 0 if they can be skipped and -1 on error.
+ */
+static gint
+roles_scope_element (RolesScope *scope, Recipe *recipe, xmlTextReaderPtr reader,
+                     const gchar *name, gint depth, const gchar *url,
+                     GError **error)
+{
+    if (scope->closed) {
+        return 0;
+    }
+    if (scope->depth < 0) {
+        if (g_strcmp0 (name, scope->element) == 0) {
+            xmlChar *id = xmlTextReaderGetAttribute (reader, (xmlChar *) "id");
+            if (id != NULL || !scope->need_id) {
+                scope->depth = depth;
+            }
+            xmlFree (id);
+        }
+        return 1;
+    }
+    if (depth <= scope->depth) {
+        scope->closed = TRUE;
+        return 0;
+    }
+    if (depth == scope->depth + 1) {
+        scope->in_task = g_strcmp0 (name, "task") == 0;
+        if (scope->in_task) {
+            scope->tasks++;
+            return 1;
+        }
+    } else if (!scope->in_task) {
+        return 0;
+    }
+    if (g_strcmp0 (name, "roles") == 0 &&
+            !roles_scope_parse (scope, recipe, reader, url, error)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Same as restraint_recipe_update_roles but streams through the recipe
+ * XML in buffer, only the <roles/> elements are turned into nodes.
+ */
+gboolean
+restraint_recipe_update_roles_from_memory (Recipe *recipe, const gchar *buffer,
+                                           gsize length, const gchar *url,
+                                           GError **error)
+{
+    g_return_val_if_fail(recipe != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    // Same precedence as find_recipe
+    RolesScope scopes[] = {
+        { "recipe", TRUE, -1 },
+        { "guestrecipe", FALSE, -1 },
+    };
+    RolesScope *scope = NULL;
+    gboolean ret = FALSE;
+    xmlTextReaderPtr reader;
+    gint read;
+
+    for (guint i = 0; i < G_N_ELEMENTS (scopes); i++) {
+        scopes[i].task_roles = g_array_new (FALSE, FALSE, sizeof (TaskRoles));
+    }
+
+    reader = xmlReaderForMemory (buffer, length, url, NULL, XML_PARSE_NONET);
+    if (reader == NULL) {
+        recipe_xml_error (error, url);
+        goto out;
+    }
+
+    read = xmlTextReaderRead (reader);
+    while (read == 1) {
+        gint interested = 0;
+
+        if (xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT) {
+            read = xmlTextReaderRead (reader);
+            continue;
+        }
+        const gchar *name = (const gchar *) xmlTextReaderConstLocalName (reader);
+        gint depth = xmlTextReaderDepth (reader);
+        for (guint i = 0; i < G_N_ELEMENTS (scopes); i++) {
+            gint element = roles_scope_element (&scopes[i], recipe, reader,
+                                                name, depth, url, error);
+            if (element < 0) {
+                goto out;
+            }
+            interested |= element;
+        }
+        // A <recipe id=""/> wins over any <guestrecipe/>
+        if (scopes[0].depth >= 0) {
+            scopes[1].closed = TRUE;
+        }
+        read = interested ? xmlTextReaderRead (reader) : xmlTextReaderNext (reader);
+    }
+    if (read < 0) {
+        recipe_xml_error (error, url);
+        goto out;
+    }
+
+    if (scopes[0].depth >= 0) {
+        scope = &scopes[0];
+    } else if (scopes[1].depth >= 0) {
+        scope = &scopes[1];
+    } else {
+        unrecognised("<recipe/> element not found");
+        goto out;
+    }
+
+    if (scope->have_roles) {
+        g_list_free_full(recipe->roles, (GDestroyNotify) restraint_role_free);
+        recipe->roles = scope->roles;
+        scope->roles = NULL;
+        g_clear_pointer (&recipe->env, rstrnt_env_map_unref);
+    }
+    GList *tasks = recipe->tasks;
+    guint index = 0;
+    for (guint i = 0; i < scope->task_roles->len; i++) {
+        TaskRoles *task_roles = &g_array_index (scope->task_roles, TaskRoles, i);
+        while (tasks != NULL && index < task_roles->index) {
+            tasks = tasks->next;
+            index++;
+        }
+        if (tasks == NULL) {
+            // The rest are not built yet, they refresh their own roles
+            if (task_roles->index >= recipe->task_count) {
+                g_warning ("%s has more <task/> elements than the recipe", url);
+            }
+            break;
+        }
+        Task *task = tasks->data;
+        g_list_free_full(task->roles, (GDestroyNotify) restraint_role_free);
+        task->roles = task_roles->roles;
+        task_roles->roles = NULL;
+    }
+    // Too few <task/> nodes in the XML
+    g_warn_if_fail(scope->tasks >= g_list_length (recipe->tasks));
+    ret = TRUE;
+
+out:
+    if (reader != NULL) {
+        xmlFreeTextReader (reader);
+    }
+    for (guint i = 0; i < G_N_ELEMENTS (scopes); i++) {
+        roles_scope_clear (&scopes[i]);
+    }
+    return ret;
+}
+
+typedef struct {
+    Recipe *recipe;
+    gchar *url;
+    gint64 started;
+    RecipeRefreshCallback callback;
+    gpointer user_data;
+} RecipeRefreshData;
+
+static RecipeRefreshStats refresh_stats;
+
+static void
+recipe_refresh_cb (SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+    RecipeRefreshData *refresh_data = (RecipeRefreshData *) user_data;
+    Recipe *recipe = refresh_data->recipe;
+    gint64 fetched = g_get_monotonic_time ();
+    GError *error = NULL;
+
+    refresh_stats.refreshes++;
+    refresh_stats.fetch_us += fetched - refresh_data->started;
+
+    if (msg->status_code == SOUP_STATUS_NOT_MODIFIED) {
+        // Roles are still what we have
+        refresh_stats.not_modified++;
+    } else if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code)) {
+        g_set_error (&error, SOUP_HTTP_ERROR, msg->status_code,
+                     "Fetching %s: %s", refresh_data->url, msg->reason_phrase);
+    } else {
+        SoupBuffer *body = soup_message_body_flatten (msg->response_body);
+        if (restraint_recipe_update_roles_from_memory (recipe, body->data,
+                                                       body->length,
+                                                       refresh_data->url,
+                                                       &error)) {
+            g_free (recipe->roles_etag);
+            recipe->roles_etag = g_strdup (
+                soup_message_headers_get_one (msg->response_headers, "ETag"));
+            g_free (recipe->roles_last_modified);
+            recipe->roles_last_modified = g_strdup (
+                soup_message_headers_get_one (msg->response_headers, "Last-Modified"));
+        }
+        soup_buffer_free (body);
+        refresh_stats.parse_us += g_get_monotonic_time () - fetched;
+    }
+    if (error != NULL) {
+        refresh_stats.errors++;
+    }
+    refresh_stats.last_us = g_get_monotonic_time () - refresh_data->started;
+
+    refresh_data->callback (error, refresh_data->user_data);
+    g_clear_error (&error);
+    g_free (refresh_data->url);
+    g_slice_free (RecipeRefreshData, refresh_data);
+}
+
+/*
+ * Refreshes the recipe and task roles from url.  The fetch is conditional
+ * on what the last refresh returned, when nothing changed the recipe XML
+ * isn't even transferred.  callback gets a borrowed error, if any.
+ */
+void
+restraint_recipe_refresh_roles (SoupSession *session, Recipe *recipe,
+                                const gchar *url, RecipeRefreshCallback callback,
+                                gpointer user_data)
+{
+    g_return_if_fail(session != NULL);
+    g_return_if_fail(recipe != NULL);
+    g_return_if_fail(callback != NULL);
+
+    SoupMessage *msg = soup_message_new ("GET", url);
+    if (msg == NULL) {
+        GError *error = g_error_new (SOUP_HTTP_ERROR, SOUP_STATUS_MALFORMED,
+                                     "Invalid recipe URL %s", url);
+        callback (error, user_data);
+        g_error_free (error);
+        return;
+    }
+    if (recipe->roles_etag != NULL) {
+        soup_message_headers_append (msg->request_headers, "If-None-Match",
+                                     recipe->roles_etag);
+    }
+    if (recipe->roles_last_modified != NULL) {
+        soup_message_headers_append (msg->request_headers, "If-Modified-Since",
+                                     recipe->roles_last_modified);
+    }
+
+    RecipeRefreshData *refresh_data = g_slice_new0 (RecipeRefreshData);
+    refresh_data->recipe = recipe;
+    refresh_data->url = g_strdup (url);
+    refresh_data->started = g_get_monotonic_time ();
+    refresh_data->callback = callback;
+    refresh_data->user_data = user_data;
+    soup_session_queue_message (session, msg, recipe_refresh_cb, refresh_data);
+}
+
+const RecipeRefreshStats *
+restraint_recipe_refresh_stats (void)
+{
+    return &refresh_stats;
+}
+
 void restraint_recipe_free(Recipe *recipe) {
     g_return_if_fail(recipe != NULL);
     g_free(recipe->recipe_id);
@@ -395,57 +724,238 @@ void restraint_recipe_free(Recipe *recipe) {
     g_free(recipe->osarch);
     g_free(recipe->owner);
     g_free(recipe->base_path);
-    soup_uri_free(recipe->recipe_uri);
+    if (recipe->recipe_uri != NULL) {
+        soup_uri_free(recipe->recipe_uri);
+    }
     g_list_free_full(recipe->tasks, (GDestroyNotify) restraint_task_free);
+    if (recipe->task_xml != NULL) {
+        g_queue_free_full(recipe->task_xml, (GDestroyNotify) xmlFree);
+    }
     g_list_free_full(recipe->params, (GDestroyNotify) restraint_param_free);
     g_list_free_full(recipe->roles, (GDestroyNotify) restraint_role_free);
+    if (recipe->installed_deps != NULL) {
+        g_hash_table_destroy(recipe->installed_deps);
+    }
+    rstrnt_package_cache_free(recipe->packages);
+    g_free(recipe->roles_etag);
+    g_free(recipe->roles_last_modified);
+    rstrnt_env_map_unref(recipe->env);
+    rstrnt_host_facts_free(recipe->host_facts);
     g_slice_free(Recipe, recipe);
 }
 
-static Recipe *
-recipe_parse (xmlDoc *doc, SoupURI *recipe_uri, GError **error, gchar **cfg_file)
+/*
+ * The recipe element being loaded.  Its <params/> and <roles/> are parsed
+ * as the reader streams through them, each <task/> is only copied out and
+ * becomes a Task once the recipe gets to it.
+ */
+typedef struct {
+    const gchar *element;
+    gboolean need_id;
+    gint depth;         // of the recipe element, -1 until found
+    gboolean closed;    // left it, or not needed any more
+    Recipe *recipe;
+} RecipeScope;
+
+static gchar *
+reader_attribute (xmlTextReaderPtr reader, const gchar *attribute)
+{
+    xmlChar *text = xmlTextReaderGetAttribute (reader, (xmlChar *) attribute);
+    gchar *result = g_strdup ((gchar *) text);
+
+    xmlFree (text);
+    return result;
+}
+
+static void
+recipe_scope_found (RecipeScope *scope, xmlTextReaderPtr reader, gint depth)
+{
+    Recipe *recipe = scope->recipe;
+
+    scope->depth = depth;
+    recipe->job_id = reader_attribute (reader, "job_id");
+    recipe->recipe_set_id = reader_attribute (reader, "recipe_set_id");
+    recipe->recipe_id = reader_attribute (reader, "id");
+    recipe->osarch = reader_attribute (reader, "arch");
+    recipe->osdistro = reader_attribute (reader, "distro");
+    recipe->osmajor = reader_attribute (reader, "family");
+    recipe->osvariant = reader_attribute (reader, "variant");
+}
+
+/*
+ * Looks at the element the reader is on.  Returns 1 if its children are
+ * of interest, 0 if they can be skipped and -1 on error.
+ */
+static gint
+recipe_scope_element (RecipeScope *scope, xmlTextReaderPtr reader,
+                      const gchar *name, gint depth, const gchar *url,
+                      GError **error)
 {
-    g_return_val_if_fail(doc != NULL, NULL);
+    Recipe *recipe = scope->recipe;
+    GError *tmp_error = NULL;
+
+    if (scope->closed) {
+        return 0;
+    }
+    if (scope->depth < 0) {
+        if (g_strcmp0 (name, scope->element) == 0) {
+            xmlChar *id = xmlTextReaderGetAttribute (reader, (xmlChar *) "id");
+            if (id != NULL || !scope->need_id) {
+                recipe_scope_found (scope, reader, depth);
+            }
+            xmlFree (id);
+        }
+        return 1;
+    }
+    if (depth <= scope->depth) {
+        scope->closed = TRUE;
+        return 0;
+    }
+    if (depth > scope->depth + 1) {
+        return 0;
+    }
+
+    if (g_strcmp0 (name, "task") == 0) {
+        xmlChar *task_id = xmlTextReaderGetAttribute (reader, (xmlChar *) "id");
+        if (task_id == NULL) {
+            unrecognised("<task/> without id");
+            return -1;
+        }
+        xmlFree (task_id);
+        xmlChar *task_xml = xmlTextReaderReadOuterXml (reader);
+        if (task_xml == NULL) {
+            recipe_xml_error (error, url);
+            return -1;
+        }
+        g_queue_push_tail (recipe->task_xml, task_xml);
+        recipe->task_count++;
+    } else if (g_strcmp0 (name, "params") == 0 ||
+               g_strcmp0 (name, "roles") == 0) {
+        gboolean params = g_strcmp0 (name, "params") == 0;
+        xmlNodePtr node = xmlTextReaderExpand (reader);
+        if (node == NULL) {
+            recipe_xml_error (error, url);
+            return -1;
+        }
+        GList *list = params ? parse_params (node, &tmp_error)
+                             : parse_roles (node, &tmp_error);
+        /* could be empty, but if parsing causes an error then fail */
+        if (tmp_error != NULL) {
+            g_propagate_prefixed_error (error, tmp_error, "Recipe %s has ",
+                                        recipe->recipe_id);
+            return -1;
+        }
+        if (params) {
+            g_list_free_full (recipe->params, (GDestroyNotify) restraint_param_free);
+            recipe->params = list;
+        } else {
+            g_list_free_full (recipe->roles, (GDestroyNotify) restraint_role_free);
+            recipe->roles = list;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Streams through the recipe XML without building the document.  Only the
+ * recipe attributes, params and roles are parsed here, the tasks are kept
+ * as XML until restraint_recipe_next_task() gets to them.  Takes
+ * recipe_uri, when NULL the recipe came on stdin.
+ */
+Recipe *
+restraint_recipe_parse (GBytes *xml, SoupURI *recipe_uri, GError **error,
+                        gchar **cfg_file)
+{
+    g_return_val_if_fail(xml != NULL, NULL);
     g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
+    // Same precedence as find_recipe
+    RecipeScope scopes[] = {
+        { "recipe", TRUE, -1 },
+        { "guestrecipe", FALSE, -1 },
+    };
+    gchar *url = recipe_uri != NULL ? soup_uri_to_string (recipe_uri, FALSE)
+                                    : g_strdup ("stdin");
     GError *tmp_error = NULL;
-    gint i = 0;
-    Recipe *result = g_slice_new0(Recipe);
+    Recipe *result = NULL;
+    gchar *owner = NULL;
+    gchar *checkpoint_file = NULL;
+    xmlTextReaderPtr reader;
+    gsize length;
+    gint read;
+
+    for (guint i = 0; i < G_N_ELEMENTS (scopes); i++) {
+        scopes[i].recipe = g_slice_new0 (Recipe);
+        scopes[i].recipe->task_xml = g_queue_new ();
+    }
 
-    xmlNode *job = xmlDocGetRootElement(doc);
-    if (job == NULL) {
-        unrecognised("Invalid XML Document");
-        goto error;
+    const gchar *buffer = g_bytes_get_data (xml, &length);
+    reader = xmlReaderForMemory (buffer, length, url, NULL, XML_PARSE_NONET);
+    if (reader == NULL) {
+        recipe_xml_error (error, url);
+        goto out;
     }
 
-    xmlNodePtr recipe = find_recipe(doc);
-    if (recipe == NULL) {
+    read = xmlTextReaderRead (reader);
+    while (read == 1) {
+        gint interested = 0;
+
+        if (xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT) {
+            read = xmlTextReaderRead (reader);
+            continue;
+        }
+        const gchar *name = (const gchar *) xmlTextReaderConstLocalName (reader);
+        gint depth = xmlTextReaderDepth (reader);
+        if (depth == 0) {
+            owner = reader_attribute (reader, "owner");
+            checkpoint_file = reader_attribute (reader, "checkpoint_file");
+        }
+        for (guint i = 0; i < G_N_ELEMENTS (scopes); i++) {
+            gint element = recipe_scope_element (&scopes[i], reader, name,
+                                                 depth, url, error);
+            if (element < 0) {
+                goto out;
+            }
+            interested |= element;
+        }
+        // A <recipe id=""/> wins over any <guestrecipe/>
+        if (scopes[0].depth >= 0) {
+            scopes[1].closed = TRUE;
+        }
+        read = interested ? xmlTextReaderRead (reader) : xmlTextReaderNext (reader);
+    }
+    if (read < 0) {
+        recipe_xml_error (error, url);
+        goto out;
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS (scopes); i++) {
+        if (scopes[i].depth >= 0) {
+            result = g_steal_pointer (&scopes[i].recipe);
+            break;
+        }
+    }
+    if (result == NULL) {
         unrecognised("<recipe/> element not found");
-        goto error;
+        goto out;
     }
 
-    result->job_id = get_attribute(recipe, "job_id");
-    result->recipe_set_id = get_attribute(recipe, "recipe_set_id");
-    result->recipe_id = get_attribute(recipe, "id");
-    result->osarch = get_attribute(recipe, "arch");
-    result->osdistro = get_attribute(recipe, "distro");
-    result->osmajor = get_attribute(recipe, "family");
-    result->osvariant = get_attribute(recipe, "variant");
-    result->owner = get_attribute(job, "owner");
+    result->installed_deps = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+    result->packages = rstrnt_package_cache_new();
+    result->owner = g_steal_pointer (&owner);
 
     if (recipe_uri == NULL) {
         gchar *tmp_str;
 
-        tmp_str = get_attribute (job, "checkpoint_file");
-        *cfg_file = g_build_filename (VAR_LIB_PATH, tmp_str, NULL);
-        g_free (tmp_str);
+        *cfg_file = g_build_filename (VAR_LIB_PATH, checkpoint_file, NULL);
 
         // Hack to make soup_uri_new happy.
         tmp_str = g_strdup_printf ("http://localhost/recipes/%s/", result->recipe_id);
         recipe_uri = soup_uri_new (tmp_str);
         g_free (tmp_str);
     }
-    result->recipe_uri = recipe_uri;
+    result->recipe_uri = g_steal_pointer (&recipe_uri);
 
     // Gather the location in which to install tasks
     result->base_path = get_install_dir(INSTALL_CONFIG_FILE, &tmp_error);
@@ -455,52 +965,68 @@ recipe_parse (xmlDoc *doc, SoupURI *recipe_uri, GError **error, gchar **cfg_file
         g_clear_error(&tmp_error);
     }
 
-
-    GList *tasks = NULL;
-    xmlNode *child = recipe->children;
-    while (child != NULL) {
-        if (child->type == XML_ELEMENT_NODE &&
-                g_strcmp0((gchar *)child->name, "task") == 0) {
-            Task *task = parse_task(child, result, &tmp_error);
-            if (task == NULL) {
-                g_propagate_error(error, tmp_error);
-                goto error;
-            }
-            /* link task to recipe for additional attributes */
-            task->recipe = result;
-            task->order = i++*2;
-            tasks = g_list_prepend(tasks, task);
-        } else
-        if (child->type == XML_ELEMENT_NODE &&
-                g_strcmp0((gchar *)child->name, "params") == 0) {
-            result->params = parse_params(child, &tmp_error);
-            /* params could be empty, but if parsing causes an error then fail */
-            if (tmp_error != NULL) {
-                g_propagate_prefixed_error(error, tmp_error,
-                                 "Recipe %s has ", result->recipe_id);
-                goto error;
-            }
-        } else
-        if (child->type == XML_ELEMENT_NODE &&
-                g_strcmp0((gchar *)child->name, "roles") == 0) {
-            result->roles = parse_roles(child, &tmp_error);
-            /* roles could be empty, but if parsing causes an error then fail */
-            if (tmp_error != NULL) {
-                g_propagate_prefixed_error(error, tmp_error,
-                                 "Recipe %s has ", result->recipe_id);
-                goto error;
-            }
+out:
+    if (reader != NULL) {
+        xmlFreeTextReader (reader);
+    }
+    for (guint i = 0; i < G_N_ELEMENTS (scopes); i++) {
+        if (scopes[i].recipe != NULL) {
+            restraint_recipe_free (scopes[i].recipe);
         }
-        child = child->next;
     }
-    tasks = g_list_reverse(tasks);
-
-    result->tasks = tasks;
+    if (recipe_uri != NULL) {
+        soup_uri_free (recipe_uri);
+    }
+    g_free (owner);
+    g_free (checkpoint_file);
+    g_free (url);
     return result;
+}
 
-error:
-    restraint_recipe_free(result);
-    return NULL;
+/*
+ * Returns the task after current, or the first one when current is NULL,
+ * building it from its <task/> element the first time it is reached.
+ * NULL once there are no more tasks, or if the element is not a valid
+ * task.
+ */
+GList *
+restraint_recipe_next_task (Recipe *recipe, GList *current, GError **error)
+{
+    g_return_val_if_fail(recipe != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    GList *next = current != NULL ? current->next : recipe->tasks;
+    if (next != NULL || recipe->task_xml == NULL ||
+            g_queue_is_empty (recipe->task_xml)) {
+        return next;
+    }
+
+    xmlChar *task_xml = g_queue_pop_head (recipe->task_xml);
+    guint index = recipe->task_count - g_queue_get_length (recipe->task_xml) - 1;
+    xmlDocPtr doc = xmlReadDoc (task_xml, NULL, NULL, XML_PARSE_NONET);
+    xmlFree (task_xml);
+    if (doc == NULL) {
+        const xmlError *xmlerr = xmlGetLastError ();
+        g_set_error (error, RESTRAINT_XML_PARSE_ERROR,
+                     RESTRAINT_XML_PARSE_ERROR_BAD_SYNTAX,
+                     "Recipe %s task %u: %s", recipe->recipe_id, index,
+                     xmlerr != NULL ? xmlerr->message : "Unknown libxml error");
+        return NULL;
+    }
+    Task *task = parse_task (xmlDocGetRootElement (doc), recipe, error);
+    xmlFreeDoc (doc);
+    if (task == NULL) {
+        return NULL;
+    }
+    task->order = index * 2;
+
+    if (current == NULL) {
+        recipe->tasks = g_list_append (NULL, task);
+        return recipe->tasks;
+    }
+    // current is the last task built so far
+    g_list_append (current, task);
+    return current->next;
 }
 
 static gboolean fetch_retry (gpointer user_data)
@@ -513,18 +1039,18 @@ static gboolean fetch_retry (gpointer user_data)
 }
 
 static void
-fetch_completed(GError *error, xmlDoc *doc, gpointer user_data)
+fetch_completed(GError *error, GBytes *xml, gpointer user_data)
 {
     AppData *app_data = (AppData *)user_data;
 
     if (error) {
-        g_warn_if_fail(!doc);
+        g_warn_if_fail(!xml);
         if (app_data->fetch_retries < RECIPE_FETCH_RETRIES) {
             g_print("* RETRY [%d]**:%s\n", ++app_data->fetch_retries,
                     error->message);
             g_timeout_add_seconds (RECIPE_FETCH_INTERVAL, fetch_retry, app_data);
         } else {
-            g_propagate_prefixed_error(&app_data->error, error,
+            g_propagate_prefixed_error(&app_data->error, g_error_copy(error),
                     "While fetching recipe XML: ");
             /* Set us back to idle so we can accept a valid recipe */
             app_data->state = RECIPE_COMPLETE;
@@ -532,8 +1058,8 @@ fetch_completed(GError *error, xmlDoc *doc, gpointer user_data)
         return;
     }
 
-    g_warn_if_fail(!app_data->recipe_xmldoc);
-    app_data->recipe_xmldoc = doc;
+    g_warn_if_fail(!app_data->recipe_xml);
+    app_data->recipe_xml = xml;
     app_data->state = RECIPE_PARSE;
 }
 
@@ -542,7 +1068,7 @@ restraint_recipe_parse_stream (GInputStream *stream, gpointer user_data)
 {
     AppData *app_data = (AppData *) user_data;
 
-    restraint_xml_parse_from_stream(stream, app_data->recipe_url, fetch_completed, app_data);
+    restraint_xml_read_from_stream(stream, app_data->recipe_url, fetch_completed, app_data);
 }
 
 gboolean
@@ -555,12 +1081,18 @@ recipe_handler (gpointer user_data)
 
     switch (app_data->state) {
         case RECIPE_FETCH:
-            if (!app_data->stdin && recipe_wait_on_beaker (app_data->recipe_url, "* Recipe fetch"))
+            if (!app_data->stdin && recipe_wait_on_beaker (app_data, "* Recipe fetch",
+                                                           recipe_wait_resume)) {
+                // recipe_wait_resume will put us back in RECIPE_FETCH
+                app_data->state = RECIPE_FETCHING;
+                app_data->recipe_handler_id = 0;
+                result = G_SOURCE_REMOVE;
                 break;
+            }
 
             g_string_printf(message, "* Fetching recipe: %s\n", app_data->recipe_url);
             app_data->state = RECIPE_FETCHING;
-            restraint_xml_parse_from_url(soup_session, app_data->recipe_url,
+            restraint_xml_read_from_url(soup_session, app_data->recipe_url,
                     fetch_completed, app_data);
             // fetch_completed callback will move us to the next state
             break;
@@ -568,10 +1100,16 @@ recipe_handler (gpointer user_data)
             g_string_printf(message, "* Parsing recipe\n");
             if (app_data->recipe_url)
                 recipe_uri = soup_uri_new(app_data->recipe_url);
-            app_data->recipe = recipe_parse(app_data->recipe_xmldoc, recipe_uri,
-                                            &app_data->error, &app_data->config_file);
+            app_data->recipe = restraint_recipe_parse(app_data->recipe_xml, recipe_uri,
+                                                      &app_data->error,
+                                                      &app_data->config_file);
+            // The tasks were copied out, the rest is not needed any more
+            g_clear_pointer(&app_data->recipe_xml, g_bytes_unref);
+            if (app_data->recipe && ! app_data->error) {
+                app_data->tasks = restraint_recipe_next_task(app_data->recipe, NULL,
+                                                             &app_data->error);
+            }
             if (app_data->recipe && ! app_data->error) {
-                app_data->tasks = app_data->recipe->tasks;
                 app_data->state = RECIPE_RUN;
             } else {
                 app_data->state = RECIPE_COMPLETE;
@@ -605,10 +1143,7 @@ recipe_handler (gpointer user_data)
                     app_data->close_message (app_data->message_data);
                 }
             }
-            if (app_data->recipe_xmldoc) {
-                xmlFreeDoc(app_data->recipe_xmldoc);
-                app_data->recipe_xmldoc = NULL;
-            }
+            g_clear_pointer(&app_data->recipe_xml, g_bytes_unref);
             // free current recipe
             if (app_data->recipe) {
               restraint_recipe_free(app_data->recipe);
@@ -644,6 +1179,11 @@ recipe_handler_finish (gpointer user_data)
     AppData *app_data = (AppData *) user_data;
     ClientData *client_data = app_data->message_data;
 
+    // Only removed while Beaker is unhealthy, recipe_wait_resume adds us back
+    if (app_data->bkr_wait == BKR_WAIT_PENDING) {
+        return;
+    }
+
     if (client_data) {
         if (app_data->error) {
          soup_message_set_status_full (client_data->client_msg,
@@ -660,24 +1200,111 @@ recipe_handler_finish (gpointer user_data)
     g_clear_error (&app_data->error);
 }
 
+typedef struct {
+    AppData *app_data;
+    gchar *state_tag;
+    RecipeWaitResume resume;
+} BeakerWaitData;
+
+static void beaker_wait_check (BeakerWaitData *wait_data);
+
+static void
+recipe_wait_resume (gpointer user_data)
+{
+    AppData *app_data = (AppData *) user_data;
+
+    app_data->state = RECIPE_FETCH;
+    app_data->recipe_handler_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                                                  recipe_handler,
+                                                  app_data,
+                                                  recipe_handler_finish);
+}
+
+static void
+beaker_wait_done (BeakerWaitData *wait_data)
+{
+    AppData *app_data = wait_data->app_data;
+
+    app_data->bkr_wait = BKR_WAIT_DONE;
+    app_data->bkr_wait_interval = 0;
+    wait_data->resume (app_data);
+    g_free (wait_data->state_tag);
+    g_slice_free (BeakerWaitData, wait_data);
+}
+
+static gboolean
+beaker_wait_retry (gpointer user_data)
+{
+    BeakerWaitData *wait_data = (BeakerWaitData *) user_data;
+
+    if (g_cancellable_is_cancelled (wait_data->app_data->cancellable)) {
+        // Let the caller find out it was cancelled
+        beaker_wait_done (wait_data);
+    } else {
+        beaker_wait_check (wait_data);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void
+beaker_wait_health_cb (bkr_health_status_t status, gpointer user_data)
+{
+    BeakerWaitData *wait_data = (BeakerWaitData *) user_data;
+    AppData *app_data = wait_data->app_data;
+
+    if (status == BKR_HEALTH_STATUS_GOOD) {
+        beaker_wait_done (wait_data);
+        return;
+    }
+
+    app_data->bkr_wait_interval = rstrnt_bkr_backoff (app_data->bkr_wait_interval);
+    g_printerr ("%s: Waiting on Beaker for %u seconds\n", wait_data->state_tag,
+                app_data->bkr_wait_interval);
+    g_timeout_add_seconds (app_data->bkr_wait_interval, beaker_wait_retry,
+                           wait_data);
+}
+
+static void
+beaker_wait_check (BeakerWaitData *wait_data)
+{
+    rstrnt_bkr_check_recipe_async (soup_session, wait_data->app_data->recipe_url,
+                                   beaker_wait_health_cb, wait_data);
+}
+
 /*
- * Waits for 60 seconds if Beaker's recipe health status is not GOOD.
+ * Checks Beaker's recipe health without blocking the main loop.  Until it
+ * is GOOD the check is repeated, backing off between attempts, after
+ * which resume is called and the next call returns FALSE.
  *
- * Returns TRUE if wait was done, FALSE otherwise.
+ * Returns TRUE if the caller has to wait for resume, FALSE otherwise.
  */
 gboolean
-recipe_wait_on_beaker (const gchar *recipe_url, const gchar *state_tag)
+recipe_wait_on_beaker (gpointer user_data, const gchar *state_tag,
+                       RecipeWaitResume resume)
 {
-    g_return_val_if_fail (recipe_url != NULL, FALSE);
+    AppData *app_data = (AppData *) user_data;
+    BeakerWaitData *wait_data;
+
+    g_return_val_if_fail (app_data->recipe_url != NULL, FALSE);
     g_return_val_if_fail (state_tag != NULL, FALSE);
     g_return_val_if_fail (BKR_ENV_EXISTS (), FALSE);
 
-    if (BKR_RECIPE_IS_HEALTHY (recipe_url))
-        return FALSE;
+    switch (app_data->bkr_wait) {
+        case BKR_WAIT_DONE:
+            app_data->bkr_wait = BKR_WAIT_NONE;
+            return FALSE;
+        case BKR_WAIT_PENDING:
+            return TRUE;
+        default:
+            break;
+    }
 
-    g_printerr ("%s", state_tag);
-    g_printerr (": Waiting on Beaker for 60 seconds\n");
-    g_usleep (60 * G_USEC_PER_SEC);
+    wait_data = g_slice_new0 (BeakerWaitData);
+    wait_data->app_data = app_data;
+    wait_data->state_tag = g_strdup (state_tag);
+    wait_data->resume = resume;
+    app_data->bkr_wait = BKR_WAIT_PENDING;
+    beaker_wait_check (wait_data);
 
     return TRUE;
 }
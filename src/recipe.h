@@ -23,6 +23,10 @@
 #include <libsoup/soup.h>
 #include <libxml/tree.h>
 
+#include "env_map.h"
+#include "package_cache.h"
+#include "task_plugin.h"
+
 #define RECIPE_FETCH_INTERVAL 10
 #define RECIPE_FETCH_RETRIES 12
 
@@ -39,6 +43,14 @@ typedef enum {
     RECIPE_COMPLETE,
 } RecipeSetupState;
 
+typedef enum {
+    BKR_WAIT_NONE,
+    BKR_WAIT_PENDING, /* Health check or backoff in progress */
+    BKR_WAIT_DONE,    /* Beaker healthy, the caller may proceed */
+} BkrWaitState;
+
+typedef void (*RecipeWaitResume) (gpointer user_data);
+
 typedef struct {
     gchar *recipe_id;
     gchar *job_id;
@@ -49,12 +61,32 @@ typedef struct {
     gchar *osarch;
     gchar *owner;
     gchar *base_path;
-    GList *tasks; // list of Task *
+    GList *tasks; // list of Task *, built as the recipe gets to them
+    GQueue *task_xml; // <task/> elements not built yet, see restraint_recipe_next_task()
+    guint task_count; // <task/> elements in the recipe
     GList *params; // list of Params
     GList *roles; // list of Roles
     SoupURI *recipe_uri;
+    GHashTable *installed_deps; // packages installed by earlier tasks
+    RstrntPackageCache *packages; // rpmdb, loaded on first use
+    gchar *roles_etag; // validators of the last role refresh
+    gchar *roles_last_modified;
+    RstrntEnvMap *env; // variables shared by the tasks, see build_env()
+    RstrntHostFacts *host_facts; // looked up by the first task run
 } Recipe;
 
+/* Role refreshes done so far and the time spent on them */
+typedef struct {
+    guint64 refreshes;
+    guint64 not_modified;
+    guint64 errors;
+    gint64 fetch_us;
+    gint64 parse_us;
+    gint64 last_us;
+} RecipeRefreshStats;
+
+typedef void (*RecipeRefreshCallback) (GError *error, gpointer user_data);
+
 #define RESTRAINT_RECIPE_PARSE_ERROR restraint_recipe_parse_error_quark()
 GQuark restraint_recipe_parse_error_quark(void);
 typedef enum {
@@ -63,9 +95,23 @@ typedef enum {
 
 gboolean recipe_handler (gpointer user_data);
 void restraint_recipe_parse_stream (GInputStream *stream, gpointer user_data);
+Recipe *restraint_recipe_parse (GBytes *xml, SoupURI *recipe_uri, GError **error,
+                                gchar **cfg_file);
+GList *restraint_recipe_next_task (Recipe *recipe, GList *current, GError **error);
 void restraint_recipe_update_roles(Recipe *recipe, xmlDoc *doc, GError **error);
+gboolean restraint_recipe_update_roles_from_memory (Recipe *recipe,
+                                                    const gchar *buffer,
+                                                    gsize length,
+                                                    const gchar *url,
+                                                    GError **error);
+void restraint_recipe_refresh_roles (SoupSession *session, Recipe *recipe,
+                                     const gchar *url,
+                                     RecipeRefreshCallback callback,
+                                     gpointer user_data);
+const RecipeRefreshStats *restraint_recipe_refresh_stats (void);
 void restraint_recipe_free(Recipe *recipe);
 void recipe_handler_finish (gpointer user_data);
-gboolean recipe_wait_on_beaker (const gchar *recipe_url, const gchar *state_tag);
+gboolean recipe_wait_on_beaker (gpointer user_data, const gchar *state_tag,
+                                RecipeWaitResume resume);
 
 #endif
@@ -0,0 +1,479 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <gmodule.h>
+#include <libsoup/soup.h>
+
+#include "report_plugin.h"
+#include "utils.h"
+
+/*
+ * report_result plugins used to be a chain of shell scripts forked for
+ * every result.  Now every entry of report_result.d which has a native
+ * implementation, either built in or a shared object, runs on a worker
+ * thread and only the entries left over go through the shell runner.
+ */
+
+#define REPORT_PLUGIN_CHUNK 131072
+#define REPORT_PLUGIN_OUTPUT "resultoutputfile.log"
+
+GQuark
+rstrnt_report_plugin_error_quark (void)
+{
+    return g_quark_from_static_string ("rstrnt-report-plugin-error-quark");
+}
+
+typedef struct {
+    guint64 runs;
+    guint64 failures;     /* verdicts with fail set */
+    guint64 errors;
+    gint64 total_us;
+    gint64 max_us;
+} ReportPluginStats;
+
+typedef struct {
+    gchar *task_name;
+    gchar *result_url;
+    gchar **env;
+    GPtrArray *plugins;       /* const RstrntReportPlugin *, in order */
+    GPtrArray *entries;       /* report_result.d entry of each plugin */
+    GPtrArray *skip;          /* names the shell runner must not run */
+    gboolean shell_needed;
+    RstrntReportPluginsCallback callback;
+    gpointer user_data;
+} ReportJob;
+
+/* Only touched from the main loop */
+static GHashTable *report_modules = NULL;   /* path -> plugin or NULL */
+static GThreadPool *report_pool = NULL;
+
+/* Shared with the workers */
+static GMutex report_stats_lock;
+static GHashTable *report_stats = NULL;     /* name -> ReportPluginStats */
+
+static void
+report_job_free (ReportJob *job)
+{
+    g_free (job->task_name);
+    g_free (job->result_url);
+    g_strfreev (job->env);
+    g_ptr_array_free (job->plugins, TRUE);
+    g_ptr_array_free (job->entries, TRUE);
+    g_ptr_array_free (job->skip, TRUE);
+    g_slice_free (ReportJob, job);
+}
+
+static void
+report_plugin_account (const gchar *name, gint64 elapsed, gboolean ok,
+                       gboolean fail)
+{
+    ReportPluginStats *stats;
+
+    g_mutex_lock (&report_stats_lock);
+    if (report_stats == NULL) {
+        report_stats = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, g_free);
+    }
+    stats = g_hash_table_lookup (report_stats, name);
+    if (stats == NULL) {
+        stats = g_new0 (ReportPluginStats, 1);
+        g_hash_table_insert (report_stats, g_strdup (name), stats);
+    }
+    stats->runs++;
+    stats->failures += fail ? 1 : 0;
+    stats->errors += ok ? 0 : 1;
+    stats->total_us += elapsed;
+    stats->max_us = MAX (stats->max_us, elapsed);
+    g_mutex_unlock (&report_stats_lock);
+
+    g_debug ("%s: %s took %" G_GINT64_FORMAT " us", __func__, name, elapsed);
+}
+
+/*
+ * One line per native plugin which has run so far:
+ * name runs failures errors total_ms avg_ms max_ms
+ */
+void
+rstrnt_report_plugins_stats (GString *out)
+{
+    GHashTableIter iter;
+    gpointer key;
+    GList *names = NULL;
+
+    g_mutex_lock (&report_stats_lock);
+    if (report_stats != NULL) {
+        g_hash_table_iter_init (&iter, report_stats);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+            names = g_list_prepend (names, key);
+        }
+        names = g_list_sort (names, (GCompareFunc) g_strcmp0);
+    }
+    for (GList *l = names; l; l = g_list_next (l)) {
+        ReportPluginStats *stats = g_hash_table_lookup (report_stats, l->data);
+        g_string_append_printf (out, "%s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                                " %" G_GUINT64_FORMAT " %.3f %.3f %.3f\n",
+                                (gchar *) l->data, stats->runs, stats->failures,
+                                stats->errors, stats->total_us / 1000.0,
+                                stats->total_us / 1000.0 / stats->runs,
+                                stats->max_us / 1000.0);
+    }
+    g_mutex_unlock (&report_stats_lock);
+    g_list_free (names);
+}
+
+/*
+ * Same as rstrnt-report-log, PUT in chunks with Content-Range.
+ */
+static gboolean
+report_plugin_put_log (SoupSession *session, const gchar *result_url,
+                       const gchar *name, GString *log, GError **error)
+{
+    gchar *url = g_strdup_printf ("%s/logs/%s", result_url, name);
+    gboolean ret = TRUE;
+
+    for (gsize offset = 0; ret && offset < log->len; offset += REPORT_PLUGIN_CHUNK) {
+        gsize len = MIN (log->len - offset, REPORT_PLUGIN_CHUNK);
+        SoupMessage *msg = soup_message_new ("PUT", url);
+
+        if (msg == NULL) {
+            g_set_error (error, RSTRNT_REPORT_PLUGIN_ERROR,
+                         RSTRNT_REPORT_PLUGIN_FAILED, "Malformed url: %s", url);
+            ret = FALSE;
+            break;
+        }
+        gchar *range = g_strdup_printf ("bytes %" G_GSIZE_FORMAT "-%" G_GSIZE_FORMAT
+                                        "/%" G_GSIZE_FORMAT,
+                                        offset, offset + len - 1, log->len);
+        soup_message_headers_append (msg->request_headers, "Content-Range", range);
+        soup_message_set_request (msg, "text/plain", SOUP_MEMORY_COPY,
+                                  log->str + offset, len);
+        guint status = soup_session_send_message (session, msg);
+        if (!SOUP_STATUS_IS_SUCCESSFUL (status)) {
+            g_set_error (error, RSTRNT_REPORT_PLUGIN_ERROR,
+                         RSTRNT_REPORT_PLUGIN_FAILED,
+                         "Uploading %s failed: %u %s", url, status,
+                         msg->reason_phrase);
+            ret = FALSE;
+        }
+        g_free (range);
+        g_object_unref (msg);
+    }
+    g_free (url);
+    return ret;
+}
+
+/*
+ * Same as rstrnt-report-result --no-plugins TEST/plugin FAIL 0 with the
+ * output attached.
+ */
+static gboolean
+report_plugin_post_fail (SoupSession *session, ReportJob *job,
+                         const gchar *name, GString *output, GError **error)
+{
+    SoupURI *result_uri = soup_uri_new (job->result_url);
+    gboolean ret = FALSE;
+
+    if (result_uri == NULL) {
+        g_set_error (error, RSTRNT_REPORT_PLUGIN_ERROR,
+                     RSTRNT_REPORT_PLUGIN_FAILED, "Malformed url: %s",
+                     job->result_url);
+        return FALSE;
+    }
+    // The result collection the triggering result was posted to
+    SoupURI *results_uri = soup_uri_new_with_base (result_uri, "./");
+    SoupMessage *msg = soup_message_new_from_uri ("POST", results_uri);
+    gchar *path = g_strdup_printf ("%s/%s", job->task_name, name);
+    gchar *form = soup_form_encode ("path", path, "result", "FAIL",
+                                    "score", "0", "no_plugins", "1", NULL);
+
+    soup_message_set_request (msg, "application/x-www-form-urlencoded",
+                              SOUP_MEMORY_TAKE, form, strlen (form));
+    guint status = soup_session_send_message (session, msg);
+    if (SOUP_STATUS_IS_SUCCESSFUL (status)) {
+        const gchar *location = soup_message_headers_get_one (msg->response_headers,
+                                                              "Location");
+        ret = location == NULL || output->len == 0 ||
+            report_plugin_put_log (session, location, REPORT_PLUGIN_OUTPUT,
+                                   output, error);
+    } else {
+        g_set_error (error, RSTRNT_REPORT_PLUGIN_ERROR,
+                     RSTRNT_REPORT_PLUGIN_FAILED,
+                     "Failed to submit result, status: %u Message: %s",
+                     status, msg->reason_phrase);
+    }
+
+    g_free (path);
+    g_object_unref (msg);
+    soup_uri_free (results_uri);
+    soup_uri_free (result_uri);
+    return ret;
+}
+
+static void
+report_job_deliver (SoupSession *session, ReportJob *job, const gchar *name,
+                    RstrntReportVerdict *verdict)
+{
+    GError *error = NULL;
+
+    if (verdict->log->len > 0 &&
+            !report_plugin_put_log (session, job->result_url,
+                                    verdict->log_name ? verdict->log_name : "plugin.log",
+                                    verdict->log, &error)) {
+        g_warning ("** ERROR: plugin %s: %s", name, error->message);
+        g_clear_error (&error);
+    }
+    if (verdict->fail &&
+            !report_plugin_post_fail (session, job, name, verdict->output, &error)) {
+        g_warning ("** ERROR: plugin %s: %s", name, error->message);
+        g_clear_error (&error);
+    }
+}
+
+static gboolean
+report_job_done (gpointer user_data)
+{
+    ReportJob *job = user_data;
+    gchar *shell_disabled = NULL;
+
+    if (job->shell_needed) {
+        g_ptr_array_add (job->skip, NULL);
+        shell_disabled = g_strjoinv (" ", (gchar **) job->skip->pdata);
+        g_ptr_array_remove_index (job->skip, job->skip->len - 1);
+    }
+    job->callback (shell_disabled, job->user_data);
+    g_free (shell_disabled);
+    report_job_free (job);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+report_job_unskip (ReportJob *job, const gchar *entry)
+{
+    for (guint i = 0; i < job->skip->len; i++) {
+        if (STREQ (g_ptr_array_index (job->skip, i), entry)) {
+            g_ptr_array_remove_index (job->skip, i);
+            break;
+        }
+    }
+    job->shell_needed = TRUE;
+}
+
+/*
+ * Runs on a worker, the plugins of one result run one after the other so
+ * checks still see the state the previous ones left behind.
+ */
+static void
+report_job_run (gpointer data, gpointer user_data)
+{
+    ReportJob *job = data;
+    SoupSession *session = NULL;
+    RstrntReportContext context = {
+        .task_name = job->task_name,
+        .result_url = job->result_url,
+        .env = (const gchar *const *) job->env,
+    };
+
+    for (guint i = 0; i < job->plugins->len; i++) {
+        const RstrntReportPlugin *plugin = g_ptr_array_index (job->plugins, i);
+        const gchar *entry = g_ptr_array_index (job->entries, i);
+        RstrntReportVerdict verdict = {
+            .output = g_string_new (NULL),
+            .log = g_string_new (NULL),
+        };
+        GError *error = NULL;
+        gint64 start = g_get_monotonic_time ();
+        gboolean ok = plugin->run (&context, &verdict, &error);
+
+        report_plugin_account (plugin->name, g_get_monotonic_time () - start,
+                               ok, ok && verdict.fail);
+        if (!ok) {
+            if (g_error_matches (error, RSTRNT_REPORT_PLUGIN_ERROR,
+                                 RSTRNT_REPORT_PLUGIN_UNSUPPORTED) &&
+                    !g_str_has_suffix (entry, "." G_MODULE_SUFFIX)) {
+                // Let the shell plugin of the same name do it
+                g_debug ("%s: %s: %s", __func__, entry, error->message);
+                report_job_unskip (job, entry);
+            } else {
+                g_warning ("** ERROR: plugin %s: %s", plugin->name, error->message);
+            }
+            g_clear_error (&error);
+        } else if (job->result_url != NULL) {
+            if (session == NULL) {
+                session = soup_session_new_with_options ("timeout", 3600, NULL);
+            }
+            report_job_deliver (session, job, plugin->name, &verdict);
+        }
+        g_string_free (verdict.output, TRUE);
+        g_string_free (verdict.log, TRUE);
+    }
+
+    if (session != NULL) {
+        soup_session_abort (session);
+        g_object_unref (session);
+    }
+    g_main_context_invoke (NULL, report_job_done, job);
+}
+
+static const RstrntReportPlugin *
+report_plugin_builtin (const gchar *name)
+{
+    const RstrntReportPlugin *const *builtin = rstrnt_report_plugins_builtin ();
+
+    for (; *builtin != NULL; builtin++) {
+        if (STREQ ((*builtin)->name, name)) {
+            return *builtin;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Shared objects are loaded once and stay resident, a broken one is
+ * remembered as such and not retried.
+ */
+static const RstrntReportPlugin *
+report_plugin_load (const gchar *path)
+{
+    const RstrntReportPlugin *plugin = NULL;
+    RstrntReportPluginEntry entry = NULL;
+    gpointer cached;
+    GModule *module;
+
+    if (report_modules == NULL) {
+        report_modules = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
+    }
+    if (g_hash_table_lookup_extended (report_modules, path, NULL, &cached)) {
+        return cached;
+    }
+
+    module = g_module_open (path, G_MODULE_BIND_LOCAL);
+    if (module == NULL) {
+        g_warning ("** ERROR: loading plugin %s: %s", path, g_module_error ());
+    } else if (!g_module_symbol (module, RSTRNT_REPORT_PLUGIN_SYMBOL,
+                                 (gpointer *) &entry) || entry == NULL) {
+        g_warning ("** ERROR: plugin %s has no %s", path,
+                   RSTRNT_REPORT_PLUGIN_SYMBOL);
+    } else {
+        plugin = entry ();
+        if (plugin == NULL || plugin->abi != RSTRNT_REPORT_PLUGIN_ABI ||
+                plugin->name == NULL || plugin->run == NULL) {
+            g_warning ("** ERROR: plugin %s: unsupported ABI", path);
+            plugin = NULL;
+        }
+    }
+
+    if (plugin != NULL) {
+        g_module_make_resident (module);
+    } else if (module != NULL) {
+        g_module_close (module);
+    }
+    g_hash_table_insert (report_modules, g_strdup (path), (gpointer) plugin);
+    return plugin;
+}
+
+static gint
+report_plugin_compare (gconstpointer a, gconstpointer b)
+{
+    return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/*
+ * Run the report_result plugins in plugin_dir for a result.  The callback
+ * is invoked from the main loop, possibly before this returns when there
+ * is nothing to run natively.
+ */
+void
+rstrnt_report_plugins_run (const gchar *plugin_dir,
+                           const gchar *task_name,
+                           const gchar *result_url,
+                           const gchar *const *env,
+                           const gchar *disabled,
+                           RstrntReportPluginsCallback callback,
+                           gpointer user_data)
+{
+    ReportJob *job = g_slice_new0 (ReportJob);
+    GPtrArray *entries = g_ptr_array_new_with_free_func (g_free);
+    gchar **disabledv = g_strsplit (disabled != NULL ? disabled : "", " ", -1);
+    GDir *dir = g_dir_open (plugin_dir, 0, NULL);
+    const gchar *entry;
+
+    job->task_name = g_strdup (task_name);
+    job->result_url = g_strdup (result_url);
+    job->env = g_strdupv ((gchar **) env);
+    job->plugins = g_ptr_array_new ();
+    job->entries = g_ptr_array_new_with_free_func (g_free);
+    job->skip = g_ptr_array_new_with_free_func (g_free);
+    job->callback = callback;
+    job->user_data = user_data;
+
+    for (gchar **name = disabledv; *name != NULL; name++) {
+        if (**name != '\0') {
+            g_ptr_array_add (job->skip, g_strdup (*name));
+        }
+    }
+
+    while (dir != NULL && (entry = g_dir_read_name (dir)) != NULL) {
+        g_ptr_array_add (entries, g_strdup (entry));
+    }
+    if (dir != NULL) {
+        g_dir_close (dir);
+    }
+    // Same order as the shell glob
+    g_ptr_array_sort (entries, report_plugin_compare);
+
+    for (guint i = 0; i < entries->len; i++) {
+        const gchar *name = g_ptr_array_index (entries, i);
+        const RstrntReportPlugin *plugin;
+
+        if (g_strv_contains ((const gchar *const *) disabledv, name)) {
+            continue;
+        }
+        if (g_str_has_suffix (name, "." G_MODULE_SUFFIX)) {
+            gchar *path = g_build_filename (plugin_dir, name, NULL);
+            plugin = report_plugin_load (path);
+            g_free (path);
+            // Never hand a shared object to the shell
+            g_ptr_array_add (job->skip, g_strdup (name));
+        } else {
+            plugin = report_plugin_builtin (name);
+            if (plugin != NULL) {
+                g_ptr_array_add (job->skip, g_strdup (name));
+            } else {
+                job->shell_needed = TRUE;
+            }
+        }
+        if (plugin != NULL) {
+            g_ptr_array_add (job->plugins, (gpointer) plugin);
+            g_ptr_array_add (job->entries, g_strdup (name));
+        }
+    }
+    g_ptr_array_free (entries, TRUE);
+    g_strfreev (disabledv);
+
+    if (job->plugins->len == 0) {
+        report_job_done (job);
+        return;
+    }
+
+    if (report_pool == NULL) {
+        report_pool = g_thread_pool_new (report_job_run, NULL,
+                                         REPORT_PLUGIN_WORKERS, FALSE, NULL);
+    }
+    g_thread_pool_push (report_pool, job, NULL);
+}
@@ -0,0 +1,106 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_REPORT_PLUGIN_H
+#define _RESTRAINT_REPORT_PLUGIN_H
+
+#include <glib.h>
+
+/*
+ * Plugin ABI
+ *
+ * A native report_result plugin is a shared object in report_result.d
+ * exporting RSTRNT_REPORT_PLUGIN_SYMBOL, a function returning a pointer to
+ * a static RstrntReportPlugin.  The run function is called from a worker
+ * thread once for every result reported without --no-plugins.  It must not
+ * touch the main loop, anything it wants reported goes into the verdict and
+ * restraintd takes care of the rest.
+ */
+#define RSTRNT_REPORT_PLUGIN_ABI 1
+#define RSTRNT_REPORT_PLUGIN_SYMBOL "rstrnt_report_plugin"
+
+typedef struct {
+    const gchar *task_name;   /* TEST, results are reported below it */
+    const gchar *result_url;  /* RSTRNT_RESULT_URL, the result just reported */
+    const gchar *const *env;  /* environment of the task, NULL terminated */
+} RstrntReportContext;
+
+typedef struct {
+    /* Report an additional FAIL named task_name/plugin with output as its
+     * log. */
+    gboolean fail;
+    GString *output;
+    /* Attach log to the result just reported when not empty. */
+    GString *log;
+    const gchar *log_name;
+} RstrntReportVerdict;
+
+/* Return FALSE and set error when the check could not be done.  Errors in
+ * the RSTRNT_REPORT_PLUGIN_ERROR domain with code
+ * RSTRNT_REPORT_PLUGIN_UNSUPPORTED make restraintd run the shell plugin of
+ * the same name instead. */
+typedef gboolean (*RstrntReportFunc) (const RstrntReportContext *context,
+                                      RstrntReportVerdict *verdict,
+                                      GError **error);
+
+typedef struct {
+    guint abi;
+    const gchar *name;
+    RstrntReportFunc run;
+} RstrntReportPlugin;
+
+typedef const RstrntReportPlugin *(*RstrntReportPluginEntry) (void);
+
+#define RSTRNT_REPORT_PLUGIN_ERROR rstrnt_report_plugin_error_quark ()
+GQuark rstrnt_report_plugin_error_quark (void);
+typedef enum {
+    RSTRNT_REPORT_PLUGIN_UNSUPPORTED,
+    RSTRNT_REPORT_PLUGIN_LOAD_FAILED,
+    RSTRNT_REPORT_PLUGIN_FAILED,
+} RstrntReportPluginError;
+
+/*
+ * Host
+ */
+#define REPORT_PLUGIN_WORKERS 4
+
+/* Called in the main loop once the native plugins are done.  shell_disabled
+ * is the RSTRNT_DISABLED value for running the remaining shell plugins,
+ * NULL when there are none left to run. */
+typedef void (*RstrntReportPluginsCallback) (const gchar *shell_disabled,
+                                             gpointer user_data);
+
+void rstrnt_report_plugins_run (const gchar *plugin_dir,
+                                const gchar *task_name,
+                                const gchar *result_url,
+                                const gchar *const *env,
+                                const gchar *disabled,
+                                RstrntReportPluginsCallback callback,
+                                gpointer user_data);
+void rstrnt_report_plugins_stats (GString *out);
+
+/*
+ * Built-in replacements for the shell plugins shipped with restraint
+ */
+const RstrntReportPlugin *const *rstrnt_report_plugins_builtin (void);
+gchar *rstrnt_dmesg_scan (const gchar *dmesg, GRegex *failure,
+                          GRegex *false_strings);
+gchar *rstrnt_avc_scan (const gchar *audit_log, gint64 since);
+gboolean rstrnt_kmsg_record (const gchar *record, gsize length, guint64 *seq,
+                             GString *out);
+
+#endif
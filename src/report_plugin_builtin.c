@@ -0,0 +1,678 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/klog.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "report_plugin.h"
+#include "utils.h"
+
+/*
+ * Native versions of the plugins in plugins/report_result.d.  They behave
+ * like the scripts of the same name, anything they can't do here (no
+ * access to the kernel log, no readable audit log, ...) is reported as
+ * unsupported and the script runs instead.
+ */
+
+#define SYSLOG_ACTION_READ_ALL 3
+#define SYSLOG_ACTION_CLEAR 5
+#define SYSLOG_ACTION_SIZE_BUFFER 10
+
+#define DMESG_FAILURE_FILE "/usr/share/rhts/failurestrings"
+#define DMESG_FAILURE_DEFAULT "Oops|BUG|NMI appears to be stuck|Badness at"
+#define DMESG_FALSE_FILE "/usr/share/rhts/falsestrings"
+#define DMESG_FALSE_DEFAULT "BIOS BUG|DEBUG|mapping multiple BARs.*IBM System X3250 M4"
+#define DMESG_SEPARATOR "====================================================\n"
+#define DMESG_KMSG "/dev/kmsg"
+#define DMESG_CURSOR_FILE "/var/lib/restraint/dmesg_cursor"
+#define DMESG_BOOT_ID "/proc/sys/kernel/random/boot_id"
+#define DMESG_RECORD_MAX 8192
+
+#define AVC_SINCE_FILE "/var/lib/restraint/avc_since"
+#define AVC_AUDIT_LOG "/var/log/audit/audit.log"
+#define AVC_SELINUX_ENFORCE "/sys/fs/selinux/enforce"
+
+/* Kernel log and avc_since are global, check and clear must not overlap */
+static GMutex dmesg_lock;
+static GMutex avc_lock;
+
+/*
+ * Records already looked at.  The descriptor stays open so every read
+ * picks up where the last one stopped, the cursor only matters when
+ * restraintd restarts within the same boot.  Protected by dmesg_lock.
+ */
+static gint kmsg_fd = -1;
+static gboolean kmsg_unavailable = FALSE;
+static gboolean kmsg_have_cursor = FALSE;
+static guint64 kmsg_cursor = 0;
+
+/* Compiled patterns, FAILURESTRINGS and FALSESTRINGS rarely change */
+static GMutex regex_lock;
+static GHashTable *regex_cache = NULL;
+
+static const gchar *
+report_env (const RstrntReportContext *context, const gchar *name)
+{
+    const gchar *value = g_environ_getenv ((gchar **) context->env, name);
+    // Empty counts as unset, as with test -z
+    return (value != NULL && *value != '\0') ? value : NULL;
+}
+
+static GRegex *
+report_regex (const gchar *pattern, GError **error)
+{
+    GRegex *regex;
+
+    g_mutex_lock (&regex_lock);
+    if (regex_cache == NULL) {
+        regex_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify) g_regex_unref);
+    }
+    regex = g_hash_table_lookup (regex_cache, pattern);
+    if (regex == NULL) {
+        regex = g_regex_new (pattern, G_REGEX_OPTIMIZE, 0, error);
+        if (regex != NULL) {
+            g_hash_table_insert (regex_cache, g_strdup (pattern), regex);
+        }
+    }
+    if (regex != NULL) {
+        g_regex_ref (regex);
+    }
+    g_mutex_unlock (&regex_lock);
+    return regex;
+}
+
+static gboolean
+report_unsupported (GError **error, const gchar *what, gint errsv)
+{
+    g_set_error (error, RSTRNT_REPORT_PLUGIN_ERROR,
+                 RSTRNT_REPORT_PLUGIN_UNSUPPORTED, "%s: %s", what,
+                 g_strerror (errsv));
+    return FALSE;
+}
+
+/*
+ * Strings in file take precedence over the default, the environment
+ * variable over both.  Blank lines in file are dropped and the rest joined
+ * with '|'.
+ */
+static gchar *
+dmesg_strings (const RstrntReportContext *context, const gchar *file,
+               const gchar *variable, const gchar *fallback,
+               const gchar *label, gchar **selector)
+{
+    const gchar *value = report_env (context, variable);
+    gchar *contents = NULL;
+    gsize length = 0;
+
+    if (value != NULL) {
+        *selector = g_strdup_printf ("%s Environment Variable", variable);
+        return g_strdup (value);
+    }
+    if (g_file_get_contents (file, &contents, &length, NULL) && length > 0) {
+        gchar **lines = g_strsplit (contents, "\n", -1);
+        GString *joined = g_string_new (NULL);
+        for (gchar **line = lines; *line != NULL; line++) {
+            if (**line == '\0' || strspn (*line, " ") == strlen (*line)) {
+                continue;
+            }
+            if (joined->len > 0) {
+                g_string_append_c (joined, '|');
+            }
+            g_string_append (joined, *line);
+        }
+        g_strfreev (lines);
+        g_free (contents);
+        *selector = g_strdup_printf ("%s file", label);
+        return g_string_free (joined, FALSE);
+    }
+    g_free (contents);
+    *selector = g_strdup_printf ("Default %s", variable);
+    return g_strdup (fallback);
+}
+
+static void
+dmesg_describe_file (GString *out, const gchar *file, const gchar *label)
+{
+    gchar *contents = NULL;
+    gsize length = 0;
+
+    if (!g_file_test (file, G_FILE_TEST_EXISTS)) {
+        g_string_append_printf (out, "%s file not found.\n", label);
+    } else if (!g_file_get_contents (file, &contents, &length, NULL) ||
+               length == 0) {
+        g_string_append_printf (out, "%s file found but empty.\n", label);
+    } else {
+        g_string_append_printf (out, "%s file found and contains:\n", label);
+        g_string_append_len (out, contents, length);
+    }
+    g_free (contents);
+}
+
+/*
+ * Everything between "cut here" and "end trace" is one trace and reported
+ * unless false_strings matches somewhere in it, every other line is
+ * reported when failure matches and false_strings doesn't.  Returns NULL
+ * when there is nothing to report.
+ */
+gchar *
+rstrnt_dmesg_scan (const gchar *dmesg, GRegex *failure, GRegex *false_strings)
+{
+    GString *out = g_string_new (NULL);
+    GString *lines = g_string_new (NULL);
+    GString *trace = NULL;
+    gchar **split = g_strsplit (dmesg, "\n", -1);
+
+    for (gchar **line = split; *line != NULL; line++) {
+        if (trace == NULL && strstr (*line, "cut here") != NULL) {
+            trace = g_string_new (NULL);
+        }
+        if (trace == NULL) {
+            if (**line != '\0' &&
+                    !g_regex_match (false_strings, *line, 0, NULL) &&
+                    g_regex_match (failure, *line, 0, NULL)) {
+                g_string_append_printf (lines, "%s\n", *line);
+            }
+            continue;
+        }
+        g_string_append_printf (trace, "%s\n", *line);
+        if (strstr (*line, "end trace") != NULL || *(line + 1) == NULL) {
+            // Matched as a single line like paste -s | grep does
+            gchar *joined = g_strdelimit (g_strdup (trace->str), "\n", '\t');
+            if (!g_regex_match (false_strings, joined, 0, NULL)) {
+                g_string_append (out, trace->str);
+            }
+            g_free (joined);
+            g_string_free (trace, TRUE);
+            trace = NULL;
+        }
+    }
+    g_strfreev (split);
+
+    // Traces first, then the single lines, same as the script
+    g_string_append (out, lines->str);
+    g_string_free (lines, TRUE);
+    if (out->len == 0) {
+        g_string_free (out, TRUE);
+        return NULL;
+    }
+    return g_string_free (out, FALSE);
+}
+
+/*
+ * Parses one /dev/kmsg record, "level,seq,usec,flags;message" followed by
+ * optional " KEY=value" dictionary lines, and appends the message to out
+ * the way dmesg prints it.  Returns FALSE if record isn't one.
+ */
+gboolean
+rstrnt_kmsg_record (const gchar *record, gsize length, guint64 *seq,
+                    GString *out)
+{
+    const gchar *end = record + length;
+    const gchar *message = memchr (record, ';', length);
+    gchar *field;
+    guint64 usec;
+
+    if (message == NULL) {
+        return FALSE;
+    }
+    field = (gchar *) record;
+    g_ascii_strtoull (field, &field, 10);
+    if (*field != ',') {
+        return FALSE;
+    }
+    *seq = g_ascii_strtoull (field + 1, &field, 10);
+    if (*field != ',') {
+        return FALSE;
+    }
+    usec = g_ascii_strtoull (field + 1, &field, 10);
+    if (*field != ',' && *field != ';') {
+        return FALSE;
+    }
+    if (out == NULL) {
+        return TRUE;
+    }
+
+    g_string_append_printf (out, "[%5" G_GUINT64_FORMAT ".%06" G_GUINT64_FORMAT
+                            "] ", usec / G_USEC_PER_SEC, usec % G_USEC_PER_SEC);
+    // Non printable characters, newlines included, come escaped as \xNN
+    for (const gchar *c = message + 1; c < end && *c != '\n'; c++) {
+        if (*c == '\\' && end - c >= 4 && c[1] == 'x' &&
+                g_ascii_isxdigit (c[2]) && g_ascii_isxdigit (c[3])) {
+            g_string_append_c (out, g_ascii_xdigit_value (c[2]) << 4 |
+                                    g_ascii_xdigit_value (c[3]));
+            c += 3;
+        } else {
+            g_string_append_c (out, *c);
+        }
+    }
+    g_string_append_c (out, '\n');
+    return TRUE;
+}
+
+static gchar *
+kmsg_boot_id (void)
+{
+    gchar *boot_id = NULL;
+
+    if (g_file_get_contents (DMESG_BOOT_ID, &boot_id, NULL, NULL)) {
+        g_strstrip (boot_id);
+    }
+    return boot_id;
+}
+
+/*
+ * Sequence numbers restart on boot, a cursor saved by another boot is
+ * worthless.
+ */
+static void
+kmsg_load_cursor (void)
+{
+    gchar *contents = NULL;
+    gchar *boot_id = kmsg_boot_id ();
+    gchar **fields = NULL;
+
+    if (boot_id != NULL &&
+            g_file_get_contents (DMESG_CURSOR_FILE, &contents, NULL, NULL)) {
+        fields = g_strsplit (g_strstrip (contents), " ", 2);
+        if (g_strv_length (fields) == 2 && STREQ (fields[0], boot_id)) {
+            kmsg_cursor = g_ascii_strtoull (fields[1], NULL, 10);
+            kmsg_have_cursor = TRUE;
+        }
+    }
+    g_strfreev (fields);
+    g_free (contents);
+    g_free (boot_id);
+}
+
+static void
+kmsg_save_cursor (void)
+{
+    gchar *boot_id = kmsg_boot_id ();
+    gchar *contents;
+    GError *error = NULL;
+
+    if (boot_id == NULL) {
+        return;
+    }
+    contents = g_strdup_printf ("%s %" G_GUINT64_FORMAT "\n", boot_id,
+                                kmsg_cursor);
+    if (!g_file_set_contents (DMESG_CURSOR_FILE, contents, -1, &error)) {
+        g_warning ("Saving kernel log cursor: %s", error->message);
+        g_clear_error (&error);
+    }
+    g_free (contents);
+    g_free (boot_id);
+}
+
+/*
+ * Appends the records logged since the last call to out, or just skips
+ * past them when out is NULL.  Returns FALSE when /dev/kmsg can't be used
+ * and the whole buffer has to be read instead.  Called with dmesg_lock
+ * held.
+ */
+static gboolean
+kmsg_read (GString *out)
+{
+    gchar record[DMESG_RECORD_MAX];
+    gboolean advanced = FALSE;
+    guint64 seq;
+
+    if (kmsg_unavailable) {
+        return FALSE;
+    }
+    if (kmsg_fd < 0) {
+        kmsg_fd = g_open (DMESG_KMSG, O_RDONLY | O_NONBLOCK, 0);
+        if (kmsg_fd < 0) {
+            kmsg_unavailable = TRUE;
+            return FALSE;
+        }
+        // Tasks have no business with our read position
+        fcntl (kmsg_fd, F_SETFD, FD_CLOEXEC);
+        kmsg_load_cursor ();
+    }
+
+    for (;;) {
+        // One record per read
+        gssize length = read (kmsg_fd, record, sizeof (record));
+        if (length < 0) {
+            if (errno == EINTR || errno == EPIPE) {
+                // EPIPE: overwritten before we got to it, carry on after
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            g_warning ("Reading %s: %s", DMESG_KMSG, g_strerror (errno));
+            close (kmsg_fd);
+            kmsg_fd = -1;
+            kmsg_unavailable = TRUE;
+            return FALSE;
+        }
+        if (!rstrnt_kmsg_record (record, length, &seq, NULL) ||
+                (kmsg_have_cursor && seq <= kmsg_cursor)) {
+            continue;
+        }
+        if (out != NULL) {
+            rstrnt_kmsg_record (record, length, &seq, out);
+        }
+        kmsg_cursor = seq;
+        kmsg_have_cursor = TRUE;
+        advanced = TRUE;
+    }
+    if (advanced) {
+        kmsg_save_cursor ();
+    }
+    return TRUE;
+}
+
+/*
+ * The raw kernel log, with the <level> prefixes dmesg strips.
+ */
+static gchar *
+dmesg_read (GError **error)
+{
+    gint size = klogctl (SYSLOG_ACTION_SIZE_BUFFER, NULL, 0);
+    if (size < 0) {
+        report_unsupported (error, "Reading kernel log size", errno);
+        return NULL;
+    }
+
+    gchar *buffer = g_malloc (size + 1);
+    gint length = klogctl (SYSLOG_ACTION_READ_ALL, buffer, size);
+    if (length < 0) {
+        report_unsupported (error, "Reading kernel log", errno);
+        g_free (buffer);
+        return NULL;
+    }
+    buffer[length] = '\0';
+
+    GString *out = g_string_sized_new (length);
+    for (gchar *line = buffer; *line != '\0';) {
+        gchar *end = strchr (line, '\n');
+        if (end == NULL) {
+            end = line + strlen (line);
+        }
+        if (*line == '<') {
+            gchar *close = memchr (line, '>', end - line);
+            if (close != NULL) {
+                line = close + 1;
+            }
+        }
+        g_string_append_len (out, line, end - line);
+        if (*end == '\0') {
+            break;
+        }
+        g_string_append_c (out, '\n');
+        line = end + 1;
+    }
+    g_free (buffer);
+    return g_string_free (out, FALSE);
+}
+
+static gboolean
+dmesg_check (const RstrntReportContext *context, RstrntReportVerdict *verdict,
+             GError **error)
+{
+    const gchar *failure_file = report_env (context, "FAILUREFILENM");
+    const gchar *false_file = report_env (context, "FALSEFILENM");
+    gchar *failure_selector = NULL, *false_selector = NULL;
+    gchar *failure_strings, *false_strings;
+    GRegex *failure = NULL, *false_regex = NULL;
+    gchar *dmesg = NULL, *found = NULL;
+    GError *regex_error = NULL;
+    gboolean ret = FALSE;
+
+    failure_file = failure_file ? failure_file : DMESG_FAILURE_FILE;
+    false_file = false_file ? false_file : DMESG_FALSE_FILE;
+    failure_strings = dmesg_strings (context, failure_file, "FAILURESTRINGS",
+                                     DMESG_FAILURE_DEFAULT, "failurestrings",
+                                     &failure_selector);
+    false_strings = dmesg_strings (context, false_file, "FALSESTRINGS",
+                                   DMESG_FALSE_DEFAULT, "falsestrings",
+                                   &false_selector);
+
+    failure = report_regex (failure_strings, &regex_error);
+    false_regex = failure ? report_regex (false_strings, &regex_error) : NULL;
+    if (false_regex == NULL) {
+        // Let grep have a go at it
+        g_set_error (error, RSTRNT_REPORT_PLUGIN_ERROR,
+                     RSTRNT_REPORT_PLUGIN_UNSUPPORTED,
+                     "Compiling dmesg selectors: %s", regex_error->message);
+        g_clear_error (&regex_error);
+        goto out;
+    }
+
+    g_mutex_lock (&dmesg_lock);
+    GString *kmsg = g_string_new (NULL);
+    if (kmsg_read (kmsg)) {
+        dmesg = g_string_free (kmsg, FALSE);
+    } else {
+        g_string_free (kmsg, TRUE);
+        dmesg = dmesg_read (error);
+    }
+    g_mutex_unlock (&dmesg_lock);
+    if (dmesg == NULL) {
+        goto out;
+    }
+
+    if (*dmesg != '\0') {
+        g_string_append (verdict->log, dmesg);
+        verdict->log_name = "dmesg.log";
+    }
+
+    found = rstrnt_dmesg_scan (dmesg, failure, false_regex);
+    if (found != NULL) {
+        GString *out = verdict->output;
+        verdict->fail = TRUE;
+        g_string_append (out, found);
+        g_string_append (out, DMESG_SEPARATOR "DMESG Selectors:\n");
+        g_string_append_printf (out, "Used %s and %s\n", failure_selector,
+                                false_selector);
+        g_string_append (out, DMESG_SEPARATOR);
+        g_string_append_printf (out, "FAILURESTRINGS: %s\n", failure_strings);
+        dmesg_describe_file (out, failure_file, "FailureStrings");
+        g_string_append (out, DMESG_SEPARATOR);
+        g_string_append_printf (out, "FALSESTRINGS: %s\n", false_strings);
+        dmesg_describe_file (out, false_file, "FalseStrings");
+        g_string_append (out, DMESG_SEPARATOR);
+    }
+    ret = TRUE;
+
+out:
+    if (failure != NULL) {
+        g_regex_unref (failure);
+    }
+    if (false_regex != NULL) {
+        g_regex_unref (false_regex);
+    }
+    g_free (found);
+    g_free (dmesg);
+    g_free (failure_strings);
+    g_free (false_strings);
+    g_free (failure_selector);
+    g_free (false_selector);
+    return ret;
+}
+
+static gboolean
+dmesg_clear (const RstrntReportContext *context, RstrntReportVerdict *verdict,
+             GError **error)
+{
+    gint ret = 0;
+
+    // With /dev/kmsg nothing needs clearing, skip what the check left
+    g_mutex_lock (&dmesg_lock);
+    if (!kmsg_read (NULL)) {
+        ret = klogctl (SYSLOG_ACTION_CLEAR, NULL, 0);
+    }
+    g_mutex_unlock (&dmesg_lock);
+    if (ret < 0) {
+        return report_unsupported (error, "Clearing kernel log", errno);
+    }
+    return TRUE;
+}
+
+/*
+ * Denials recorded at or after since, the equivalent of
+ * ausearch -m AVC -m USER_AVC -m SELINUX_ERR -sv no -ts since.  Returns
+ * NULL when there are none.
+ */
+gchar *
+rstrnt_avc_scan (const gchar *audit_log, gint64 since)
+{
+    GString *out = g_string_new (NULL);
+    gchar **lines = g_strsplit (audit_log, "\n", -1);
+
+    for (gchar **line = lines; *line != NULL; line++) {
+        const gchar *record = *line;
+        gboolean selinux_err = g_str_has_prefix (record, "type=SELINUX_ERR ") ||
+                               g_str_has_prefix (record, "type=USER_SELINUX_ERR ");
+
+        if (!selinux_err && !g_str_has_prefix (record, "type=AVC ") &&
+                !g_str_has_prefix (record, "type=USER_AVC ")) {
+            continue;
+        }
+        // Permissive denials don't fail the syscall
+        if (!selinux_err && (strstr (record, "denied") == NULL ||
+                             strstr (record, "permissive=1") != NULL)) {
+            continue;
+        }
+        const gchar *stamp = strstr (record, "msg=audit(");
+        if (stamp == NULL ||
+                g_ascii_strtoll (stamp + strlen ("msg=audit("), NULL, 10) < since) {
+            continue;
+        }
+        g_string_append_printf (out, "----\n%s\n", record);
+    }
+    g_strfreev (lines);
+
+    if (out->len == 0) {
+        g_string_free (out, TRUE);
+        return NULL;
+    }
+    return g_string_free (out, FALSE);
+}
+
+static gboolean
+avc_check (const RstrntReportContext *context, RstrntReportVerdict *verdict,
+           GError **error)
+{
+    gchar *enforce = NULL;
+    gchar *audit_log = NULL;
+    gchar *rotated = NULL;
+    gchar *found = NULL;
+    GStatBuf st;
+    gint64 since = 0;
+
+    if (!g_file_get_contents (AVC_SELINUX_ENFORCE, &enforce, NULL, NULL)) {
+        // selinux disabled, no avc check
+        return TRUE;
+    }
+
+    g_mutex_lock (&avc_lock);
+    if (g_stat (AVC_SINCE_FILE, &st) == 0) {
+        since = st.st_mtime;
+    }
+    g_mutex_unlock (&avc_lock);
+
+    if (!g_file_get_contents (AVC_AUDIT_LOG, &audit_log, NULL, NULL)) {
+        g_free (enforce);
+        return report_unsupported (error, "Reading " AVC_AUDIT_LOG, errno);
+    }
+    // The log may have been rotated since the last check
+    if (g_stat (AVC_AUDIT_LOG ".1", &st) == 0 && st.st_mtime >= since &&
+            g_file_get_contents (AVC_AUDIT_LOG ".1", &rotated, NULL, NULL)) {
+        gchar *both = g_strconcat (rotated, audit_log, NULL);
+        g_free (audit_log);
+        audit_log = both;
+    }
+
+    GString *out = verdict->output;
+    g_string_append_printf (out, "SELinux status:                 enabled\n"
+                            "Current mode:                   %s\n",
+                            enforce[0] == '1' ? "enforcing" : "permissive");
+
+    found = rstrnt_avc_scan (audit_log, since);
+    if (found != NULL) {
+        verdict->fail = TRUE;
+        g_string_append (out, found);
+    } else {
+        g_string_append (verdict->log, out->str);
+        g_string_append (verdict->log, "<no matches>\n");
+        verdict->log_name = "avc.log";
+    }
+
+    g_free (found);
+    g_free (rotated);
+    g_free (audit_log);
+    g_free (enforce);
+    return TRUE;
+}
+
+static gboolean
+avc_clear (const RstrntReportContext *context, RstrntReportVerdict *verdict,
+           GError **error)
+{
+    gint fd;
+    gboolean ret = TRUE;
+
+    g_mutex_lock (&avc_lock);
+    fd = g_open (AVC_SINCE_FILE, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0 || g_utime (AVC_SINCE_FILE, NULL) < 0) {
+        ret = report_unsupported (error, "Touching " AVC_SINCE_FILE, errno);
+    }
+    if (fd >= 0) {
+        g_close (fd, NULL);
+    }
+    g_mutex_unlock (&avc_lock);
+    return ret;
+}
+
+static const RstrntReportPlugin builtin_dmesg_check = {
+    RSTRNT_REPORT_PLUGIN_ABI, "01_dmesg_check", dmesg_check
+};
+static const RstrntReportPlugin builtin_avc_check = {
+    RSTRNT_REPORT_PLUGIN_ABI, "10_avc_check", avc_check
+};
+static const RstrntReportPlugin builtin_avc_clear = {
+    RSTRNT_REPORT_PLUGIN_ABI, "20_avc_clear", avc_clear
+};
+static const RstrntReportPlugin builtin_dmesg_clear = {
+    RSTRNT_REPORT_PLUGIN_ABI, "30_dmesg_clear", dmesg_clear
+};
+
+static const RstrntReportPlugin *const builtins[] = {
+    &builtin_dmesg_check,
+    &builtin_avc_check,
+    &builtin_avc_clear,
+    &builtin_dmesg_clear,
+    NULL
+};
+
+const RstrntReportPlugin *const *
+rstrnt_report_plugins_builtin (void)
+{
+    return builtins;
+}
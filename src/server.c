@@ -25,42 +25,64 @@
 #include <fcntl.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
+#include <json.h>
 #include "recipe.h"
 #include "task.h"
+#include "metadata.h"
 #include "errors.h"
 #include "common.h"
 #include "config.h"
 #include "process.h"
 #include "logging.h"
 #include "message.h"
+#include "metrics.h"
+#include "spool.h"
 #include "server.h"
+#include "trace.h"
+#include "report_plugin.h"
+#include "local_socket.h"
+#include "utils.h"
 
 SoupSession *soup_session;
 GMainLoop *loop;
 char *strsignal(int sig);
 
-static void
-copy_header (SoupURI *uri, const char *name, const char *value, gpointer dest_headers)
+/*
+ * Point a Location handed back by the lab controller at uri, keeping
+ * just its path and query.
+ */
+static gchar *
+rebase_location (SoupURI *uri, const char *value)
 {
     SoupURI *old_uri = NULL;
     SoupURI *new_uri = NULL;
     gchar *just_path = NULL;
     gchar *new_val = NULL;
 
+    // convert value to URI
+    old_uri = soup_uri_new_with_base (uri, value);
+    // Get just the path and query
+    just_path = soup_uri_to_string (old_uri, TRUE);
+    // generate new uri with base plus path
+    new_uri = soup_uri_new_with_base (uri, just_path);
+    // convert to full url string
+    new_val = soup_uri_to_string (new_uri, FALSE);
+    g_free (just_path);
+    soup_uri_free (old_uri);
+    soup_uri_free (new_uri);
+
+    return new_val;
+}
+
+static void
+copy_header (SoupURI *uri, const char *name, const char *value, gpointer dest_headers)
+{
+    gchar *new_val = NULL;
+
     if (g_strcmp0 (name, "Location") == 0) {
-        // convert value to URI
-        old_uri = soup_uri_new_with_base (uri, value);
-        // Get just the path and query
-        just_path = soup_uri_to_string (old_uri, TRUE);
-        // generate new uri with base plus path
-        new_uri = soup_uri_new_with_base (uri, just_path);
-        // convert to full url string
-        new_val = soup_uri_to_string (new_uri, FALSE);
+        new_val = rebase_location (uri, value);
         soup_message_headers_append (dest_headers, name, new_val);
         g_free (new_val);
-        g_free (just_path);
-        soup_uri_free (old_uri);
-        soup_uri_free (new_uri);
     } else {
         soup_message_headers_append (dest_headers, name, value);
     }
@@ -156,6 +178,24 @@ server_io_callback (GIOChannel *io, GIOCondition condition, gpointer user_data)
     return G_SOURCE_REMOVE;
 }
 
+/* The report plugins are done with client_data */
+static void
+server_plugins_done (ClientData *client_data)
+{
+    AppData *app_data = (AppData *) client_data->user_data;
+
+    rstrnt_metrics_observe (METRIC_PLUGIN_DURATION,
+                            g_get_monotonic_time () - client_data->plugins_started);
+    if (client_data->answered) {
+        // The task waits in TASK_COMPLETE, it is still the current one
+        restraint_task_plugins_done (app_data, app_data->tasks->data);
+        g_object_unref (client_data->client_msg);
+    } else {
+        soup_server_unpause_message (client_data->server, client_data->client_msg);
+    }
+    g_slice_free (ClientData, client_data);
+}
+
 void
 plugin_finish_callback (gint pid_result, gboolean localwatchdog, gpointer user_data, GError *error)
 {
@@ -166,9 +206,101 @@ plugin_finish_callback (gint pid_result, gboolean localwatchdog, gpointer user_d
     if (pid_result != 0) {
         g_warning ("** ERROR: running plugins returned non-zero %i\n", pid_result);
     }
-    soup_server_unpause_message (client_data->server, client_data->client_msg);
+    server_plugins_done (client_data);
+}
 
-    g_slice_free(ClientData, client_data);
+/*
+ * Whatever has no native implementation still goes through the shell
+ * runner, disabled lists the plugins it has to skip.
+ */
+static void
+server_run_shell_plugins (ClientData *client_data, const gchar *disabled)
+{
+    AppData *app_data = (AppData *) client_data->user_data;
+    SoupMessage *client_msg = client_data->client_msg;
+    Task *task = app_data->tasks->data;
+
+    // Create a new ProcessCommand
+    const gchar *command[] = { PLUGIN_SCRIPT, NULL };
+    RstrntCgroup *plugin_cgroup = restraint_task_cgroup (task, "plugins");
+
+    // The plugin variables only live for this run
+    RstrntEnvMap *plugin_env = rstrnt_env_map_new (task->env);
+    rstrnt_env_map_setf (plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_RESULT_URL", "%s",
+                         soup_message_headers_get_one (client_msg->response_headers, "Location"));
+    rstrnt_env_map_setf (plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_PLUGINS_DIR", "%s/report_result.d", PLUGIN_DIR);
+    rstrnt_env_map_set (plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_NOPLUGINS", "1");
+    rstrnt_env_map_set (plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_DISABLED", disabled);
+    RstrntTaskPlugins *plugins = restraint_task_plugins (task, command, plugin_env);
+
+    process_run_argv ((const gchar *const *) plugins->argv,
+                      rstrnt_env_map_envp (plugins->env),
+                      "/usr/share/restraint/plugins",
+                      plugin_cgroup,
+                      &plugins->attrs,
+                      FALSE,
+                      NULL,
+                      NULL,
+                      server_io_callback,
+                      plugin_finish_callback,
+                      NULL,
+                      0,
+                      FALSE,
+                      app_data->cancellable,
+                      client_data);
+    rstrnt_task_plugins_free (plugins);
+    rstrnt_env_map_unref (plugin_env);
+    rstrnt_cgroup_unref (plugin_cgroup);
+}
+
+static void
+report_plugins_finish_cb (const gchar *shell_disabled, gpointer user_data)
+{
+    ClientData *client_data = (ClientData *) user_data;
+
+    if (shell_disabled != NULL) {
+        server_run_shell_plugins (client_data, shell_disabled);
+    } else {
+        server_plugins_done (client_data);
+    }
+}
+
+/*
+ * Runs the report plugins against the Location of the result in
+ * client_msg's response, they unpause it when done unless it was
+ * answered already.  Returns FALSE when the result asked for no plugins.
+ */
+static gboolean
+server_results_plugins (ClientData *client_data, Task *task)
+{
+    SoupMessage *client_msg = client_data->client_msg;
+    GHashTable *table;
+    gboolean no_plugins;
+
+    // Very important that we don't run plugins from results
+    // reported from the plugins themselves.
+    table = soup_form_decode (client_msg->request_body->data);
+    no_plugins = g_hash_table_lookup_extended (table, "no_plugins", NULL, NULL);
+
+    // Execute report plugins
+    if (!no_plugins) {
+        gchar *result_url = g_strdup (soup_message_headers_get_one (client_msg->response_headers, "Location"));
+        gchar *plugin_dir = g_strdup_printf ("%s/report_result.d", PLUGIN_DIR);
+
+        client_data->plugins_started = g_get_monotonic_time ();
+        rstrnt_report_plugins_run (plugin_dir,
+                                   task->name,
+                                   result_url,
+                                   rstrnt_env_map_envp (task->env),
+                                   g_hash_table_lookup (table, "disable_plugin"),
+                                   report_plugins_finish_cb,
+                                   client_data);
+        g_free (plugin_dir);
+        g_free (result_url);
+    }
+    g_hash_table_destroy (table);
+
+    return !no_plugins;
 }
 
 static void
@@ -178,7 +310,6 @@ server_msg_complete (SoupSession *session, SoupMessage *server_msg, gpointer use
     AppData *app_data = (AppData *) client_data->user_data;
     SoupMessage *client_msg = client_data->client_msg;
     Task *task = app_data->tasks->data;
-    GHashTable *table;
     gboolean no_plugins = FALSE;
     SoupMessageHeadersIter iter;
     const gchar *name, *value;
@@ -197,69 +328,574 @@ server_msg_complete (SoupSession *session, SoupMessage *server_msg, gpointer use
     soup_message_set_status (client_msg, server_msg->status_code);
 
     if (g_str_has_suffix (client_data->path, "/results/")) {
-        // Very important that we don't run plugins from results
-        // reported from the plugins themselves.
-        table = soup_form_decode (client_msg->request_body->data);
-        no_plugins = g_hash_table_lookup_extended (table, "no_plugins", NULL, NULL);
-
-        // Execute report plugins
-        if (!no_plugins) {
-            // Create a new ProcessCommand
-            gchar *command = g_strdup_printf ("%s %s", TASK_PLUGIN_SCRIPT, PLUGIN_SCRIPT);
-
-            // Last four entries are NULL.  Replace first three with plugin vars
-            gchar *result_server = g_strdup_printf("RSTRNT_RESULT_URL=%s", soup_message_headers_get_one (client_msg->response_headers, "Location"));
-            if (task->env->pdata[task->env->len - 5] != NULL) {
-                g_free (task->env->pdata[task->env->len - 5]);
-            }
-            task->env->pdata[task->env->len - 5] = result_server;
+        no_plugins = !server_results_plugins (client_data, task);
+    } else {
+        soup_server_unpause_message (client_data->server, client_msg);
+        g_slice_free (ClientData, client_data);
+    }
 
-            gchar *plugin_dir = g_strdup_printf("RSTRNT_PLUGINS_DIR=%s/report_result.d", PLUGIN_DIR);
-            if (task->env->pdata[task->env->len - 4] != NULL) {
-                g_free (task->env->pdata[task->env->len - 4]);
-            }
-            task->env->pdata[task->env->len - 4] = plugin_dir;
+    // If no plugins are running we should return to the client right away.
+    if (no_plugins) {
+        soup_server_unpause_message (client_data->server, client_msg);
+        g_slice_free (ClientData, client_data);
+    }
+}
 
-            gchar *no_plugins = g_strdup_printf("RSTRNT_NOPLUGINS=1");
-            if (task->env->pdata[task->env->len - 3] != NULL) {
-                g_free (task->env->pdata[task->env->len - 3]);
-            }
-            task->env->pdata[task->env->len - 3] = no_plugins;
-            gchar *disable_plugin = g_hash_table_lookup (table, "disable_plugin");
-            if (disable_plugin) {
-                gchar *disabled_plugins = g_strdup_printf ("RSTRNT_DISABLED=%s", disable_plugin);
-                if (task->env->pdata[task->env->len - 2] != NULL) {
-                    g_free (task->env->pdata[task->env->len - 2]);
-                }
-                task->env->pdata[task->env->len - 2] = disabled_plugins;
+static void
+server_plugins_callback (SoupServer *server, SoupMessage *client_msg,
+                         const char *path, GHashTable *query,
+                         SoupClientContext *context, gpointer data)
+{
+    GString *stats;
+
+    if (client_msg->method != SOUP_METHOD_GET) {
+        soup_message_set_status (client_msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+        return;
+    }
+    // Timings of the native report_result plugins
+    stats = g_string_new (NULL);
+    rstrnt_report_plugins_stats (stats);
+    soup_message_set_response (client_msg, "text/plain", SOUP_MEMORY_TAKE,
+                               stats->str, stats->len);
+    g_string_free (stats, FALSE);
+    soup_message_set_status (client_msg, SOUP_STATUS_OK);
+}
+
+static void
+server_metrics_callback (SoupServer *server, SoupMessage *client_msg,
+                         const char *path, GHashTable *query,
+                         SoupClientContext *context, gpointer data)
+{
+    gchar *metrics;
+
+    if (client_msg->method != SOUP_METHOD_GET) {
+        soup_message_set_status (client_msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+        return;
+    }
+    metrics = rstrnt_metrics_to_prometheus ();
+    soup_message_set_response (client_msg, "text/plain; version=0.0.4", SOUP_MEMORY_TAKE,
+                               metrics, strlen (metrics));
+    soup_message_set_status (client_msg, SOUP_STATUS_OK);
+}
+
+/*
+ * Where the task finds a result that is still in the spool, the lab
+ * controller gives it its real location later.
+ */
+static gchar *
+server_spool_location (SoupMessage *client_msg, const gchar *url, guint64 id)
+{
+    gchar *location = g_strdup_printf ("%s%" G_GUINT64_FORMAT, url, id);
+    gchar *result_url = rebase_location (soup_message_get_uri (client_msg), location);
+
+    g_free (location);
+    return result_url;
+}
+
+/*
+ * A batch of results posted by rstrnt-report-result --batch.  Each one
+ * is spooled like a single result, or forwarded through the message
+ * queue with --no-spool, which keeps them in order and retries them like
+ * any other message.  The report plugins run once when all of them are
+ * done, after the answer when every result was spooled.
+ */
+typedef struct {
+    ClientData *client_data;
+    Task *task;
+    GPtrArray *entries;
+    json_object *response;
+    gchar *disable_plugin;
+    gboolean no_plugins;
+    gchar *last_location; /* Of the last result accepted */
+    guint done;
+} ResultBatch;
+
+typedef struct {
+    ResultBatch *batch;
+    SoupMessage *msg;
+    json_object *status;
+} ResultBatchEntry;
+
+static void
+result_batch_entry_free (gpointer data)
+{
+    g_slice_free (ResultBatchEntry, data);
+}
+
+static void
+result_batch_free (ResultBatch *batch)
+{
+    g_ptr_array_free (batch->entries, TRUE);
+    json_object_put (batch->response);
+    g_free (batch->disable_plugin);
+    g_free (batch->last_location);
+    g_slice_free (ResultBatch, batch);
+}
+
+static const gchar *
+result_batch_string (json_object *jobj, const gchar *key)
+{
+    json_object *val;
+
+    if (!json_object_object_get_ex (jobj, key, &val) ||
+        !json_object_is_type (val, json_type_string)) {
+        return NULL;
+    }
+    return json_object_get_string (val);
+}
+
+static ResultBatch *
+result_batch_new (ClientData *client_data, Task *task, GError **error)
+{
+    static const gchar *const fields[] = { "path", "result", "score", "message", NULL };
+    SoupMessage *client_msg = client_data->client_msg;
+    ResultBatch *batch;
+    json_tokener *tok;
+    json_object *jobj = NULL;
+    json_object *results;
+    json_object *statuses;
+    json_object *val;
+    guint count;
+
+    if (client_msg->request_body->length > 0) {
+        tok = json_tokener_new ();
+        jobj = json_tokener_parse_ex (tok, client_msg->request_body->data,
+                                      client_msg->request_body->length);
+        json_tokener_free (tok);
+    }
+    if (jobj == NULL ||
+        !json_object_object_get_ex (jobj, "results", &results) ||
+        !json_object_is_type (results, json_type_array) ||
+        json_object_array_length (results) == 0) {
+        g_set_error (error, RESTRAINT_ERROR,
+                     RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                     "Malformed result batch");
+        json_object_put (jobj);
+        return NULL;
+    }
+    count = json_object_array_length (results);
+    for (guint i = 0; i < count; i++) {
+        json_object *result = json_object_array_get_idx (results, i);
+        if (!json_object_is_type (result, json_type_object) ||
+            result_batch_string (result, "path") == NULL ||
+            result_batch_string (result, "result") == NULL) {
+            g_set_error (error, RESTRAINT_ERROR,
+                         RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                         "Result %u of the batch needs a path and a result", i);
+            json_object_put (jobj);
+            return NULL;
+        }
+    }
+
+    batch = g_slice_new0 (ResultBatch);
+    batch->client_data = client_data;
+    batch->task = task;
+    batch->entries = g_ptr_array_new_full (count, result_batch_entry_free);
+    batch->response = json_object_new_object ();
+    statuses = json_object_new_array ();
+    json_object_object_add (batch->response, "results", statuses);
+    if (json_object_object_get_ex (jobj, "no_plugins", &val)) {
+        batch->no_plugins = json_object_get_boolean (val);
+    }
+    batch->disable_plugin = g_strdup (result_batch_string (jobj, "disable_plugin"));
+
+    for (guint i = 0; i < count; i++) {
+        json_object *result = json_object_array_get_idx (results, i);
+        ResultBatchEntry *entry = g_slice_new0 (ResultBatchEntry);
+        GHashTable *form = g_hash_table_new (g_str_hash, g_str_equal);
+        SoupURI *server_uri;
+        gchar *form_data;
+
+        for (guint k = 0; fields[k] != NULL; k++) {
+            const gchar *value = result_batch_string (result, fields[k]);
+            if (value != NULL) {
+                g_hash_table_insert (form, (gpointer) fields[k], (gpointer) value);
             }
+        }
+        server_uri = soup_uri_new_with_base (task->task_uri, "results/");
+        entry->msg = soup_message_new_from_uri ("POST", server_uri);
+        soup_uri_free (server_uri);
+        form_data = soup_form_encode_hash (form);
+        soup_message_set_request (entry->msg, "application/x-www-form-urlencoded",
+                                  SOUP_MEMORY_TAKE, form_data, strlen (form_data));
+        g_hash_table_destroy (form);
+
+        entry->batch = batch;
+        entry->status = json_object_new_object ();
+        json_object_array_add (statuses, entry->status);
+        g_ptr_array_add (batch->entries, entry);
+    }
+    json_object_put (jobj);
+
+    return batch;
+}
 
-            process_run ((const gchar *) command,
-                         (const gchar **) task->env->pdata,
-                         "/usr/share/restraint/plugins",
-                         FALSE,
-                         0,
-                         NULL,
-                         server_io_callback,
-                         plugin_finish_callback,
-                         NULL,
-                         0,
-                         FALSE,
-                         app_data->cancellable,
-                         client_data);
-            g_free (command);
+static void
+result_batch_finish (ResultBatch *batch)
+{
+    ClientData *client_data = batch->client_data;
+    SoupMessage *client_msg = client_data->client_msg;
+    Task *task = batch->task;
+    const gchar *body;
+
+    body = json_object_to_json_string_ext (batch->response, JSON_C_TO_STRING_PLAIN);
+    soup_message_set_response (client_msg, "application/json", SOUP_MEMORY_COPY,
+                               body, strlen (body));
+    soup_message_set_status (client_msg, SOUP_STATUS_OK);
+
+    if (batch->no_plugins || batch->last_location == NULL) {
+        if (!client_data->answered) {
+            soup_server_unpause_message (client_data->server, client_msg);
         }
-        g_hash_table_destroy (table);
+        g_slice_free (ClientData, client_data);
     } else {
-        soup_server_unpause_message (client_data->server, client_msg);
+        // The plugins report against the last result, as they would
+        // after the last of a series of single results.
+        gchar *plugin_dir = g_strdup_printf ("%s/report_result.d", PLUGIN_DIR);
+
+        soup_message_headers_replace (client_msg->response_headers, "Location",
+                                      batch->last_location);
+        if (client_data->answered) {
+            g_object_ref (client_msg);
+            task->plugins_running++;
+        }
+        client_data->plugins_started = g_get_monotonic_time ();
+        rstrnt_report_plugins_run (plugin_dir,
+                                   task->name,
+                                   batch->last_location,
+                                   rstrnt_env_map_envp (task->env),
+                                   batch->disable_plugin,
+                                   report_plugins_finish_cb,
+                                   client_data);
+        g_free (plugin_dir);
+    }
+    result_batch_free (batch);
+}
+
+static void
+result_batch_complete (SoupSession *session, SoupMessage *server_msg, gpointer user_data)
+{
+    ResultBatchEntry *entry = (ResultBatchEntry *) user_data;
+    ResultBatch *batch = entry->batch;
+    SoupMessage *client_msg = batch->client_data->client_msg;
+    const gchar *location;
+
+    json_object_object_add (entry->status, "status",
+                            json_object_new_int (server_msg->status_code));
+    location = soup_message_headers_get_one (server_msg->response_headers, "Location");
+    if (SOUP_STATUS_IS_SUCCESSFUL (server_msg->status_code) && location != NULL) {
+        gchar *new_val = rebase_location (soup_message_get_uri (client_msg), location);
+
+        json_object_object_add (entry->status, "location",
+                                json_object_new_string (new_val));
+        // The queue completes them in batch order
+        g_free (batch->last_location);
+        batch->last_location = new_val;
+    }
+    entry->msg = NULL;
+
+    if (++batch->done == batch->entries->len) {
+        result_batch_finish (batch);
+    }
+}
+
+/*
+ * Adds the results of the batch to the spool and answers them with their
+ * spool location.  Those that couldn't be spooled keep their message and
+ * are forwarded while the task waits.
+ */
+static void
+result_batch_spool (ResultBatch *batch, RstrntSpool *spool)
+{
+    SoupMessage *client_msg = batch->client_data->client_msg;
+    SoupURI *server_uri = soup_uri_new_with_base (batch->task->task_uri, "results/");
+    gchar *url = soup_uri_to_string (server_uri, FALSE);
+
+    soup_uri_free (server_uri);
+    for (guint i = 0; i < batch->entries->len; i++) {
+        ResultBatchEntry *entry = g_ptr_array_index (batch->entries, i);
+        GError *error = NULL;
+        guint64 id;
+
+        id = rstrnt_spool_add (spool, url, entry->msg->request_body->data, &error);
+        if (id == 0) {
+            g_warning ("Forwarding result without spooling it: %s", error->message);
+            g_clear_error (&error);
+            continue;
+        }
+        g_free (batch->last_location);
+        batch->last_location = server_spool_location (client_msg, url, id);
+        json_object_object_add (entry->status, "status",
+                                json_object_new_int (SOUP_STATUS_CREATED));
+        json_object_object_add (entry->status, "location",
+                                json_object_new_string (batch->last_location));
+        g_clear_object (&entry->msg);
+        batch->done++;
+    }
+    g_free (url);
+}
+
+static void
+server_results_batch (ClientData *client_data, Task *task)
+{
+    AppData *app_data = (AppData *) client_data->user_data;
+    SoupMessage *client_msg = client_data->client_msg;
+    ResultBatch *batch;
+    GError *error = NULL;
+
+    if (client_msg->method != SOUP_METHOD_POST) {
+        soup_message_set_status (client_msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
         g_slice_free (ClientData, client_data);
+        return;
+    }
+    batch = result_batch_new (client_data, task, &error);
+    if (batch == NULL) {
+        soup_message_set_status_full (client_msg, SOUP_STATUS_BAD_REQUEST, error->message);
+        g_clear_error (&error);
+        g_slice_free (ClientData, client_data);
+        return;
     }
+    task->results_reported = TRUE;
 
-    // If no plugins are running we should return to the client right away.
-    if (no_plugins) {
+    if (app_data->spool != NULL) {
+        result_batch_spool (batch, app_data->spool);
+    }
+    if (batch->done == batch->entries->len) {
+        // Every result is in the spool, the task doesn't wait for plugins
+        client_data->answered = TRUE;
+        result_batch_finish (batch);
+        return;
+    }
+    for (guint i = 0; i < batch->entries->len; i++) {
+        ResultBatchEntry *entry = g_ptr_array_index (batch->entries, i);
+
+        if (entry->msg == NULL) {
+            continue;
+        }
+        app_data->queue_message (soup_session,
+                                 entry->msg,
+                                 app_data->message_data,
+                                 result_batch_complete,
+                                 app_data->cancellable,
+                                 entry);
+    }
+    soup_server_pause_message (client_data->server, client_msg);
+}
+
+/*
+ * GET .../tasks/<id>/watchdog answers with the local watchdog telemetry of
+ * that task, or of the running task when the path has no task.
+ */
+static void
+server_watchdog_telemetry (ClientData *client_data, Task *task)
+{
+    SoupMessage *client_msg = client_data->client_msg;
+    gchar **parts = g_strsplit (client_data->path, "/", -1);
+    const gchar *task_id = task->task_id;
+    json_object *telemetry;
+    GError *error = NULL;
+    gchar *path;
+
+    for (guint i = 0; parts[i] != NULL && parts[i + 1] != NULL; i++) {
+        if (g_strcmp0 (parts[i], "tasks") == 0) {
+            task_id = parts[i + 1];
+        }
+    }
+    path = rstrnt_lwd_telemetry_path (LWD_TELEMETRY_DIR, task_id);
+    telemetry = rstrnt_lwd_telemetry_read (path, &error);
+    if (telemetry == NULL) {
+        soup_message_set_status_full (client_msg, SOUP_STATUS_NOT_FOUND, error->message);
+        g_clear_error (&error);
+    } else {
+        json_object_object_add (telemetry, "task_id", json_object_new_string (task_id));
+        json_object_object_add (telemetry, "heartbeat",
+                                json_object_new_int (process_get_heartbeat ()));
+        const gchar *body = json_object_to_json_string_ext (telemetry, JSON_C_TO_STRING_PLAIN);
+        soup_message_set_response (client_msg, "application/json", SOUP_MEMORY_COPY,
+                                   body, strlen (body));
+        soup_message_set_status (client_msg, SOUP_STATUS_OK);
+        json_object_put (telemetry);
+    }
+    g_free (path);
+    g_strfreev (parts);
+    g_slice_free (ClientData, client_data);
+}
+
+/*
+ * Sends server_msg with the headers and body of client_msg, which waits
+ * for the response.
+ */
+static void
+server_forward (ClientData *client_data, SoupMessage *server_msg)
+{
+    AppData *app_data = (AppData *) client_data->user_data;
+    SoupMessage *client_msg = client_data->client_msg;
+    SoupMessageHeadersIter iter;
+    const gchar *name, *value;
+
+    soup_message_headers_iter_init (&iter, client_msg->request_headers);
+    while (soup_message_headers_iter_next (&iter, &name, &value))
+        copy_header (soup_message_get_uri (server_msg), name, value, server_msg->request_headers);
+
+    if (client_msg->request_body->length) {
+      SoupBuffer *request = soup_message_body_flatten (client_msg->request_body);
+      soup_message_body_append_buffer (server_msg->request_body, request);
+      soup_buffer_free (request);
+    }
+
+    // Depending on how the recipe was started this will either issue a new connection back
+    // to the uri that started the recipe or it will use the existing client connection
+    // back to the restraint client.
+    app_data->queue_message (soup_session,
+                             server_msg,
+                             app_data->message_data,
+                             server_msg_complete,
+                             app_data->cancellable,
+                             client_data);
+    soup_server_pause_message (client_data->server, client_msg);
+}
+
+/*
+ * Answers a result as soon as it is in the spool, with a Location made
+ * up from its spool id.  The report plugins run after the task got the
+ * answer, the logs they PUT there are spooled too.  Returns FALSE if the
+ * result couldn't be spooled and has to be forwarded while the task
+ * waits.
+ */
+static gboolean
+server_results_spool (ClientData *client_data, Task *task)
+{
+    AppData *app_data = (AppData *) client_data->user_data;
+    SoupMessage *client_msg = client_data->client_msg;
+    SoupURI *server_uri = soup_uri_new_with_base (task->task_uri, "results/");
+    gchar *url = soup_uri_to_string (server_uri, FALSE);
+    GError *error = NULL;
+    gchar *result_url;
+    guint64 id;
+
+    soup_uri_free (server_uri);
+    id = rstrnt_spool_add (app_data->spool, url,
+                           client_msg->request_body->length ? client_msg->request_body->data : "",
+                           &error);
+    if (id == 0) {
+        g_warning ("Forwarding result without spooling it: %s", error->message);
+        g_clear_error (&error);
+        g_free (url);
+        return FALSE;
+    }
+    task->results_reported = TRUE;
+
+    result_url = server_spool_location (client_msg, url, id);
+    soup_message_headers_replace (client_msg->response_headers, "Location", result_url);
+    soup_message_set_status (client_msg, SOUP_STATUS_CREATED);
+
+    // The plugins only read the request and the Location from here on
+    client_data->answered = TRUE;
+    g_object_ref (client_msg);
+    task->plugins_running++;
+    if (!server_results_plugins (client_data, task)) {
+        task->plugins_running--;
+        g_object_unref (client_msg);
+        g_slice_free (ClientData, client_data);
+    }
+    g_free (result_url);
+    g_free (url);
+    return TRUE;
+}
+
+/*
+ * The spool id in .../results/<id>/logs/... when path is for the logs
+ * of a spooled result, 0 otherwise.
+ */
+static guint64
+server_spooled_result (AppData *app_data, const gchar *path)
+{
+    const gchar *results = strstr (path, "/results/");
+    gchar *end;
+    guint64 id;
+
+    if (app_data->spool == NULL || results == NULL) {
+        return 0;
+    }
+    id = g_ascii_strtoull (results + strlen ("/results/"), &end, BASE10);
+    if (!g_str_has_prefix (end, "/logs/") ||
+        !rstrnt_spool_lookup (app_data->spool, id, NULL, NULL)) {
+        return 0;
+    }
+    return id;
+}
+
+/*
+ * Keeps a log PUT to a result the lab controller hasn't located yet in
+ * the spool.  A HEAD from --resume can't be answered before that, the
+ * log is uploaded from the start.
+ */
+static void
+server_spool_log (ClientData *client_data, guint64 spool_id)
+{
+    AppData *app_data = (AppData *) client_data->user_data;
+    SoupMessage *client_msg = client_data->client_msg;
+    SoupBuffer *body;
+    GError *error = NULL;
+
+    if (client_msg->method == SOUP_METHOD_HEAD) {
+        soup_message_set_status (client_msg, SOUP_STATUS_NOT_FOUND);
+        g_slice_free (ClientData, client_data);
+        return;
+    }
+    body = soup_message_body_flatten (client_msg->request_body);
+    if (rstrnt_spool_add_log (app_data->spool, spool_id,
+                              strstr (client_data->path, "/logs/") + strlen ("/logs/"),
+                              soup_message_headers_get_one (client_msg->request_headers,
+                                                            "Content-Range"),
+                              body->data, body->length, &error)) {
+        soup_message_set_status (client_msg, SOUP_STATUS_NO_CONTENT);
+    } else {
+        soup_message_set_status_full (client_msg, SOUP_STATUS_INTERNAL_SERVER_ERROR,
+                                      error->message);
+        g_clear_error (&error);
+    }
+    soup_buffer_free (body);
+    g_slice_free (ClientData, client_data);
+}
+
+static void
+server_spooled_log_ready (RstrntSpoolState state, const gchar *location, gpointer user_data)
+{
+    ClientData *client_data = (ClientData *) user_data;
+    SoupMessage *client_msg = client_data->client_msg;
+    SoupMessage *server_msg;
+    SoupURI *server_uri;
+    const gchar *logs;
+    gchar *log_url;
+
+    if (state != SPOOL_FORWARDED || location == NULL) {
+        soup_message_set_status_full (client_msg, SOUP_STATUS_NOT_FOUND,
+                                      "Result was not taken by the lab controller");
         soup_server_unpause_message (client_data->server, client_msg);
         g_slice_free (ClientData, client_data);
+        return;
     }
+
+    // .../results/<spool id>/logs/<name> goes to <location>/logs/<name>
+    logs = strstr (strstr (client_data->path, "/results/"), "/logs/");
+    log_url = rstrnt_spool_log_url (location, logs + strlen ("/logs/"));
+    server_uri = soup_uri_new (log_url);
+    server_msg = soup_message_new_from_uri (client_msg->method == SOUP_METHOD_HEAD ?
+                                            SOUP_METHOD_HEAD : SOUP_METHOD_PUT,
+                                            server_uri);
+    soup_uri_free (server_uri);
+    g_free (log_url);
+
+    server_forward (client_data, server_msg);
+}
+
+static void
+server_trace_finished (SoupMessage *client_msg, gpointer user_data)
+{
+    gint64 *started = user_data;
+
+    rstrnt_trace_message (TRACE_INBOUND, client_msg, *started, 1);
 }
 
 static void
@@ -270,8 +906,7 @@ server_recipe_callback (SoupServer *server, SoupMessage *client_msg,
     AppData *app_data = (AppData *) data;
     SoupMessage *server_msg;
     SoupURI *server_uri;
-    SoupMessageHeadersIter iter;
-    const gchar *name, *value;
+    guint64 spool_id;
 
     ClientData *client_data = g_slice_new0 (ClientData);
     client_data->path = path;
@@ -279,6 +914,16 @@ server_recipe_callback (SoupServer *server, SoupMessage *client_msg,
     client_data->client_msg = client_msg;
     client_data->server = server;
 
+    // Recorded once the response has been written, whichever way it went
+    if (rstrnt_trace_enabled ()) {
+        gint64 *started = g_new (gint64, 1);
+
+        *started = g_get_monotonic_time ();
+        g_signal_connect_data (client_msg, "finished",
+                               G_CALLBACK (server_trace_finished), started,
+                               (GClosureNotify) g_free, 0);
+    }
+
     if (app_data->state == RECIPE_IDLE) {
         soup_message_set_status_full (client_msg, SOUP_STATUS_BAD_REQUEST, "No Recipe Running");
         g_slice_free (ClientData, client_data);
@@ -287,19 +932,48 @@ server_recipe_callback (SoupServer *server, SoupMessage *client_msg,
     // FIXME - make sure we have valid tasks first
     Task *task = (Task *) app_data->tasks->data;
 
-    if (g_str_has_suffix (path, "/results/")) {
+    if (g_str_has_suffix (path, "/results/batch")) {
+        server_results_batch (client_data, task);
+        return;
+    } else if (g_str_has_suffix (path, "/results/") && app_data->spool != NULL &&
+               server_results_spool (client_data, task)) {
+        return;
+    } else if (g_str_has_suffix (path, "/results/")) {
         server_uri = soup_uri_new_with_base (task->task_uri, "results/");
         server_msg = soup_message_new_from_uri ("POST", server_uri);
         if (task != NULL) {
             task->results_reported = TRUE;
         }
     } else if (g_strrstr (path, "/logs/") != NULL) {
+        // rstrnt-report-log --resume asks how much of the log exists,
+        // restraint has no way to answer that so start from scratch.
+        if (client_msg->method == SOUP_METHOD_HEAD && app_data->stdin) {
+            soup_message_set_status (client_msg, SOUP_STATUS_NOT_FOUND);
+            g_slice_free (ClientData, client_data);
+            return;
+        }
+        // Spooled until the lab controller gives the result its id
+        spool_id = server_spooled_result (app_data, path);
+        if (spool_id != 0 && rstrnt_spool_holds_logs (app_data->spool, spool_id)) {
+            server_spool_log (client_data, spool_id);
+            return;
+        } else if (spool_id != 0) {
+            soup_server_pause_message (server, client_msg);
+            rstrnt_spool_wait (app_data->spool, spool_id, server_spooled_log_ready, client_data);
+            return;
+        }
         gchar *uri = soup_uri_to_string(task->task_uri, FALSE);
         gchar *log_url = swap_base(path, uri, "/recipes/");
         server_uri = soup_uri_new (log_url);
         g_free (log_url);
         g_free (uri);
-        server_msg = soup_message_new_from_uri ("PUT", server_uri);
+        server_msg = soup_message_new_from_uri (client_msg->method == SOUP_METHOD_HEAD ?
+                                                SOUP_METHOD_HEAD : SOUP_METHOD_PUT,
+                                                server_uri);
+    } else if (g_str_has_suffix (path, "watchdog") &&
+               client_msg->method == SOUP_METHOD_GET) {
+        server_watchdog_telemetry (client_data, task);
+        return;
     } else if (g_str_has_suffix (path, "watchdog")) {
         GHashTable *form_data;
         gchar      *encoded_form;
@@ -326,12 +1000,7 @@ server_recipe_callback (SoupServer *server, SoupMessage *client_msg,
             g_warning ("Adjustment to local watchdog ignored since "
                        "'no_localwatchdog' metadata is set");
         } else {
-            task->remaining_time = max_time;
-
-            if (task->time_chged == NULL)
-                task->time_chged = g_malloc (sizeof (time_t));
-
-            *task->time_chged = time (NULL);
+            restraint_task_adjust_watchdog (app_data, task, max_time);
         }
 
         // Update the number of watchdog seconds for External watchdog
@@ -419,26 +1088,7 @@ status_cleanup:
 
     soup_uri_free (server_uri);
 
-    soup_message_headers_iter_init (&iter, client_msg->request_headers);
-    while (soup_message_headers_iter_next (&iter, &name, &value))
-        copy_header (soup_message_get_uri (server_msg), name, value, server_msg->request_headers);
-
-    if (client_msg->request_body->length) {
-      SoupBuffer *request = soup_message_body_flatten (client_msg->request_body);
-      soup_message_body_append_buffer (server_msg->request_body, request);
-      soup_buffer_free (request);
-    }
-
-    // Depending on how the recipe was started this will either issue a new connection back
-    // to the uri that started the recipe or it will use the existing client connection
-    // back to the restraint client.
-    app_data->queue_message (soup_session,
-                             server_msg,
-                             app_data->message_data,
-                             server_msg_complete,
-                             app_data->cancellable,
-                             client_data);
-    soup_server_pause_message (server, client_msg);
+    server_forward (client_data, server_msg);
 }
 
 static void
@@ -664,7 +1314,13 @@ int main(int argc, char *argv[]) {
   AppData *app_data;
   const gchar *config = "config.conf";
   SoupServer *soup_server = NULL;
+  GSocketService *local_service = NULL;
+  gchar *local_path = NULL;
   GError *error = NULL;
+  gint heartbeat = 0;
+  gboolean no_cgroups = FALSE;
+  gchar *trace = NULL;
+  gboolean no_spool = FALSE;
 
   app_data = g_slice_new0 (AppData);
   app_data->cancellable = g_cancellable_new ();
@@ -675,10 +1331,19 @@ int main(int argc, char *argv[]) {
   app_data->uploader_interval = LOG_UPLOAD_INTERVAL;
 
   rstrnt_uploader_override (app_data);
+  restraint_metadata_cache_set_dir (METADATA_CACHE_DIR);
 
   GOptionEntry entries [] = {
     { "port", 'p', 0, G_OPTION_ARG_INT, &app_data->port, "Port to listen on", "PORT" },
     { "stdin", 's', 0, G_OPTION_ARG_NONE, &app_data->stdin, "Run from STDIN/STDOUT", NULL },
+    { "heartbeat", 0, 0, G_OPTION_ARG_INT, &heartbeat,
+      "Seconds between local watchdog checks (default 60)", "SECONDS" },
+    { "no-cgroups", 0, 0, G_OPTION_ARG_NONE, &no_cgroups,
+      "Don't run tasks in cgroups of their own", NULL },
+    { "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace,
+      "Record the HTTP requests sent and received to FILE", "FILE" },
+    { "no-spool", 0, 0, G_OPTION_ARG_NONE, &no_spool,
+      "Keep tasks waiting until the lab controller has their results", NULL },
     { NULL }
   };
   GOptionContext *context = g_option_context_new(NULL);
@@ -691,6 +1356,20 @@ int main(int argc, char *argv[]) {
   if (!parse_succeeded) {
     exit (PARSE_ARGS_FAILED);
   }
+  if (heartbeat > 0) {
+    process_set_heartbeat (heartbeat);
+  }
+  if (trace != NULL && !rstrnt_trace_open (trace, &error)) {
+      g_printerr ("Running without a trace: %s\n", error->message);
+      g_clear_error (&error);
+  }
+  g_free (trace);
+
+  // The cgroup of a restraintd started through ssh isn't ours to change
+  if (!no_cgroups && !app_data->stdin && !rstrnt_cgroup_init (&error)) {
+      g_printerr ("Running tasks without cgroups: %s\n", error->message);
+      g_clear_error (&error);
+  }
 
   if (!app_data->stdin) {
       app_data->config_file = g_build_filename (VAR_LIB_PATH, config, NULL);
@@ -721,11 +1400,26 @@ int main(int argc, char *argv[]) {
   soup_session = soup_session_new();
   soup_session_add_feature_by_type (soup_session, SOUP_TYPE_CONTENT_SNIFFER);
 
+  // Results left over from before a reboot are queued first
+  if (!no_spool && !app_data->stdin) {
+      app_data->spool = rstrnt_spool_open (RESULT_SPOOL_PATH,
+                                           (QueueMessage) restraint_queue_message,
+                                           soup_session, &error);
+      if (app_data->spool == NULL) {
+          g_printerr ("Forwarding results without a spool: %s\n", error->message);
+          g_clear_error (&error);
+      }
+  }
+
   // Define a soup server
   soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "restraint ", NULL);
 
   soup_server_add_handler (soup_server, "/recipes",
                            server_recipe_callback, app_data, NULL);
+  soup_server_add_handler (soup_server, "/plugins",
+                           server_plugins_callback, app_data, NULL);
+  soup_server_add_handler (soup_server, "/metrics",
+                           server_metrics_callback, app_data, NULL);
 
   /* Tell our soup server to listen on any local interface. This includes
      IPv4 and IPv6 if available */
@@ -739,6 +1433,14 @@ int main(int argc, char *argv[]) {
   app_data->restraint_url = g_strdup_printf ("http://localhost:%d", app_data->port);
   g_print ("Listening on %s\n", app_data->restraint_url);
 
+  // Fast path for the rstrnt-* commands, TCP still works without it
+  local_path = get_local_socket_filename (app_data->port);
+  local_service = rstrnt_local_listen (soup_server, local_path, &error);
+  if (local_service == NULL) {
+      g_warning ("Unable to listen on %s: %s", local_path, error->message);
+      g_clear_error (&error);
+  }
+
   g_unix_signal_add (SIGINT, on_sigint_term, app_data);
   g_unix_signal_add (SIGTERM, on_sigterm_term, app_data);
   g_unix_signal_add (SIGHUP, on_sighup_term, app_data);
@@ -766,9 +1468,18 @@ int main(int argc, char *argv[]) {
   }
 
   soup_session_abort(soup_session);
+  rstrnt_spool_free (app_data->spool);
   soup_session_remove_feature_by_type (soup_session, SOUP_TYPE_CONTENT_SNIFFER);
   g_object_unref(soup_session);
 
+  if (local_service != NULL) {
+      g_socket_service_stop (local_service);
+      g_socket_listener_close (G_SOCKET_LISTENER (local_service));
+      g_object_unref (local_service);
+      g_unlink (local_path);
+  }
+  g_free (local_path);
+
   // no longer need to call soup_server_quit as disconnect does it all.
   soup_server_disconnect(soup_server);
   g_object_unref(soup_server);
@@ -783,6 +1494,7 @@ int main(int argc, char *argv[]) {
   }
 
   restraint_free_app_data (app_data);
+  rstrnt_trace_close ();
 
   return 0;
 }
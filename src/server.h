@@ -22,13 +22,15 @@
 
 #define VAR_LIB_PATH "/var/lib/restraint"
 #define PLUGIN_SCRIPT "/usr/share/restraint/plugins/run_plugins"
-#define TASK_PLUGIN_SCRIPT "/usr/share/restraint/plugins/run_task_plugins"
 #define PLUGIN_DIR "/usr/share/restraint/plugins"
+#define TASK_PLUGIN_DIR PLUGIN_DIR "/task_run.d"
 
 #define LOG_UPLOAD_INTERVAL 15  /* Seconds */
 #define LOG_UPLOAD_MIN_INTERVAL 3  /* Seconds */
 #define LOG_UPLOAD_MAX_INTERVAL 60  /* Seconds */
 
+#define RESULT_SPOOL_PATH VAR_LIB_PATH "/results.spool"
+
 typedef enum {
   ABORTED_NONE,
   ABORTED_RECIPE,
@@ -41,7 +43,7 @@ typedef struct RstrntServerAppData {
   guint recipe_handler_id;
   guint task_handler_id;
   gchar *recipe_url;
-  xmlDoc *recipe_xmldoc;
+  GBytes *recipe_xml;
   Recipe *recipe;
   GList *tasks;
   GError *error;
@@ -60,6 +62,9 @@ typedef struct RstrntServerAppData {
   guint last_signal;
   guint uploader_source_id; /* Event source ID for log uploader */
   guint uploader_interval; /* In seconds. 0 disables the log manager */
+  BkrWaitState bkr_wait; /* Waiting on Beaker's recipe health */
+  guint bkr_wait_interval; /* In seconds. Grows while Beaker is unhealthy */
+  RstrntSpool *spool; /* NULL when tasks wait for the lab controller */
 } AppData;
 
 #endif
@@ -0,0 +1,708 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <json.h>
+#include <libsoup/soup.h>
+
+#include "metrics.h"
+#include "spool.h"
+
+/*
+ * The journal holds one JSON object per line:
+ *
+ *   {"id":1700000000000000,"url":"http://lab/recipes/1/tasks/2/results/","body":"..."}
+ *   {"id":1700000000000000,"status":201,"location":"http://lab/.../results/42"}
+ *   {"id":1700000000000000,"log":3,"name":"plugin.log","range":"bytes 0-99/100"}
+ *   {"id":1700000000000000,"log":3,"status":204}
+ *
+ * the first when a result is added, the second once the lab controller
+ * answered for it.  The last two do the same for a log PUT to the result
+ * before it had a location, its body is kept in <journal>.logs/<id>-<log>.
+ * A line torn by a crash doesn't parse and is skipped.
+ */
+
+typedef struct {
+    RstrntSpool *spool;
+    guint64 id;
+    gchar *url;            /* Freed with body once the result left the spool */
+    gchar *body;
+    RstrntSpoolState state;
+    gchar *location;
+    gint64 added;          /* monotonic time, or when the spool was opened */
+    GSList *waiters;
+    GQueue logs;           /* SpoolLog to PUT once located, the head is in flight */
+} SpoolEntry;
+
+typedef struct {
+    SpoolEntry *entry;
+    guint seq;
+    gchar *name;           /* Under .../logs/, as the request had it */
+    gchar *range;          /* Content-Range of the request, if any */
+    gchar *file;
+} SpoolLog;
+
+typedef struct {
+    RstrntSpoolCallback callback;
+    gpointer user_data;
+} SpoolWaiter;
+
+struct _RstrntSpool {
+    gchar *path;
+    gint fd;
+    gchar *logs_dir;
+    GHashTable *entries;   /* id -> SpoolEntry, kept to map later log uploads */
+    guint pending;
+    guint pending_logs;
+    guint64 next_id;
+    guint next_log;
+    QueueMessage queue_message;
+    SoupSession *session;
+};
+
+static void
+spool_set_errno_error (GError **error, gint errsv, const gchar *action,
+                       const gchar *path)
+{
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                 "Failed to %s %s: %s", action, path, g_strerror (errsv));
+}
+
+static void
+spool_log_free (gpointer data)
+{
+    SpoolLog *log = data;
+
+    g_free (log->name);
+    g_free (log->range);
+    g_free (log->file);
+    g_slice_free (SpoolLog, log);
+}
+
+static void
+spool_entry_free (gpointer data)
+{
+    SpoolEntry *entry = data;
+
+    g_free (entry->url);
+    g_free (entry->body);
+    g_free (entry->location);
+    g_slist_free_full (entry->waiters, g_free);
+    g_queue_foreach (&entry->logs, (GFunc) spool_log_free, NULL);
+    g_queue_clear (&entry->logs);
+    g_slice_free (SpoolEntry, entry);
+}
+
+static const gchar *
+spool_string (json_object *record, const gchar *key)
+{
+    json_object *val;
+
+    if (!json_object_object_get_ex (record, key, &val) ||
+        !json_object_is_type (val, json_type_string)) {
+        return NULL;
+    }
+    return json_object_get_string (val);
+}
+
+/* Only returns once data is on disk */
+static gboolean
+spool_write (gint fd, const gchar *data, gsize length, const gchar *path,
+             GError **error)
+{
+    gsize written = 0;
+
+    while (written < length) {
+        gssize ret = write (fd, data + written, length - written);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            spool_set_errno_error (error, errno, "write", path);
+            return FALSE;
+        }
+        written += ret;
+    }
+    if (fdatasync (fd) != 0) {
+        spool_set_errno_error (error, errno, "sync", path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+spool_append (RstrntSpool *spool, json_object *record, GError **error)
+{
+    gchar *line = g_strconcat (json_object_to_json_string_ext (record, JSON_C_TO_STRING_PLAIN),
+                               "\n", NULL);
+    gboolean ret = spool_write (spool->fd, line, strlen (line), spool->path, error);
+
+    g_free (line);
+    return ret;
+}
+
+/* Nothing left to forward, the mappings stay in memory */
+static void
+spool_truncate (RstrntSpool *spool)
+{
+    if (spool->pending > 0 || spool->pending_logs > 0) {
+        return;
+    }
+    if (ftruncate (spool->fd, 0) != 0 || fdatasync (spool->fd) != 0) {
+        g_warning ("Failed to truncate %s: %s", spool->path, g_strerror (errno));
+    }
+}
+
+static SpoolLog *
+spool_log_new (SpoolEntry *entry, guint seq, const gchar *name, const gchar *range)
+{
+    RstrntSpool *spool = entry->spool;
+    SpoolLog *log = g_slice_new0 (SpoolLog);
+
+    log->entry = entry;
+    log->seq = seq;
+    log->name = g_strdup (name);
+    log->range = g_strdup (range);
+    log->file = g_strdup_printf ("%s/%" G_GUINT64_FORMAT "-%u", spool->logs_dir,
+                                 entry->id, seq);
+    g_queue_push_tail (&entry->logs, log);
+    spool->next_log = MAX (spool->next_log, seq + 1);
+    spool->pending_logs++;
+    return log;
+}
+
+/* Records the answer for the log at the head of its entry and drops it */
+static void
+spool_log_done (SpoolEntry *entry, guint status)
+{
+    RstrntSpool *spool = entry->spool;
+    SpoolLog *log = g_queue_pop_head (&entry->logs);
+    json_object *record;
+    GError *error = NULL;
+
+    record = json_object_new_object ();
+    json_object_object_add (record, "id", json_object_new_int64 (entry->id));
+    json_object_object_add (record, "log", json_object_new_int (log->seq));
+    json_object_object_add (record, "status", json_object_new_int (status));
+    if (!spool_append (spool, record, &error)) {
+        g_warning ("%s", error->message);
+        g_clear_error (&error);
+    }
+    json_object_put (record);
+
+    g_unlink (log->file);
+    spool_log_free (log);
+    spool->pending_logs--;
+}
+
+/* The logs of a result without a location have nowhere to go */
+static void
+spool_drop_logs (SpoolEntry *entry)
+{
+    RstrntSpool *spool = entry->spool;
+    SpoolLog *log;
+
+    while ((log = g_queue_pop_head (&entry->logs)) != NULL) {
+        g_warning ("Dropping log %s, result %" G_GUINT64_FORMAT " has no location",
+                   log->name, entry->id);
+        g_unlink (log->file);
+        spool_log_free (log);
+        spool->pending_logs--;
+    }
+}
+
+static void spool_send_log (SpoolEntry *entry);
+
+static void
+spool_log_complete (SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+    SpoolEntry *entry = user_data;
+    SpoolLog *log = g_queue_peek_head (&entry->logs);
+
+    // The message queue retries anything but client errors
+    if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code)) {
+        g_warning ("%s: Log %s of result %" G_GUINT64_FORMAT " was rejected by %s",
+                   msg->reason_phrase, log->name, entry->id, entry->location);
+    }
+    spool_log_done (entry, msg->status_code);
+    spool_send_log (entry);
+    spool_truncate (entry->spool);
+}
+
+/* PUTs the oldest log kept for entry, one at a time keeps them in order */
+static void
+spool_send_log (SpoolEntry *entry)
+{
+    RstrntSpool *spool = entry->spool;
+    SpoolLog *log = g_queue_peek_head (&entry->logs);
+    GError *error = NULL;
+    SoupMessage *msg;
+    gchar *contents;
+    gsize length;
+    gchar *url;
+
+    if (log == NULL) {
+        return;
+    }
+    if (!g_file_get_contents (log->file, &contents, &length, &error)) {
+        g_warning ("Dropping log %s of result %" G_GUINT64_FORMAT ": %s",
+                   log->name, entry->id, error->message);
+        g_clear_error (&error);
+        spool_log_done (entry, SOUP_STATUS_NOT_FOUND);
+        spool_send_log (entry);
+        return;
+    }
+    url = rstrnt_spool_log_url (entry->location, log->name);
+    msg = soup_message_new ("PUT", url);
+    g_free (url);
+    if (log->range != NULL) {
+        soup_message_headers_append (msg->request_headers, "Content-Range", log->range);
+    }
+    soup_message_set_request (msg, "text/plain", SOUP_MEMORY_TAKE, contents, length);
+    spool->queue_message (spool->session, msg, NULL, spool_log_complete, NULL, entry);
+}
+
+/* Called once the lab controller answered for the result */
+static void
+spool_settle_logs (SpoolEntry *entry)
+{
+    if (entry->location != NULL) {
+        spool_send_log (entry);
+    } else {
+        spool_drop_logs (entry);
+    }
+}
+
+/* Only the id -> location mapping is needed from now on */
+static void
+spool_entry_settle (SpoolEntry *entry)
+{
+    g_clear_pointer (&entry->url, g_free);
+    g_clear_pointer (&entry->body, g_free);
+}
+
+static void
+spool_notify (SpoolEntry *entry)
+{
+    GSList *waiters = g_slist_reverse (entry->waiters);
+
+    entry->waiters = NULL;
+    for (GSList *iter = waiters; iter != NULL; iter = iter->next) {
+        SpoolWaiter *waiter = iter->data;
+
+        waiter->callback (entry->state, entry->location, waiter->user_data);
+    }
+    g_slist_free_full (waiters, g_free);
+}
+
+static void
+spool_forward_complete (SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+    SpoolEntry *entry = user_data;
+    RstrntSpool *spool = entry->spool;
+    const gchar *location;
+    json_object *record;
+    GError *error = NULL;
+
+    location = soup_message_headers_get_one (msg->response_headers, "Location");
+    if (SOUP_STATUS_IS_SUCCESSFUL (msg->status_code)) {
+        entry->state = SPOOL_FORWARDED;
+        if (location != NULL) {
+            SoupURI *uri = soup_uri_new_with_base (soup_message_get_uri (msg), location);
+
+            entry->location = soup_uri_to_string (uri, FALSE);
+            soup_uri_free (uri);
+        }
+    } else {
+        // The message queue retries anything but client errors
+        entry->state = SPOOL_REJECTED;
+        g_warning ("%s: Result %" G_GUINT64_FORMAT " was rejected by %s",
+                   msg->reason_phrase, entry->id, entry->url);
+    }
+
+    record = json_object_new_object ();
+    json_object_object_add (record, "id", json_object_new_int64 (entry->id));
+    json_object_object_add (record, "status", json_object_new_int (msg->status_code));
+    if (entry->location != NULL) {
+        json_object_object_add (record, "location", json_object_new_string (entry->location));
+    }
+    // At worst the result is forwarded twice after a restart
+    if (!spool_append (spool, record, &error)) {
+        g_warning ("%s", error->message);
+        g_clear_error (&error);
+    }
+    json_object_put (record);
+    spool_entry_settle (entry);
+
+    spool->pending--;
+    rstrnt_metrics_set (METRIC_SPOOL_PENDING, spool->pending);
+    rstrnt_metrics_observe (METRIC_SPOOL_FORWARD_LATENCY,
+                            g_get_monotonic_time () - entry->added);
+    spool_settle_logs (entry);
+    spool_truncate (spool);
+    spool_notify (entry);
+}
+
+static void
+spool_send (RstrntSpool *spool, SpoolEntry *entry)
+{
+    SoupMessage *msg = soup_message_new ("POST", entry->url);
+
+    soup_message_set_request (msg, "application/x-www-form-urlencoded",
+                              SOUP_MEMORY_COPY, entry->body, strlen (entry->body));
+    spool->queue_message (spool->session, msg, NULL, spool_forward_complete, NULL, entry);
+}
+
+static SpoolEntry *
+spool_entry_new (RstrntSpool *spool, guint64 id, const gchar *url, const gchar *body)
+{
+    SpoolEntry *entry = g_slice_new0 (SpoolEntry);
+
+    entry->spool = spool;
+    entry->id = id;
+    entry->url = g_strdup (url);
+    entry->body = g_strdup (body);
+    entry->state = SPOOL_PENDING;
+    entry->added = g_get_monotonic_time ();
+    g_hash_table_insert (spool->entries, &entry->id, entry);
+    spool->next_id = MAX (spool->next_id, id + 1);
+    spool->pending++;
+    return entry;
+}
+
+static void
+spool_load_log (SpoolEntry *entry, guint seq, json_object *record)
+{
+    SpoolLog *log;
+
+    if (entry == NULL) {
+        return;
+    }
+    if (spool_string (record, "name") != NULL) {
+        spool_log_new (entry, seq, spool_string (record, "name"),
+                       spool_string (record, "range"));
+        return;
+    }
+    for (GList *iter = entry->logs.head; iter != NULL; iter = iter->next) {
+        log = iter->data;
+        if (log->seq == seq) {
+            g_queue_delete_link (&entry->logs, iter);
+            g_unlink (log->file);
+            spool_log_free (log);
+            entry->spool->pending_logs--;
+            break;
+        }
+    }
+}
+
+/* Results settled before the restart may still have logs to PUT */
+static void
+spool_resume_logs (gpointer key, gpointer value, gpointer user_data)
+{
+    SpoolEntry *entry = value;
+
+    if (entry->state != SPOOL_PENDING) {
+        spool_settle_logs (entry);
+    }
+}
+
+/* The results still pending in the journal, in the order they were added */
+static GList *
+spool_load (RstrntSpool *spool, const gchar *contents)
+{
+    gchar **lines = g_strsplit (contents, "\n", -1);
+    GList *pending = NULL;
+
+    for (guint i = 0; lines[i] != NULL; i++) {
+        json_object *record = json_tokener_parse (lines[i]);
+        json_object *val;
+        SpoolEntry *entry;
+        guint64 id;
+
+        if (record == NULL || !json_object_object_get_ex (record, "id", &val)) {
+            json_object_put (record);
+            continue;
+        }
+        id = json_object_get_int64 (val);
+        entry = g_hash_table_lookup (spool->entries, &id);
+        if (json_object_object_get_ex (record, "log", &val)) {
+            spool_load_log (entry, json_object_get_int (val), record);
+        } else if (entry == NULL && spool_string (record, "url") != NULL &&
+            spool_string (record, "body") != NULL) {
+            entry = spool_entry_new (spool, id, spool_string (record, "url"),
+                                     spool_string (record, "body"));
+            pending = g_list_prepend (pending, entry);
+        } else if (entry != NULL && entry->state == SPOOL_PENDING &&
+                   json_object_object_get_ex (record, "status", &val)) {
+            guint status = json_object_get_int (val);
+
+            entry->state = SOUP_STATUS_IS_SUCCESSFUL (status) ? SPOOL_FORWARDED : SPOOL_REJECTED;
+            entry->location = g_strdup (spool_string (record, "location"));
+            spool_entry_settle (entry);
+            pending = g_list_remove (pending, entry);
+            spool->pending--;
+        }
+        json_object_put (record);
+    }
+    g_strfreev (lines);
+
+    return g_list_reverse (pending);
+}
+
+RstrntSpool *
+rstrnt_spool_open (const gchar *path,
+                   QueueMessage queue_message,
+                   SoupSession *session,
+                   GError **error)
+{
+    RstrntSpool *spool;
+    GList *pending;
+    gchar *contents;
+    gsize length;
+    gchar *dir;
+
+    g_return_val_if_fail (path != NULL && queue_message != NULL, NULL);
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    dir = g_path_get_dirname (path);
+    g_mkdir_with_parents (dir, 0755);
+    g_free (dir);
+
+    spool = g_slice_new0 (RstrntSpool);
+    spool->path = g_strdup (path);
+    spool->logs_dir = g_strconcat (path, ".logs", NULL);
+    g_mkdir_with_parents (spool->logs_dir, 0755);
+    spool->entries = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                            NULL, spool_entry_free);
+    spool->queue_message = queue_message;
+    spool->session = session;
+    // Ids outlive restarts and never look like a small lab controller id
+    spool->next_id = g_get_real_time ();
+    spool->fd = open (path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (spool->fd < 0) {
+        spool_set_errno_error (error, errno, "open", path);
+        rstrnt_spool_free (spool);
+        return NULL;
+    }
+
+    if (!g_file_get_contents (path, &contents, &length, error)) {
+        rstrnt_spool_free (spool);
+        return NULL;
+    }
+    pending = spool_load (spool, contents);
+    // End a torn line so it doesn't swallow the next record
+    if (length > 0 && contents[length - 1] != '\n' &&
+        write (spool->fd, "\n", 1) != 1) {
+        g_warning ("Failed to write %s: %s", path, g_strerror (errno));
+    }
+    g_free (contents);
+
+    rstrnt_metrics_set (METRIC_SPOOL_PENDING, spool->pending);
+    g_hash_table_foreach (spool->entries, spool_resume_logs, NULL);
+    spool_truncate (spool);
+    for (GList *iter = pending; iter != NULL; iter = iter->next) {
+        spool_send (spool, iter->data);
+    }
+    g_list_free (pending);
+
+    return spool;
+}
+
+void
+rstrnt_spool_free (RstrntSpool *spool)
+{
+    if (spool == NULL) {
+        return;
+    }
+    if (spool->fd >= 0) {
+        close (spool->fd);
+    }
+    g_hash_table_destroy (spool->entries);
+    g_free (spool->logs_dir);
+    g_free (spool->path);
+    g_slice_free (RstrntSpool, spool);
+}
+
+/*
+ * Adds a result to POST to url and queues it.  Returns its id once it is
+ * on disk, or 0 if it could not be kept.
+ */
+guint64
+rstrnt_spool_add (RstrntSpool *spool,
+                  const gchar *url,
+                  const gchar *body,
+                  GError **error)
+{
+    SpoolEntry *entry;
+    json_object *record;
+    guint64 id;
+
+    g_return_val_if_fail (spool != NULL && url != NULL && body != NULL, 0);
+    g_return_val_if_fail (error == NULL || *error == NULL, 0);
+
+    id = spool->next_id;
+    record = json_object_new_object ();
+    json_object_object_add (record, "id", json_object_new_int64 (id));
+    json_object_object_add (record, "url", json_object_new_string (url));
+    json_object_object_add (record, "body", json_object_new_string (body));
+    if (!spool_append (spool, record, error)) {
+        json_object_put (record);
+        return 0;
+    }
+    json_object_put (record);
+
+    entry = spool_entry_new (spool, id, url, body);
+    rstrnt_metrics_set (METRIC_SPOOL_PENDING, spool->pending);
+    spool_send (spool, entry);
+
+    return id;
+}
+
+gboolean
+rstrnt_spool_lookup (RstrntSpool *spool,
+                     guint64 id,
+                     RstrntSpoolState *state,
+                     const gchar **location)
+{
+    SpoolEntry *entry = g_hash_table_lookup (spool->entries, &id);
+
+    if (entry == NULL) {
+        return FALSE;
+    }
+    if (state != NULL) {
+        *state = entry->state;
+    }
+    if (location != NULL) {
+        *location = entry->location;
+    }
+    return TRUE;
+}
+
+/* Calls callback once the result is forwarded or rejected */
+void
+rstrnt_spool_wait (RstrntSpool *spool,
+                   guint64 id,
+                   RstrntSpoolCallback callback,
+                   gpointer user_data)
+{
+    SpoolEntry *entry = g_hash_table_lookup (spool->entries, &id);
+    SpoolWaiter *waiter;
+
+    g_return_if_fail (entry != NULL);
+
+    if (entry->state != SPOOL_PENDING) {
+        callback (entry->state, entry->location, user_data);
+        return;
+    }
+    waiter = g_new (SpoolWaiter, 1);
+    waiter->callback = callback;
+    waiter->user_data = user_data;
+    entry->waiters = g_slist_prepend (entry->waiters, waiter);
+}
+
+/*
+ * TRUE while log PUTs to the result have to go through the spool: it has
+ * no location yet or logs kept earlier are still being PUT.
+ */
+gboolean
+rstrnt_spool_holds_logs (RstrntSpool *spool, guint64 id)
+{
+    SpoolEntry *entry = g_hash_table_lookup (spool->entries, &id);
+
+    return entry != NULL &&
+        (entry->state == SPOOL_PENDING || !g_queue_is_empty (&entry->logs));
+}
+
+/*
+ * Keeps a log PUT to .../results/<id>/logs/<name> until the result has a
+ * location.  Returns once the body is on disk.
+ */
+gboolean
+rstrnt_spool_add_log (RstrntSpool *spool,
+                      guint64 id,
+                      const gchar *name,
+                      const gchar *range,
+                      const gchar *data,
+                      gsize length,
+                      GError **error)
+{
+    SpoolEntry *entry = g_hash_table_lookup (spool->entries, &id);
+    json_object *record;
+    SpoolLog *log;
+    gboolean ret;
+    gint fd;
+
+    g_return_val_if_fail (entry != NULL && name != NULL, FALSE);
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    log = spool_log_new (entry, spool->next_log, name, range);
+    fd = open (log->file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        spool_set_errno_error (error, errno, "open", log->file);
+        ret = FALSE;
+    } else {
+        ret = spool_write (fd, data, length, log->file, error);
+        close (fd);
+    }
+    if (ret) {
+        record = json_object_new_object ();
+        json_object_object_add (record, "id", json_object_new_int64 (id));
+        json_object_object_add (record, "log", json_object_new_int (log->seq));
+        json_object_object_add (record, "name", json_object_new_string (name));
+        if (range != NULL) {
+            json_object_object_add (record, "range", json_object_new_string (range));
+        }
+        ret = spool_append (spool, record, error);
+        json_object_put (record);
+    }
+    if (!ret) {
+        g_queue_remove (&entry->logs, log);
+        g_unlink (log->file);
+        spool_log_free (log);
+        spool->pending_logs--;
+        return FALSE;
+    }
+    // Nothing else in flight once the result is settled
+    if (entry->state != SPOOL_PENDING && entry->logs.length == 1) {
+        spool_settle_logs (entry);
+        spool_truncate (spool);
+    }
+    return TRUE;
+}
+
+/* <location>/logs/<name>, location may end in a slash */
+gchar *
+rstrnt_spool_log_url (const gchar *location, const gchar *name)
+{
+    gsize length = strlen (location);
+
+    if (length > 0 && location[length - 1] == '/') {
+        length--;
+    }
+    return g_strdup_printf ("%.*s/logs/%s", (gint) length, location, name);
+}
+
+guint
+rstrnt_spool_pending (RstrntSpool *spool)
+{
+    return spool->pending;
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_SPOOL_H
+#define _RESTRAINT_SPOOL_H
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "message.h"
+
+typedef enum {
+    SPOOL_PENDING,
+    SPOOL_FORWARDED,    /* the lab controller took it */
+    SPOOL_REJECTED,     /* the lab controller turned it down */
+} RstrntSpoolState;
+
+/* location is where the lab controller put the result, if it took it */
+typedef void (*RstrntSpoolCallback) (RstrntSpoolState state,
+                                     const gchar *location,
+                                     gpointer user_data);
+
+typedef struct _RstrntSpool RstrntSpool;
+
+/*
+ * Results are kept in an append-only journal until the lab controller
+ * has them, and forwarded through queue_message in the order they were
+ * added.  Results a previous restraintd left in the journal are queued
+ * again when it is opened.
+ */
+RstrntSpool *rstrnt_spool_open (const gchar *path,
+                                QueueMessage queue_message,
+                                SoupSession *session,
+                                GError **error);
+void rstrnt_spool_free (RstrntSpool *spool);
+
+guint64 rstrnt_spool_add (RstrntSpool *spool,
+                          const gchar *url,
+                          const gchar *body,
+                          GError **error);
+gboolean rstrnt_spool_lookup (RstrntSpool *spool,
+                              guint64 id,
+                              RstrntSpoolState *state,
+                              const gchar **location);
+void rstrnt_spool_wait (RstrntSpool *spool,
+                        guint64 id,
+                        RstrntSpoolCallback callback,
+                        gpointer user_data);
+guint rstrnt_spool_pending (RstrntSpool *spool);
+
+/*
+ * Log PUTs to a result that has no location yet are kept next to the
+ * journal and PUT to <location>/logs/<name> in the order they came once
+ * the lab controller took the result.
+ */
+gboolean rstrnt_spool_holds_logs (RstrntSpool *spool, guint64 id);
+gboolean rstrnt_spool_add_log (RstrntSpool *spool,
+                               guint64 id,
+                               const gchar *name,
+                               const gchar *range,
+                               const gchar *data,
+                               gsize length,
+                               GError **error);
+gchar *rstrnt_spool_log_url (const gchar *location, const gchar *name);
+
+#endif
@@ -0,0 +1,395 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "sync_server.h"
+
+typedef struct {
+    gpointer owner;
+    const gchar *event;   /* key in table->waiters */
+    GQueue *queue;
+    GList *link;          /* in queue */
+    GList *owner_link;    /* in the owner's queue */
+} SyncWaiter;
+
+typedef struct {
+    gint fd;
+    gboolean setter;      /* local connection, its frames are sets */
+    GString *frame;       /* partial frame read so far */
+} SyncConn;
+
+typedef struct {
+    RstrntSyncServer *server;
+    gboolean setter;
+} SyncListener;
+
+RstrntSyncTable *
+rstrnt_sync_table_new (RstrntSyncNotify notify, gpointer user_data)
+{
+    RstrntSyncTable *table = g_slice_new0 (RstrntSyncTable);
+
+    table->events = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                           NULL);
+    table->waiters = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify) g_queue_free);
+    table->owners = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                           (GDestroyNotify) g_queue_free);
+    table->notify = notify;
+    table->user_data = user_data;
+    return table;
+}
+
+void
+rstrnt_sync_table_free (RstrntSyncTable *table)
+{
+    GHashTableIter iter;
+    GQueue *queue;
+
+    g_hash_table_iter_init (&iter, table->owners);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &queue)) {
+        for (GList *l = queue->head; l != NULL; l = l->next) {
+            g_slice_free (SyncWaiter, l->data);
+        }
+    }
+    g_hash_table_destroy (table->owners);
+    g_hash_table_destroy (table->waiters);
+    g_hash_table_destroy (table->events);
+    g_slice_free (RstrntSyncTable, table);
+}
+
+static void
+sync_table_unlink_owner (RstrntSyncTable *table, SyncWaiter *waiter)
+{
+    GQueue *owned = g_hash_table_lookup (table->owners, waiter->owner);
+
+    g_queue_delete_link (owned, waiter->owner_link);
+    if (g_queue_is_empty (owned)) {
+        g_hash_table_remove (table->owners, waiter->owner);
+    }
+}
+
+/*
+ * Records event and notifies everybody waiting for it, only they are
+ * looked at.
+ */
+void
+rstrnt_sync_table_set (RstrntSyncTable *table, const gchar *event)
+{
+    gchar *key = NULL;
+    GQueue *queue = NULL;
+    SyncWaiter *waiter;
+
+    if (!g_hash_table_contains (table->events, event)) {
+        g_hash_table_add (table->events, g_strdup (event));
+    }
+    if (!g_hash_table_lookup_extended (table->waiters, event,
+                                       (gpointer *) &key, (gpointer *) &queue)) {
+        return;
+    }
+    g_hash_table_steal (table->waiters, event);
+
+    while ((waiter = g_queue_pop_head (queue)) != NULL) {
+        sync_table_unlink_owner (table, waiter);
+        table->n_waiters--;
+        table->notify (waiter->owner, key, table->user_data);
+        g_slice_free (SyncWaiter, waiter);
+    }
+    g_queue_free (queue);
+    g_free (key);
+}
+
+/*
+ * Returns TRUE if event is already set, otherwise owner waits for it.
+ */
+gboolean
+rstrnt_sync_table_block (RstrntSyncTable *table, gpointer owner,
+                         const gchar *event)
+{
+    gchar *key = NULL;
+    GQueue *queue = NULL;
+    GQueue *owned;
+    SyncWaiter *waiter;
+
+    if (g_hash_table_contains (table->events, event)) {
+        return TRUE;
+    }
+
+    if (!g_hash_table_lookup_extended (table->waiters, event,
+                                       (gpointer *) &key, (gpointer *) &queue)) {
+        key = g_strdup (event);
+        queue = g_queue_new ();
+        g_hash_table_insert (table->waiters, key, queue);
+    }
+    owned = g_hash_table_lookup (table->owners, owner);
+    if (owned == NULL) {
+        owned = g_queue_new ();
+        g_hash_table_insert (table->owners, owner, owned);
+    }
+
+    waiter = g_slice_new0 (SyncWaiter);
+    waiter->owner = owner;
+    waiter->event = key;
+    waiter->queue = queue;
+    g_queue_push_tail (queue, waiter);
+    waiter->link = queue->tail;
+    g_queue_push_tail (owned, waiter);
+    waiter->owner_link = owned->tail;
+    table->n_waiters++;
+    return FALSE;
+}
+
+/*
+ * Forgets everything owner waits for, in time proportional to that.
+ */
+void
+rstrnt_sync_table_drop (RstrntSyncTable *table, gpointer owner)
+{
+    GQueue *owned = g_hash_table_lookup (table->owners, owner);
+    SyncWaiter *waiter;
+
+    if (owned == NULL) {
+        return;
+    }
+    g_hash_table_steal (table->owners, owner);
+
+    while ((waiter = g_queue_pop_head (owned)) != NULL) {
+        g_queue_delete_link (waiter->queue, waiter->link);
+        if (g_queue_is_empty (waiter->queue)) {
+            g_hash_table_remove (table->waiters, waiter->event);
+        }
+        table->n_waiters--;
+        g_slice_free (SyncWaiter, waiter);
+    }
+    g_queue_free (owned);
+}
+
+static void
+sync_conn_free (SyncConn *conn)
+{
+    close (conn->fd);
+    g_string_free (conn->frame, TRUE);
+    g_slice_free (SyncConn, conn);
+}
+
+static void
+sync_conn_close (RstrntSyncServer *server, SyncConn *conn)
+{
+    epoll_ctl (server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    rstrnt_sync_table_drop (server->table, conn);
+    g_hash_table_remove (server->conns, conn);
+}
+
+static void
+sync_conn_send (SyncConn *conn, const gchar *event)
+{
+    gsize length = strlen (event) + 1;
+
+    // Frames are tiny, a peer that can't take one is as good as gone
+    if (send (conn->fd, event, length, MSG_NOSIGNAL | MSG_DONTWAIT) != length) {
+        // epoll reports the hangup and the connection is cleaned up there
+        shutdown (conn->fd, SHUT_RDWR);
+    }
+}
+
+static void
+sync_server_notify (gpointer owner, const gchar *event, gpointer user_data)
+{
+    sync_conn_send ((SyncConn *) owner, event);
+}
+
+static void
+sync_conn_frame (RstrntSyncServer *server, SyncConn *conn, const gchar *event)
+{
+    if (*event == '\0') {
+        return;
+    }
+    if (conn->setter) {
+        rstrnt_sync_table_set (server->table, event);
+    } else if (rstrnt_sync_table_block (server->table, conn, event)) {
+        sync_conn_send (conn, event);
+    }
+}
+
+/*
+ * Reads whatever is there and handles every complete frame.  Returns
+ * FALSE once the connection is finished with.
+ */
+static gboolean
+sync_conn_read (RstrntSyncServer *server, SyncConn *conn)
+{
+    gchar buf[SYNC_FRAME_MAX];
+
+    for (;;) {
+        gssize rcv = recv (conn->fd, buf, sizeof (buf), 0);
+        if (rcv == 0) {
+            return FALSE;
+        }
+        if (rcv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        gchar *start = buf;
+        gchar *end = buf + rcv;
+        while (start < end) {
+            gchar *nul = memchr (start, '\0', end - start);
+            if (nul == NULL) {
+                g_string_append_len (conn->frame, start, end - start);
+                break;
+            }
+            g_string_append_len (conn->frame, start, nul - start);
+            sync_conn_frame (server, conn, conn->frame->str);
+            g_string_truncate (conn->frame, 0);
+            start = nul + 1;
+        }
+        if (conn->frame->len >= SYNC_FRAME_MAX) {
+            // Not speaking our protocol
+            return FALSE;
+        }
+    }
+}
+
+static gboolean
+sync_server_dispatch (gint fd, GIOCondition condition, gpointer user_data)
+{
+    RstrntSyncServer *server = (RstrntSyncServer *) user_data;
+    struct epoll_event events[SYNC_EPOLL_EVENTS];
+    gint ready;
+
+    ready = epoll_wait (server->epoll_fd, events, SYNC_EPOLL_EVENTS, 0);
+    for (gint i = 0; i < ready; i++) {
+        SyncConn *conn = events[i].data.ptr;
+        gboolean alive = TRUE;
+
+        if (events[i].events & EPOLLIN) {
+            alive = sync_conn_read (server, conn);
+        }
+        if (!alive || events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+            sync_conn_close (server, conn);
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+void
+rstrnt_sync_server_add_conn (RstrntSyncServer *server, gint sockfd,
+                             gboolean setter)
+{
+    SyncConn *conn = g_slice_new0 (SyncConn);
+    struct epoll_event event = { 0 };
+
+    conn->fd = sockfd;
+    conn->setter = setter;
+    conn->frame = g_string_new (NULL);
+    g_unix_set_fd_nonblocking (sockfd, TRUE, NULL);
+
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = conn;
+    if (epoll_ctl (server->epoll_fd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
+        sync_conn_free (conn);
+        return;
+    }
+    g_hash_table_add (server->conns, conn);
+}
+
+static gboolean
+sync_server_accept (gint fd, GIOCondition condition, gpointer user_data)
+{
+    SyncListener *listener = (SyncListener *) user_data;
+    gint sockfd = accept (fd, NULL, NULL);
+
+    if (sockfd >= 0) {
+        rstrnt_sync_server_add_conn (listener->server, sockfd,
+                                     listener->setter);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+sync_listener_free (gpointer data)
+{
+    g_slice_free (SyncListener, data);
+}
+
+/*
+ * Connections accepted on sockfd send sets if setter, blocks otherwise.
+ */
+void
+rstrnt_sync_server_listen (RstrntSyncServer *server, gint sockfd,
+                           gboolean setter)
+{
+    SyncListener *listener = g_slice_new0 (SyncListener);
+    guint id;
+
+    listener->server = server;
+    listener->setter = setter;
+    id = g_unix_fd_add_full (G_PRIORITY_DEFAULT, sockfd, G_IO_IN,
+                             sync_server_accept, listener, sync_listener_free);
+    server->listeners = g_slist_prepend (server->listeners,
+                                         GUINT_TO_POINTER (id));
+}
+
+/*
+ * Liveness of the blocked clients comes from one epoll set watched by the
+ * main loop, nothing has to be sent to find out a peer went away.
+ */
+RstrntSyncServer *
+rstrnt_sync_server_new (GError **error)
+{
+    RstrntSyncServer *server;
+    gint epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+
+    if (epoll_fd < 0) {
+        gint errsv = errno;
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                     "Failed to create epoll instance: %s", g_strerror (errsv));
+        return NULL;
+    }
+
+    server = g_slice_new0 (RstrntSyncServer);
+    server->epoll_fd = epoll_fd;
+    server->table = rstrnt_sync_table_new (sync_server_notify, server);
+    server->conns = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                           (GDestroyNotify) sync_conn_free,
+                                           NULL);
+    server->epoll_source = g_unix_fd_add (epoll_fd, G_IO_IN,
+                                          sync_server_dispatch, server);
+    return server;
+}
+
+void
+rstrnt_sync_server_free (RstrntSyncServer *server)
+{
+    for (GSList *l = server->listeners; l != NULL; l = l->next) {
+        g_source_remove (GPOINTER_TO_UINT (l->data));
+    }
+    g_slist_free (server->listeners);
+    g_source_remove (server->epoll_source);
+    rstrnt_sync_table_free (server->table);
+    g_hash_table_destroy (server->conns);
+    close (server->epoll_fd);
+    g_slice_free (RstrntSyncServer, server);
+}
@@ -0,0 +1,68 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_SYNC_SERVER_H
+#define _RESTRAINT_SYNC_SERVER_H
+
+#include <glib.h>
+
+#define SYNC_PORT 6776
+#define SYNC_FRAME_MAX 4096   /* Longest event name, terminating NUL included */
+#define SYNC_EPOLL_EVENTS 64
+
+/*
+ * Every message is a frame, the event name followed by a NUL.  set
+ * connections send any number of them, block connections get back each
+ * of theirs once it is set.
+ */
+
+typedef void (*RstrntSyncNotify) (gpointer owner, const gchar *event,
+                                  gpointer user_data);
+
+typedef struct {
+    GHashTable *events;   /* events set so far */
+    GHashTable *waiters;  /* event -> GQueue of waiters */
+    GHashTable *owners;   /* owner -> GQueue of waiters */
+    guint n_waiters;
+    RstrntSyncNotify notify;
+    gpointer user_data;
+} RstrntSyncTable;
+
+typedef struct {
+    RstrntSyncTable *table;
+    gint epoll_fd;
+    guint epoll_source;
+    GHashTable *conns;    /* open connections */
+    GSList *listeners;    /* source ids */
+} RstrntSyncServer;
+
+RstrntSyncTable *rstrnt_sync_table_new (RstrntSyncNotify notify,
+                                        gpointer user_data);
+void rstrnt_sync_table_free (RstrntSyncTable *table);
+void rstrnt_sync_table_set (RstrntSyncTable *table, const gchar *event);
+gboolean rstrnt_sync_table_block (RstrntSyncTable *table, gpointer owner,
+                                  const gchar *event);
+void rstrnt_sync_table_drop (RstrntSyncTable *table, gpointer owner);
+
+RstrntSyncServer *rstrnt_sync_server_new (GError **error);
+void rstrnt_sync_server_free (RstrntSyncServer *server);
+void rstrnt_sync_server_listen (RstrntSyncServer *server, gint sockfd,
+                                gboolean setter);
+void rstrnt_sync_server_add_conn (RstrntSyncServer *server, gint sockfd,
+                                  gboolean setter);
+
+#endif
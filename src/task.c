@@ -45,10 +45,12 @@
 #include "env.h"
 #include "xml.h"
 #include "logging.h"
+#include "metrics.h"
 
 void
 restraint_task_result (Task *task, AppData *app_data, gchar *result,
                        gint int_score, gchar *path, gchar *message);
+static void start_uploader (AppData *app_data);
 
 void
 archive_entry_callback (const gchar *entry, gpointer user_data)
@@ -83,6 +85,17 @@ fetch_retry (gpointer user_data)
     return FALSE;
 }
 
+static void
+task_wait_resume (gpointer user_data)
+{
+    AppData *app_data = (AppData *) user_data;
+
+    app_data->task_handler_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                                                task_handler,
+                                                app_data,
+                                                NULL);
+}
+
 static gboolean
 refresh_role_retry (gpointer user_data)
 {
@@ -135,6 +148,67 @@ fetch_finish_callback (GError *error, guint32 match_cnt,
                                                 NULL);
 }
 
+static void
+task_package_install (TaskRunData *task_run_data)
+{
+    AppData *app_data = task_run_data->app_data;
+    Task *task = (Task *) app_data->tasks->data;
+    const gchar *command[] = {
+        "rstrnt-package",
+        task->keepchanges ? "install" : "reinstall",
+        task->fetch.package_name,
+        NULL
+    };
+
+    process_run_argv (command, NULL, NULL, NULL, NULL, FALSE, NULL,
+                      NULL, task_io_callback, task_handler_callback,
+                      NULL, 0, FALSE, app_data->cancellable, task_run_data);
+}
+
+static void
+task_package_verified (gboolean unmodified, gpointer user_data)
+{
+    TaskRunData *task_run_data = (TaskRunData *) user_data;
+    AppData *app_data = task_run_data->app_data;
+    Task *task = (Task *) app_data->tasks->data;
+
+    if (!unmodified) {
+        task_package_install (task_run_data);
+        return;
+    }
+
+    gchar *message = g_strdup_printf ("** Package %s already installed\n",
+                                      task->fetch.package_name);
+    restraint_log_task (app_data, RSTRNT_LOG_TYPE_HARNESS, message,
+                        strlen (message));
+    g_free (message);
+    task_handler_callback (0, FALSE, task_run_data, NULL);
+}
+
+/*
+ * The package manager is skipped when the task package is already there.
+ * Without keepchanges the package is normally reinstalled to get pristine
+ * files back, which is only needed when rpm says they were modified.
+ * Both rpm queries run from the main loop.
+ */
+static void
+task_package_cache_loaded (gpointer user_data)
+{
+    TaskRunData *task_run_data = (TaskRunData *) user_data;
+    AppData *app_data = task_run_data->app_data;
+    Task *task = (Task *) app_data->tasks->data;
+
+    if (!rstrnt_package_cache_contains (task->recipe->packages,
+                                        task->fetch.package_name)) {
+        task_package_install (task_run_data);
+    } else if (task->keepchanges) {
+        task_package_verified (TRUE, task_run_data);
+    } else {
+        rstrnt_package_verify (task->fetch.package_name, app_data->cancellable,
+                               task_package_verified, task_run_data);
+    }
+}
+
 void
 restraint_task_fetch(AppData *app_data) {
     g_return_if_fail(app_data != NULL);
@@ -174,24 +248,19 @@ restraint_task_fetch(AppData *app_data) {
         }
         case TASK_FETCH_INSTALL_PACKAGE:
             ;
-            gchar *command = NULL;
-            if (task->keepchanges) {
-              command = g_strdup_printf ("rstrnt-package install %s",
-                                         task->fetch.package_name);
-            } else {
-              command = g_strdup_printf ("rstrnt-package reinstall %s",
-                                         task->fetch.package_name);
-            }
             // Use appropriate package install command
             TaskRunData *task_run_data = g_slice_new0(TaskRunData);
             task_run_data->app_data = app_data;
             task_run_data->pass_state = TASK_METADATA_PARSE;
             task_run_data->fail_state = TASK_COMPLETE;
             task_run_data->log_type = RSTRNT_LOG_TYPE_HARNESS;
-            process_run ((const gchar *)command, NULL, NULL, FALSE, 0,
-                         NULL, task_io_callback, task_handler_callback,
-                         NULL, 0, FALSE, app_data->cancellable, task_run_data);
-            g_free (command);
+            if (rstrnt_package_force_reinstall (task->recipe->params, task->params)) {
+                task_package_install (task_run_data);
+                break;
+            }
+            // task_package_cache_loaded moves us on
+            rstrnt_package_cache_load (task->recipe->packages, app_data->cancellable,
+                                       task_package_cache_loaded, task_run_data);
             break;
         default:
             // Set task_run_data->error and add task_handler_callback
@@ -203,6 +272,50 @@ restraint_task_fetch(AppData *app_data) {
     }
 }
 
+static void
+task_output_counted (AppData *app_data, gsize bytes)
+{
+    Task *task = (Task *) app_data->tasks->data;
+
+    task->output_bytes += bytes;
+    rstrnt_lwd_telemetry_output (task->telemetry, bytes);
+}
+
+/*
+ * Task output goes straight from the pipe or pty to task.log, the
+ * uploader picks it up from there.
+ */
+static gboolean
+task_output_pump (GIOChannel *io, GIOCondition condition, AppData *app_data)
+{
+    Task *task = (Task *) app_data->tasks->data;
+    GError *tmp_error = NULL;
+    gssize bytes;
+
+    if (condition & G_IO_IN) {
+        bytes = rstrnt_log_pump (task, RSTRNT_LOG_TYPE_TASK,
+                                 g_io_channel_unix_get_fd (io), &tmp_error);
+        if (bytes > 0) {
+            task_output_counted (app_data, bytes);
+            if (0 == app_data->uploader_source_id)
+                start_uploader (app_data);
+            return G_SOURCE_CONTINUE;
+        }
+        if (bytes == 0) {
+            g_print ("finished!");
+            return G_SOURCE_REMOVE;
+        }
+        if (g_error_matches (tmp_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+            g_clear_error (&tmp_error);
+            return G_SOURCE_CONTINUE;
+        }
+        g_warning ("IO error: %s", tmp_error->message);
+        g_clear_error (&tmp_error);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
 gboolean
 io_callback (GIOChannel    *io,
              GIOCondition   condition,
@@ -212,6 +325,11 @@ io_callback (GIOChannel    *io,
     AppData *app_data = (AppData *) user_data;
     GError *tmp_error = NULL;
 
+    if (log_type == RSTRNT_LOG_TYPE_TASK && app_data->tasks != NULL &&
+        rstrnt_log_manager_enabled (app_data)) {
+        return task_output_pump (io, condition, app_data);
+    }
+
     gchar buf[IO_BUFFER_SIZE] = { 0 };
     gsize bytes_read = 0;
 
@@ -224,6 +342,9 @@ io_callback (GIOChannel    *io,
             g_debug ("%s", buf);
 
             restraint_log_task (app_data, log_type, buf, bytes_read);
+            if (log_type == RSTRNT_LOG_TYPE_TASK && app_data->tasks != NULL) {
+                task_output_counted (app_data, bytes_read);
+            }
 
             return G_SOURCE_CONTINUE;
 
@@ -276,6 +397,46 @@ task_finish_plugins_callback (gint pid_result, gboolean localwatchdog, gpointer
     g_slice_free(TaskRunData, task_run_data);
 }
 
+static void
+task_output_finish (AppData *app_data, Task *task)
+{
+    gdouble seconds = (g_get_monotonic_time () - task->output_start) / (gdouble) G_USEC_PER_SEC;
+    gchar *message;
+
+    message = g_strdup_printf ("*** Task output: %" G_GUINT64_FORMAT " bytes, %.0f bytes/s\n",
+                               task->output_bytes,
+                               seconds > 0 ? task->output_bytes / seconds : 0);
+    g_printerr ("%s", message);
+    restraint_log_task (app_data, RSTRNT_LOG_TYPE_HARNESS, message, strlen (message));
+    g_free (message);
+}
+
+/*
+ * Logs what the task used and releases its cgroup.  Returns the usage
+ * summary reported with the exit code result.
+ */
+static gchar *
+task_cgroup_finish (AppData *app_data, Task *task)
+{
+    RstrntCgroupStats stats;
+    gchar *usage;
+    gchar *message;
+
+    rstrnt_cgroup_read_stats (task->cgroup, &stats);
+    usage = rstrnt_cgroup_stats_to_string (&stats);
+    message = g_strdup_printf ("*** Task resources: %s%s\n", usage,
+                               rstrnt_cgroup_populated (task->cgroup) ?
+                               " (processes left running)" : "");
+    g_printerr ("%s", message);
+    restraint_log_task (app_data, RSTRNT_LOG_TYPE_HARNESS, message, strlen (message));
+    g_free (message);
+
+    rstrnt_cgroup_unref (task->cgroup);
+    task->cgroup = NULL;
+
+    return usage;
+}
+
 void
 task_finish_callback (gint pid_result, gboolean localwatchdog, gpointer user_data, GError *error)
 {
@@ -283,6 +444,21 @@ task_finish_callback (gint pid_result, gboolean localwatchdog, gpointer user_dat
     AppData *app_data = task_run_data->app_data;
     Task *task = app_data->tasks->data;
 
+    gchar *usage = NULL;
+
+    if (rstrnt_watchdog_armed (task->watchdog)) {
+        task->remaining_time = rstrnt_watchdog_remaining (task->watchdog);
+        rstrnt_watchdog_disarm (task->watchdog);
+    }
+    restraint_task_telemetry (task, localwatchdog ? LWD_EVENT_EXPIRE : LWD_EVENT_FINISH, 0);
+    rstrnt_lwd_telemetry_close (task->telemetry);
+    task->telemetry = NULL;
+
+    task_output_finish (app_data, task);
+    if (task->cgroup) {
+        usage = task_cgroup_finish (app_data, task);
+    }
+
     // Did the command Succeed?
     if (pid_result == 0) {
         task->state = task_run_data->pass_state;
@@ -290,7 +466,7 @@ task_finish_callback (gint pid_result, gboolean localwatchdog, gpointer user_dat
         // If not running in rhts compat mode and user hasn't reported results,
         // report PASS for exit code 0.
         if (!task->rhts_compat && !task->results_reported) {
-            restraint_task_result(task, app_data, "PASS", 0, "exit_code", NULL);
+            restraint_task_result(task, app_data, "PASS", 0, "exit_code", usage);
         }
     } else {
         task->state = task_run_data->fail_state;
@@ -307,8 +483,11 @@ task_finish_callback (gint pid_result, gboolean localwatchdog, gpointer user_dat
         } else {
             // If not running in rhts compat mode report FAIL if exit code is not 0
             if (!task->rhts_compat) {
-                restraint_task_result(task, app_data, "FAIL", pid_result, 
-                                      "exit_code", "Command returned non-zero");
+                gchar *message = g_strconcat ("Command returned non-zero",
+                                              usage ? ", " : NULL, usage, NULL);
+                restraint_task_result(task, app_data, "FAIL", pid_result,
+                                      "exit_code", message);
+                g_free (message);
             } else {
                 g_set_error(&task->error, RESTRAINT_ERROR,
                             RESTRAINT_TASK_RUNNER_RC_ERROR,
@@ -317,45 +496,43 @@ task_finish_callback (gint pid_result, gboolean localwatchdog, gpointer user_dat
         }
     }
 
+    g_free (usage);
+
     // Run Finish/Completed plugins
     // Always run completed plugins and if localwatchdog triggered run those as well.
-    gchar *command = g_strdup_printf ("%s %s", TASK_PLUGIN_SCRIPT, PLUGIN_SCRIPT);
-    // Last four entries are NULL.  Replace first three with plugin vars
+    const gchar *command[] = { PLUGIN_SCRIPT, NULL };
+    RstrntCgroup *plugin_cgroup = restraint_task_cgroup (task, "plugins");
+    // The plugin variables only live for this run
+    RstrntEnvMap *plugin_env = rstrnt_env_map_new (task->env);
     gchar *localwatchdog_plugin = g_strdup_printf(" %s/localwatchdog.d", PLUGIN_DIR);
-    gchar *plugin_dir = g_strdup_printf("RSTRNT_PLUGINS_DIR=%s/completed.d%s", PLUGIN_DIR, localwatchdog ? localwatchdog_plugin : "");
+    rstrnt_env_map_setf (plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_PLUGINS_DIR", "%s/completed.d%s",
+                         PLUGIN_DIR, localwatchdog ? localwatchdog_plugin : "");
     g_free (localwatchdog_plugin);
-    if (task->env->pdata[task->env->len - 5] != NULL) {
-        g_free (task->env->pdata[task->env->len - 5]);
-    }
-    task->env->pdata[task->env->len - 5] = plugin_dir;
+    rstrnt_env_map_set (plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_NOPLUGINS", "1");
+    rstrnt_env_map_set (plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_LOCALWATCHDOG",
+                        localwatchdog ? "TRUE" : "FALSE");
 
-    gchar *no_plugins = g_strdup_printf("RSTRNT_NOPLUGINS=1");
-    if (task->env->pdata[task->env->len - 4] != NULL) {
-        g_free (task->env->pdata[task->env->len - 4]);
-    }
-    task->env->pdata[task->env->len - 4] = no_plugins;
-
-    gchar *rstrnt_localwatchdog = g_strdup_printf("RSTRNT_LOCALWATCHDOG=%s", localwatchdog ? "TRUE" : "FALSE");
-    if (task->env->pdata[task->env->len - 3] != NULL) {
-        g_free (task->env->pdata[task->env->len - 3]);
-    }
-    task->env->pdata[task->env->len - 3] = rstrnt_localwatchdog;
+    RstrntTaskPlugins *plugins = restraint_task_plugins (task, command, plugin_env);
 
     task_run_data->log_type = RSTRNT_LOG_TYPE_HARNESS;
-    process_run ((const gchar *) command,
-                 (const gchar **) task->env->pdata,
-                 "/usr/share/restraint/plugins",
-                 FALSE,
-                 0,
-                 NULL,
-                 task_io_callback,
-                 task_finish_plugins_callback,
-                 NULL,
-                 0,
-                 FALSE,
-                 app_data->cancellable,
-                 task_run_data);
-    g_free (command);
+    process_run_argv ((const gchar *const *) plugins->argv,
+                      rstrnt_env_map_envp (plugins->env),
+                      "/usr/share/restraint/plugins",
+                      plugin_cgroup,
+                      &plugins->attrs,
+                      FALSE,
+                      NULL,
+                      NULL,
+                      task_io_callback,
+                      task_finish_plugins_callback,
+                      NULL,
+                      0,
+                      FALSE,
+                      app_data->cancellable,
+                      task_run_data);
+    rstrnt_task_plugins_free (plugins);
+    rstrnt_env_map_unref (plugin_env);
+    rstrnt_cgroup_unref (plugin_cgroup);
 }
 
 static void
@@ -385,6 +562,12 @@ check_param_for_override (Param *param, Task *task)
         task->metadata->use_pty = STREQ (value, "TRUE");
 
         g_free (value);
+    } else if (STREQ (name, "RSTRNT_MEMORY_MAX")) {
+        g_free (task->memory_max);
+        task->memory_max = g_strdup (param->value);
+    } else if (STREQ (name, "RSTRNT_CPU_MAX")) {
+        g_free (task->cpu_max);
+        task->cpu_max = g_strdup (param->value);
     }
 }
 
@@ -473,6 +656,8 @@ task_handler_callback (gint pid_result, gboolean localwatchdog, gpointer user_da
         // Did the command Succeed?
         if (pid_result == 0) {
             task->state = task_run_data->pass_state;
+            rstrnt_package_cache_add (task->recipe->packages,
+                                      task->fetch.package_name);
         } else {
             task->state = task_run_data->fail_state;
             g_set_error (&task->error, RESTRAINT_ERROR,
@@ -515,30 +700,40 @@ restraint_log_lwd_message (AppData *app_data,
     g_string_free (message, TRUE);
 }
 
-void restraint_start_heartbeat(TaskRunData *task_run_data,
-                               gint64 remaining_time,
-                               time_t *expire_time)
+static void
+lwd_expire_time (gchar *expire_time, gsize size, gint64 remaining_time)
 {
     time_t rawtime = time (NULL);
     struct tm timeinfo;
-    if (expire_time != NULL) {
-        localtime_r(expire_time, &timeinfo);
-    } else {
+
+    if (remaining_time != 0) {
         localtime_r(&rawtime, &timeinfo);
         timeinfo.tm_sec += remaining_time;
-    }
-
-    if ((remaining_time != 0) || (expire_time != NULL)) {
         mktime(&timeinfo);
-        strftime(task_run_data->expire_time,
-                 sizeof(task_run_data->expire_time),
-                 "%a %b %d %H:%M:%S %Y", &timeinfo);
+        strftime(expire_time, size, "%a %b %d %H:%M:%S %Y", &timeinfo);
     } else {
-        snprintf(task_run_data->expire_time,
-                  sizeof(task_run_data->expire_time),
-                  " * Disabled! *");
+        snprintf(expire_time, size, " * Disabled! *");
     }
+}
+
+void restraint_start_heartbeat(TaskRunData *task_run_data,
+                               gint64 remaining_time)
+{
+    lwd_expire_time (task_run_data->expire_time,
+                     sizeof (task_run_data->expire_time),
+                     remaining_time);
+}
 
+/*
+ * The only place remaining_time is written to the config, a task that
+ * is resumed after a reboot gets the time it had left.
+ */
+static void
+task_watchdog_persist (AppData *app_data, Task *task)
+{
+    restraint_config_set (app_data->config_file, task->task_id,
+                          "remaining_time", NULL,
+                          G_TYPE_UINT64, task->remaining_time);
 }
 
 gboolean
@@ -548,64 +743,180 @@ task_heartbeat_callback (gpointer user_data)
     AppData *app_data = task_run_data->app_data;
     Task *task = (Task *) app_data->tasks->data;
 
-    time_t rawtime;
-    double delta_sec = 0;
-    gboolean modified_wd = FALSE;
-
-    if (task->time_chged != NULL) {
-        // user requested WD change by way of
-        // rstrnt-adjust-watchdog cli
-        modified_wd = TRUE;
-        if (task->remaining_time) {
-            time(&rawtime);
-            delta_sec = difftime(rawtime, *task->time_chged);
-            // calculate expired time
-            *task->time_chged += task->remaining_time;
-            if (delta_sec < task->remaining_time) {
-                task->remaining_time -= delta_sec;
-            } else {
-                task->remaining_time = 0;
-            }
-        }
-        restraint_start_heartbeat(
-            task_run_data,
-            task->remaining_time,
-            task->time_chged);
-        g_free(task->time_chged);
-        task->time_chged = NULL;
-    } else {
-        if (task->remaining_time > HEARTBEAT) {
-            task->remaining_time -= HEARTBEAT;
-        } else {
-            task->remaining_time = 0;
-        }
-    }
-    restraint_config_set (app_data->config_file, task->task_id,
-                          "remaining_time", NULL,
-                          G_TYPE_UINT64, task->remaining_time);
+    // The watchdog keeps the deadline, the heartbeat only reports on it
+    task->remaining_time = rstrnt_watchdog_remaining (task->watchdog);
+    task_watchdog_persist (app_data, task);
+    restraint_task_telemetry (task, LWD_EVENT_HEARTBEAT, 0);
 
     restraint_log_lwd_message(task_run_data->app_data,
                               task_run_data->expire_time,
-                              modified_wd);
+                              FALSE);
 
     return G_SOURCE_CONTINUE;
 }
 
-void task_timeout_cb(gpointer user_data, guint64 *time_remain)
+void task_timeout_cb(gpointer user_data)
 {
-    TaskRunData *task_run_data = (TaskRunData *) user_data;
-    AppData *app_data = task_run_data->app_data;
+    task_heartbeat_callback (user_data);
+}
+
+/*
+ * rstrnt-adjust-watchdog, the running task is killed seconds from now.
+ * The new deadline takes effect right away.
+ */
+void
+restraint_task_adjust_watchdog (AppData *app_data, Task *task, gint64 seconds)
+{
+    GError *error = NULL;
+    gchar expire_time[80];
+
+    task->remaining_time = seconds;
+    if (rstrnt_watchdog_armed (task->watchdog) &&
+        !rstrnt_watchdog_set (task->watchdog, seconds, &error)) {
+        g_warning ("Failed to adjust local watchdog: %s", error->message);
+        g_clear_error (&error);
+    }
+    task_watchdog_persist (app_data, task);
+    restraint_task_telemetry (task, LWD_EVENT_ADJUST, seconds);
+
+    lwd_expire_time (expire_time, sizeof (expire_time), seconds);
+    restraint_log_lwd_message (app_data, expire_time, TRUE);
+}
+
+static void
+task_telemetry_open (Task *task)
+{
+    GError *error = NULL;
+    gchar *path;
+
+    if (task->telemetry != NULL) {
+        return;
+    }
+    path = rstrnt_lwd_telemetry_path (LWD_TELEMETRY_DIR, task->task_id);
+    task->telemetry = rstrnt_lwd_telemetry_open (path, LWD_TELEMETRY_RECORDS, &error);
+    if (task->telemetry == NULL) {
+        g_printerr ("Local watchdog telemetry disabled: %s\n", error->message);
+        g_clear_error (&error);
+    }
+    g_free (path);
+}
+
+void
+restraint_task_telemetry (Task *task, RstrntLwdEvent event, gint64 adjusted)
+{
+    GError *error = NULL;
+
+    if (task->telemetry == NULL) {
+        return;
+    }
+    if (!rstrnt_lwd_telemetry_record (task->telemetry, event,
+                                      task->remaining_time, adjusted, &error)) {
+        g_printerr ("%s [%s, %d]\n", error->message,
+                    g_quark_to_string (error->domain), error->code);
+        g_clear_error (&error);
+    }
+}
+
+/*
+ * Makes a cgroup for a process tree of task, kind tells the task itself
+ * from its plugins.  NULL when cgroups are not used or can't be made,
+ * the processes then run in the cgroup of restraintd.
+ */
+RstrntCgroup *
+restraint_task_cgroup (Task *task, const gchar *kind)
+{
+    static guint serial = 0;
+    RstrntCgroup *cgroup;
+    GError *error = NULL;
+    gchar *name;
+
+    if (!rstrnt_cgroup_enabled ()) {
+        return NULL;
+    }
+    // Plugins may run next to each other, each gets its own leaf
+    name = g_strdup_printf ("%s-%s-%u", kind, task->task_id, ++serial);
+    cgroup = rstrnt_cgroup_new (name, &error);
+    if (cgroup == NULL) {
+        g_printerr ("Running %s of task %s outside a cgroup: %s\n",
+                    kind, task->task_id, error->message);
+        g_clear_error (&error);
+    }
+    g_free (name);
+
+    return cgroup;
+}
+
+/*
+ * Runs command through the task_run.d plugins with env.  The host is
+ * looked at once per recipe before its first task runs, without the
+ * facts the scripts do it all.
+ */
+RstrntTaskPlugins *
+restraint_task_plugins (Task *task, const gchar *const *command, RstrntEnvMap *env)
+{
+    return rstrnt_task_plugins_new (TASK_PLUGIN_DIR, command, env, task->recipe->host_facts);
+}
+
+static void
+task_host_facts_cb (RstrntHostFacts *facts, gpointer user_data)
+{
+    AppData *app_data = (AppData *) user_data;
     Task *task = (Task *) app_data->tasks->data;
-    gboolean result;
 
-    result = task_heartbeat_callback(task_run_data);
-    if (!result) {
-        task->remaining_time = 0;
+    task->recipe->host_facts = facts;
+    app_data->task_handler_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                                                task_handler,
+                                                app_data,
+                                                NULL);
+}
+
+static void
+task_cgroup_limit (AppData *app_data, Task *task, const gchar *file,
+                   const gchar *value)
+{
+    GError *error = NULL;
+
+    if (value == NULL || rstrnt_cgroup_set (task->cgroup, file, value, &error)) {
+        return;
     }
+    gchar *message = g_strdup_printf ("*** Ignoring %s %s: %s\n", file, value,
+                                      error->message);
+    g_printerr ("%s", message);
+    restraint_log_task (app_data, RSTRNT_LOG_TYPE_HARNESS, message, strlen (message));
+    g_free (message);
+    g_clear_error (&error);
+}
+
+static void
+task_watchdog_arm (Task *task)
+{
+    GError *error = NULL;
 
-    *time_remain = task->remaining_time;
+    // no_localwatchdog
+    if (task->remaining_time <= 0) {
+        return;
+    }
+    if (task->watchdog == NULL) {
+        task->watchdog = rstrnt_watchdog_new (&error);
+    }
+    if (task->watchdog != NULL &&
+        !rstrnt_watchdog_set (task->watchdog, task->remaining_time, &error)) {
+        g_clear_pointer (&task->watchdog, rstrnt_watchdog_unref);
+    }
+    if (task->watchdog == NULL) {
+        // Never run a task unguarded, a main loop timeout still kills it
+        g_printerr ("Local watchdog of task %s falls back to a timeout: %s\n",
+                    task->task_id, error->message);
+        g_clear_error (&error);
+        task->watchdog = rstrnt_watchdog_new_timeout ();
+        rstrnt_watchdog_set (task->watchdog, task->remaining_time, NULL);
+    }
 }
 
+static void task_exec (TaskRunData *task_run_data, RstrntTaskPlugins *plugins);
+static void task_linger_finish_callback (gint pid_result, gboolean localwatchdog,
+                                         gpointer user_data, GError *error);
+
 void
 task_run (AppData *app_data)
 {
@@ -615,39 +926,106 @@ task_run (AppData *app_data)
     task_run_data->pass_state = TASK_COMPLETE;
     task_run_data->fail_state = TASK_COMPLETE;
 
-    gchar *entry_point;
-    if (task->metadata->entry_point) {
-        entry_point = g_strdup_printf ("%s %s", TASK_PLUGIN_SCRIPT, task->metadata->entry_point);
-    } else {
-        entry_point = g_strdup_printf ("%s %s", TASK_PLUGIN_SCRIPT, DEFAULT_ENTRY_POINT);
-    }
+    gchar **entry_point = g_strsplit (task->metadata->entry_point ?
+                                      task->metadata->entry_point : DEFAULT_ENTRY_POINT,
+                                      " ", 0);
     if (task->metadata->nolocalwatchdog) {
       task->remaining_time = 0;
     }
 
     task_run_data->log_type = RSTRNT_LOG_TYPE_TASK;
-    restraint_start_heartbeat(task_run_data, task->remaining_time, NULL);
+    task->output_bytes = 0;
+    task->output_start = g_get_monotonic_time ();
+    restraint_start_heartbeat(task_run_data, task->remaining_time);
+    task_telemetry_open (task);
+    restraint_task_telemetry (task, LWD_EVENT_START, 0);
     if (task->metadata->nolocalwatchdog) {
         restraint_log_lwd_message(task_run_data->app_data,
                                   task_run_data->expire_time,
                                   FALSE);
     }
 
-    process_run ((const gchar *) entry_point,
-                 (const gchar **)task->env->pdata,
-                 task->path,
-                 task->metadata->use_pty,
-                 task->remaining_time,
-                 task_timeout_cb,
-                 task_io_callback,
-                 task_finish_callback,
-                 NULL,
-                 0,
-                 FALSE,
-                 app_data->cancellable,
-                 task_run_data);
-
-    g_free (entry_point);
+    rstrnt_cgroup_unref (task->cgroup);
+    task->cgroup = restraint_task_cgroup (task, "task");
+    if (task->cgroup) {
+        task_cgroup_limit (app_data, task, "memory.max", task->memory_max);
+        task_cgroup_limit (app_data, task, "cpu.max", task->cpu_max);
+    }
+
+    task_watchdog_arm (task);
+
+    RstrntTaskPlugins *plugins = restraint_task_plugins (task,
+                                                         (const gchar *const *) entry_point,
+                                                         task->env);
+    g_strfreev (entry_point);
+
+    if (plugins->linger_argv != NULL) {
+        RstrntWatchdog *watchdog = process_watchdog_new (TASK_PLUGIN_TIMEOUT,
+                                                         *plugins->linger_argv);
+
+        task_run_data->plugins = plugins;
+        process_run_argv ((const gchar *const *) plugins->linger_argv,
+                          NULL,
+                          NULL,
+                          NULL,
+                          NULL,
+                          FALSE,
+                          watchdog,
+                          NULL,
+                          task_io_callback,
+                          task_linger_finish_callback,
+                          NULL,
+                          0,
+                          FALSE,
+                          app_data->cancellable,
+                          task_run_data);
+        rstrnt_watchdog_unref (watchdog);
+    } else {
+        task_exec (task_run_data, plugins);
+    }
+}
+
+/* Starts the task itself through plugins, which it frees */
+static void
+task_exec (TaskRunData *task_run_data, RstrntTaskPlugins *plugins)
+{
+    AppData *app_data = task_run_data->app_data;
+    Task *task = (Task *) app_data->tasks->data;
+
+    process_run_argv ((const gchar *const *) plugins->argv,
+                      rstrnt_env_map_envp (plugins->env),
+                      task->path,
+                      task->cgroup,
+                      &plugins->attrs,
+                      task->metadata->use_pty,
+                      rstrnt_watchdog_armed (task->watchdog) ? task->watchdog : NULL,
+                      task_timeout_cb,
+                      task_io_callback,
+                      task_finish_callback,
+                      NULL,
+                      0,
+                      FALSE,
+                      app_data->cancellable,
+                      task_run_data);
+
+    rstrnt_task_plugins_free (plugins);
+}
+
+static void
+task_linger_finish_callback (gint pid_result, gboolean localwatchdog,
+                             gpointer user_data, GError *error)
+{
+    TaskRunData *task_run_data = (TaskRunData *) user_data;
+    RstrntTaskPlugins *plugins = g_steal_pointer (&task_run_data->plugins);
+
+    if (error != NULL) {
+        g_warning ("%s %s failed: %s", plugins->linger_argv[1],
+                   plugins->linger_argv[2], error->message);
+    } else if (pid_result != 0) {
+        g_warning ("%s %s returned %i", plugins->linger_argv[1],
+                   plugins->linger_argv[2], pid_result);
+    }
+    task_exec (task_run_data, plugins);
 }
 
 static void
@@ -813,9 +1191,12 @@ void restraint_task_free(Task *task) {
     }
     g_list_free_full(task->params, (GDestroyNotify) restraint_param_free);
     g_list_free_full(task->roles, (GDestroyNotify) restraint_role_free);
-    //g_strfreev (task->env);
-    if (task->env)
-        g_ptr_array_free (task->env, TRUE);
+    rstrnt_env_map_unref (task->env);
+    rstrnt_lwd_telemetry_close (task->telemetry);
+    rstrnt_cgroup_unref (task->cgroup);
+    rstrnt_watchdog_unref (task->watchdog);
+    g_free (task->memory_max);
+    g_free (task->cpu_max);
     restraint_metadata_free(task->metadata);
     g_slice_free(Task, task);
 }
@@ -823,13 +1204,26 @@ void restraint_task_free(Task *task) {
 gboolean
 restraint_next_task (AppData *app_data, TaskSetupState task_state) {
     Task *task = NULL;
+    GError *error = NULL;
 
-    while ((app_data->tasks = g_list_next (app_data->tasks)) != NULL) {
+    app_data->tasks = restraint_recipe_next_task (app_data->recipe,
+                                                  app_data->tasks, &error);
+    if (app_data->tasks != NULL) {
         task = (Task *) app_data->tasks->data;
         task->state = task_state;
         return TRUE;
     }
 
+    if (error != NULL) {
+        // The next <task/> could not be built, the recipe ends here
+        if (app_data->error == NULL) {
+            g_propagate_error (&app_data->error, error);
+        } else {
+            g_warning ("%s", error->message);
+            g_error_free (error);
+        }
+    }
+
     // No more tasks, let the recipe_handler know we are done.
     app_data->state = RECIPE_COMPLETE;
     app_data->aborted = ABORTED_NONE;
@@ -987,32 +1381,28 @@ parse_task_config (gchar   *config_file,
 }
 
 static void
-recipe_fetch_complete(GError *error, xmlDoc *doc, gpointer user_data)
+recipe_refresh_complete (GError *error, gpointer user_data)
 {
     AppData *app_data = (AppData *)user_data;
     Task *task = app_data->tasks->data;
 
-    if (error) {
+    if (g_error_matches (error, RESTRAINT_RECIPE_PARSE_ERROR,
+                         RESTRAINT_RECIPE_PARSE_ERROR_UNRECOGNISED)) {
+        // Bad roles won't get any better by asking again
+        g_propagate_error(&task->error, g_error_copy (error));
+        task->state = TASK_COMPLETE;
+    } else if (error) {
         if (app_data->fetch_retries < ROLE_REFRESH_RETRIES) {
             g_print("* RETRY refresh roles [%d]**:%s\n", ++app_data->fetch_retries,
                     error->message);
             g_timeout_add_seconds (ROLE_REFRESH_INTERVAL, refresh_role_retry, app_data);
             return;
         } else {
-            g_warn_if_fail(!doc);
-            g_propagate_error(&task->error, error);
+            g_propagate_error(&task->error, g_error_copy (error));
             task->state = TASK_COMPLETE;
         }
     } else {
-        g_warn_if_fail(doc != NULL);
-        GError *tmp_error = NULL;
-        restraint_recipe_update_roles(app_data->recipe, doc, &tmp_error);
-        if (tmp_error) {
-            g_propagate_error(&task->error, tmp_error);
-            task->state = TASK_COMPLETE;
-        } else {
-            task->state = TASK_ENV;
-        }
+        task->state = TASK_ENV;
     }
 
     app_data->task_handler_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
@@ -1077,6 +1467,39 @@ stop_uploader (AppData *app_data)
     app_data->uploader_source_id = 0;
 }
 
+/* The harness log of the last task keeps the metrics of the whole recipe */
+static void
+restraint_log_metrics (AppData *app_data)
+{
+    Recipe *recipe = app_data->recipe;
+    gchar *summary;
+
+    if (app_data->tasks->next != NULL ||
+        (recipe != NULL && recipe->task_xml != NULL && !g_queue_is_empty (recipe->task_xml)))
+        return;
+
+    summary = rstrnt_metrics_summary ();
+    g_printerr ("%s", summary);
+    restraint_log_task (app_data, RSTRNT_LOG_TYPE_HARNESS, summary, strlen (summary));
+    g_free (summary);
+}
+
+/*
+ * The report plugins of a spooled result finished, the task may be
+ * waiting for them to complete.
+ */
+void
+restraint_task_plugins_done (AppData *app_data, Task *task)
+{
+    if (--task->plugins_running == 0 && task->plugins_wait) {
+        task->plugins_wait = FALSE;
+        app_data->task_handler_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                                                    task_handler,
+                                                    app_data,
+                                                    NULL);
+    }
+}
+
 gboolean
 task_handler (gpointer user_data)
 {
@@ -1133,8 +1556,11 @@ task_handler (gpointer user_data)
       }
       break;
     case TASK_FETCH:
-        if (!app_data->stdin && recipe_wait_on_beaker (app_data->recipe_url, "** Task fetch"))
+        if (!app_data->stdin && recipe_wait_on_beaker (app_data, "** Task fetch",
+                                                          task_wait_resume)) {
+            result = G_SOURCE_REMOVE;
             break;
+        }
 
         // Fetch Task from rpm or url
         if (app_data->fetch_retries > 0) {
@@ -1154,13 +1580,16 @@ task_handler (gpointer user_data)
       break;
     case TASK_REFRESH_ROLES:
       if (app_data->recipe_url) {
-          if (!app_data->stdin && recipe_wait_on_beaker (app_data->recipe_url, "** Task role refresh"))
+          if (!app_data->stdin && recipe_wait_on_beaker (app_data, "** Task role refresh",
+                                                            task_wait_resume)) {
+              result = G_SOURCE_REMOVE;
               break;
+          }
 
           g_string_printf(message, "** Refreshing peer role hostnames: Retries %"
                                      G_GINT32_FORMAT "\n", app_data->fetch_retries);
-          restraint_xml_parse_from_url(soup_session, app_data->recipe_url,
-                  recipe_fetch_complete, app_data);
+          restraint_recipe_refresh_roles(soup_session, app_data->recipe,
+                  app_data->recipe_url, recipe_refresh_complete, app_data);
           result = G_SOURCE_REMOVE;
       } else {
           task->state = TASK_ENV;
@@ -1189,14 +1618,17 @@ task_handler (gpointer user_data)
       // All dependencies are installed with system package command
       // All repodependencies are installed via fetch_git
       if (!task->started) {
-          if (!app_data->stdin && recipe_wait_on_beaker (app_data->recipe_url, "** Task dependencies"))
+          if (!app_data->stdin && recipe_wait_on_beaker (app_data, "** Task dependencies",
+                                                            task_wait_resume)) {
+              result = G_SOURCE_REMOVE;
               break;
+          }
 
           g_string_printf(message, "** Installing dependencies\n");
           TaskRunData *task_run_data = g_slice_new0(TaskRunData);
           task_run_data->app_data = app_data;
           task_run_data->log_type = RSTRNT_LOG_TYPE_HARNESS;
-          restraint_start_heartbeat(task_run_data, 0, NULL);
+          restraint_start_heartbeat(task_run_data, 0);
           restraint_install_dependencies (task, task_io_callback,
                                           taskrun_archive_entry_callback,
                                           dependency_finish_cb,
@@ -1214,6 +1646,12 @@ task_handler (gpointer user_data)
       //       heartbeat_handler
       if (g_cancellable_is_cancelled (app_data->cancellable)) {
           task->state = TASK_COMPLETE;
+      } else if (task->recipe->host_facts == NULL) {
+          // Once per recipe, the login shell may take a while
+          rstrnt_host_facts_lookup (rstrnt_env_map_envp (task->recipe->env),
+                                    app_data->cancellable,
+                                    task_host_facts_cb, app_data);
+          result = G_SOURCE_REMOVE;
       } else {
           g_string_printf(message, "** Running task: %s [%s]\n", task->task_id, task->name);
           task_run (app_data);
@@ -1234,6 +1672,12 @@ task_handler (gpointer user_data)
       }
       break;
     case TASK_COMPLETE:
+      // Results the plugins post after the task completed are refused
+      if (task->plugins_running > 0) {
+          task->plugins_wait = TRUE;
+          result = G_SOURCE_REMOVE;
+          break;
+      }
       // Set task finished
       if (g_cancellable_is_cancelled(app_data->cancellable) &&
           app_data->aborted != ABORTED_NONE) {
@@ -1254,6 +1698,7 @@ task_handler (gpointer user_data)
       break;
     case TASK_COMPLETED:
     {
+      restraint_log_metrics (app_data);
       if (rstrnt_log_manager_enabled (app_data)) {
           if (0 != app_data->uploader_source_id)
               stop_uploader (app_data);
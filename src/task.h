@@ -26,9 +26,13 @@
 #include "recipe.h"
 #include "logging.h"
 #include "message.h"
+#include "spool.h"
 #include "server.h"
 #include "metadata.h"
 #include "utils.h"
+#include "lwd_telemetry.h"
+#include "cgroup.h"
+#include "watchdog.h"
 
 #define DEFAULT_MAX_TIME 10 * 60 // default amount of time before local watchdog kills process
 #define DEFAULT_ENTRY_POINT "make run"
@@ -99,18 +103,21 @@ typedef struct RstrntTask {
     gboolean finished;
     /* Has this task reported results? */
     gboolean results_reported;
+    /* Report plugins of spooled results, the task completes after them */
+    guint plugins_running;
+    gboolean plugins_wait;
     /* Has this task triggered the localwatchdog? */
     gboolean localwatchdog;
     /* Are we running in rhts_compat mode? */
     gboolean rhts_compat;
     /* remaining time task is allowed to run before being killed */
     gint64 remaining_time;
-    /* Captures the time watchdog time was adjusted */
-    time_t *time_chged;
+    /* Local watchdog, armed while the task runs */
+    RstrntWatchdog *watchdog;
     /* task order needed for multi-host tasks */
     gint order;
     /* environment variables that will be passed on to task */
-    GPtrArray *env;
+    RstrntEnvMap *env;
     /* State engine holding current state of task */
     TaskSetupState state;
     /* Error at the task level */
@@ -123,6 +130,16 @@ typedef struct RstrntTask {
     /* Start stop times */
     time_t starttime;
     time_t endtime;
+    /* Local watchdog telemetry, open while the task runs */
+    RstrntLwdTelemetry *telemetry;
+    /* cgroup of the task process tree, NULL without cgroups */
+    RstrntCgroup *cgroup;
+    /* memory.max and cpu.max of the task cgroup, from task params */
+    gchar *memory_max;
+    gchar *cpu_max;
+    /* Task output of the current run and when the run started */
+    guint64 output_bytes;
+    gint64 output_start;
 } Task;
 
 typedef struct {
@@ -131,6 +148,8 @@ typedef struct {
     TaskSetupState fail_state;
     gchar expire_time[80];
     RstrntLogType log_type;
+    /* The task run waiting for 05_linger's loginctl */
+    RstrntTaskPlugins *plugins;
 } TaskRunData;
 
 Task *restraint_task_new(void);
@@ -142,6 +161,12 @@ gboolean restraint_build_env(Task *task, GError **error);
 void restraint_task_status (Task *task, AppData *app_data, gchar *, gchar *, GError *reason);
 void restraint_task_run(Task *task);
 void restraint_task_free(Task *task);
+void restraint_task_telemetry (Task *task, RstrntLwdEvent event, gint64 adjusted);
+RstrntCgroup *restraint_task_cgroup (Task *task, const gchar *kind);
+void restraint_task_adjust_watchdog (AppData *app_data, Task *task, gint64 seconds);
+void restraint_task_plugins_done (AppData *app_data, Task *task);
+RstrntTaskPlugins *restraint_task_plugins (Task *task, const gchar *const *command,
+                                           RstrntEnvMap *env);
 goffset *restraint_task_get_offset (Task *task, const gchar *path);
 void restraint_init_result_hash (AppData *app_data);
 gboolean task_io_callback (GIOChannel *io, GIOCondition condition, gpointer user_data);
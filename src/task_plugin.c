@@ -0,0 +1,588 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "process.h"
+#include "task_plugin.h"
+
+/*
+ * Native versions of the plugins in plugins/task_run.d.  They used to be
+ * chained with exec, one bash (and a few rpm, runcon and loginctl runs)
+ * per plugin for every task and every plugin run.  restraintd now sets up
+ * the environment itself and the forked child does the rest just before
+ * exec.  Scripts it doesn't know about are still run, in order, after
+ * the native steps.
+ */
+
+#define LOGIN_ENV_MARKER "\0RSTRNT_LOGIN_ENV"
+
+static const struct {
+    const gchar *name;
+    RstrntTaskPluginStep step;
+} task_plugins_builtin[] = {
+    { "05_linger", TASK_PLUGIN_LINGER },
+    { "10_bash_login", TASK_PLUGIN_LOGIN },
+    { "15_beakerlib", TASK_PLUGIN_BEAKERLIB },
+    { "20_unconfined", TASK_PLUGIN_UNCONFINED },
+    { "25_environment", TASK_PLUGIN_ENVIRONMENT },
+    { "30_restore_events", TASK_PLUGIN_RESTORE_EVENTS },
+    { "35_oom_adj", TASK_PLUGIN_OOM_ADJ },
+};
+
+static const gchar *
+task_plugins_env (RstrntEnvMap *env, const gchar *name)
+{
+    const gchar *value = rstrnt_env_map_get (env, name);
+    // Empty counts as unset, as with test -z
+    return (value != NULL && *value != '\0') ? value : NULL;
+}
+
+/*
+ * Same as sed 's/\(.*\)release\s\([0-9]*\).*\/\1\2/; s/\s//g' on the first
+ * line of /etc/redhat-release, "Fedora release 39 (Thirty Nine)" gives
+ * Fedora39.
+ */
+gchar *
+rstrnt_host_osmajor (const gchar *release)
+{
+    GRegex *regex = g_regex_new ("^(.*)release\\s([0-9]*).*$", 0, 0, NULL);
+    gchar *line = g_strndup (release, strcspn (release, "\n"));
+    gchar *osmajor = g_regex_replace (regex, line, -1, 0, "\\1\\2", 0, NULL);
+    gchar *out = osmajor;
+
+    for (const gchar *c = osmajor; *c != '\0'; c++) {
+        if (!g_ascii_isspace (*c)) {
+            *out++ = *c;
+        }
+    }
+    *out = '\0';
+
+    g_free (line);
+    g_regex_unref (regex);
+    return osmajor;
+}
+
+static gchar *
+os_release_get (const gchar *os_release, const gchar *key)
+{
+    gchar **lines = g_strsplit (os_release, "\n", -1);
+    gchar *value = NULL;
+    gsize key_len = strlen (key);
+
+    for (gchar **line = lines; *line != NULL && value == NULL; line++) {
+        if (strncmp (*line, key, key_len) == 0 && (*line)[key_len] == '=') {
+            value = g_shell_unquote (*line + key_len + 1, NULL);
+        }
+    }
+    g_strfreev (lines);
+    return value;
+}
+
+/*
+ * The context 20_unconfined ran tasks in, worked out from os-release
+ * rather than asking rpm which package provides redhat-release.  Only
+ * the user, role and type are returned, the level is added by the caller.
+ */
+gchar *
+rstrnt_host_unconfined_context (const gchar *os_release)
+{
+    gchar *id = os_release_get (os_release, "ID");
+    gchar *version = os_release_get (os_release, "VERSION_ID");
+    gint major = version != NULL ? atoi (version) : 0;
+    gchar *context;
+
+    if ((g_strcmp0 (id, "rhel") == 0 && major >= 6) ||
+        (g_strcmp0 (id, "fedora") == 0 && major >= 12)) {
+        context = g_strdup ("unconfined_u:unconfined_r:unconfined_t:s0-s0:c0.c1023");
+    } else if (g_strcmp0 (id, "rhel") == 0 && major <= 4) {
+        context = g_strdup ("root:system_r:unconfined_t");
+    } else {
+        context = g_strdup ("root:system_r:unconfined_t:s0");
+    }
+
+    g_free (version);
+    g_free (id);
+    return context;
+}
+
+/*
+ * Variables in the output of env -0 from a login shell that envp doesn't
+ * already hold with the same value.
+ */
+gchar **
+rstrnt_host_login_env (const gchar **envp, const gchar *login_env, gsize length)
+{
+    static const gchar *const ignored[] = { "SHLVL", "_", "PWD", "OLDPWD", NULL };
+    GPtrArray *vars = g_ptr_array_new ();
+    const gchar *end = login_env + length;
+
+    for (const gchar *var = login_env; var < end; var += strlen (var) + 1) {
+        const gchar *eq = strchr (var, '=');
+        gchar *name;
+
+        if (eq == NULL || eq == var) {
+            continue;
+        }
+        name = g_strndup (var, eq - var);
+        if (!g_strv_contains (ignored, name) &&
+            g_strcmp0 (g_environ_getenv ((gchar **) envp, name), eq + 1) != 0) {
+            g_ptr_array_add (vars, g_strdup (var));
+        }
+        g_free (name);
+    }
+    g_ptr_array_add (vars, NULL);
+    return (gchar **) g_ptr_array_free (vars, FALSE);
+}
+
+/* The MLS range of a context, NULL without one */
+static const gchar *
+context_level (const gchar *context)
+{
+    const gchar *c = context;
+
+    for (gint i = 0; i < 3 && c != NULL; i++) {
+        c = strchr (c, ':');
+        if (c != NULL) {
+            c++;
+        }
+    }
+    return c;
+}
+
+/*
+ * The SELinux context tasks should be started in, NULL when SELinux is
+ * disabled or we already are unconfined.  Whether the policy lets us
+ * switch to it is checked by the lookup.
+ */
+static gchar *
+host_exec_context (void)
+{
+    gchar *current = NULL, *os_release = NULL, *context;
+
+    if (!g_file_test (TASK_PLUGIN_SELINUX_ENFORCE, G_FILE_TEST_EXISTS) ||
+        !g_file_get_contents ("/proc/self/attr/current", &current, NULL, NULL) ||
+        strstr (current, TASK_PLUGIN_UNCONFINED_CONTEXT) != NULL) {
+        g_free (current);
+        return NULL;
+    }
+    // The kernel NUL terminates it
+    current[strcspn (current, "\n")] = '\0';
+
+    g_file_get_contents (TASK_PLUGIN_OS_RELEASE, &os_release, NULL, NULL);
+    context = rstrnt_host_unconfined_context (os_release != NULL ? os_release : "");
+    g_free (os_release);
+
+    // No level given, keep ours as runcon does
+    if (context_level (context) == NULL && context_level (current) != NULL) {
+        gchar *full = g_strconcat (context, ":", context_level (current), NULL);
+        g_free (context);
+        context = full;
+    }
+    g_free (current);
+
+    return context;
+}
+
+static gchar *
+host_osarch (void)
+{
+    struct utsname name;
+
+    if (uname (&name) == -1) {
+        return NULL;
+    }
+    // uname -i reports i386 for any x86 flavour
+    if (name.machine[0] == 'i' && g_str_has_suffix (name.machine, "86")) {
+        return g_strdup ("i386");
+    }
+    return g_strdup (name.machine);
+}
+
+typedef struct {
+    RstrntHostFacts *facts;
+    gchar **envp;
+    GString *output;
+    GCancellable *cancellable;
+    RstrntHostFactsCallback callback;
+    gpointer user_data;
+} HostFactsLookup;
+
+static gboolean
+host_facts_io_cb (GIOChannel *io, GIOCondition condition, gpointer user_data)
+{
+    HostFactsLookup *lookup = (HostFactsLookup *) user_data;
+    gchar buf[8192];
+    gsize bytes_read;
+
+    if (condition & G_IO_IN) {
+        switch (g_io_channel_read_chars (io, buf, sizeof (buf), &bytes_read, NULL)) {
+            case G_IO_STATUS_NORMAL:
+                g_string_append_len (lookup->output, buf, bytes_read);
+                return TRUE;
+            case G_IO_STATUS_AGAIN:
+                return TRUE;
+            default:
+                return FALSE;
+        }
+    }
+    return FALSE;
+}
+
+static void
+host_facts_run (HostFactsLookup *lookup, const gchar *const *argv,
+                const gchar *path, ProcessFinishCallback finish_callback)
+{
+    RstrntWatchdog *watchdog = process_watchdog_new (TASK_PLUGIN_TIMEOUT, argv[0]);
+
+    g_string_truncate (lookup->output, 0);
+    process_run_argv (argv, (const gchar **) lookup->envp, path, NULL,
+                      NULL, FALSE, watchdog, NULL,
+                      host_facts_io_cb, finish_callback, NULL, 0, FALSE,
+                      lookup->cancellable, lookup);
+    rstrnt_watchdog_unref (watchdog);
+}
+
+static void
+host_facts_done (HostFactsLookup *lookup)
+{
+    lookup->callback (lookup->facts, lookup->user_data);
+    g_strfreev (lookup->envp);
+    g_string_free (lookup->output, TRUE);
+    g_slice_free (HostFactsLookup, lookup);
+}
+
+static void
+host_exec_context_cb (gint pid_result, gboolean localwatchdog,
+                      gpointer user_data, GError *error)
+{
+    HostFactsLookup *lookup = (HostFactsLookup *) user_data;
+
+    if (error != NULL || pid_result != 0) {
+        g_message ("Failed to run in SELinux context %s, tasks run in the default context",
+                   lookup->facts->exec_context);
+        g_clear_pointer (&lookup->facts->exec_context, g_free);
+    }
+    host_facts_done (lookup);
+}
+
+static void
+host_login_env_cb (gint pid_result, gboolean localwatchdog,
+                   gpointer user_data, GError *error)
+{
+    HostFactsLookup *lookup = (HostFactsLookup *) user_data;
+    const gchar *argv[] = { "runcon", lookup->facts->exec_context, "--", "true", NULL };
+    const gchar *data = lookup->output->str;
+    const gchar *start = NULL;
+
+    if (error == NULL && pid_result == 0) {
+        start = memmem (data, lookup->output->len,
+                        LOGIN_ENV_MARKER, sizeof (LOGIN_ENV_MARKER));
+    } else if (localwatchdog) {
+        g_warning ("Login shell took more than %d seconds, tasks run without its variables",
+                   TASK_PLUGIN_TIMEOUT);
+    }
+    if (start != NULL) {
+        start += sizeof (LOGIN_ENV_MARKER);
+        lookup->facts->login_env = rstrnt_host_login_env ((const gchar **) lookup->envp, start,
+                                                          data + lookup->output->len - start);
+    } else {
+        lookup->facts->login_env = g_new0 (gchar *, 1);
+    }
+
+    // Check the policy lets us run something in it, as 20_unconfined did
+    // with runcon -- true
+    if (lookup->facts->exec_context != NULL) {
+        host_facts_run (lookup, argv, NULL, host_exec_context_cb);
+    } else {
+        host_facts_done (lookup);
+    }
+}
+
+/*
+ * Look at the host once, envp is the environment shared by the tasks of
+ * the recipe.  What a login shell adds to envp is found by running one,
+ * 10_bash_login ran every task through bash -l, whatever the profile
+ * prints before the marker is dropped.  callback gets the facts once the
+ * shell and the SELinux check are done, neither may take longer than
+ * TASK_PLUGIN_TIMEOUT.
+ */
+void
+rstrnt_host_facts_lookup (const gchar **envp,
+                          GCancellable *cancellable,
+                          RstrntHostFactsCallback callback,
+                          gpointer user_data)
+{
+    const gchar *argv[] = {
+        "/bin/bash", "-l", "-c",
+        "printf '\\0RSTRNT_LOGIN_ENV\\0'; exec env -0",
+        NULL
+    };
+    HostFactsLookup *lookup = g_slice_new0 (HostFactsLookup);
+    RstrntHostFacts *facts = g_slice_new0 (RstrntHostFacts);
+    gchar *release = NULL;
+
+    facts->hostname = g_strdup (g_get_host_name ());
+    facts->osarch = host_osarch ();
+    if (g_file_get_contents (TASK_PLUGIN_REDHAT_RELEASE, &release, NULL, NULL)) {
+        facts->osmajor = rstrnt_host_osmajor (release);
+        g_free (release);
+    }
+    facts->exec_context = host_exec_context ();
+    facts->loginctl = g_find_program_in_path ("loginctl");
+
+    lookup->facts = facts;
+    lookup->envp = g_strdupv ((gchar **) envp);
+    lookup->output = g_string_new (NULL);
+    lookup->cancellable = cancellable;
+    lookup->callback = callback;
+    lookup->user_data = user_data;
+    host_facts_run (lookup, argv, "/", host_login_env_cb);
+}
+
+void
+rstrnt_host_facts_free (RstrntHostFacts *facts)
+{
+    if (facts == NULL) {
+        return;
+    }
+    g_strfreev (facts->login_env);
+    g_free (facts->hostname);
+    g_free (facts->osarch);
+    g_free (facts->osmajor);
+    g_free (facts->exec_context);
+    g_free (facts->loginctl);
+    g_slice_free (RstrntHostFacts, facts);
+}
+
+static RstrntTaskPluginStep
+task_plugins_step (const gchar *name)
+{
+    for (guint i = 0; i < G_N_ELEMENTS (task_plugins_builtin); i++) {
+        if (g_strcmp0 (task_plugins_builtin[i].name, name) == 0) {
+            return task_plugins_builtin[i].step;
+        }
+    }
+    return 0;
+}
+
+static gint
+task_plugins_compare (gconstpointer a, gconstpointer b)
+{
+    return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/*
+ * 05_linger, keep the user session bus around without a login.  The
+ * loginctl run that changes the setting is left to the caller.
+ */
+static void
+task_plugins_linger (RstrntTaskPlugins *plugins, RstrntHostFacts *facts)
+{
+    struct passwd *pw = getpwuid (getuid ());
+    gboolean disable = task_plugins_env (plugins->env, "RSTRNT_DISABLE_LINGER") != NULL;
+    const gchar *action = NULL;
+    gboolean lingers;
+    gchar *linger;
+
+    if (facts->loginctl == NULL || pw == NULL) {
+        return;
+    }
+    linger = g_build_filename (TASK_PLUGIN_LINGER_DIR, pw->pw_name, NULL);
+    lingers = g_file_test (linger, G_FILE_TEST_EXISTS);
+    if (disable && lingers) {
+        action = "disable-linger";
+    } else if (!disable) {
+        if (!lingers) {
+            action = "enable-linger";
+        }
+        rstrnt_env_map_setf (plugins->env, ENV_LAYER_PLUGIN, "XDG_RUNTIME_DIR",
+                             "/run/user/%u", getuid ());
+    }
+    if (action != NULL) {
+        const gchar *argv[] = { facts->loginctl, action, pw->pw_name, NULL };
+        plugins->linger_argv = g_strdupv ((gchar **) argv);
+    }
+    g_free (linger);
+}
+
+/* 15_beakerlib, results go through restraint and stale state is dropped */
+static void
+task_plugins_beakerlib (RstrntTaskPlugins *plugins)
+{
+    const gchar *rebootcount = task_plugins_env (plugins->env, "REBOOTCOUNT");
+    const gchar *testid = task_plugins_env (plugins->env, "TESTID");
+    const gchar *name;
+    gchar *path;
+    GDir *dir;
+
+    rstrnt_env_map_set (plugins->env, ENV_LAYER_PLUGIN, "BEAKERLIB_COMMAND_REPORT_RESULT",
+                        "/usr/bin/rstrnt-report-result --rhts");
+    rstrnt_env_map_set (plugins->env, ENV_LAYER_PLUGIN, "BEAKERLIB_COMMAND_SUBMIT_LOG",
+                        "/usr/bin/rstrnt-report-log");
+
+    if (plugins->noplugins || g_strcmp0 (rebootcount, "0") != 0) {
+        return;
+    }
+    // rm -f /var/tmp/beakerlib-$TESTID/*
+    path = g_strdup_printf ("/var/tmp/beakerlib-%s", testid != NULL ? testid : "");
+    dir = g_dir_open (path, 0, NULL);
+    while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+        gchar *file = g_build_filename (path, name, NULL);
+        if (name[0] != '.' && !g_file_test (file, G_FILE_TEST_IS_DIR)) {
+            g_remove (file);
+        }
+        g_free (file);
+    }
+    if (dir != NULL) {
+        g_dir_close (dir);
+    }
+    g_free (path);
+}
+
+/*
+ * Work out how to run command through the plugins in plugin_dir with the
+ * variables of env.  The steps done in restraintd happen here, the ones
+ * that change the child go into attrs for process_run_argv().  Setting
+ * RSTRNT_SCRIPT_PLUGINS runs the scripts as before.
+ */
+RstrntTaskPlugins *
+rstrnt_task_plugins_new (const gchar *plugin_dir,
+                         const gchar *const *command,
+                         RstrntEnvMap *env,
+                         RstrntHostFacts *facts)
+{
+    RstrntTaskPlugins *plugins = g_slice_new0 (RstrntTaskPlugins);
+    GPtrArray *entries = g_ptr_array_new_with_free_func (g_free);
+    GPtrArray *argv = g_ptr_array_new ();
+    GDir *dir = g_dir_open (plugin_dir, 0, NULL);
+    const gchar *logging, *entry;
+    gboolean scripts;
+
+    plugins->env = rstrnt_env_map_new (env);
+    plugins->noplugins = task_plugins_env (env, "RSTRNT_NOPLUGINS") != NULL;
+    logging = task_plugins_env (env, "RSTRNT_LOGGING");
+    plugins->verbose = logging != NULL && atoi (logging) >= 4;
+    scripts = facts == NULL || task_plugins_env (env, "RSTRNT_SCRIPT_PLUGINS") != NULL;
+    rstrnt_env_map_set (plugins->env, ENV_LAYER_PLUGIN, "RSTRNT_TASK_PLUGINS_DIR", plugin_dir);
+
+    while (dir != NULL && (entry = g_dir_read_name (dir)) != NULL) {
+        // Hidden files are left out by the shell glob
+        if (entry[0] != '.') {
+            g_ptr_array_add (entries, g_strdup (entry));
+        }
+    }
+    if (dir != NULL) {
+        g_dir_close (dir);
+    }
+    g_ptr_array_sort (entries, task_plugins_compare);
+
+    for (guint i = 0; i < entries->len; i++) {
+        const gchar *name = g_ptr_array_index (entries, i);
+        RstrntTaskPluginStep step = scripts ? 0 : task_plugins_step (name);
+
+        // Restoring events talks to the sync server, which the main loop
+        // can't wait for.  It is only needed after a reboot, the script
+        // does it then.
+        if (step == TASK_PLUGIN_RESTORE_EVENTS && !plugins->noplugins &&
+            g_file_test (TASK_PLUGIN_EVENTS_FILE, G_FILE_TEST_EXISTS)) {
+            step = 0;
+        }
+        if (step != 0) {
+            plugins->steps |= step;
+        } else {
+            g_ptr_array_add (argv, g_build_filename (plugin_dir, name, NULL));
+        }
+    }
+    g_ptr_array_free (entries, TRUE);
+
+    for (const gchar *const *arg = command; *arg != NULL; arg++) {
+        g_ptr_array_add (argv, g_strdup (*arg));
+    }
+    g_ptr_array_add (argv, NULL);
+    plugins->argv = (gchar **) g_ptr_array_free (argv, FALSE);
+
+    if (plugins->steps & TASK_PLUGIN_LINGER) {
+        task_plugins_linger (plugins, facts);
+    }
+    if (plugins->steps & TASK_PLUGIN_LOGIN) {
+        for (gchar **var = facts->login_env; *var != NULL; var++) {
+            gchar **pair = g_strsplit (*var, "=", 2);
+            rstrnt_env_map_set (plugins->env, ENV_LAYER_LOGIN, pair[0], pair[1]);
+            g_strfreev (pair);
+        }
+    }
+    if (plugins->steps & TASK_PLUGIN_BEAKERLIB) {
+        task_plugins_beakerlib (plugins);
+    }
+    if (plugins->verbose) {
+        GString *banner = g_string_new (NULL);
+
+        for (guint i = 0; i < G_N_ELEMENTS (task_plugins_builtin); i++) {
+            if (plugins->steps & task_plugins_builtin[i].step) {
+                g_string_append_printf (banner, "**** -- INFO: *** Running Plugin: %s (native)\n",
+                                        task_plugins_builtin[i].name);
+            }
+        }
+        plugins->banner = g_string_free (banner, banner->len == 0);
+        plugins->attrs.banner = plugins->banner;
+    }
+    // 10_bash_login, a pty child already leads its own session
+    plugins->attrs.setsid = (plugins->steps & TASK_PLUGIN_LOGIN) != 0;
+    if (plugins->steps & TASK_PLUGIN_UNCONFINED) {
+        plugins->attrs.exec_context = facts->exec_context;
+    }
+    // 35_oom_adj, restraintd itself is protected from the OOM killer
+    if ((plugins->steps & TASK_PLUGIN_OOM_ADJ) && !plugins->noplugins) {
+        plugins->attrs.oom_score_adj = "0";
+    }
+    if (plugins->steps & TASK_PLUGIN_ENVIRONMENT) {
+        if (facts->hostname != NULL) {
+            rstrnt_env_map_set (plugins->env, ENV_LAYER_HOST, "HOSTNAME", facts->hostname);
+        }
+        if (facts->osarch != NULL) {
+            rstrnt_env_map_set (plugins->env, ENV_LAYER_HOST, "RSTRNT_OSARCH", facts->osarch);
+        }
+        if (facts->osmajor != NULL) {
+            rstrnt_env_map_set (plugins->env, ENV_LAYER_HOST, "RSTRNT_OSMAJOR", facts->osmajor);
+        }
+    }
+
+    return plugins;
+}
+
+void
+rstrnt_task_plugins_free (RstrntTaskPlugins *plugins)
+{
+    g_strfreev (plugins->argv);
+    g_strfreev (plugins->linger_argv);
+    g_free (plugins->banner);
+    rstrnt_env_map_unref (plugins->env);
+    g_slice_free (RstrntTaskPlugins, plugins);
+}
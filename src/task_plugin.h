@@ -0,0 +1,98 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_TASK_PLUGIN_H
+#define _RESTRAINT_TASK_PLUGIN_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "env_map.h"
+#include "process.h"
+
+#define TASK_PLUGIN_EVENTS_FILE "/var/lib/restraint/rstrnt_events"
+#define TASK_PLUGIN_LINGER_DIR "/var/lib/systemd/linger"
+#define TASK_PLUGIN_OS_RELEASE "/etc/os-release"
+#define TASK_PLUGIN_REDHAT_RELEASE "/etc/redhat-release"
+#define TASK_PLUGIN_SELINUX_ENFORCE "/sys/fs/selinux/enforce"
+#define TASK_PLUGIN_UNCONFINED_CONTEXT "unconfined_u:unconfined_r:unconfined_t:"
+#define TASK_PLUGIN_TIMEOUT 60  /* Seconds the login shell, loginctl or runcon may take */
+
+/*
+ * The plugins shipped in task_run.d that restraintd does itself.  Each one
+ * is only done if its script is still there, removing a script still
+ * disables it.
+ */
+typedef enum {
+    TASK_PLUGIN_LINGER         = 1 << 0,  /* 05_linger */
+    TASK_PLUGIN_LOGIN          = 1 << 1,  /* 10_bash_login */
+    TASK_PLUGIN_BEAKERLIB      = 1 << 2,  /* 15_beakerlib */
+    TASK_PLUGIN_UNCONFINED     = 1 << 3,  /* 20_unconfined */
+    TASK_PLUGIN_ENVIRONMENT    = 1 << 4,  /* 25_environment */
+    TASK_PLUGIN_RESTORE_EVENTS = 1 << 5,  /* 30_restore_events */
+    TASK_PLUGIN_OOM_ADJ        = 1 << 6,  /* 35_oom_adj */
+} RstrntTaskPluginStep;
+
+/*
+ * What the plugins used to work out again for every task, found once per
+ * recipe instead.
+ */
+typedef struct {
+    gchar **login_env;    /* NAME=value a login shell sets or changes */
+    gchar *hostname;
+    gchar *osarch;        /* as uname -i */
+    gchar *osmajor;       /* from /etc/redhat-release, RedHatEnterpriseLinux9 */
+    gchar *exec_context;  /* SELinux context to exec in, NULL to keep ours */
+    gchar *loginctl;      /* NULL without systemd-logind */
+} RstrntHostFacts;
+
+typedef void (*RstrntHostFactsCallback) (RstrntHostFacts *facts, gpointer user_data);
+
+/*
+ * One run through task_run.d.  argv holds the scripts restraintd has no
+ * native version of, each execs the next one, then the command.  Pass
+ * attrs with it to process_run_argv().  A task runs linger_argv first,
+ * when 05_linger has to change the linger setting.
+ */
+typedef struct {
+    gchar **argv;
+    gchar **linger_argv;  /* loginctl enable-linger or disable-linger, or NULL */
+    RstrntEnvMap *env;    /* the environment with what the plugins export */
+    guint steps;          /* RstrntTaskPluginStep done natively */
+    gboolean noplugins;   /* RSTRNT_NOPLUGINS, a plugin run */
+    gboolean verbose;     /* RSTRNT_LOGGING asks for info messages */
+    gchar *banner;        /* the native steps' info messages */
+    ProcessAttrs attrs;   /* what the steps change in the child */
+} RstrntTaskPlugins;
+
+void rstrnt_host_facts_lookup (const gchar **envp,
+                               GCancellable *cancellable,
+                               RstrntHostFactsCallback callback,
+                               gpointer user_data);
+void rstrnt_host_facts_free (RstrntHostFacts *facts);
+gchar *rstrnt_host_osmajor (const gchar *release);
+gchar *rstrnt_host_unconfined_context (const gchar *os_release);
+gchar **rstrnt_host_login_env (const gchar **envp, const gchar *login_env,
+                               gsize length);
+
+RstrntTaskPlugins *rstrnt_task_plugins_new (const gchar *plugin_dir,
+                                            const gchar *const *command,
+                                            RstrntEnvMap *env,
+                                            RstrntHostFacts *facts);
+void rstrnt_task_plugins_free (RstrntTaskPlugins *plugins);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <libsoup/soup.h>
+
+#include "errors.h"
+#include "trace.h"
+
+/*
+ * Start of a segment of the trace file, the records follow.  Every
+ * restraintd start appends a new segment.
+ */
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 record_size;
+    gint64 start;          /* microseconds since the epoch */
+} TraceHeader;
+
+static const gchar *trace_method_names[] = {
+    [TRACE_METHOD_OTHER] = "OTHER",
+    [TRACE_METHOD_GET] = "GET",
+    [TRACE_METHOD_HEAD] = "HEAD",
+    [TRACE_METHOD_POST] = "POST",
+    [TRACE_METHOD_PUT] = "PUT",
+};
+
+static const gchar *trace_direction_names[] = {
+    [TRACE_OUTBOUND] = "out",
+    [TRACE_STDOUT] = "stdout",
+    [TRACE_INBOUND] = "in",
+};
+
+static gint trace_fd = -1;
+static gchar *trace_path = NULL;
+static gint64 trace_started = 0;
+
+static void
+trace_set_errno_error (GError **error, gint errsv, const gchar *action,
+                       const gchar *path)
+{
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                 "Failed to %s %s: %s", action, path, g_strerror (errsv));
+}
+
+static RstrntTraceMethod
+trace_method (const gchar *method)
+{
+    if (method == SOUP_METHOD_GET) {
+        return TRACE_METHOD_GET;
+    } else if (method == SOUP_METHOD_HEAD) {
+        return TRACE_METHOD_HEAD;
+    } else if (method == SOUP_METHOD_POST) {
+        return TRACE_METHOD_POST;
+    } else if (method == SOUP_METHOD_PUT) {
+        return TRACE_METHOD_PUT;
+    }
+    return TRACE_METHOD_OTHER;
+}
+
+/*
+ * Walks the segments of a trace, adding their records to entries unless
+ * it is NULL.  The timestamps of later segments are moved by the time
+ * between their start and the start of the first.  Returns the length of
+ * what could be parsed, anything after it was cut short by restraintd
+ * being killed while writing.
+ */
+static gsize
+trace_parse (const gchar *contents, gsize length, GPtrArray *entries,
+             gint64 *start, guint *segments)
+{
+    TraceHeader header;
+    gint64 first = 0;
+    gint64 shift = 0;
+    gsize offset = 0;
+
+    *segments = 0;
+    while (offset < length) {
+        RstrntTraceRecord record;
+
+        if (length - offset >= sizeof (header) &&
+                memcmp (contents + offset, TRACE_MAGIC, sizeof (header.magic)) == 0) {
+            memcpy (&header, contents + offset, sizeof (header));
+            if (header.version != TRACE_VERSION ||
+                    header.record_size != sizeof (RstrntTraceRecord)) {
+                break;
+            }
+            if (*segments == 0) {
+                first = header.start;
+            }
+            shift = header.start - first;
+            (*segments)++;
+            offset += sizeof (header);
+            continue;
+        }
+        if (*segments == 0 || length - offset < sizeof (record)) {
+            break;
+        }
+        memcpy (&record, contents + offset, sizeof (record));
+        if (length - offset - sizeof (record) < record.path_length) {
+            break;
+        }
+        if (entries != NULL) {
+            RstrntTraceEntry *entry = g_slice_new (RstrntTraceEntry);
+
+            entry->record = record;
+            entry->record.timestamp += shift;
+            entry->segment = *segments - 1;
+            entry->path = g_strndup (contents + offset + sizeof (record), record.path_length);
+            g_ptr_array_add (entries, entry);
+        }
+        offset += sizeof (record) + record.path_length;
+    }
+
+    if (start != NULL) {
+        *start = first;
+    }
+    return offset;
+}
+
+/*
+ * Starts a new segment at the end of the trace at path, so the traffic
+ * from before a reboot is kept.  A record the previous restraintd didn't
+ * finish writing is dropped first.  The records are written unbuffered
+ * so a trace survives restraintd being killed.
+ */
+gboolean
+rstrnt_trace_open (const gchar *path, GError **error)
+{
+    TraceHeader header = {
+        .version = TRACE_VERSION,
+        .record_size = sizeof (RstrntTraceRecord),
+        .start = g_get_real_time (),
+    };
+    gchar *contents;
+    gsize length;
+    gint fd;
+
+    g_return_val_if_fail (path != NULL, FALSE);
+    g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+    fd = open (path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        trace_set_errno_error (error, errno, "open", path);
+        return FALSE;
+    }
+    if (!g_file_get_contents (path, &contents, &length, error)) {
+        close (fd);
+        return FALSE;
+    }
+    if (length > 0) {
+        guint segments;
+        gsize valid = trace_parse (contents, length, NULL, NULL, &segments);
+
+        if (segments == 0) {
+            g_set_error (error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                         "%s is not a restraintd trace file", path);
+            g_free (contents);
+            close (fd);
+            return FALSE;
+        }
+        if (valid < length && ftruncate (fd, valid) != 0) {
+            trace_set_errno_error (error, errno, "truncate", path);
+            g_free (contents);
+            close (fd);
+            return FALSE;
+        }
+    }
+    g_free (contents);
+
+    memcpy (header.magic, TRACE_MAGIC, sizeof (header.magic));
+    if (write (fd, &header, sizeof (header)) != sizeof (header)) {
+        trace_set_errno_error (error, errno, "write", path);
+        close (fd);
+        return FALSE;
+    }
+
+    rstrnt_trace_close ();
+    trace_fd = fd;
+    trace_path = g_strdup (path);
+    trace_started = g_get_monotonic_time ();
+    return TRUE;
+}
+
+void
+rstrnt_trace_close (void)
+{
+    if (trace_fd >= 0) {
+        close (trace_fd);
+        trace_fd = -1;
+    }
+    g_clear_pointer (&trace_path, g_free);
+}
+
+gboolean
+rstrnt_trace_enabled (void)
+{
+    return trace_fd >= 0;
+}
+
+/*
+ * Records msg once its response is in, started being the monotonic time
+ * it was sent or received.
+ */
+void
+rstrnt_trace_message (RstrntTraceDirection direction,
+                      SoupMessage *msg,
+                      gint64 started,
+                      guint attempt)
+{
+    RstrntTraceRecord record = { 0 };
+    struct iovec iov[2];
+    const gchar *path;
+    gssize length;
+
+    if (trace_fd < 0) {
+        return;
+    }
+
+    path = soup_uri_get_path (soup_message_get_uri (msg));
+    record.timestamp = started - trace_started;
+    record.latency = g_get_monotonic_time () - started;
+    record.request_bytes = msg->request_body->length;
+    record.response_bytes = msg->response_body->length;
+    record.status = msg->status_code;
+    record.attempt = MIN (attempt, G_MAXUINT16);
+    record.direction = direction;
+    record.method = trace_method (msg->method);
+    record.path_length = strlen (path);
+
+    iov[0].iov_base = &record;
+    iov[0].iov_len = sizeof (record);
+    iov[1].iov_base = (gpointer) path;
+    iov[1].iov_len = record.path_length;
+    length = sizeof (record) + record.path_length;
+
+    // A trace with holes in it is no use to replay, give up on it
+    if (writev (trace_fd, iov, G_N_ELEMENTS (iov)) != length) {
+        g_warning ("Stopped tracing to %s: %s", trace_path,
+                   g_strerror (errno));
+        rstrnt_trace_close ();
+    }
+}
+
+const gchar *
+rstrnt_trace_method_name (RstrntTraceMethod method)
+{
+    if (method < G_N_ELEMENTS (trace_method_names)) {
+        return trace_method_names[method];
+    }
+    return trace_method_names[TRACE_METHOD_OTHER];
+}
+
+const gchar *
+rstrnt_trace_direction_name (RstrntTraceDirection direction)
+{
+    if (direction < G_N_ELEMENTS (trace_direction_names)) {
+        return trace_direction_names[direction];
+    }
+    return "unknown";
+}
+
+static void
+trace_entry_free (gpointer data)
+{
+    RstrntTraceEntry *entry = data;
+
+    g_free (entry->path);
+    g_slice_free (RstrntTraceEntry, entry);
+}
+
+/*
+ * The records of every segment of a trace as RstrntTraceEntry, oldest
+ * first, with start set to when the first segment was opened.  A record
+ * cut short by restraintd being killed while writing it is left out.
+ */
+GPtrArray *
+rstrnt_trace_read (const gchar *path, gint64 *start, GError **error)
+{
+    GPtrArray *entries;
+    gchar *contents;
+    gsize length;
+    guint segments;
+
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+    if (!g_file_get_contents (path, &contents, &length, error)) {
+        return NULL;
+    }
+    entries = g_ptr_array_new_with_free_func (trace_entry_free);
+    trace_parse (contents, length, entries, start, &segments);
+    g_free (contents);
+
+    if (segments == 0) {
+        g_set_error (error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX,
+                     "%s is not a restraintd trace file", path);
+        g_ptr_array_unref (entries);
+        return NULL;
+    }
+    return entries;
+}
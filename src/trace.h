@@ -0,0 +1,80 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_TRACE_H
+#define _RESTRAINT_TRACE_H
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#define TRACE_MAGIC "RSTRNTTR"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_OUTBOUND,     /* restraint_queue_message() to the lab controller */
+    TRACE_STDOUT,       /* restraint_stdout_message() to the restraint client */
+    TRACE_INBOUND,      /* requests to /recipes from the tasks */
+} RstrntTraceDirection;
+
+typedef enum {
+    TRACE_METHOD_OTHER,
+    TRACE_METHOD_GET,
+    TRACE_METHOD_HEAD,
+    TRACE_METHOD_POST,
+    TRACE_METHOD_PUT,
+} RstrntTraceMethod;
+
+/*
+ * One record of the trace file, followed by path_length bytes of path.
+ * The timestamp is from the start of its segment in the file.
+ */
+typedef struct {
+    gint64 timestamp;        /* microseconds since its segment was opened */
+    gint64 latency;          /* microseconds until the response */
+    guint64 request_bytes;
+    guint64 response_bytes;
+    guint32 status;
+    guint16 attempt;         /* 1 for the first try, more for retries */
+    guint8 direction;        /* RstrntTraceDirection */
+    guint8 method;           /* RstrntTraceMethod */
+    guint32 path_length;
+    guint32 reserved;
+} RstrntTraceRecord;
+
+typedef struct {
+    RstrntTraceRecord record;    /* timestamp from the start of the first segment */
+    guint segment;               /* the restraintd start it was recorded by, from 0 */
+    gchar *path;
+} RstrntTraceEntry;
+
+/*
+ * There is a single trace per process, written from the main loop only.
+ * Recording is a no-op while no trace is open.
+ */
+gboolean rstrnt_trace_open (const gchar *path, GError **error);
+void rstrnt_trace_close (void);
+gboolean rstrnt_trace_enabled (void);
+void rstrnt_trace_message (RstrntTraceDirection direction,
+                           SoupMessage *msg,
+                           gint64 started,
+                           guint attempt);
+
+const gchar *rstrnt_trace_method_name (RstrntTraceMethod method);
+const gchar *rstrnt_trace_direction_name (RstrntTraceDirection direction);
+GPtrArray *rstrnt_trace_read (const gchar *path, gint64 *start, GError **error);
+
+#endif
@@ -20,52 +20,301 @@
 #include <libsoup/soup.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
+#include "upload.h"
+#include "local_socket.h"
 
-#define READ_BUFFER_SIZE 131072
-static gchar input_buf[READ_BUFFER_SIZE];
-static gssize offset = 0;
-
-static gint
-upload_chunk (SoupSession *session,
-              GInputStream *in,
-              guint64 filesize,
-              guint64 bytes_left,
-              SoupURI *result_log_uri,
-              GError **error)
+/*
+ * A file is sent as ranged PUTs, several of them in flight at once on a
+ * private main context so the callers keep their synchronous API.  The
+ * ranges are read in order but may complete in any order, the servers
+ * write each one at its offset.  Through restraintd's local socket they
+ * go one after the other, restraintd queues them anyway.  When the local
+ * socket turns out to be unusable the rest goes over TCP.
+ */
+typedef struct {
+    SoupSession *session;
+    gboolean own_session;   /* Made by us, the caller had none */
+    SoupURI *uri;
+    GInputStream *in;
+    GMainContext *context;
+    const UploadOptions *options;
+    UploadStats *stats;
+    guint64 filesize;
+    guint64 offset;     /* Next byte to read */
+    gsize chunk_size;
+    guint in_flight;
+    GQueue pending;     /* Ranges in flight, oldest first */
+    gboolean local;     /* Through the local socket of restraintd */
+    GError *error;
+} UploadJob;
+
+typedef struct {
+    UploadJob *job;
+    SoupBuffer *buffer;
+    guint64 start;
+    guint attempts;
+    gint64 sent_at;
+} UploadRange;
+
+static const UploadOptions upload_defaults = {
+    .inflight = UPLOAD_INFLIGHT,
+    .retries = UPLOAD_RETRIES,
+    .resume = FALSE,
+};
+
+static void upload_fill (UploadJob *job);
+
+static SoupSession *
+upload_session (UploadJob *job)
 {
-    SoupMessage *server_msg;
-    gchar *range;
-    gssize bytes_read;
-    gint ret;
-    GError *tmp_error = NULL;
-    bytes_read = g_input_stream_read (
-        in, input_buf, (bytes_left < READ_BUFFER_SIZE) ? bytes_left : READ_BUFFER_SIZE,
-        NULL, &tmp_error);
-    if (tmp_error) {
-        g_propagate_error (error, tmp_error);
-        return -1;
-    }
-    if (bytes_read > 0) {
-        server_msg = soup_message_new_from_uri ("PUT", result_log_uri);
-        range = g_strdup_printf ("bytes %" G_GSSIZE_FORMAT "-%" G_GSSIZE_FORMAT "/%" G_GUINT64_FORMAT,
-                                 offset,
-                                 offset + bytes_read - 1,
-                                 filesize);
-        offset += bytes_read;
-        soup_message_headers_append (server_msg->request_headers, "Content-Range", range);
-        g_free (range);
-        soup_message_set_request (server_msg, "text/plain", SOUP_MEMORY_COPY, input_buf, bytes_read);
-        ret = soup_session_send_message (session, server_msg);
-        if (SOUP_STATUS_IS_SUCCESSFUL (ret)) {
-            return bytes_read;
+    if (job->session == NULL) {
+        job->session = soup_session_new_with_options ("timeout", LOCAL_SOCKET_TIMEOUT,
+                                                      "max-conns-per-host", UPLOAD_INFLIGHT,
+                                                      NULL);
+        job->own_session = TRUE;
+    }
+    return job->session;
+}
+
+/*
+ * Aim for chunks taking UPLOAD_CHUNK_TARGET_US each, moving halfway from
+ * the current size towards what the last chunk measured.
+ */
+gsize
+upload_chunk_size (gsize current, gsize bytes, gint64 elapsed_us)
+{
+    guint64 target;
+
+    if (elapsed_us <= 0) {
+        elapsed_us = 1;
+    }
+    target = (guint64) bytes * UPLOAD_CHUNK_TARGET_US / elapsed_us;
+    target = (current + target) / 2;
+    target = CLAMP (target, UPLOAD_CHUNK_MIN, UPLOAD_CHUNK_MAX);
+
+    return target - target % UPLOAD_CHUNK_MIN;
+}
+
+static gboolean
+upload_retryable (guint status_code)
+{
+    return SOUP_STATUS_IS_SERVER_ERROR (status_code) ||
+           status_code == SOUP_STATUS_IO_ERROR ||
+           status_code == SOUP_STATUS_CANT_CONNECT;
+}
+
+static void
+upload_range_free (UploadRange *range)
+{
+    soup_buffer_free (range->buffer);
+    g_slice_free (UploadRange, range);
+}
+
+static void
+upload_range_complete (SoupSession *session, SoupMessage *msg, gpointer user_data);
+
+static SoupMessage *
+upload_range_message (UploadJob *job, guint64 start, SoupBuffer *buffer)
+{
+    SoupMessage *msg;
+    gchar *content_range;
+
+    msg = soup_message_new_from_uri ("PUT", job->uri);
+    content_range = g_strdup_printf ("bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT,
+                                     start,
+                                     start + buffer->length - 1,
+                                     job->filesize);
+    soup_message_headers_append (msg->request_headers, "Content-Range", content_range);
+    g_free (content_range);
+    soup_message_headers_set_content_type (msg->request_headers, "text/plain", NULL);
+    soup_message_body_append_buffer (msg->request_body, buffer);
+
+    return msg;
+}
+
+static void
+upload_range_send (UploadRange *range)
+{
+    UploadJob *job = range->job;
+    SoupMessage *msg;
+
+    msg = upload_range_message (job, range->start, range->buffer);
+    range->sent_at = g_get_monotonic_time ();
+    soup_session_queue_message (upload_session (job), msg, upload_range_complete, range);
+}
+
+static gboolean
+upload_range_retry (gpointer user_data)
+{
+    upload_range_send ((UploadRange *) user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+upload_range_complete (SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+    UploadRange *range = (UploadRange *) user_data;
+    UploadJob *job = range->job;
+
+    if (SOUP_STATUS_IS_SUCCESSFUL (msg->status_code)) {
+        g_queue_remove (&job->pending, range);
+        job->chunk_size = upload_chunk_size (job->chunk_size, range->buffer->length,
+                                             g_get_monotonic_time () - range->sent_at);
+        job->stats->sent += range->buffer->length;
+        job->stats->chunks++;
+        job->stats->chunk_size = job->chunk_size;
+        // replace with callback
+        g_print (".");
+    } else if (job->error == NULL &&
+               upload_retryable (msg->status_code) &&
+               range->attempts < job->options->retries) {
+        GSource *source;
+
+        source = g_timeout_source_new (UPLOAD_RETRY_DELAY << range->attempts);
+        range->attempts++;
+        job->stats->retries++;
+        g_source_set_callback (source, upload_range_retry, range, NULL);
+        g_source_attach (source, job->context);
+        g_source_unref (source);
+        return;
+    } else {
+        g_queue_remove (&job->pending, range);
+        if (job->error == NULL) {
+            g_set_error_literal (&job->error, SOUP_HTTP_ERROR, msg->status_code,
+                                 msg->reason_phrase);
+        }
+    }
+
+    upload_range_free (range);
+    job->in_flight--;
+    upload_fill (job);
+}
+
+/*
+ * The next length bytes of the file, NULL with job->error set when they
+ * cannot be read.
+ */
+static SoupBuffer *
+upload_read (UploadJob *job, gsize length)
+{
+    gsize bytes_read = 0;
+    gchar *data = g_malloc (length);
+
+    if (!g_input_stream_read_all (job->in, data, length, &bytes_read,
+                                  NULL, &job->error)) {
+        g_free (data);
+        return NULL;
+    }
+    if (bytes_read < length) {
+        g_set_error (&job->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                     "File shrank to %" G_GUINT64_FORMAT " bytes",
+                     job->offset + bytes_read);
+        g_free (data);
+        return NULL;
+    }
+    return soup_buffer_new (SOUP_MEMORY_TAKE, data, length);
+}
+
+/*
+ * Everything before this offset is known to be on the server.
+ */
+static guint64
+upload_acked (UploadJob *job)
+{
+    UploadRange *oldest = g_queue_peek_head (&job->pending);
+
+    return oldest != NULL ? oldest->start : job->offset;
+}
+
+/*
+ * Read and send ranges until enough are in flight, keeping them within
+ * UPLOAD_RESUME_WINDOW of the oldest one.  Nothing new is started once a
+ * range failed, the ones in flight are left to finish.
+ */
+static void
+upload_fill (UploadJob *job)
+{
+    while (job->error == NULL &&
+           job->in_flight < job->options->inflight &&
+           job->offset < job->filesize) {
+        UploadRange *range;
+        SoupBuffer *buffer;
+        gsize length = MIN (job->chunk_size, job->filesize - job->offset);
+
+        if (job->offset + length > upload_acked (job) + UPLOAD_RESUME_WINDOW) {
+            break;
+        }
+        buffer = upload_read (job, length);
+        if (buffer == NULL) {
+            break;
+        }
+        range = g_slice_new0 (UploadRange);
+        range->job = job;
+        range->buffer = buffer;
+        range->start = job->offset;
+        job->offset += buffer->length;
+        job->in_flight++;
+        g_queue_push_tail (&job->pending, range);
+        upload_range_send (range);
+    }
+}
+
+static void
+upload_local (UploadJob *job)
+{
+    while (job->local && job->error == NULL && job->offset < job->filesize) {
+        SoupBuffer *buffer;
+        SoupMessage *msg;
+
+        buffer = upload_read (job, MIN (UPLOAD_LOCAL_CHUNK, job->filesize - job->offset));
+        if (buffer == NULL) {
+            break;
+        }
+        msg = upload_range_message (job, job->offset, buffer);
+        if (rstrnt_local_send_message (msg) == SOUP_STATUS_NONE) {
+            // Stale socket or nothing listening, this range goes over TCP
+            job->local = FALSE;
+            g_seekable_seek (G_SEEKABLE (job->in), job->offset, G_SEEK_SET,
+                             NULL, &job->error);
+        } else if (SOUP_STATUS_IS_SUCCESSFUL (msg->status_code)) {
+            job->offset += buffer->length;
+            job->stats->sent += buffer->length;
+            job->stats->chunks++;
+            job->stats->chunk_size = buffer->length;
+            g_print (".");
         } else {
-            g_set_error_literal (error, SOUP_HTTP_ERROR, server_msg->status_code,
-                                     server_msg->reason_phrase);
-            g_object_unref (server_msg);
-            return -1;
+            g_set_error_literal (&job->error, SOUP_HTTP_ERROR, msg->status_code,
+                                 msg->reason_phrase);
         }
+        g_object_unref (msg);
+        soup_buffer_free (buffer);
     }
-    return 0;
+}
+
+/*
+ * The length the server has of the file, 0 when it has none or does not
+ * tell.  Holes may be left in the last UPLOAD_RESUME_WINDOW bytes of it.
+ */
+static guint64
+upload_known_length (UploadJob *job)
+{
+    SoupMessage *msg;
+    guint64 length = 0;
+
+    msg = soup_message_new_from_uri ("HEAD", job->uri);
+    if (job->local && rstrnt_local_send_message (msg) == SOUP_STATUS_NONE) {
+        job->local = FALSE;
+    }
+    if (!job->local) {
+        soup_session_send_message (upload_session (job), msg);
+    }
+    if (SOUP_STATUS_IS_SUCCESSFUL (msg->status_code) &&
+        soup_message_headers_get_encoding (msg->response_headers) == SOUP_ENCODING_CONTENT_LENGTH) {
+        length = soup_message_headers_get_content_length (msg->response_headers);
+    }
+    g_object_unref (msg);
+
+    return length;
 }
 
 gboolean
@@ -74,16 +323,37 @@ upload_file (SoupSession *session,
              gchar *filename,
              SoupURI *results_uri,
              GError **error)
+{
+    return upload_file_full (session, filepath, filename, results_uri,
+                             NULL, NULL, error);
+}
+
+gboolean
+upload_file_full (SoupSession *session,
+                  gchar *filepath,
+                  gchar *filename,
+                  SoupURI *results_uri,
+                  const UploadOptions *options,
+                  UploadStats *stats,
+                  GError **error)
 {
     GFile *f = g_file_new_for_path (filepath);
     GFileInputStream *fis = NULL;
     GFileInfo *fileinfo = NULL;
-    guint64 filesize, uploaded;
+    UploadStats local_stats = { 0 };
+    UploadJob job = { 0 };
+    guint64 filesize;
     GError *tmp_error = NULL;
     SoupURI *result_log_uri;
-    gint ret;
     char *uri_estring_filename = NULL;
 
+    if (options == NULL) {
+        options = &upload_defaults;
+    }
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+
     fileinfo = g_file_query_info (f, "standard::*", G_FILE_QUERY_INFO_NONE,
                                   NULL, &tmp_error);
     if (tmp_error != NULL) {
@@ -110,30 +380,59 @@ upload_file (SoupSession *session,
     uri_estring_filename = g_uri_escape_string(filename, NULL, FALSE);
     result_log_uri = soup_uri_new_with_base (results_uri,
                                              uri_estring_filename);
-    uploaded = 0;
-    while (uploaded < filesize) {
-        ret = upload_chunk (
-            session, G_INPUT_STREAM (fis), filesize, (filesize - uploaded),
-            result_log_uri, &tmp_error);
-        if (ret < 0) {
-            break;
-        } else {
-            uploaded += ret;
-            // replace with callback
-            g_print (".");
+
+    job.session = session;
+    job.uri = result_log_uri;
+    job.in = G_INPUT_STREAM (fis);
+    job.options = options;
+    job.stats = stats;
+    job.filesize = filesize;
+    job.chunk_size = UPLOAD_CHUNK_START;
+    job.local = rstrnt_local_available (result_log_uri);
+    job.context = g_main_context_new ();
+
+    // The session queues on the thread default context
+    g_main_context_push_thread_default (job.context);
+
+    if (options->resume) {
+        guint64 known = upload_known_length (&job);
+
+        // Only the part before any hole counts
+        if (known > UPLOAD_RESUME_WINDOW && known <= filesize &&
+            g_seekable_seek (G_SEEKABLE (fis), known - UPLOAD_RESUME_WINDOW,
+                             G_SEEK_SET, NULL, &job.error)) {
+            job.offset = known - UPLOAD_RESUME_WINDOW;
+            stats->skipped = job.offset;
         }
     }
 
+    if (job.local && job.error == NULL) {
+        upload_local (&job);
+    }
+    if (!job.local && job.error == NULL) {
+        upload_fill (&job);
+    }
+    while (job.in_flight > 0) {
+        g_main_context_iteration (job.context, TRUE);
+    }
+    if (job.own_session) {
+        soup_session_abort (job.session);
+        g_object_unref (job.session);
+    }
+
+    g_main_context_pop_thread_default (job.context);
+    g_main_context_unref (job.context);
+
     g_free(uri_estring_filename);
     soup_uri_free (result_log_uri);
     g_object_unref(fis);
     g_object_unref (f);
 
-    if (tmp_error) {
-        g_propagate_prefixed_error (error, tmp_error,
+    if (job.error) {
+        g_propagate_prefixed_error (error, job.error,
             "Error uploading: %s ", filepath);
         return FALSE;
     }
 
-    return uploaded == filesize;
+    return stats->skipped + stats->sent == filesize;
 }
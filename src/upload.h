@@ -18,6 +18,38 @@
 #ifndef _RESTRAINT_UPLOAD_H
 #define _RESTRAINT_UPLOAD_H
 
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#define UPLOAD_CHUNK_START 131072
+#define UPLOAD_CHUNK_MIN 65536
+#define UPLOAD_CHUNK_MAX (8 * 1024 * 1024)
+#define UPLOAD_CHUNK_TARGET_US G_USEC_PER_SEC /* Time one chunk should take */
+#define UPLOAD_LOCAL_CHUNK (1024 * 1024)
+#define UPLOAD_INFLIGHT 4
+/*
+ * Ranges complete in any order, so the length a server reports may hide
+ * holes.  Nothing past the oldest range still in flight is sent further
+ * than this, and a resume starts this far before the reported length.
+ */
+#define UPLOAD_RESUME_WINDOW (UPLOAD_INFLIGHT * UPLOAD_CHUNK_MAX)
+#define UPLOAD_RETRIES 5
+#define UPLOAD_RETRY_DELAY 500 /* Milliseconds, doubled on every retry */
+
+typedef struct {
+    guint inflight;   /* Ranged PUTs kept in flight */
+    guint retries;    /* Attempts per range after the first one */
+    gboolean resume;  /* Skip what the server already has of the file */
+} UploadOptions;
+
+typedef struct {
+    guint64 sent;       /* Bytes PUT successfully */
+    guint64 skipped;    /* Bytes the server already had when resuming */
+    guint chunks;
+    guint retries;
+    gsize chunk_size;   /* Last size picked for a chunk */
+} UploadStats;
+
 gboolean
 upload_file (SoupSession *session,
              gchar *filepath,
@@ -25,4 +57,20 @@ upload_file (SoupSession *session,
              SoupURI *results_uri,
              GError **error);
 
+/*
+ * session may be NULL, one is made if the file has to go over TCP after
+ * all, when restraintd's local socket is missing or stale.
+ */
+gboolean
+upload_file_full (SoupSession *session,
+                  gchar *filepath,
+                  gchar *filename,
+                  SoupURI *results_uri,
+                  const UploadOptions *options,
+                  UploadStats *stats,
+                  GError **error);
+
+gsize
+upload_chunk_size (gsize current, gsize bytes, gint64 elapsed_us);
+
 #endif
@@ -208,6 +208,20 @@ get_envvar_filename(guint port)
     return(filename);
 }
 
+/* get_local_socket_filename()
+ *
+ * The unix socket restraintd listens on next to the env file, the
+ * rstrnt-* commands use it instead of TCP when it exists.
+ */
+gchar *
+get_local_socket_filename(guint port)
+{
+    if (g_file_test(CMD_ENV_DIR, G_FILE_TEST_IS_DIR)) {
+        return g_strdup_printf(CMD_SOCKET_FORMAT, CMD_ENV_DIR, port);
+    }
+    return g_strdup_printf(CMD_SOCKET_FORMAT, ".", port);
+}
+
 /* get_install_dir()
  *
  * Get directory to install tasks by configured file or default.
@@ -0,0 +1,208 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "watchdog.h"
+
+static gboolean
+watchdog_expired_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+    RstrntWatchdog *watchdog = (RstrntWatchdog *) user_data;
+    uint64_t expirations;
+
+    // Nothing to read if the deadline moved since the timer fired
+    if (read (fd, &expirations, sizeof (expirations)) != sizeof (expirations)) {
+        return G_SOURCE_CONTINUE;
+    }
+    if (watchdog->func != NULL) {
+        watchdog->func (watchdog->user_data);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+watchdog_timeout_cb (gpointer user_data)
+{
+    RstrntWatchdog *watchdog = (RstrntWatchdog *) user_data;
+
+    watchdog->source_id = 0;
+    if (watchdog->func != NULL) {
+        watchdog->func (watchdog->user_data);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+RstrntWatchdog *
+rstrnt_watchdog_new (GError **error)
+{
+    RstrntWatchdog *watchdog;
+    clockid_t clock = CLOCK_BOOTTIME;
+    gint fd;
+
+    fd = timerfd_create (clock, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1 && errno == EINVAL) {
+        clock = CLOCK_MONOTONIC;
+        fd = timerfd_create (clock, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+    if (fd == -1) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Failed to create watchdog timer: %s", g_strerror (errno));
+        return NULL;
+    }
+
+    watchdog = g_slice_new0 (RstrntWatchdog);
+    watchdog->ref_count = 1;
+    watchdog->fd = fd;
+    watchdog->clock = clock;
+    watchdog->source_id = g_unix_fd_add (fd, G_IO_IN, watchdog_expired_cb, watchdog);
+    return watchdog;
+}
+
+/*
+ * A watchdog for when rstrnt_watchdog_new() fails.  The deadline is a
+ * main loop timeout on CLOCK_MONOTONIC, time spent suspended doesn't
+ * count towards it, but it is still enforced.
+ */
+RstrntWatchdog *
+rstrnt_watchdog_new_timeout (void)
+{
+    RstrntWatchdog *watchdog = g_slice_new0 (RstrntWatchdog);
+
+    watchdog->ref_count = 1;
+    watchdog->fd = -1;
+    watchdog->clock = CLOCK_MONOTONIC;
+    return watchdog;
+}
+
+RstrntWatchdog *
+rstrnt_watchdog_ref (RstrntWatchdog *watchdog)
+{
+    g_return_val_if_fail (watchdog != NULL, NULL);
+
+    watchdog->ref_count++;
+    return watchdog;
+}
+
+void
+rstrnt_watchdog_unref (RstrntWatchdog *watchdog)
+{
+    if (watchdog == NULL || --watchdog->ref_count > 0) {
+        return;
+    }
+    if (watchdog->source_id != 0) {
+        g_source_remove (watchdog->source_id);
+    }
+    if (watchdog->fd != -1) {
+        close (watchdog->fd);
+    }
+    g_slice_free (RstrntWatchdog, watchdog);
+}
+
+/* func is called once the deadline passes, NULL stops watching */
+void
+rstrnt_watchdog_watch (RstrntWatchdog *watchdog, RstrntWatchdogFunc func,
+                       gpointer user_data)
+{
+    watchdog->func = func;
+    watchdog->user_data = user_data;
+}
+
+gint64
+rstrnt_watchdog_now (RstrntWatchdog *watchdog)
+{
+    struct timespec now;
+
+    clock_gettime (watchdog->clock, &now);
+    return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_nsec / 1000;
+}
+
+/*
+ * Moves the deadline to seconds from now, replacing the previous one in
+ * a single step.  0 or less expires the watchdog right away.
+ */
+gboolean
+rstrnt_watchdog_set (RstrntWatchdog *watchdog, gint64 seconds, GError **error)
+{
+    struct itimerspec spec;
+    gint64 deadline = rstrnt_watchdog_now (watchdog) + MAX (seconds, 0) * G_USEC_PER_SEC;
+
+    if (watchdog->fd == -1) {
+        if (watchdog->source_id != 0) {
+            g_source_remove (watchdog->source_id);
+        }
+        watchdog->source_id = g_timeout_add (CLAMP (seconds, 0, G_MAXUINT / 1000) * 1000,
+                                             watchdog_timeout_cb, watchdog);
+        watchdog->deadline = deadline;
+        return TRUE;
+    }
+
+    memset (&spec, 0, sizeof (spec));
+    spec.it_value.tv_sec = deadline / G_USEC_PER_SEC;
+    spec.it_value.tv_nsec = (deadline % G_USEC_PER_SEC) * 1000;
+    if (timerfd_settime (watchdog->fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Failed to set watchdog timer: %s", g_strerror (errno));
+        return FALSE;
+    }
+    watchdog->deadline = deadline;
+    return TRUE;
+}
+
+void
+rstrnt_watchdog_disarm (RstrntWatchdog *watchdog)
+{
+    struct itimerspec spec;
+
+    if (watchdog->fd == -1) {
+        if (watchdog->source_id != 0) {
+            g_source_remove (watchdog->source_id);
+            watchdog->source_id = 0;
+        }
+        watchdog->deadline = 0;
+        return;
+    }
+
+    memset (&spec, 0, sizeof (spec));
+    timerfd_settime (watchdog->fd, 0, &spec, NULL);
+    watchdog->deadline = 0;
+}
+
+gboolean
+rstrnt_watchdog_armed (RstrntWatchdog *watchdog)
+{
+    return watchdog != NULL && watchdog->deadline != 0;
+}
+
+/* Seconds left, rounded up, 0 once expired or disarmed */
+gint64
+rstrnt_watchdog_remaining (RstrntWatchdog *watchdog)
+{
+    gint64 left;
+
+    if (!rstrnt_watchdog_armed (watchdog)) {
+        return 0;
+    }
+    left = watchdog->deadline - rstrnt_watchdog_now (watchdog);
+    return left > 0 ? (left + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC : 0;
+}
@@ -0,0 +1,55 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_WATCHDOG_H
+#define _RESTRAINT_WATCHDOG_H
+
+#include <glib.h>
+#include <time.h>
+
+typedef void (*RstrntWatchdogFunc) (gpointer user_data);
+
+/*
+ * A local watchdog, a deadline on CLOCK_BOOTTIME kept in a timerfd.  Time
+ * spent suspended counts and steps of the wall clock don't, the function
+ * being watched is called from the main loop as soon as the deadline
+ * passes.
+ */
+typedef struct {
+    gint ref_count;
+    gint fd;             /* the timerfd, -1 for a main loop timeout */
+    clockid_t clock;     /* CLOCK_MONOTONIC on kernels without BOOTTIME timers */
+    guint source_id;     /* the timerfd watch or the pending timeout */
+    gint64 deadline;     /* microseconds on clock, 0 when disarmed */
+    RstrntWatchdogFunc func;
+    gpointer user_data;
+} RstrntWatchdog;
+
+RstrntWatchdog *rstrnt_watchdog_new (GError **error);
+RstrntWatchdog *rstrnt_watchdog_new_timeout (void);
+RstrntWatchdog *rstrnt_watchdog_ref (RstrntWatchdog *watchdog);
+void rstrnt_watchdog_unref (RstrntWatchdog *watchdog);
+void rstrnt_watchdog_watch (RstrntWatchdog *watchdog, RstrntWatchdogFunc func,
+                            gpointer user_data);
+gboolean rstrnt_watchdog_set (RstrntWatchdog *watchdog, gint64 seconds,
+                              GError **error);
+void rstrnt_watchdog_disarm (RstrntWatchdog *watchdog);
+gboolean rstrnt_watchdog_armed (RstrntWatchdog *watchdog);
+gint64 rstrnt_watchdog_now (RstrntWatchdog *watchdog);
+gint64 rstrnt_watchdog_remaining (RstrntWatchdog *watchdog);
+
+#endif
@@ -1,7 +1,6 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include <libsoup/soup.h>
-#include <libxml/parser.h>
 #include <libxml/xpath.h>
 #include <libxml/tree.h>
 
@@ -14,7 +13,7 @@ GQuark restraint_xml_parse_error_quark(void) {
 typedef struct {
     GError *error;
     char buf[4096];
-    xmlParserCtxt *parser_ctxt;
+    GByteArray *data;
     gchar *url;
     RestraintXmlRequestCompletionCallback completion_callback;
     gpointer completion_callback_user_data;
@@ -37,54 +36,34 @@ restraint_xml_read_callback(GObject *source, GAsyncResult *result, gpointer user
         goto finished;
     }
 
-    // We only initialise the XML parsing context after we have read some
-    // bytes, not sooner, because it uses the initial bytes for charset detection.
-    if (ctxt->parser_ctxt == NULL) {
-        ctxt->parser_ctxt = xmlCreatePushParserCtxt(NULL, NULL, ctxt->buf, size, ctxt->url);
-        if (ctxt->parser_ctxt == NULL) {
-            g_set_error_literal(&ctxt->error, RESTRAINT_XML_PARSE_ERROR,
-                    RESTRAINT_XML_PARSE_ERROR_BAD_SYNTAX,
-                    "Error creating libxml parser context");
-            goto finished;
-        }
-    } else {
-        xmlParserErrors xmlresult = xmlParseChunk(ctxt->parser_ctxt, ctxt->buf, size,
-                size > 0 ? 0 : 1);
-        if (xmlresult != XML_ERR_OK) {
-            const xmlError *xmlerr = xmlCtxtGetLastError(ctxt->parser_ctxt);
-            g_set_error_literal(&ctxt->error, RESTRAINT_XML_PARSE_ERROR,
-                    RESTRAINT_XML_PARSE_ERROR_BAD_SYNTAX,
-                    xmlerr != NULL ? xmlerr->message : "Unknown libxml error");
-            goto finished;
-        }
-    }
-
     if (size > 0) {
         // Go back to read another chunk.
+        g_byte_array_append(ctxt->data, (guint8 *) ctxt->buf, size);
         g_input_stream_read_async(stream, ctxt->buf, sizeof(ctxt->buf),
                 G_PRIORITY_DEFAULT, /* cancellable */ NULL,
                 restraint_xml_read_callback, ctxt);
         return;
     }
 
+    if (ctxt->data->len == 0) {
+        g_set_error(&ctxt->error, RESTRAINT_XML_PARSE_ERROR,
+                RESTRAINT_XML_PARSE_ERROR_BAD_SYNTAX,
+                "%s: Document is empty", ctxt->url);
+    }
+
 finished:
-    g_input_stream_close(stream, /* cancellable */ NULL, &ctxt->error);
+    g_input_stream_close(stream, /* cancellable */ NULL,
+            ctxt->error ? NULL : &ctxt->error);
     g_object_unref(stream);
 
     if (ctxt->error) {
-        if (ctxt->parser_ctxt) {
-            xmlFreeDoc(ctxt->parser_ctxt->myDoc);
-            xmlFreeParserCtxt(ctxt->parser_ctxt);
-        }
+        g_byte_array_free(ctxt->data, TRUE);
         ctxt->completion_callback(ctxt->error, NULL,
                 ctxt->completion_callback_user_data);
     } else {
-        g_warn_if_fail(ctxt->parser_ctxt != NULL);
-        g_warn_if_fail(ctxt->parser_ctxt->myDoc != NULL);
-        // If there was no error, we transfer ownership of myDoc to the callback.
-        ctxt->completion_callback(NULL, ctxt->parser_ctxt->myDoc,
+        // If there was no error, we transfer ownership of the bytes to the callback.
+        ctxt->completion_callback(NULL, g_byte_array_free_to_bytes(ctxt->data),
                 ctxt->completion_callback_user_data);
-        xmlFreeParserCtxt(ctxt->parser_ctxt);
     }
 
     g_clear_error(&ctxt->error);
@@ -92,8 +71,21 @@ finished:
     g_slice_free(RestraintXmlRequestContext, ctxt);
 }
 
+static RestraintXmlRequestContext *
+restraint_xml_request_context_new(const gchar *url,
+    RestraintXmlRequestCompletionCallback completion_callback,
+    gpointer user_data)
+{
+    RestraintXmlRequestContext *ctxt = g_slice_new0(RestraintXmlRequestContext);
+    ctxt->data = g_byte_array_new();
+    ctxt->url = g_strdup(url);
+    ctxt->completion_callback = completion_callback;
+    ctxt->completion_callback_user_data = user_data;
+    return ctxt;
+}
+
 void
-restraint_xml_parse_from_stream(
+restraint_xml_read_from_stream(
     GInputStream *stream,
     const gchar *url,
     RestraintXmlRequestCompletionCallback completion_callback,
@@ -102,10 +94,8 @@ restraint_xml_parse_from_stream(
     g_return_if_fail(stream != NULL);
     g_return_if_fail(completion_callback != NULL);
 
-    RestraintXmlRequestContext *ctxt = g_slice_new0(RestraintXmlRequestContext);
-    ctxt->url = g_strdup(url);
-    ctxt->completion_callback = completion_callback;
-    ctxt->completion_callback_user_data = user_data;
+    RestraintXmlRequestContext *ctxt = restraint_xml_request_context_new(url,
+            completion_callback, user_data);
 
     g_input_stream_read_async(stream, ctxt->buf, sizeof(ctxt->buf),
             G_PRIORITY_DEFAULT, /* cancellable */ NULL,
@@ -120,6 +110,10 @@ restraint_xml_request_callback(GObject *source, GAsyncResult *res, gpointer user
     GInputStream *stream = soup_request_send_finish(SOUP_REQUEST(source), res, &ctxt->error);
     if (!stream) {
         ctxt->completion_callback(ctxt->error, NULL, ctxt->completion_callback_user_data);
+        g_clear_error(&ctxt->error);
+        g_byte_array_free(ctxt->data, TRUE);
+        g_free(ctxt->url);
+        g_slice_free(RestraintXmlRequestContext, ctxt);
         return;
     }
 
@@ -129,7 +123,7 @@ restraint_xml_request_callback(GObject *source, GAsyncResult *res, gpointer user
 }
 
 void
-restraint_xml_parse_from_url(
+restraint_xml_read_from_url(
     SoupSession *soup_session,
     const gchar *url,
     RestraintXmlRequestCompletionCallback completion_callback,
@@ -147,10 +141,8 @@ restraint_xml_parse_from_url(
         return;
     }
 
-    RestraintXmlRequestContext *ctxt = g_slice_new0(RestraintXmlRequestContext);
-    ctxt->url = g_strdup(url);
-    ctxt->completion_callback = completion_callback;
-    ctxt->completion_callback_user_data = user_data;
+    RestraintXmlRequestContext *ctxt = restraint_xml_request_context_new(url,
+            completion_callback, user_data);
 
     soup_request_send_async(request, /* cancellable */ NULL,
             restraint_xml_request_callback, ctxt);
@@ -14,33 +14,33 @@ typedef enum {
     RESTRAINT_XML_PARSE_ERROR_BAD_SYNTAX, /* parse errors from libxml2 */
 } RestraintXmlParseError;
 
-typedef void (*RestraintXmlRequestCompletionCallback)(GError *error, xmlDoc *doc, gpointer user_data);
+typedef void (*RestraintXmlRequestCompletionCallback)(GError *error, GBytes *xml, gpointer user_data);
 
 /**
- * restraint_xml_parse_stream:
- * @stream (transfer full): an input stream containing XML to be read and parsed.
+ * restraint_xml_read_from_stream:
+ * @stream (transfer full): an input stream containing XML to be read.
  * @url: the URL from which the XML was retrieved.
  * @completion_callback: a function which will be called when the stream has
- *   been read to completion and the XML has been parsed (or an error occurred).
+ *   been read to completion (or an error occurred).
  * @user_data (closure): extra argument for the completion callback.
  *
- * Reads from the given stream asynchronously and parses the XML it contains,
- * producing an xmlDoc from it.
+ * Reads from the given stream asynchronously, the XML is left as it is for
+ * the caller to parse with a streaming reader rather than a whole xmlDoc.
  *
- * The callback function will be called with the resulting xmlDoc and %NULL
- * for the error argument, if the document was parsed successfully. The
- * callback takes ownership of the xmlDoc.
+ * The callback function will be called with the bytes read and %NULL for
+ * the error argument, if the stream was read successfully. The callback
+ * takes ownership of the bytes.
  *
  * If an error occurred, the callback will be called with an error and %NULL
- * for the doc argument.
+ * for the xml argument.
  */
-void restraint_xml_parse_from_stream(
+void restraint_xml_read_from_stream(
     GInputStream *stream,
     const gchar *url,
     RestraintXmlRequestCompletionCallback completion_callback,
     gpointer user_data);
 
-void restraint_xml_parse_from_url(
+void restraint_xml_read_from_url(
     SoupSession *soup_session,
     const gchar *url,
     RestraintXmlRequestCompletionCallback completion_callback,
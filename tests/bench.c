@@ -0,0 +1,245 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <json.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+
+#include "bench.h"
+
+typedef struct {
+    const gchar *path;
+    const gchar *unit;
+    BenchFunc func;
+    gconstpointer data;
+} BenchCase;
+
+static const gchar *bench_suite = NULL;
+static GPtrArray *bench_cases = NULL;
+
+static gint bench_repeat = 5;
+static gboolean bench_quick = FALSE;
+static gchar *bench_output = NULL;
+static gchar *bench_path = NULL;
+
+static GOptionEntry bench_entries[] = {
+    { "repeat", 'r', 0, G_OPTION_ARG_INT, &bench_repeat,
+      "Measured runs of each benchmark, after one to warm up", "N" },
+    { "quick", 'q', 0, G_OPTION_ARG_NONE, &bench_quick,
+      "Do a tenth of the work", NULL },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &bench_output,
+      "Write the results as JSON to FILE", "FILE" },
+    { "path", 'p', 0, G_OPTION_ARG_STRING, &bench_path,
+      "Only run the benchmarks starting with PATH", "PATH" },
+    { NULL }
+};
+
+void
+bench_init (int *argc, char ***argv, const gchar *suite)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, bench_entries, NULL);
+    if (!g_option_context_parse (context, argc, argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        exit (1);
+    }
+    g_option_context_free (context);
+
+    bench_repeat = MAX (bench_repeat, 1);
+    bench_suite = suite;
+    bench_cases = g_ptr_array_new_with_free_func (g_free);
+}
+
+void
+bench_add (const gchar *path, const gchar *unit, BenchFunc func, gconstpointer data)
+{
+    BenchCase *bench = g_new0 (BenchCase, 1);
+
+    bench->path = path;
+    bench->unit = unit;
+    bench->func = func;
+    bench->data = data;
+    g_ptr_array_add (bench_cases, bench);
+}
+
+void
+bench_start (BenchRun *run)
+{
+    run->started = g_get_monotonic_time ();
+}
+
+void
+bench_stop (BenchRun *run)
+{
+    run->usec += g_get_monotonic_time () - run->started;
+}
+
+guint
+bench_scale (guint n)
+{
+    return bench_quick ? MAX (n / 10, 1) : n;
+}
+
+static gdouble
+bench_value (const BenchCase *bench, const BenchRun *run)
+{
+    gdouble seconds = (gdouble) MAX (run->usec, 1) / G_USEC_PER_SEC;
+
+    if (g_strcmp0 (bench->unit, "MB/s") == 0) {
+        return run->bytes / seconds / 1e6;
+    }
+    if (g_str_has_suffix (bench->unit, "/s")) {
+        return run->ops / seconds;
+    }
+    return run->value;
+}
+
+static gint
+bench_compare (gconstpointer a, gconstpointer b)
+{
+    gdouble x = *(const gdouble *) a;
+    gdouble y = *(const gdouble *) b;
+
+    return (x > y) - (x < y);
+}
+
+static json_object *
+bench_case_run (const BenchCase *bench)
+{
+    gdouble *values = g_new (gdouble, bench_repeat);
+    json_object *result;
+    BenchRun run;
+
+    // The first run only warms up caches and allocators
+    for (gint i = -1; i < bench_repeat; i++) {
+        gint64 started;
+
+        memset (&run, 0, sizeof (run));
+        started = g_get_monotonic_time ();
+        bench->func (&run, bench->data);
+        if (run.started == 0) {
+            run.usec = g_get_monotonic_time () - started;
+        }
+        if (i >= 0) {
+            values[i] = bench_value (bench, &run);
+        }
+    }
+    qsort (values, bench_repeat, sizeof (gdouble), bench_compare);
+
+    g_print ("%s: %.2f %s (min %.2f, max %.2f)\n", bench->path,
+             values[bench_repeat / 2], bench->unit, values[0], values[bench_repeat - 1]);
+
+    result = json_object_new_object ();
+    json_object_object_add (result, "name", json_object_new_string (bench->path));
+    json_object_object_add (result, "unit", json_object_new_string (bench->unit));
+    json_object_object_add (result, "median", json_object_new_double (values[bench_repeat / 2]));
+    json_object_object_add (result, "min", json_object_new_double (values[0]));
+    json_object_object_add (result, "max", json_object_new_double (values[bench_repeat - 1]));
+    json_object_object_add (result, "runs", json_object_new_int (bench_repeat));
+    json_object_object_add (result, "ops", json_object_new_int64 (run.ops));
+    json_object_object_add (result, "bytes", json_object_new_int64 (run.bytes));
+    g_free (values);
+
+    return result;
+}
+
+int
+bench_run (void)
+{
+    json_object *report, *results;
+    GDateTime *now = g_date_time_new_now_utc ();
+    gchar *timestamp = g_date_time_format (now, "%Y-%m-%dT%H:%M:%SZ");
+    struct utsname uts;
+    int ret = 0;
+
+    report = json_object_new_object ();
+    results = json_object_new_array ();
+    json_object_object_add (report, "suite", json_object_new_string (bench_suite));
+    json_object_object_add (report, "timestamp", json_object_new_string (timestamp));
+    if (uname (&uts) == 0) {
+        json_object_object_add (report, "machine", json_object_new_string (uts.machine));
+        json_object_object_add (report, "kernel", json_object_new_string (uts.release));
+    }
+    json_object_object_add (report, "quick", json_object_new_boolean (bench_quick));
+    json_object_object_add (report, "results", results);
+
+    for (guint i = 0; i < bench_cases->len; i++) {
+        const BenchCase *bench = g_ptr_array_index (bench_cases, i);
+
+        if (bench_path != NULL && !g_str_has_prefix (bench->path, bench_path)) {
+            continue;
+        }
+        json_object_array_add (results, bench_case_run (bench));
+    }
+
+    if (bench_output != NULL &&
+        json_object_to_file_ext (bench_output, report, JSON_C_TO_STRING_PLAIN) != 0) {
+        g_printerr ("Failed to write %s\n", bench_output);
+        ret = 1;
+    }
+
+    json_object_put (report);
+    g_ptr_array_free (bench_cases, TRUE);
+    g_free (timestamp);
+    g_date_time_unref (now);
+    return ret;
+}
+
+static void
+bench_http_sink_handler (SoupServer *server, SoupMessage *msg,
+                         const char *path, GHashTable *query,
+                         SoupClientContext *client, gpointer data)
+{
+    BenchHttpSink *sink = data;
+
+    sink->requests++;
+    sink->bytes += msg->request_body->length;
+    soup_message_set_status (msg, SOUP_STATUS_OK);
+}
+
+BenchHttpSink *
+bench_http_sink_start (void)
+{
+    BenchHttpSink *sink = g_slice_new0 (BenchHttpSink);
+    GError *error = NULL;
+    GSList *uris;
+
+    sink->server = soup_server_new (NULL, NULL);
+    soup_server_add_handler (sink->server, NULL, bench_http_sink_handler, sink, NULL);
+    if (!soup_server_listen_local (sink->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error)) {
+        g_error ("%s", error->message);
+    }
+    uris = soup_server_get_uris (sink->server);
+    sink->uri = soup_uri_copy (uris->data);
+    g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+
+    return sink;
+}
+
+void
+bench_http_sink_stop (BenchHttpSink *sink)
+{
+    soup_server_disconnect (sink->server);
+    g_object_unref (sink->server);
+    soup_uri_free (sink->uri);
+    g_slice_free (BenchHttpSink, sink);
+}
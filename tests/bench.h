@@ -0,0 +1,68 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RESTRAINT_BENCH_H
+#define _RESTRAINT_BENCH_H
+
+/*
+ * For benchmarks: runs each registered benchmark a few times, like
+ * g_test_run() runs tests, and reports the median.  With --output the
+ * results are written as one JSON object for trend tracking.
+ */
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+typedef struct {
+    // What the timed part did
+    guint64 ops;
+    guint64 bytes;
+    // For units that aren't a rate, the measured value itself
+    gdouble value;
+    // Timed part, the whole benchmark unless bench_start() is called
+    gint64 started;
+    gint64 usec;
+} BenchRun;
+
+typedef void (*BenchFunc) (BenchRun *run, gconstpointer data);
+
+void bench_init (int *argc, char ***argv, const gchar *suite);
+/*
+ * unit "MB/s" reports bytes per second, any other ".../s" ops per
+ * second and anything else the value set by the benchmark.
+ */
+void bench_add (const gchar *path, const gchar *unit,
+                BenchFunc func, gconstpointer data);
+int bench_run (void);
+
+void bench_start (BenchRun *run);
+void bench_stop (BenchRun *run);
+// n, or a tenth of it with --quick
+guint bench_scale (guint n);
+
+/* An HTTP server in the main context answering 200 to anything */
+typedef struct {
+    SoupServer *server;
+    SoupURI *uri;
+    guint requests;
+    guint64 bytes;
+} BenchHttpSink;
+
+BenchHttpSink *bench_http_sink_start (void);
+void bench_http_sink_stop (BenchHttpSink *sink);
+
+#endif
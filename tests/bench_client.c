@@ -0,0 +1,154 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* client.c has its own main, handle_message() is all that's needed */
+#define main restraint_client_main
+#include "client.c"
+#undef main
+
+#include "bench.h"
+
+#define BENCH_LOG_CHUNK 4096
+
+static guint handled = 0;
+
+/* What the real callbacks do with a message before writing anything */
+static void
+bench_results_cb (const char *path, GHashTable *headers,
+                  struct json_object *json_body, gpointer user_data)
+{
+    GHashTable *body = json_to_hashtable (json_body);
+
+    g_assert_cmpstr (g_hash_table_lookup (body, "result"), ==, "PASS");
+    g_hash_table_destroy (body);
+    handled++;
+}
+
+static void
+bench_logs_cb (const char *path, GHashTable *headers,
+               struct json_object *json_body, gpointer user_data)
+{
+    goffset start, end, total_length;
+    gsize body_length;
+    guchar *body_data;
+
+    g_assert_true (headers_get_content_range (headers, &start, &end, &total_length));
+    body_data = g_base64_decode (json_object_get_string (json_body), &body_length);
+    g_assert_cmpuint (body_length, ==, end - start + 1);
+    g_free (body_data);
+    handled++;
+}
+
+static void
+bench_other_cb (const char *path, GHashTable *headers,
+                struct json_object *json_body, gpointer user_data)
+{
+    g_assert_not_reached ();
+}
+
+/* The same paths, in the same order, as restraint registers */
+static GSList *
+bench_regexes_new (void)
+{
+    GSList *regexes = NULL;
+
+    regexes = register_path (regexes, "/start$", bench_other_cb);
+    regexes = register_path (regexes, "/recipes/[[:alnum:]]+/tasks/[[:digit:]]+/status$",
+                             bench_other_cb);
+    regexes = register_path (regexes, "/recipes/[[:alnum:]]+/tasks/[[:digit:]]+/results/$",
+                             bench_results_cb);
+    regexes = register_path (regexes, "/recipes/[[:alnum:]]+/watchdog$", bench_other_cb);
+    regexes = register_path (regexes, "/recipes/[[:alnum:]]+/tasks/[[:digit:]]+/logs/",
+                             bench_logs_cb);
+    regexes = register_path (regexes,
+                             "/recipes/[[:alnum:]]+/tasks/[[:digit:]]+/results/[[:digit:]]+/logs/",
+                             bench_logs_cb);
+    return regexes;
+}
+
+/* A line of restraintd output as restraint_stdout_message() writes it */
+static gchar *
+bench_message_new (gboolean log)
+{
+    if (log) {
+        gchar *data = g_malloc (BENCH_LOG_CHUNK);
+        gchar *encoded, *message;
+
+        memset (data, 'x', BENCH_LOG_CHUNK);
+        encoded = g_base64_encode ((guchar *) data, BENCH_LOG_CHUNK);
+        message = g_strdup_printf ("{\"headers\":{\"Content-Range\":\"bytes 0-%d/*\","
+                                   "\"Content-Type\":\"text/plain\","
+                                   "\"rstrnt-path\":\"/recipes/1/tasks/2/logs/taskout.log\","
+                                   "\"rstrnt-method\":\"PUT\",\"body-length\":%d},"
+                                   "\"body\":\"%s\"}",
+                                   BENCH_LOG_CHUNK - 1, BENCH_LOG_CHUNK, encoded);
+        g_free (encoded);
+        g_free (data);
+        return message;
+    }
+    return g_strdup ("{\"headers\":{\"Content-Type\":\"application/x-www-form-urlencoded\","
+                     "\"transaction-id\":\"1700000000\","
+                     "\"rstrnt-path\":\"/recipes/1/tasks/2/results/\","
+                     "\"rstrnt-method\":\"POST\",\"body-length\":51},"
+                     "\"body\":{\"path\":\"/bench\",\"result\":\"PASS\",\"score\":\"0\","
+                     "\"message\":\"benchmark\"}}");
+}
+
+static void
+bench_handle_message (BenchRun *run, gconstpointer data)
+{
+    gboolean log = GPOINTER_TO_INT (data);
+    guint count = bench_scale (log ? 20000 : 200000);
+    gchar *message = bench_message_new (log);
+    AppData *app_data = g_slice_new0 (AppData);
+    RecipeData *recipe_data = g_slice_new0 (RecipeData);
+
+    app_data->regexes = bench_regexes_new ();
+    recipe_data->app_data = app_data;
+    recipe_data->rhost = g_strdup ("bench.example.com");
+    handled = 0;
+
+    bench_start (run);
+    for (guint i = 0; i < count; i++) {
+        handle_message (message, recipe_data);
+    }
+    bench_stop (run);
+    g_assert_cmpuint (handled, ==, count);
+
+    run->ops = count;
+    run->bytes = (guint64) count * strlen (message);
+
+    g_free (recipe_data->rhost);
+    g_slice_free (RecipeData, recipe_data);
+    g_slist_free_full (app_data->regexes, clear_regex);
+    g_slice_free (AppData, app_data);
+    g_free (message);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    bench_init (&argc, &argv, "client");
+
+    bench_add ("/client/handle_message/result", "msgs/s", bench_handle_message,
+               GINT_TO_POINTER (FALSE));
+    bench_add ("/client/handle_message/log", "msgs/s", bench_handle_message,
+               GINT_TO_POINTER (TRUE));
+
+    return bench_run ();
+}
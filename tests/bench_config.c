@@ -0,0 +1,115 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "bench.h"
+#include "config.h"
+
+// Sections of a run config partway through a long recipe
+#define BENCH_CONFIG_TASKS 100
+
+static gchar *
+bench_config_new (void)
+{
+    gchar *dir = g_dir_make_tmp ("bench_config_XXXXXX", NULL);
+    gchar *config_file = g_build_filename (dir, "config.conf", NULL);
+    GError *error = NULL;
+
+    for (guint i = 0; i < BENCH_CONFIG_TASKS; i++) {
+        gchar *section = g_strdup_printf ("%u", 1000 + i);
+        gchar *offsets = g_strdup_printf ("offsets_%u", 1000 + i);
+
+        restraint_config_set (config_file, section, "started", &error, G_TYPE_BOOLEAN, TRUE);
+        g_assert_no_error (error);
+        restraint_config_set (config_file, section, "reboots", &error, G_TYPE_UINT64, (guint64) 0);
+        g_assert_no_error (error);
+        restraint_config_set (config_file, offsets, "logs/taskout.log", &error,
+                              G_TYPE_UINT64, (guint64) 4096 * i);
+        g_assert_no_error (error);
+        g_free (offsets);
+        g_free (section);
+    }
+    g_free (dir);
+
+    return config_file;
+}
+
+static void
+bench_config_free (gchar *config_file)
+{
+    gchar *dir = g_path_get_dirname (config_file);
+
+    g_remove (config_file);
+    g_rmdir (dir);
+    g_free (dir);
+    g_free (config_file);
+}
+
+/* The log offsets saved after each upload */
+static void
+bench_config_set (BenchRun *run, gconstpointer data)
+{
+    guint count = bench_scale (GPOINTER_TO_UINT (data));
+    gchar *config_file = bench_config_new ();
+    GError *error = NULL;
+
+    bench_start (run);
+    for (guint i = 0; i < count; i++) {
+        restraint_config_set (config_file, "offsets_1050", "logs/taskout.log", &error,
+                              G_TYPE_UINT64, (guint64) i);
+    }
+    bench_stop (run);
+    g_assert_no_error (error);
+
+    run->ops = count;
+    bench_config_free (config_file);
+}
+
+static void
+bench_config_get (BenchRun *run, gconstpointer data)
+{
+    guint count = bench_scale (GPOINTER_TO_UINT (data));
+    gchar *config_file = bench_config_new ();
+    GError *error = NULL;
+    guint64 sum = 0;
+
+    bench_start (run);
+    for (guint i = 0; i < count; i++) {
+        sum += restraint_config_get_uint64 (config_file, "offsets_1050",
+                                            "logs/taskout.log", &error);
+    }
+    bench_stop (run);
+    g_assert_no_error (error);
+    g_assert_cmpuint (sum, ==, (guint64) count * 4096 * 50);
+
+    run->ops = count;
+    bench_config_free (config_file);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    bench_init (&argc, &argv, "config");
+
+    bench_add ("/config/set", "ops/s", bench_config_set, GUINT_TO_POINTER (2000));
+    bench_add ("/config/get", "ops/s", bench_config_get, GUINT_TO_POINTER (5000));
+
+    return bench_run ();
+}
@@ -0,0 +1,88 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "fetch.h"
+#include "fetch_uri.h"
+
+#define BENCH_ARCHIVE "test-data/http-remote/fetch_http.tgz"
+
+typedef struct {
+    GMainLoop *loop;
+    GError *error;
+} FetchRun;
+
+static void
+bench_fetch_finish (GError *error, guint32 match_cnt, guint32 nonmatch_cnt,
+                    gpointer user_data)
+{
+    FetchRun *fetch_run = user_data;
+
+    if (error) {
+        g_propagate_error (&fetch_run->error, error);
+    }
+    g_main_loop_quit (fetch_run->loop);
+}
+
+/* The task archive read and extracted, as for a fetch="" task */
+static void
+bench_fetch_uri (BenchRun *run, gconstpointer data)
+{
+    guint count = bench_scale (GPOINTER_TO_UINT (data));
+    gchar *cwd = g_get_current_dir ();
+    gchar *fulluri = g_strdup_printf ("file://%s/" BENCH_ARCHIVE "#restraint", cwd);
+    SoupURI *url = soup_uri_new (fulluri);
+    gchar *path = g_dir_make_tmp ("bench_fetch_uri_XXXXXX", NULL);
+    FetchRun fetch_run = { g_main_loop_new (NULL, FALSE), NULL };
+    GStatBuf st;
+
+    g_assert_cmpint (g_stat (BENCH_ARCHIVE, &st), ==, 0);
+
+    bench_start (run);
+    for (guint i = 0; i < count; i++) {
+        // Without keepchanges each fetch starts from an empty directory
+        restraint_fetch_uri (url, path, FALSE, TRUE, NULL, bench_fetch_finish, &fetch_run);
+        g_main_loop_run (fetch_run.loop);
+        g_assert_no_error (fetch_run.error);
+    }
+    bench_stop (run);
+
+    run->ops = count;
+    run->bytes = (guint64) count * st.st_size;
+
+    rmrf (path);
+    g_main_loop_unref (fetch_run.loop);
+    soup_uri_free (url);
+    g_free (path);
+    g_free (fulluri);
+    g_free (cwd);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    bench_init (&argc, &argv, "fetch_uri");
+
+    bench_add ("/fetch_uri/file", "fetches/s", bench_fetch_uri, GUINT_TO_POINTER (500));
+
+    return bench_run ();
+}
@@ -0,0 +1,153 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#define LOG_MANAGER_DIR "./bench_logging_logs"
+
+#include "logging.c"
+#include "bench.h"
+#include "metrics.h"
+
+#define BENCH_LOG_SIZE (32 * 1024 * 1024)
+
+SoupSession *soup_session;
+
+static BenchHttpSink *sink;
+
+static RstrntTask *
+bench_task_new (void)
+{
+    static guint count = 0;
+    RstrntTask *task = restraint_task_new ();
+
+    task->task_id = g_strdup_printf ("bench-%u", count++);
+    task->task_uri = soup_uri_new_with_base (sink->uri, "/recipes/1/tasks/1/");
+
+    return task;
+}
+
+/* Drops the logs, the runs would fill the disk otherwise */
+static void
+bench_task_free (RstrntTask *task)
+{
+    gchar *path = g_build_filename (LOG_MANAGER_DIR, task->task_id, NULL);
+    const gchar *names[] = { "task.log", "harness.log" };
+
+    rstrnt_close_logs (task);
+    for (guint i = 0; i < G_N_ELEMENTS (names); i++) {
+        gchar *log_path = g_build_filename (path, names[i], NULL);
+
+        g_remove (log_path);
+        g_free (log_path);
+    }
+    g_rmdir (path);
+    g_free (path);
+    restraint_task_free (task);
+}
+
+static void
+bench_log_fill (RstrntTask *task, gsize chunk, guint count)
+{
+    gchar *buffer = g_malloc (chunk);
+
+    memset (buffer, 'x', chunk - 1);
+    buffer[chunk - 1] = '\n';
+    for (guint i = 0; i < count; i++) {
+        rstrnt_log_bytes (task, RSTRNT_LOG_TYPE_TASK, buffer, chunk);
+    }
+    rstrnt_flush_logs (task, NULL);
+    g_free (buffer);
+}
+
+/* Task output as written by the task handler, data is the write size */
+static void
+bench_log_bytes (BenchRun *run, gconstpointer data)
+{
+    gsize chunk = GPOINTER_TO_SIZE (data);
+    guint count = bench_scale (BENCH_LOG_SIZE / chunk);
+    RstrntTask *task = bench_task_new ();
+
+    // Opening the log isn't part of it
+    rstrnt_log (task, RSTRNT_LOG_TYPE_TASK, "start\n");
+    rstrnt_flush_logs (task, NULL);
+
+    bench_start (run);
+    bench_log_fill (task, chunk, count);
+    bench_stop (run);
+
+    run->ops = count;
+    run->bytes = (guint64) count * chunk;
+    bench_task_free (task);
+}
+
+/* All of a task log sent to the lab controller, in BKR_MAX_CONTENT_LENGTH chunks */
+static void
+bench_upload_logs (BenchRun *run, gconstpointer data)
+{
+    guint count = bench_scale (BENCH_LOG_SIZE / LOG_PUMP_SIZE);
+    RstrntTask *task = bench_task_new ();
+    RstrntServerAppData app_data;
+    guint64 uploaded;
+    guint requests;
+
+    bench_log_fill (task, LOG_PUMP_SIZE, count);
+
+    app_data.queue_message = restraint_queue_message;
+    app_data.config_file = LOG_MANAGER_DIR "/config.conf";
+    uploaded = rstrnt_metrics_count (METRIC_LOG_UPLOAD_LATENCY);
+    requests = sink->requests;
+
+    bench_start (run);
+    rstrnt_upload_logs (task, &app_data, soup_session, NULL);
+    while (rstrnt_metrics_count (METRIC_LOG_UPLOAD_LATENCY) == uploaded) {
+        g_main_context_iteration (NULL, TRUE);
+    }
+    bench_stop (run);
+
+    run->ops = sink->requests - requests;
+    run->bytes = (guint64) count * LOG_PUMP_SIZE;
+    bench_task_free (task);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    int retval;
+
+    bench_init (&argc, &argv, "logging");
+
+    soup_session = soup_session_new ();
+    sink = bench_http_sink_start ();
+
+    bench_add ("/logging/log_bytes/line", "MB/s", bench_log_bytes, GSIZE_TO_POINTER (80));
+    bench_add ("/logging/log_bytes/64k", "MB/s", bench_log_bytes,
+               GSIZE_TO_POINTER (LOG_PUMP_SIZE));
+    bench_add ("/logging/upload_logs", "MB/s", bench_upload_logs, NULL);
+
+    retval = bench_run ();
+
+    bench_http_sink_stop (sink);
+    g_object_unref (soup_session);
+    g_remove (LOG_MANAGER_DIR "/config.conf");
+    g_rmdir (LOG_MANAGER_DIR);
+
+    return retval;
+}
@@ -0,0 +1,84 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#include "bench.h"
+#include "message.h"
+
+static BenchHttpSink *sink;
+static SoupSession *session;
+
+static void
+bench_message_finish (SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+    guint *finished = user_data;
+
+    g_assert_cmpint (msg->status_code, ==, SOUP_STATUS_OK);
+    (*finished)++;
+}
+
+/* Results as rstrnt-report-result posts them, one in flight at a time */
+static void
+bench_queue_message (BenchRun *run, gconstpointer data)
+{
+    const gchar *body = "path=%2Fbench&result=PASS&score=0&message=benchmark";
+    guint count = bench_scale (GPOINTER_TO_UINT (data));
+    SoupURI *uri = soup_uri_new_with_base (sink->uri, "/recipes/1/tasks/1/results/");
+    guint finished = 0;
+
+    bench_start (run);
+    for (guint i = 0; i < count; i++) {
+        SoupMessage *msg = soup_message_new_from_uri ("POST", uri);
+
+        soup_message_set_request (msg, "application/x-www-form-urlencoded",
+                                  SOUP_MEMORY_STATIC, body, strlen (body));
+        restraint_queue_message (session, msg, NULL, bench_message_finish, NULL, &finished);
+    }
+    while (finished < count) {
+        g_main_context_iteration (NULL, TRUE);
+    }
+    bench_stop (run);
+
+    run->ops = count;
+    run->bytes = (guint64) count * strlen (body);
+    soup_uri_free (uri);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    int retval;
+
+    bench_init (&argc, &argv, "message");
+
+    session = soup_session_new ();
+    sink = bench_http_sink_start ();
+
+    bench_add ("/message/queue_message", "msgs/s", bench_queue_message,
+               GUINT_TO_POINTER (5000));
+
+    retval = bench_run ();
+
+    bench_http_sink_stop (sink);
+    g_object_unref (session);
+
+    return retval;
+}
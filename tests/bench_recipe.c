@@ -0,0 +1,166 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <glib.h>
+#include <libxml/parser.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "recipe.h"
+#include "task.h"
+
+#define BENCH_RECIPE_TASKS 10000
+
+SoupSession *soup_session;
+
+static GBytes *recipe_xml;
+
+static GBytes *
+bench_recipe_new (guint tasks)
+{
+    GString *xml = g_string_new ("<job owner=\"user@example.com\">"
+                                 "<recipeSet><recipe id=\"1\" job_id=\"2\" "
+                                 "recipe_set_id=\"3\" family=\"Fedora39\">"
+                                 "<params><param name=\"GLOBAL\" value=\"foo\"/>"
+                                 "</params><roles><role value=\"SERVERS\">"
+                                 "<system value=\"a\"/></role></roles>");
+
+    for (guint i = 1; i <= tasks; i++) {
+        g_string_append_printf (xml, "<task id=\"%u\" name=\"/distribution/%u\">"
+                                "<rpm name=\"task-%u\" path=\"/mnt/tests/%u\"/>"
+                                "<params><param name=\"N\" value=\"%u\"/></params>"
+                                "</task>", i, i, i, i, i);
+    }
+    g_string_append (xml, "</recipe></recipeSet></job>");
+
+    return g_string_free_to_bytes (xml);
+}
+
+static Recipe *
+bench_recipe_parse (void)
+{
+    GError *error = NULL;
+    Recipe *recipe;
+
+    recipe = restraint_recipe_parse (recipe_xml, soup_uri_new ("http://localhost/recipes/1/"),
+                                     &error, NULL);
+    g_assert_no_error (error);
+    return recipe;
+}
+
+/*
+ * What the recipe held before the loader streamed it: the whole
+ * document and every task built up front.
+ */
+static void
+bench_recipe_load_dom (void)
+{
+    gsize length;
+    const gchar *data = g_bytes_get_data (recipe_xml, &length);
+    xmlDocPtr doc = xmlReadMemory (data, length, NULL, NULL, 0);
+    Recipe *recipe = bench_recipe_parse ();
+    GList *tasks = NULL;
+    GError *error = NULL;
+
+    while ((tasks = restraint_recipe_next_task (recipe, tasks, &error)) != NULL) {
+    }
+    g_assert_no_error (error);
+    g_assert_cmpuint (g_list_length (recipe->tasks), ==, BENCH_RECIPE_TASKS);
+    restraint_recipe_free (recipe);
+    xmlFreeDoc (doc);
+}
+
+/* Only the first task built, as when the recipe starts running */
+static void
+bench_recipe_load_streaming (void)
+{
+    Recipe *recipe = bench_recipe_parse ();
+    GError *error = NULL;
+
+    g_assert_nonnull (restraint_recipe_next_task (recipe, NULL, &error));
+    g_assert_no_error (error);
+    restraint_recipe_free (recipe);
+}
+
+/*
+ * Peak RSS of a child doing the load, in KiB.  Both start from a copy
+ * of this process so only the difference between them counts.
+ */
+static void
+bench_recipe_load_rss (BenchRun *run, gconstpointer data)
+{
+    gboolean dom = GPOINTER_TO_INT (data);
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    pid = fork ();
+    g_assert_cmpint (pid, !=, -1);
+    if (pid == 0) {
+        if (dom) {
+            bench_recipe_load_dom ();
+        } else {
+            bench_recipe_load_streaming ();
+        }
+        _exit (0);
+    }
+    g_assert_cmpint (wait4 (pid, &status, 0, &usage), ==, pid);
+    g_assert_true (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+
+    run->ops = BENCH_RECIPE_TASKS;
+    run->value = usage.ru_maxrss;
+}
+
+static void
+bench_recipe_parse_speed (BenchRun *run, gconstpointer data)
+{
+    Recipe *recipe;
+
+    bench_start (run);
+    recipe = bench_recipe_parse ();
+    bench_stop (run);
+
+    run->ops = recipe->task_count;
+    run->bytes = g_bytes_get_size (recipe_xml);
+    restraint_recipe_free (recipe);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    int retval;
+
+    bench_init (&argc, &argv, "recipe");
+
+    recipe_xml = bench_recipe_new (BENCH_RECIPE_TASKS);
+
+    bench_add ("/recipe/parse", "tasks/s", bench_recipe_parse_speed, NULL);
+    bench_add ("/recipe/load_rss/dom", "KiB", bench_recipe_load_rss,
+               GINT_TO_POINTER (TRUE));
+    bench_add ("/recipe/load_rss/streaming", "KiB", bench_recipe_load_rss,
+               GINT_TO_POINTER (FALSE));
+
+    retval = bench_run ();
+
+    g_bytes_unref (recipe_xml);
+
+    return retval;
+}
@@ -18,40 +18,90 @@
 
 #include "expect_http.h"
 
-static void expect_http_handler(__attribute__((unused)) SoupServer *server,
+typedef struct {
+    SoupServer *server;
+    SoupMessage *msg;
+} ExpectHttpDelayed;
+
+static gint expect_http_request_matches(gconstpointer a, gconstpointer b) {
+    const ExpectHttpRequest *request = a;
+    const ExpectHttpRequest *key = b;
+
+    if (g_strcmp0(request->method, key->method) != 0)
+        return 1;
+    return g_strcmp0(request->path, key->path);
+}
+
+static gboolean expect_http_respond(gpointer data) {
+    ExpectHttpDelayed *delayed = (ExpectHttpDelayed *)data;
+
+    soup_server_unpause_message(delayed->server, delayed->msg);
+    g_slice_free(ExpectHttpDelayed, delayed);
+    return G_SOURCE_REMOVE;
+}
+
+static void expect_http_handler(SoupServer *server,
         SoupMessage *msg, const char *path,
         __attribute__((unused)) GHashTable *query,
         __attribute__((unused)) SoupClientContext *client,
         gpointer data) {
     ExpectHttpServer *expect_http = (ExpectHttpServer *)data;
+    GList *link;
 
     g_mutex_lock(&expect_http->mutex);
     if (g_queue_is_empty(expect_http->expected_requests))
         g_error("Unexpected HTTP request");
-    ExpectHttpRequest *request = (ExpectHttpRequest *)g_queue_pop_head(
-            expect_http->expected_requests);
+    link = expect_http->expected_requests->head;
+    if (expect_http->unordered) {
+        ExpectHttpRequest key = { msg->method, path, NULL, 0, 0 };
+        link = g_queue_find_custom(expect_http->expected_requests, &key,
+                expect_http_request_matches);
+        if (link == NULL)
+            g_error("Unexpected HTTP request %s %s", msg->method, path);
+    }
+    ExpectHttpRequest *request = (ExpectHttpRequest *)link->data;
+    g_queue_delete_link(expect_http->expected_requests, link);
     g_mutex_unlock(&expect_http->mutex);
 
     g_assert_cmpstr(msg->method, ==, request->method);
     g_assert_cmpstr(path, ==, request->path);
-    g_assert_cmpstr(msg->request_body->data, ==, request->body);
+    if (request->body != NULL)
+        g_assert_cmpstr(msg->request_body->data, ==, request->body);
     soup_message_set_status(msg, request->response_status);
 
+    if (request->response_delay > 0) {
+        ExpectHttpDelayed *delayed = g_slice_new(ExpectHttpDelayed);
+        delayed->server = server;
+        delayed->msg = msg;
+        soup_server_pause_message(server, msg);
+
+        GSource *source = g_timeout_source_new(request->response_delay / 1000);
+        g_source_set_callback(source, expect_http_respond, delayed, NULL);
+        g_source_attach(source, expect_http->context);
+        g_source_unref(source);
+    }
+
     g_slice_free(ExpectHttpRequest, request);
 }
 
 ExpectHttpServer *expect_http_start(void) {
+    return expect_http_start_full(8000, FALSE);
+}
+
+/* Port 0 picks a free port, which is left in expect_http->port */
+ExpectHttpServer *expect_http_start_full(guint port, gboolean unordered) {
     ExpectHttpServer *expect_http = g_slice_new0(ExpectHttpServer);
     g_assert(expect_http != NULL);
 
     g_mutex_init(&expect_http->mutex);
+    expect_http->unordered = unordered;
+    expect_http->context = g_main_context_new();
 
-    GMainContext *async_context = g_main_context_new();
-
-    expect_http->server = soup_server_new(SOUP_SERVER_PORT, 8000,
-                                          SOUP_SERVER_ASYNC_CONTEXT, async_context,
+    expect_http->server = soup_server_new(SOUP_SERVER_PORT, port,
+                                          SOUP_SERVER_ASYNC_CONTEXT, expect_http->context,
                                           NULL);
     g_assert(expect_http->server != NULL);
+    expect_http->port = soup_server_get_port(expect_http->server);
     soup_server_add_handler(expect_http->server, NULL,
             expect_http_handler, expect_http, NULL);
 
@@ -83,6 +133,7 @@ void expect_http_finish(ExpectHttpServer *expect_http) {
         g_error("Not all expected HTTP requests were received");
     g_mutex_clear(&expect_http->mutex);
     g_object_unref(expect_http->server);
+    g_main_context_unref(expect_http->context);
     g_queue_free(expect_http->expected_requests);
     g_slice_free(ExpectHttpServer, expect_http);
 }
@@ -22,6 +22,10 @@
 /*
  * For tests: runs a dummy HTTP server in a separate thread. The server expects 
  * to receive the given series of requests. Anything else is a failure.
+ *
+ * An unordered server takes each request as the first expected one with the
+ * same method and path, as replay_trace needs when retries and new messages
+ * interleave differently than they did when the trace was recorded.
  */
 
 #include <glib.h>
@@ -30,19 +34,24 @@
 typedef struct {
     GThread *thread;
     GMutex mutex;
+    GMainContext *context;
     SoupServer *server;
+    guint port;
+    gboolean unordered;
     GQueue *expected_requests;
 } ExpectHttpServer;
 
-// Use only static strings in this struct!
+// The strings in this struct must outlive the server, they aren't copied!
 typedef struct {
     const gchar *method;
     const gchar *path;
-    const gchar *body;
+    const gchar *body;          // NULL to accept any body
     guint response_status;
+    gint64 response_delay;      // microseconds before responding
 } ExpectHttpRequest;
 
 ExpectHttpServer *expect_http_start(void);
+ExpectHttpServer *expect_http_start_full(guint port, gboolean unordered);
 void expect_http_add_request(ExpectHttpServer *expect_http,
         const ExpectHttpRequest *request);
 void expect_http_finish(ExpectHttpServer *expect_http);
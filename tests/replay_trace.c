@@ -0,0 +1,276 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Replays what restraintd sent to the lab controller in a --trace file.
+ * Each message goes through restraint_queue_message() at the time it was
+ * first sent, and an expect_http server standing in for the lab
+ * controller answers every attempt with the status it got, after the
+ * latency it took.  Both are scaled by --speed.
+ */
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expect_http.h"
+#include "message.h"
+#include "metrics.h"
+#include "trace.h"
+
+typedef struct {
+    SoupSession *session;
+    SoupURI *base;
+    GMainLoop *loop;
+    GPtrArray *sends;       /* first attempts, by the time they were sent */
+    guint next;
+    guint finished;
+    gint64 first;           /* trace time of the first send */
+    gint64 started;         /* monotonic time the replay started */
+} Replay;
+
+static gdouble speed = 1.0;
+static gboolean dump = FALSE;
+
+static GOptionEntry entries[] = {
+    { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed,
+      "Replay this many times faster than recorded, 0 for no delays (default 1)", "N" },
+    { "dump", 'd', 0, G_OPTION_ARG_NONE, &dump,
+      "Print the records instead of replaying them", NULL },
+    { NULL }
+};
+
+static gint64
+replay_scale (gint64 usec)
+{
+    return speed > 0 ? (gint64) (usec / speed) : 0;
+}
+
+static gboolean
+replay_outbound (RstrntTraceEntry *entry)
+{
+    return entry->record.direction == TRACE_OUTBOUND ||
+           entry->record.direction == TRACE_STDOUT;
+}
+
+static gint
+replay_compare_sent (gconstpointer a, gconstpointer b)
+{
+    const RstrntTraceEntry *entry_a = *(RstrntTraceEntry **) a;
+    const RstrntTraceEntry *entry_b = *(RstrntTraceEntry **) b;
+
+    if (entry_a->record.timestamp == entry_b->record.timestamp) {
+        return 0;
+    }
+    return entry_a->record.timestamp < entry_b->record.timestamp ? -1 : 1;
+}
+
+static void
+replay_dump (GPtrArray *trace, gint64 start)
+{
+    GDateTime *date = g_date_time_new_from_unix_utc (start / G_USEC_PER_SEC);
+    gchar *started = g_date_time_format (date, "%F %T UTC");
+
+    g_print ("Trace started %s, %u records\n", started, trace->len);
+    for (guint i = 0; i < trace->len; i++) {
+        RstrntTraceEntry *entry = g_ptr_array_index (trace, i);
+
+        if (i > 0 && entry->segment != ((RstrntTraceEntry *) g_ptr_array_index (trace, i - 1))->segment) {
+            g_print ("-- restraintd restarted\n");
+        }
+        g_print ("%12.6f %-6s %-5s %3u %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+                 " %10.3fms #%u %s\n",
+                 entry->record.timestamp / (gdouble) G_USEC_PER_SEC,
+                 rstrnt_trace_direction_name (entry->record.direction),
+                 rstrnt_trace_method_name (entry->record.method),
+                 entry->record.status,
+                 entry->record.request_bytes,
+                 entry->record.response_bytes,
+                 entry->record.latency / 1000.0,
+                 entry->record.attempt,
+                 entry->path);
+    }
+    g_free (started);
+    g_date_time_unref (date);
+}
+
+static void
+replay_finish (SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+    Replay *replay = user_data;
+
+    replay->finished++;
+    if (replay->finished == replay->sends->len) {
+        g_main_loop_quit (replay->loop);
+    }
+}
+
+static void
+replay_send (Replay *replay, RstrntTraceEntry *entry)
+{
+    const gchar *method = rstrnt_trace_method_name (entry->record.method);
+    SoupURI *uri = soup_uri_new_with_base (replay->base, entry->path);
+    SoupMessage *msg = soup_message_new_from_uri (method, uri);
+
+    // Only the size of the body was recorded
+    if (entry->record.request_bytes > 0) {
+        gchar *body = g_malloc (entry->record.request_bytes);
+
+        memset (body, 'x', entry->record.request_bytes);
+        soup_message_set_request (msg, g_strrstr (entry->path, "/logs/") ?
+                                  "text/plain" : "application/x-www-form-urlencoded",
+                                  SOUP_MEMORY_TAKE, body, entry->record.request_bytes);
+    }
+    restraint_queue_message (replay->session, msg, NULL, replay_finish, NULL, replay);
+    soup_uri_free (uri);
+}
+
+static gboolean
+replay_next (gpointer user_data)
+{
+    Replay *replay = user_data;
+    gint64 now = g_get_monotonic_time () - replay->started;
+
+    while (replay->next < replay->sends->len) {
+        RstrntTraceEntry *entry = g_ptr_array_index (replay->sends, replay->next);
+        gint64 due = replay_scale (entry->record.timestamp - replay->first);
+
+        if (due > now) {
+            g_timeout_add ((due - now + 999) / 1000, replay_next, replay);
+            break;
+        }
+        replay_send (replay, entry);
+        replay->next++;
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Everything the lab controller saw, retries included, in the order it did */
+static void
+replay_expect (ExpectHttpServer *expect_http, GPtrArray *trace)
+{
+    for (guint i = 0; i < trace->len; i++) {
+        RstrntTraceEntry *entry = g_ptr_array_index (trace, i);
+        ExpectHttpRequest request = {
+            .method = rstrnt_trace_method_name (entry->record.method),
+            .path = entry->path,
+            .response_status = entry->record.status,
+            .response_delay = replay_scale (entry->record.latency),
+        };
+
+        if (!replay_outbound (entry)) {
+            continue;
+        }
+        // Connection failures can't be replayed, a 503 is retried the same
+        if (request.response_status < 100) {
+            request.response_status = SOUP_STATUS_SERVICE_UNAVAILABLE;
+        }
+        expect_http_add_request (expect_http, &request);
+    }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    ExpectHttpServer *expect_http;
+    GOptionContext *context;
+    GError *error = NULL;
+    GPtrArray *trace;
+    Replay replay = { 0 };
+    gchar *base;
+    gchar *summary;
+    gint64 start;
+    gint64 recorded = 0;
+    guint inbound = 0;
+
+    context = g_option_context_new ("TRACE");
+    g_option_context_set_summary (context,
+            "Replays the requests restraintd --trace recorded against a stub lab controller.");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || argc != 2) {
+        g_printerr ("%s\n", error ? error->message : "A single trace file is needed");
+        exit (EXIT_FAILURE);
+    }
+    g_option_context_free (context);
+
+    trace = rstrnt_trace_read (argv[1], &start, &error);
+    if (trace == NULL) {
+        g_printerr ("%s\n", error->message);
+        exit (EXIT_FAILURE);
+    }
+    if (dump) {
+        replay_dump (trace, start);
+        g_ptr_array_unref (trace);
+        return 0;
+    }
+
+    replay.sends = g_ptr_array_new ();
+    for (guint i = 0; i < trace->len; i++) {
+        RstrntTraceEntry *entry = g_ptr_array_index (trace, i);
+
+        if (!replay_outbound (entry)) {
+            inbound++;
+        } else if (entry->record.attempt <= 1) {
+            g_ptr_array_add (replay.sends, entry);
+        }
+    }
+    if (replay.sends->len == 0) {
+        g_printerr ("%s has no requests to the lab controller\n", argv[1]);
+        exit (EXIT_FAILURE);
+    }
+    g_ptr_array_sort (replay.sends, replay_compare_sent);
+    replay.first = ((RstrntTraceEntry *) g_ptr_array_index (replay.sends, 0))->record.timestamp;
+    for (guint i = 0; i < trace->len; i++) {
+        RstrntTraceEntry *entry = g_ptr_array_index (trace, i);
+
+        if (replay_outbound (entry)) {
+            recorded = MAX (recorded, entry->record.timestamp + entry->record.latency);
+        }
+    }
+
+    expect_http = expect_http_start_full (0, TRUE);
+    replay_expect (expect_http, trace);
+    base = g_strdup_printf ("http://localhost:%u/", expect_http->port);
+    replay.base = soup_uri_new (base);
+    replay.session = soup_session_new ();
+    replay.loop = g_main_loop_new (NULL, FALSE);
+
+    replay.started = g_get_monotonic_time ();
+    g_idle_add (replay_next, &replay);
+    g_main_loop_run (replay.loop);
+
+    g_print ("Replayed %u messages in %.3f s, recorded in %.3f s, %u inbound requests skipped\n",
+             replay.sends->len,
+             (g_get_monotonic_time () - replay.started) / (gdouble) G_USEC_PER_SEC,
+             (recorded - replay.first) / (gdouble) G_USEC_PER_SEC,
+             inbound);
+    summary = rstrnt_metrics_summary ();
+    g_print ("%s", summary);
+    g_free (summary);
+
+    expect_http_finish (expect_http);
+    g_main_loop_unref (replay.loop);
+    g_object_unref (replay.session);
+    soup_uri_free (replay.base);
+    g_free (base);
+    g_ptr_array_unref (replay.sends);
+    g_ptr_array_unref (trace);
+
+    return 0;
+}
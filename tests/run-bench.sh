@@ -0,0 +1,30 @@
+#!/bin/bash
+
+set -e
+
+# Usage: run-bench.sh OUTPUT BENCH_PROGRAM...
+#
+# Runs each benchmark with $BENCH_ARGS (for example --quick) and
+# collects their JSON reports into a single array in OUTPUT.
+
+output=$1
+shift
+
+results=()
+for bench in "$@" ; do
+    ./"${bench}" ${BENCH_ARGS} --output "bench-obj/${bench}.json"
+    results+=("bench-obj/${bench}.json")
+done
+
+{
+    echo "["
+    separator=""
+    for result in "${results[@]}" ; do
+        echo -n "${separator}"
+        cat "${result}"
+        separator=","
+    done
+    echo "]"
+} > "${output}"
+
+echo "Results written to ${output}"
@@ -25,6 +25,75 @@ __wrap_soup_session_send_message (SoupSession *session,
     return mocked_soup_status;
 }
 
+void __real_soup_session_queue_message (SoupSession *session, SoupMessage *msg,
+                                        SoupSessionCallback callback,
+                                        gpointer user_data);
+
+void
+__wrap_soup_session_queue_message (SoupSession *session,
+                                   SoupMessage *msg,
+                                   SoupSessionCallback callback,
+                                   gpointer user_data)
+{
+    if (mocked_soup_status < 0) {
+        __real_soup_session_queue_message (session, msg, callback, user_data);
+        return;
+    }
+
+    __wrap_soup_session_send_message (session, msg);
+    callback (session, msg, user_data);
+    g_object_unref (msg);
+}
+
+static void
+health_cb (bkr_health_status_t status, gpointer user_data)
+{
+    *(bkr_health_status_t *) user_data = status;
+}
+
+static void
+test_rstrnt_bkr_check_recipe_async (gconstpointer test_data)
+{
+    bkr_health_status_t status = BKR_HEALTH_STATUS_UNKNOWN;
+    const bkr_health_stats_t *stats = rstrnt_bkr_health_stats ();
+    guint64 checks = stats->checks;
+    guint64 good = stats->good;
+    guint64 bad = stats->bad;
+    SoupSession *session = soup_session_new ();
+
+    mocked_soup_status = SOUP_STATUS_OK;
+    rstrnt_bkr_check_recipe_async (session, (char *) test_data, health_cb, &status);
+    g_assert_cmpint (BKR_HEALTH_STATUS_GOOD, ==, status);
+
+    mocked_soup_status = SOUP_STATUS_SERVICE_UNAVAILABLE;
+    rstrnt_bkr_check_recipe_async (session, (char *) test_data, health_cb, &status);
+    g_assert_cmpint (BKR_HEALTH_STATUS_BAD, ==, status);
+
+    mocked_soup_status = -1;
+
+    g_assert_cmpuint (stats->checks, ==, checks + 2);
+    g_assert_cmpuint (stats->good, ==, good + 1);
+    g_assert_cmpuint (stats->bad, ==, bad + 1);
+    g_assert_cmpint (stats->max_us, >=, stats->last_us);
+
+    g_object_unref (session);
+}
+
+static void
+test_rstrnt_bkr_backoff (void)
+{
+    guint interval = 0;
+
+    interval = rstrnt_bkr_backoff (interval);
+    g_assert_cmpuint (interval, ==, BKR_WAIT_MIN);
+    interval = rstrnt_bkr_backoff (interval);
+    g_assert_cmpuint (interval, ==, BKR_WAIT_MIN * 2);
+
+    for (int i = 0; i < 10; i++)
+        interval = rstrnt_bkr_backoff (interval);
+    g_assert_cmpuint (interval, ==, BKR_WAIT_MAX);
+}
+
 static void
 test_rstrnt_bkr_check_recipe_no_lc (gconstpointer test_data)
 {
@@ -84,6 +153,8 @@ main (int   argc,
     g_test_add_data_func ("/beaker/harness/health/bad", recipe_url, test_rstrnt_bkr_check_recipe_bad);
     g_test_add_data_func ("/beaker/harness/health/good", recipe_url, test_rstrnt_bkr_check_recipe_good);
     g_test_add_data_func ("/beaker/harness/health/no_lc", recipe_url, test_rstrnt_bkr_check_recipe_no_lc);
+    g_test_add_data_func ("/beaker/harness/health/async", recipe_url, test_rstrnt_bkr_check_recipe_async);
+    g_test_add_func ("/beaker/harness/health/backoff", test_rstrnt_bkr_backoff);
 
     return g_test_run ();
 }
@@ -0,0 +1,176 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "cgroup.h"
+
+/*
+ * The interface files are plain text, a directory holding copies of them
+ * stands in for a cgroup.
+ */
+static RstrntCgroup *
+fake_cgroup_new (const gchar *first_file, ...)
+{
+    RstrntCgroup *cgroup;
+    GError *error = NULL;
+    const gchar *file;
+    gchar *dir;
+    va_list args;
+
+    dir = g_dir_make_tmp ("test_cgroup_XXXXXX", &error);
+    g_assert_no_error (error);
+
+    va_start (args, first_file);
+    for (file = first_file; file; file = va_arg (args, const gchar *)) {
+        const gchar *contents = va_arg (args, const gchar *);
+        gchar *path = g_build_filename (dir, file, NULL);
+
+        g_assert_true (g_file_set_contents (path, contents, -1, NULL));
+        g_free (path);
+    }
+    va_end (args);
+
+    cgroup = rstrnt_cgroup_open (dir, &error);
+    g_assert_no_error (error);
+    g_free (dir);
+
+    return cgroup;
+}
+
+static void
+fake_cgroup_free (RstrntCgroup *cgroup)
+{
+    GDir *dir = g_dir_open (cgroup->path, 0, NULL);
+    const gchar *name;
+
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        gchar *path = g_build_filename (cgroup->path, name, NULL);
+        g_remove (path);
+        g_free (path);
+    }
+    g_dir_close (dir);
+    g_rmdir (cgroup->path);
+    rstrnt_cgroup_unref (cgroup);
+}
+
+static void
+test_cgroup_stats (void)
+{
+    RstrntCgroupStats stats;
+    RstrntCgroup *cgroup;
+    gchar *usage;
+
+    cgroup = fake_cgroup_new (
+        "cpu.stat", "usage_usec 1500000\nuser_usec 1000000\nsystem_usec 500000\n",
+        "memory.peak", "104857600\n",
+        "io.stat", "8:0 rbytes=4096 wbytes=8192 rios=1 wios=2 dbytes=0 dios=0\n"
+                   "253:0 rbytes=1024 wbytes=0 rios=1 wios=0 dbytes=0 dios=0\n",
+        "cpu.pressure", "some avg10=0.00 avg60=0.00 avg300=0.00 total=250\n"
+                        "full avg10=0.00 avg60=0.00 avg300=0.00 total=100\n",
+        "memory.pressure", "some avg10=1.50 avg60=0.20 avg300=0.00 total=42\n"
+                           "full avg10=0.00 avg60=0.00 avg300=0.00 total=7\n",
+        NULL);
+
+    rstrnt_cgroup_read_stats (cgroup, &stats);
+    g_assert_cmpuint (stats.cpu_usec, ==, 1500000);
+    g_assert_cmpuint (stats.memory_peak, ==, 104857600);
+    g_assert_cmpuint (stats.io_rbytes, ==, 5120);
+    g_assert_cmpuint (stats.io_wbytes, ==, 8192);
+    g_assert_cmpuint (stats.cpu_pressure_usec, ==, 250);
+    g_assert_cmpuint (stats.memory_pressure_usec, ==, 42);
+    // No io.pressure, the kernel was built without PSI for instance
+    g_assert_cmpuint (stats.io_pressure_usec, ==, 0);
+
+    usage = rstrnt_cgroup_stats_to_string (&stats);
+    g_assert_cmpstr (usage, ==, "cpu_usec=1500000 memory_peak=104857600"
+                                " io_rbytes=5120 io_wbytes=8192"
+                                " cpu_pressure_usec=250 memory_pressure_usec=42"
+                                " io_pressure_usec=0");
+    g_free (usage);
+
+    fake_cgroup_free (cgroup);
+}
+
+static void
+test_cgroup_set (void)
+{
+    RstrntCgroup *cgroup;
+    GError *error = NULL;
+    gchar *contents;
+    gchar *path;
+
+    cgroup = fake_cgroup_new ("memory.max", "max\n", NULL);
+
+    g_assert_true (rstrnt_cgroup_set (cgroup, "memory.max", "512M", &error));
+    g_assert_no_error (error);
+    path = g_build_filename (cgroup->path, "memory.max", NULL);
+    g_assert_true (g_file_get_contents (path, &contents, NULL, NULL));
+    g_assert_cmpstr (contents, ==, "512M");
+    g_free (contents);
+    g_free (path);
+
+    // The cpu controller isn't enabled
+    g_assert_false (rstrnt_cgroup_set (cgroup, "cpu.max", "50000 100000", &error));
+    g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+    g_clear_error (&error);
+
+    fake_cgroup_free (cgroup);
+}
+
+static void
+test_cgroup_populated (void)
+{
+    RstrntCgroup *cgroup;
+
+    cgroup = fake_cgroup_new ("cgroup.events", "populated 1\nfrozen 0\n", NULL);
+    g_assert_true (rstrnt_cgroup_populated (cgroup));
+    fake_cgroup_free (cgroup);
+
+    cgroup = fake_cgroup_new ("cgroup.events", "populated 0\nfrozen 0\n", NULL);
+    g_assert_false (rstrnt_cgroup_populated (cgroup));
+    fake_cgroup_free (cgroup);
+}
+
+static void
+test_cgroup_disabled (void)
+{
+    RstrntCgroup *cgroup;
+    GError *error = NULL;
+
+    // rstrnt_cgroup_init() was not called
+    g_assert_false (rstrnt_cgroup_enabled ());
+    cgroup = rstrnt_cgroup_new ("task-1-1", &error);
+    g_assert_null (cgroup);
+    g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOSYS);
+    g_clear_error (&error);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/cgroup/stats", test_cgroup_stats);
+    g_test_add_func ("/cgroup/set", test_cgroup_set);
+    g_test_add_func ("/cgroup/populated", test_cgroup_populated);
+    g_test_add_func ("/cgroup/disabled", test_cgroup_disabled);
+
+    return g_test_run ();
+}
@@ -533,6 +533,133 @@ test_rstrnt_result_env_file_not_exist()
     remove_env_file(port);
 }
 
+/* --batch takes the results from a file instead of positional arguments */
+static void
+test_rstrnt_batch()
+{
+    AppData *app_data = restraint_create_appdata();
+
+    char *argv[] = {
+        CMD_RSTRNT,
+        "--server",
+        "https://localhost/",
+        "--batch",
+        "-",
+    };
+    int argc = sizeof(argv) / sizeof(char*);
+
+    gboolean rc = parse_arguments(app_data, argc, argv);
+    g_assert_true(rc);
+
+    g_assert_cmpstr(app_data->batch, ==, "-");
+    g_assert_null(app_data->test_name);
+    g_assert_null(app_data->test_result);
+
+    restraint_free_appdata(app_data);
+}
+
+static void
+test_rstrnt_batch_positional()
+{
+    AppData *app_data = restraint_create_appdata();
+
+    char *argv[] = {
+        CMD_RSTRNT,
+        "--server",
+        "https://localhost/",
+        "--batch",
+        "results.jsonl",
+        "foo",
+        "PASS",
+    };
+    int argc = sizeof(argv) / sizeof(char*);
+
+    gboolean rc = parse_arguments(app_data, argc, argv);
+    g_assert_false(rc);
+
+    restraint_free_appdata(app_data);
+}
+
+static json_object *
+batch_read_string(const gchar *data, GError **error)
+{
+    GInputStream *stream;
+    json_object *results;
+
+    stream = g_memory_input_stream_new_from_data(data, -1, NULL);
+    results = rstrnt_result_batch_read(stream, error);
+    g_object_unref(stream);
+
+    return results;
+}
+
+static const gchar *
+batch_field(json_object *results, guint index, const gchar *key)
+{
+    json_object *val;
+
+    if (!json_object_object_get_ex(json_object_array_get_idx(results, index),
+                                   key, &val)) {
+        return NULL;
+    }
+    return json_object_get_string(val);
+}
+
+static void
+test_result_batch_read()
+{
+    GError *error = NULL;
+    json_object *results;
+
+    results = batch_read_string(
+        "{\"path\": \"setup\", \"result\": \"PASS\"}\n"
+        "\n"
+        "{\"path\": \"run/1\", \"result\": \"FAIL\", \"score\": 23,"
+        " \"message\": \"oops\", \"outputfile\": \"run.log\"}\n"
+        "{\"path\": \"run/2\", \"result\": \"WARN\", \"score\": null}",
+        &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(results);
+
+    g_assert_cmpuint(json_object_array_length(results), ==, 3);
+    g_assert_cmpstr(batch_field(results, 0, "path"), ==, "setup");
+    g_assert_cmpstr(batch_field(results, 0, "result"), ==, "PASS");
+    g_assert_null(batch_field(results, 0, "score"));
+    g_assert_cmpstr(batch_field(results, 1, "path"), ==, "run/1");
+    g_assert_cmpstr(batch_field(results, 1, "score"), ==, "23");
+    g_assert_cmpstr(batch_field(results, 1, "message"), ==, "oops");
+    g_assert_cmpstr(batch_field(results, 1, "outputfile"), ==, "run.log");
+    g_assert_null(batch_field(results, 2, "score"));
+
+    json_object_put(results);
+}
+
+static void
+test_result_batch_read_invalid()
+{
+    GError *error = NULL;
+    json_object *results;
+
+    results = batch_read_string(
+        "{\"path\": \"setup\", \"result\": \"PASS\"}\n"
+        "{\"path\": \"run\"}\n", &error);
+    g_assert_error(error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX);
+    g_assert_null(results);
+    g_assert_nonnull(strstr(error->message, "Line 2"));
+    g_clear_error(&error);
+
+    results = batch_read_string("setup PASS\n", &error);
+    g_assert_error(error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX);
+    g_assert_null(results);
+    g_clear_error(&error);
+
+    results = batch_read_string(
+        "{\"path\": \"setup\", \"result\": [\"PASS\"]}\n", &error);
+    g_assert_error(error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX);
+    g_assert_null(results);
+    g_clear_error(&error);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -552,6 +679,10 @@ int main(int argc, char *argv[])
     g_test_add_func("/cmd_upload/prefixed_environment_vars", test_prefix_variables);
     g_test_add_func("/cmd_upload/rhts_test_rstrnt_result_env_file_not_exist",
                     test_rstrnt_result_env_file_not_exist);
+    g_test_add_func("/cmd_upload/rstrnt_batch", test_rstrnt_batch);
+    g_test_add_func("/cmd_upload/rstrnt_batch_positional", test_rstrnt_batch_positional);
+    g_test_add_func("/cmd_upload/result_batch_read", test_result_batch_read);
+    g_test_add_func("/cmd_upload/result_batch_read_invalid", test_result_batch_read_invalid);
 
 
     return g_test_run();
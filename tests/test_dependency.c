@@ -90,7 +90,9 @@ static void test_soft_dependencies_success (void)
     softdependencies = g_slist_prepend (dependencies, "PackageA");
     softdependencies = g_slist_prepend (softdependencies, "Packagefail");
     softdependencies = g_slist_prepend (softdependencies, "PackageC");
-    gchar *expected = "use_pty:FALSE rstrnt-package install PackageC\n"
+    gchar *expected = "use_pty:FALSE rstrnt-package install PackageC Packagefail PackageA\n"
+                      "dummy yum: fail\n"
+                      "use_pty:FALSE rstrnt-package install PackageC\n"
                       "dummy yum: installing PackageC\n"
                       "use_pty:FALSE rstrnt-package install Packagefail\n"
                       "dummy yum: fail\n"
@@ -191,6 +193,134 @@ static void test_dependencies_success (void)
     g_slice_free(Task, task);
 }
 
+static void test_dependencies_already_installed (void)
+{
+    RunData *run_data;
+    GSList *dependencies = NULL;
+    GSList *softdependencies = NULL;
+    dependencies = g_slist_prepend (dependencies, "PackageA");
+    dependencies = g_slist_prepend (dependencies, "PackageB");
+    dependencies = g_slist_prepend (dependencies, "PackageC");
+    softdependencies = g_slist_prepend (softdependencies, "PackageD");
+    softdependencies = g_slist_prepend (softdependencies, "PackageA");
+    gchar *expected = "use_pty:FALSE rstrnt-package install PackageC PackageA\n"
+                      "dummy yum: installing PackageC PackageA\n"
+                      "use_pty:FALSE rstrnt-package install PackageD\n"
+                      "dummy yum: installing PackageD\n";
+
+    run_data = g_slice_new0 (RunData);
+    run_data->loop = g_main_loop_new (NULL, TRUE);
+    run_data->output = g_string_new (NULL);
+
+    Task *task = g_slice_new0(Task);
+    task->fetch_method = TASK_FETCH_UNPACK;
+    task->metadata = g_slice_new(MetaData);
+    task->metadata->dependencies = dependencies;
+    task->metadata->softdependencies = softdependencies;
+    task->metadata->repodeps = NULL;
+    task->fetch.url = soup_uri_new("git://localhost/repo1?master#restraint/sanity/fetch_git");
+    task->rhts_compat = FALSE;
+    task->name = "restraint/sanity/fetch_git";
+    task->recipe = g_slice_new0(Recipe);
+    task->recipe->base_path = g_dir_make_tmp("test_repodep_git_XXXXXX", NULL);
+    task->recipe->installed_deps = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                         g_free, NULL);
+    // Installed by an earlier task of the recipe
+    g_hash_table_add(task->recipe->installed_deps, g_strdup("PackageB"));
+
+    restraint_install_dependencies (task,
+                                    dependency_io_cb,
+                                    NULL,
+                                    dependency_finish_cb,
+                                    NULL,
+                                    run_data);
+
+    // run event loop while process is running.
+    g_main_loop_run (run_data->loop);
+
+    // process finished, check our results.
+    g_assert_no_error (run_data->error);
+    g_clear_error (&run_data->error);
+    g_assert_cmpstr(run_data->output->str, == , expected);
+    g_assert_true(g_hash_table_contains(task->recipe->installed_deps, "PackageA"));
+    g_assert_true(g_hash_table_contains(task->recipe->installed_deps, "PackageC"));
+    g_assert_true(g_hash_table_contains(task->recipe->installed_deps, "PackageD"));
+    g_string_free (run_data->output, TRUE);
+    g_slice_free (RunData, run_data);
+    g_slist_free (dependencies);
+    g_slist_free (softdependencies);
+
+    soup_uri_free(task->fetch.url);
+    g_hash_table_destroy(task->recipe->installed_deps);
+    g_remove (task->recipe->base_path);
+    g_free (task->recipe->base_path);
+    g_slice_free(Recipe, task->recipe);
+    g_slice_free(MetaData, task->metadata);
+    g_slice_free(Task, task);
+}
+
+static void test_dependencies_removed_spelling (void)
+{
+    RunData *run_data;
+    GSList *dependencies = NULL;
+    GSList *softdependencies = NULL;
+    dependencies = g_slist_prepend (dependencies, "PackageA");
+    dependencies = g_slist_prepend (dependencies, "-PackageB");
+    gchar *expected = "use_pty:FALSE rstrnt-package remove PackageB\n"
+                      "dummy yum: removing PackageB\n"
+                      "use_pty:FALSE rstrnt-package install PackageA\n"
+                      "dummy yum: installing PackageA\n";
+
+    run_data = g_slice_new0 (RunData);
+    run_data->loop = g_main_loop_new (NULL, TRUE);
+    run_data->output = g_string_new (NULL);
+
+    Task *task = g_slice_new0(Task);
+    task->fetch_method = TASK_FETCH_UNPACK;
+    task->metadata = g_slice_new(MetaData);
+    task->metadata->dependencies = dependencies;
+    task->metadata->softdependencies = softdependencies;
+    task->metadata->repodeps = NULL;
+    task->fetch.url = soup_uri_new("git://localhost/repo1?master#restraint/sanity/fetch_git");
+    task->rhts_compat = FALSE;
+    task->name = "restraint/sanity/fetch_git";
+    task->recipe = g_slice_new0(Recipe);
+    task->recipe->base_path = g_dir_make_tmp("test_repodep_git_XXXXXX", NULL);
+    task->recipe->installed_deps = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                         g_free, NULL);
+    // Installed by an earlier task under another spelling
+    g_hash_table_add(task->recipe->installed_deps, g_strdup("PackageB-1.0"));
+
+    restraint_install_dependencies (task,
+                                    dependency_io_cb,
+                                    NULL,
+                                    dependency_finish_cb,
+                                    NULL,
+                                    run_data);
+
+    // run event loop while process is running.
+    g_main_loop_run (run_data->loop);
+
+    // process finished, check our results.
+    g_assert_no_error (run_data->error);
+    g_clear_error (&run_data->error);
+    g_assert_cmpstr(run_data->output->str, == , expected);
+    g_assert_false(g_hash_table_contains(task->recipe->installed_deps, "PackageB-1.0"));
+    g_assert_true(g_hash_table_contains(task->recipe->installed_deps, "PackageA"));
+    g_string_free (run_data->output, TRUE);
+    g_slice_free (RunData, run_data);
+    g_slist_free (dependencies);
+    g_slist_free (softdependencies);
+
+    soup_uri_free(task->fetch.url);
+    g_hash_table_destroy(task->recipe->installed_deps);
+    g_remove (task->recipe->base_path);
+    g_free (task->recipe->base_path);
+    g_slice_free(Recipe, task->recipe);
+    g_slice_free(MetaData, task->metadata);
+    g_slice_free(Task, task);
+}
+
 static void test_dependencies_fail (void)
 {
     RunData *run_data;
@@ -850,6 +980,8 @@ int main(int argc, char *argv[]) {
     g_test_add_func("/dependencies/success", test_dependencies_success);
     g_test_add_func("/dependencies/failure", test_dependencies_fail);
     g_test_add_func("/dependencies/ignore_failure", test_dependencies_ignore_fail);
+    g_test_add_func("/dependencies/already_installed", test_dependencies_already_installed);
+    g_test_add_func("/dependencies/removed_spelling", test_dependencies_removed_spelling);
     g_test_add_func("/softdependencies/success", test_soft_dependencies_success);
     g_test_add_func("/repodeps/git/success", test_git_repodeps_success);
     g_test_add_func("/repodeps/git/fail", test_git_repodeps_fail);
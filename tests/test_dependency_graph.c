@@ -0,0 +1,109 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+
+#include "dependency_graph.h"
+
+static gint
+order_index (GPtrArray *order, RstrntDepNode *node)
+{
+    for (guint i = 0; i < order->len; i++) {
+        if (g_ptr_array_index (order, i) == node) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void test_graph_diamond (void)
+{
+    gboolean created = FALSE;
+    GSList *cycles = NULL;
+
+    RstrntDepGraph *graph = rstrnt_dep_graph_new ("task", "/t/task", NULL);
+    RstrntDepNode *a = rstrnt_dep_graph_add (graph, graph->root, "a", "/t/a", &created);
+    g_assert_true (created);
+    RstrntDepNode *b = rstrnt_dep_graph_add (graph, graph->root, "b", "/t/b", &created);
+    g_assert_true (created);
+    RstrntDepNode *common = rstrnt_dep_graph_add (graph, a, "common", "/t/common", &created);
+    g_assert_true (created);
+
+    // Seen before, must not be fetched again
+    RstrntDepNode *again = rstrnt_dep_graph_add (graph, b, "common", "/t/common", &created);
+    g_assert_false (created);
+    g_assert_true (again == common);
+    rstrnt_dep_graph_add (graph, b, "common", "/t/common", &created);
+    g_assert_cmpuint (b->requires->len, ==, 1);
+
+    rstrnt_dep_node_set_metadata (common, g_slice_new0 (MetaData));
+
+    GPtrArray *order = rstrnt_dep_graph_sort (graph, &cycles);
+    g_assert_null (cycles);
+    g_assert_cmpuint (order->len, ==, 4);
+    g_assert_cmpint (order_index (order, common), <, order_index (order, a));
+    g_assert_cmpint (order_index (order, common), <, order_index (order, b));
+    g_assert_cmpint (order_index (order, graph->root), ==, 3);
+
+    g_ptr_array_free (order, TRUE);
+    rstrnt_dep_graph_free (graph);
+}
+
+static void test_graph_cycle (void)
+{
+    GSList *cycles = NULL;
+
+    RstrntDepGraph *graph = rstrnt_dep_graph_new ("task", "/t/task", NULL);
+    RstrntDepNode *a = rstrnt_dep_graph_add (graph, graph->root, "a", "/t/a", NULL);
+    RstrntDepNode *b = rstrnt_dep_graph_add (graph, a, "b", "/t/b", NULL);
+    rstrnt_dep_graph_add (graph, b, "a", "/t/a", NULL);
+
+    GPtrArray *order = rstrnt_dep_graph_sort (graph, &cycles);
+    g_assert_cmpuint (g_slist_length (cycles), ==, 1);
+    g_assert_cmpstr (cycles->data, ==, "a -> b -> a");
+    // Every node still ends up in the plan exactly once
+    g_assert_cmpuint (order->len, ==, 3);
+    g_assert_cmpint (order_index (order, b), <, order_index (order, a));
+
+    g_slist_free_full (cycles, g_free);
+    g_ptr_array_free (order, TRUE);
+    rstrnt_dep_graph_free (graph);
+}
+
+static void test_graph_self (void)
+{
+    GSList *cycles = NULL;
+
+    RstrntDepGraph *graph = rstrnt_dep_graph_new ("task", "/t/task", NULL);
+    rstrnt_dep_graph_add (graph, graph->root, "task", "/t/task", NULL);
+
+    GPtrArray *order = rstrnt_dep_graph_sort (graph, &cycles);
+    g_assert_cmpstr (cycles->data, ==, "task -> task");
+    g_assert_cmpuint (order->len, ==, 1);
+
+    g_slist_free_full (cycles, g_free);
+    g_ptr_array_free (order, TRUE);
+    rstrnt_dep_graph_free (graph);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/dependency_graph/diamond", test_graph_diamond);
+    g_test_add_func("/dependency_graph/cycle", test_graph_cycle);
+    g_test_add_func("/dependency_graph/self", test_graph_self);
+    return g_test_run();
+}
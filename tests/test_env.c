@@ -19,23 +19,13 @@
 #include <string.h>
 
 #include "env.h"
+#include "env_map.h"
 #include "errors.h"
 #include "recipe.h"
 #include "task.h"
 #include "role.h"
 #include "param.h"
 
-static void get_env_rmembers(gchar *env, gchar **rmembers)
-{
-  if (env != NULL) {
-    gchar **envval = g_strsplit(env, "=", 2);
-    if (g_strcmp0(envval[0], "RECIPE_MEMBERS") == 0) {
-      *rmembers = g_strdup(envval[1]);
-    }
-    g_strfreev(envval);
-  }
-}
-
 static void test_task_env_role_members_standalone(void)
 {
   Task *task = g_slice_new0(Task);
@@ -48,15 +38,14 @@ static void test_task_env_role_members_standalone(void)
   task->params = g_list_append(task->params, &rmem);
 
   build_env("http://localhost", port, task);
-  g_ptr_array_foreach(task->env, (GFunc)get_env_rmembers, &rmembers);
+  rmembers = g_strdup(rstrnt_env_map_get(task->env, "RECIPE_MEMBERS"));
 
   g_assert_cmpstr(rmembers, ==, "otherhost localhost");
 
+  rstrnt_env_map_unref(task->recipe->env);
   g_slice_free(Recipe, task->recipe);
 
-  if (task->env != NULL) {
-    g_ptr_array_free(task->env, TRUE);
-  }
+  rstrnt_env_map_unref(task->env);
   g_list_free(task->params);
   g_slice_free(Task, task);
   remove_env_file(port);
@@ -86,17 +75,16 @@ static void test_task_env_role_members_beaker(void)
   task->roles = roles;
 
   build_env("http://localhost", port, task);
-  g_ptr_array_foreach(task->env, (GFunc)get_env_rmembers, &rmembers);
+  rmembers = g_strdup(rstrnt_env_map_get(task->env, "RECIPE_MEMBERS"));
 
   g_assert_cmpstr(rmembers, ==, "otherhost localhost");
 
   g_list_free(roles);
 
+  rstrnt_env_map_unref(task->recipe->env);
   g_slice_free(Recipe, task->recipe);
 
-  if (task->env != NULL) {
-    g_ptr_array_free(task->env, TRUE);
-  }
+  rstrnt_env_map_unref(task->env);
   g_slice_free(Task, task);
   remove_env_file(port);
 
@@ -105,11 +93,124 @@ static void test_task_env_role_members_beaker(void)
   }
 }
 
+static gboolean envp_contains(const gchar **envp, const gchar *entry)
+{
+  for (const gchar **e = envp; *e != NULL; e++) {
+    if (g_strcmp0(*e, entry) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static void test_env_map_layers(void)
+{
+  RstrntEnvMap *base = rstrnt_env_map_new(NULL);
+  RstrntEnvMap *env;
+  const gchar **envp;
+
+  rstrnt_env_map_set(base, ENV_LAYER_RECIPE_ROLE, "SERVERS", "server1");
+  rstrnt_env_map_set(base, ENV_LAYER_HARNESS, "HOME", "/root");
+  rstrnt_env_map_set(base, ENV_LAYER_RECIPE_PARAM, "RSTRNT_TASKNAME", "/recipe/param");
+  // A lower layer does not replace a higher one
+  rstrnt_env_map_set(base, ENV_LAYER_METADATA, "HOME", "/home/metadata");
+  g_assert_cmpstr(rstrnt_env_map_get(base, "HOME"), ==, "/root");
+
+  env = rstrnt_env_map_new(base);
+  rstrnt_env_map_set(env, ENV_LAYER_TASK_ROLE, "SERVERS", "server2");
+  rstrnt_env_map_set(env, ENV_LAYER_HARNESS, "RSTRNT_TASKNAME", "/distribution/check-install");
+  rstrnt_env_map_setf(env, ENV_LAYER_HARNESS, "RSTRNT_TASKORDER", "%d", 3);
+  rstrnt_env_map_set(env, ENV_LAYER_TASK_PARAM, "HOME", "/home/task");
+
+  g_assert_cmpstr(rstrnt_env_map_get(env, "SERVERS"), ==, "server2");
+  g_assert_cmpstr(rstrnt_env_map_get(env, "RSTRNT_TASKNAME"), ==, "/recipe/param");
+  g_assert_cmpstr(rstrnt_env_map_get(env, "HOME"), ==, "/home/task");
+  g_assert_cmpstr(rstrnt_env_map_get(env, "RSTRNT_TASKORDER"), ==, "3");
+  g_assert_null(rstrnt_env_map_get(env, "MISSING"));
+  // The base is left alone
+  g_assert_cmpstr(rstrnt_env_map_get(base, "SERVERS"), ==, "server1");
+  g_assert_null(rstrnt_env_map_get(base, "RSTRNT_TASKORDER"));
+
+  envp = rstrnt_env_map_envp(env);
+  g_assert_cmpuint(g_strv_length((gchar **) envp), ==, 4);
+  g_assert_cmpstr(envp[0], ==, "SERVERS=server2");
+  g_assert_cmpstr(envp[1], ==, "HOME=/home/task");
+  g_assert_cmpstr(envp[2], ==, "RSTRNT_TASKNAME=/recipe/param");
+  g_assert_cmpstr(envp[3], ==, "RSTRNT_TASKORDER=3");
+
+  rstrnt_env_map_unref(base);
+  g_assert_cmpstr(rstrnt_env_map_get(env, "SERVERS"), ==, "server2");
+  rstrnt_env_map_unref(env);
+}
+
+static void test_task_env_overlays(void)
+{
+  Task *task = g_slice_new0(Task);
+  Task *other = g_slice_new0(Task);
+  Param rparam = {"HOME", "/home/recipe"};
+  Param tparam = {"RSTRNT_TASKPATH", "/mnt/override"};
+  Role srv = { "SERVERS", "server1" };
+  RstrntEnvMap *recipe_env;
+  RstrntEnvMap *plugin_env;
+  guint port = 1111;
+
+  task->recipe = g_slice_new0(Recipe);
+  task->recipe->recipe_id = "123";
+  task->recipe->params = g_list_append(NULL, &rparam);
+  task->recipe->roles = g_list_append(NULL, &srv);
+  task->task_id = "456";
+  task->name = "/distribution/check-install";
+  task->path = "/mnt/tests/distribution/check-install";
+  task->params = g_list_append(NULL, &tparam);
+  other->recipe = task->recipe;
+  other->task_id = "457";
+
+  build_env("http://localhost", port, task);
+  recipe_env = task->recipe->env;
+  build_env("http://localhost", port, other);
+
+  // The recipe level variables are built once
+  g_assert_true(task->recipe->env == recipe_env);
+  g_assert_true(task->env->base == recipe_env);
+  g_assert_true(other->env->base == recipe_env);
+
+  g_assert_cmpstr(rstrnt_env_map_get(task->env, "RSTRNT_RECIPE_URL"), ==,
+                  "http://localhost/recipes/123");
+  g_assert_cmpstr(rstrnt_env_map_get(task->env, "HOME"), ==, "/home/recipe");
+  g_assert_cmpstr(rstrnt_env_map_get(task->env, "SERVERS"), ==, "server1");
+  g_assert_cmpstr(rstrnt_env_map_get(task->env, "RECIPE_MEMBERS"), ==, "server1");
+  g_assert_cmpstr(rstrnt_env_map_get(task->env, "RSTRNT_TASKPATH"), ==, "/mnt/override");
+  g_assert_cmpstr(rstrnt_env_map_get(task->env, "RSTRNT_TASKID"), ==, "456");
+  g_assert_cmpstr(rstrnt_env_map_get(other->env, "RSTRNT_TASKID"), ==, "457");
+  g_assert_true(envp_contains(rstrnt_env_map_envp(task->env), "TESTID=456"));
+
+  // Plugin variables stay out of the task environment
+  plugin_env = rstrnt_env_map_new(task->env);
+  rstrnt_env_map_set(plugin_env, ENV_LAYER_PLUGIN, "RSTRNT_NOPLUGINS", "1");
+  g_assert_true(envp_contains(rstrnt_env_map_envp(plugin_env), "RSTRNT_NOPLUGINS=1"));
+  g_assert_true(envp_contains(rstrnt_env_map_envp(plugin_env), "RSTRNT_TASKID=456"));
+  g_assert_false(envp_contains(rstrnt_env_map_envp(task->env), "RSTRNT_NOPLUGINS=1"));
+  rstrnt_env_map_unref(plugin_env);
+
+  rstrnt_env_map_unref(task->env);
+  rstrnt_env_map_unref(other->env);
+  rstrnt_env_map_unref(task->recipe->env);
+  g_list_free(task->recipe->params);
+  g_list_free(task->recipe->roles);
+  g_slice_free(Recipe, task->recipe);
+  g_list_free(task->params);
+  g_slice_free(Task, task);
+  g_slice_free(Task, other);
+  remove_env_file(port);
+}
+
 int main(int argc, char *argv[]) {
   g_test_init(&argc, &argv, NULL);
   g_test_add_func("/task/env/role_members/standalone",
       test_task_env_role_members_standalone);
   g_test_add_func("/task/env/role_members/beaker",
       test_task_env_role_members_beaker);
+  g_test_add_func("/task/env/overlays", test_task_env_overlays);
+  g_test_add_func("/env_map/layers", test_env_map_layers);
   return g_test_run();
 }
@@ -0,0 +1,311 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+
+#include "local_socket.h"
+#include "utils.h"
+
+#define PERF_CALLS 1000
+
+/* restraintd stand-in running in its own thread */
+typedef struct {
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+    SoupServer *server;
+    GSocketService *service;
+    guint port;
+    gchar *path;
+    GMutex lock;
+    GCond cond;
+    gboolean ready;
+} TestServer;
+
+static TestServer test_server;
+
+static gboolean
+unpause_idle (gpointer user_data)
+{
+    SoupMessage *msg = (SoupMessage *) user_data;
+
+    soup_message_set_status (msg, SOUP_STATUS_OK);
+    soup_server_unpause_message (test_server.server, msg);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+recipe_callback (SoupServer *server, SoupMessage *msg,
+                 const char *path, GHashTable *query,
+                 SoupClientContext *context, gpointer data)
+{
+    const gchar *range;
+
+    // Replies later like restraintd does while it forwards
+    if (g_str_has_suffix (path, "/paused")) {
+        soup_server_pause_message (server, msg);
+        g_idle_add (unpause_idle, msg);
+        return;
+    }
+    range = soup_message_headers_get_one (msg->request_headers, "Content-Range");
+    if (range != NULL) {
+        soup_message_headers_append (msg->response_headers, "X-Content-Range", range);
+    }
+    if (g_strcmp0 (msg->method, "POST") == 0) {
+        soup_message_headers_append (msg->response_headers, "Location",
+                                     "http://localhost/recipes/1/tasks/2/results/3");
+        soup_message_set_status (msg, SOUP_STATUS_CREATED);
+    } else {
+        soup_message_set_status (msg, SOUP_STATUS_OK);
+    }
+    soup_message_set_response (msg, "text/plain", SOUP_MEMORY_COPY,
+                               msg->request_body->data, msg->request_body->length);
+}
+
+static gpointer
+server_thread (gpointer data)
+{
+    GError *error = NULL;
+    GSList *uris;
+
+    g_main_context_push_thread_default (test_server.context);
+
+    test_server.server = soup_server_new (NULL, NULL);
+    soup_server_add_handler (test_server.server, "/recipes",
+                             recipe_callback, NULL, NULL);
+    soup_server_listen_local (test_server.server, 0,
+                              SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+    g_assert_no_error (error);
+    uris = soup_server_get_uris (test_server.server);
+    test_server.port = ((SoupURI *) uris->data)->port;
+    g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+
+    test_server.path = get_local_socket_filename (test_server.port);
+    test_server.service = rstrnt_local_listen (test_server.server,
+                                               test_server.path, &error);
+    g_assert_no_error (error);
+
+    g_mutex_lock (&test_server.lock);
+    test_server.ready = TRUE;
+    g_cond_signal (&test_server.cond);
+    g_mutex_unlock (&test_server.lock);
+
+    g_main_loop_run (test_server.loop);
+
+    g_socket_service_stop (test_server.service);
+    g_socket_listener_close (G_SOCKET_LISTENER (test_server.service));
+    g_object_unref (test_server.service);
+    soup_server_disconnect (test_server.server);
+    g_object_unref (test_server.server);
+
+    g_main_context_pop_thread_default (test_server.context);
+    return NULL;
+}
+
+static void
+server_start (void)
+{
+    test_server.context = g_main_context_new ();
+    test_server.loop = g_main_loop_new (test_server.context, FALSE);
+    g_mutex_init (&test_server.lock);
+    g_cond_init (&test_server.cond);
+    test_server.thread = g_thread_new ("local-socket-server", server_thread, NULL);
+
+    g_mutex_lock (&test_server.lock);
+    while (!test_server.ready) {
+        g_cond_wait (&test_server.cond, &test_server.lock);
+    }
+    g_mutex_unlock (&test_server.lock);
+}
+
+static void
+server_stop (void)
+{
+    g_main_loop_quit (test_server.loop);
+    g_thread_join (test_server.thread);
+    g_main_loop_unref (test_server.loop);
+    g_main_context_unref (test_server.context);
+    g_mutex_clear (&test_server.lock);
+    g_cond_clear (&test_server.cond);
+    g_remove (test_server.path);
+    g_free (test_server.path);
+}
+
+static SoupMessage *
+server_message (const gchar *method, const gchar *path)
+{
+    gchar *url = g_strdup_printf ("http://localhost:%u%s", test_server.port, path);
+    SoupMessage *msg = soup_message_new (method, url);
+
+    g_free (url);
+    return msg;
+}
+
+static void
+test_local_post (void)
+{
+    SoupMessage *msg;
+    const gchar *form = "path=setup&result=PASS";
+    guint status;
+
+    msg = server_message ("POST", "/recipes/1/tasks/2/results/");
+    g_assert_true (rstrnt_local_available (soup_message_get_uri (msg)));
+    soup_message_set_request (msg, "application/x-www-form-urlencoded",
+                              SOUP_MEMORY_STATIC, form, strlen (form));
+
+    status = rstrnt_local_send_message (msg);
+
+    g_assert_cmpuint (status, ==, SOUP_STATUS_CREATED);
+    g_assert_cmpuint (msg->status_code, ==, SOUP_STATUS_CREATED);
+    g_assert_cmpstr (soup_message_headers_get_one (msg->response_headers, "Location"),
+                     ==, "http://localhost/recipes/1/tasks/2/results/3");
+    g_assert_cmpstr (msg->response_body->data, ==, form);
+
+    g_object_unref (msg);
+}
+
+static void
+test_local_put_range (void)
+{
+    SoupMessage *msg;
+    const gchar *chunk = "All test and no code makes Jack a dull boy\n";
+    guint status;
+
+    msg = server_message ("PUT", "/recipes/1/tasks/2/logs/dummy.log");
+    soup_message_headers_append (msg->request_headers, "Content-Range",
+                                 "bytes 100-142/1000");
+    soup_message_set_request (msg, "text/plain", SOUP_MEMORY_STATIC,
+                              chunk, strlen (chunk));
+
+    status = rstrnt_local_send_message (msg);
+
+    g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+    g_assert_cmpstr (soup_message_headers_get_one (msg->response_headers, "X-Content-Range"),
+                     ==, "bytes 100-142/1000");
+    g_assert_cmpuint (msg->response_body->length, ==, strlen (chunk));
+
+    g_object_unref (msg);
+}
+
+static void
+test_local_paused (void)
+{
+    SoupMessage *msg;
+
+    msg = server_message ("POST", "/recipes/1/tasks/2/paused");
+
+    g_assert_cmpuint (rstrnt_local_send_message (msg), ==, SOUP_STATUS_OK);
+
+    g_object_unref (msg);
+}
+
+/* No socket, a stale one or another host: the caller goes over TCP */
+static void
+test_local_unavailable (void)
+{
+    SoupMessage *msg;
+    gchar *stale;
+
+    msg = soup_message_new ("POST", "http://localhost:1/recipes/1/");
+    g_assert_false (rstrnt_local_available (soup_message_get_uri (msg)));
+    g_assert_cmpuint (rstrnt_local_send_message (msg), ==, SOUP_STATUS_NONE);
+    g_assert_cmpuint (msg->status_code, ==, SOUP_STATUS_NONE);
+    g_object_unref (msg);
+
+    stale = get_local_socket_filename (2);
+    g_assert_true (g_file_set_contents (stale, "", 0, NULL));
+    msg = soup_message_new ("POST", "http://127.0.0.1:2/recipes/1/");
+    g_assert_true (rstrnt_local_available (soup_message_get_uri (msg)));
+    g_assert_cmpuint (rstrnt_local_send_message (msg), ==, SOUP_STATUS_NONE);
+    g_object_unref (msg);
+    g_remove (stale);
+    g_free (stale);
+
+    msg = server_message ("POST", "/recipes/1/");
+    soup_uri_set_host (soup_message_get_uri (msg), "example.com");
+    g_assert_false (rstrnt_local_available (soup_message_get_uri (msg)));
+    g_object_unref (msg);
+}
+
+/*
+ * What a helper pays per call: a fresh session over TCP against one
+ * request over the local socket.
+ */
+static void
+test_local_perf (void)
+{
+    const gchar *form = "seconds=600";
+    gdouble tcp;
+    gdouble local;
+
+    g_test_timer_start ();
+    for (guint i = 0; i < PERF_CALLS; i++) {
+        SoupSession *session = soup_session_new_with_options ("timeout", 3600, NULL);
+        SoupMessage *msg = server_message ("POST", "/recipes/1/watchdog");
+
+        soup_message_set_request (msg, "application/x-www-form-urlencoded",
+                                  SOUP_MEMORY_STATIC, form, strlen (form));
+        g_assert_cmpuint (soup_session_send_message (session, msg), ==, SOUP_STATUS_CREATED);
+        g_object_unref (msg);
+        soup_session_abort (session);
+        g_object_unref (session);
+    }
+    tcp = g_test_timer_elapsed () / PERF_CALLS;
+
+    g_test_timer_start ();
+    for (guint i = 0; i < PERF_CALLS; i++) {
+        SoupMessage *msg = server_message ("POST", "/recipes/1/watchdog");
+
+        soup_message_set_request (msg, "application/x-www-form-urlencoded",
+                                  SOUP_MEMORY_STATIC, form, strlen (form));
+        g_assert_cmpuint (rstrnt_local_send_message (msg), ==, SOUP_STATUS_CREATED);
+        g_object_unref (msg);
+    }
+    local = g_test_timer_elapsed () / PERF_CALLS;
+
+    g_test_message ("per call: session over TCP %.0f us, local socket %.0f us",
+                    tcp * G_USEC_PER_SEC, local * G_USEC_PER_SEC);
+    g_test_minimized_result (local * G_USEC_PER_SEC, "local socket %.0f us per call",
+                             local * G_USEC_PER_SEC);
+    g_assert_cmpfloat (local, <, tcp);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    int retval;
+
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/local_socket/post", test_local_post);
+    g_test_add_func ("/local_socket/put_range", test_local_put_range);
+    g_test_add_func ("/local_socket/paused", test_local_paused);
+    g_test_add_func ("/local_socket/unavailable", test_local_unavailable);
+    if (g_test_perf ()) {
+        g_test_add_func ("/local_socket/perf", test_local_perf);
+    }
+
+    server_start ();
+    retval = g_test_run ();
+    server_stop ();
+
+    return retval;
+}
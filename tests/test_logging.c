@@ -15,7 +15,9 @@
   along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE
 #include <glib.h>
+#include <sys/socket.h>
 
 #define LOG_MANAGER_DIR "./test_logging_logs"
 
@@ -186,6 +188,74 @@ test_rstrnt_log_upload_no_logs (void)
     restraint_task_free (task);
 }
 
+/*
+ * A pipe is spliced, a socket stands in for a pty and goes through the
+ * read buffer.
+ */
+static void
+test_rstrnt_log_pump (gconstpointer user_data)
+{
+    gboolean use_pipe = GPOINTER_TO_INT (user_data);
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GString) expected = NULL;
+    RstrntTask *task;
+    gssize bytes;
+    gsize total = 0;
+    int fds[2];
+
+    task = restraint_task_new ();
+    task->task_id = g_strdup_printf ("pump-%" G_GINT64_FORMAT, g_get_real_time ());
+
+    if (use_pipe)
+        g_assert_cmpint (pipe2 (fds, O_NONBLOCK), ==, 0);
+    else
+        g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), ==, 0);
+
+    // Existing content is kept, a task restarted after a reboot appends
+    rstrnt_log (task, RSTRNT_LOG_TYPE_TASK, "before reboot\n");
+    rstrnt_flush_logs (task, NULL);
+
+    expected = g_string_new ("before reboot\n");
+    for (int i = 0; i < 1000; i++)
+        g_string_append_printf (expected, "line %d of the task output\n", i);
+
+    g_assert_cmpint (write (fds[1], expected->str + 14, expected->len - 14), ==,
+                     expected->len - 14);
+    close (fds[1]);
+
+    while ((bytes = rstrnt_log_pump (task, RSTRNT_LOG_TYPE_TASK, fds[0], &error)) > 0)
+        total += bytes;
+
+    g_assert_no_error (error);
+    g_assert_cmpint (bytes, ==, 0);
+    g_assert_cmpuint (total, ==, expected->len - 14);
+    check_log_file_contents (task, "task.log", expected->str);
+
+    close (fds[0]);
+    rstrnt_close_logs (task);
+    restraint_task_free (task);
+}
+
+static void
+test_rstrnt_log_pump_would_block (void)
+{
+    g_autoptr (GError) error = NULL;
+    RstrntTask *task;
+    int fds[2];
+
+    task = restraint_task_new ();
+    task->task_id = g_strdup_printf ("pump-%" G_GINT64_FORMAT, g_get_real_time ());
+    g_assert_cmpint (pipe2 (fds, O_NONBLOCK), ==, 0);
+
+    g_assert_cmpint (rstrnt_log_pump (task, RSTRNT_LOG_TYPE_TASK, fds[0], &error), ==, -1);
+    g_assert_error (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+
+    close (fds[0]);
+    close (fds[1]);
+    rstrnt_close_logs (task);
+    restraint_task_free (task);
+}
+
 static gchar *
 assert_content_range (SoupMessage *msg,
                       goffset      expected_start,
@@ -355,6 +425,9 @@ main (int    argc,
     g_test_add_func ("/logging/chunking/zero_offset", test_rstrnt_chunk_log_zero_offset);
     g_test_add_func ("/logging/chunking/nonzero_offset", test_rstrnt_chunk_log_nonzero_offset);
     g_test_add_func ("/logging/enabled", test_rstrnt_log_manager_enabled);
+    g_test_add_data_func ("/logging/pump/splice", GINT_TO_POINTER (TRUE), test_rstrnt_log_pump);
+    g_test_add_data_func ("/logging/pump/read", GINT_TO_POINTER (FALSE), test_rstrnt_log_pump);
+    g_test_add_func ("/logging/pump/would_block", test_rstrnt_log_pump_would_block);
 
     if (!soup_server_listen_local (server, 43770, SOUP_SERVER_LISTEN_IPV4_ONLY, &error))
     {
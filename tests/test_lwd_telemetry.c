@@ -0,0 +1,207 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json.h>
+
+#include "errors.h"
+#include "lwd_telemetry.h"
+
+static gchar *tmp_test_dir;
+
+static json_object *
+record_at (json_object *telemetry, gsize index)
+{
+    json_object *records;
+
+    g_assert_true (json_object_object_get_ex (telemetry, "records", &records));
+    return json_object_array_get_idx (records, index);
+}
+
+static const gchar *
+record_string (json_object *record, const gchar *key)
+{
+    json_object *value;
+
+    g_assert_true (json_object_object_get_ex (record, key, &value));
+    return json_object_get_string (value);
+}
+
+static gint64
+record_int (json_object *record, const gchar *key)
+{
+    json_object *value;
+
+    g_assert_true (json_object_object_get_ex (record, key, &value));
+    return json_object_get_int64 (value);
+}
+
+static void
+test_lwd_telemetry_records (void)
+{
+    RstrntLwdTelemetry *telemetry;
+    json_object *object;
+    json_object *record;
+    GError *error = NULL;
+    gchar *path;
+
+    path = rstrnt_lwd_telemetry_path (tmp_test_dir, "123");
+    g_assert_true (g_str_has_suffix (path, "/123.lwd"));
+
+    telemetry = rstrnt_lwd_telemetry_open (path, 16, &error);
+    g_assert_no_error (error);
+    g_assert_true (rstrnt_lwd_telemetry_record (telemetry, LWD_EVENT_START, 600, 0, &error));
+    rstrnt_lwd_telemetry_output (telemetry, 1000);
+    rstrnt_lwd_telemetry_output (telemetry, 24);
+    g_assert_true (rstrnt_lwd_telemetry_record (telemetry, LWD_EVENT_HEARTBEAT, 540, 0, &error));
+    g_assert_true (rstrnt_lwd_telemetry_record (telemetry, LWD_EVENT_ADJUST, 1200, 1200, &error));
+    g_assert_no_error (error);
+    rstrnt_lwd_telemetry_close (telemetry);
+
+    object = rstrnt_lwd_telemetry_read (path, &error);
+    g_assert_no_error (error);
+    g_assert_cmpint (record_int (object, "count"), ==, 3);
+    g_assert_cmpint (record_int (object, "capacity"), ==, 16);
+
+    record = record_at (object, 0);
+    g_assert_cmpstr (record_string (record, "event"), ==, "start");
+    g_assert_cmpint (record_int (record, "remaining"), ==, 600);
+    g_assert_cmpint (record_int (record, "output_bytes"), ==, 0);
+    g_assert_cmpint (record_int (record, "elapsed"), >=, 0);
+    g_assert_cmpint (record_int (record, "timestamp"), >, 0);
+
+    record = record_at (object, 1);
+    g_assert_cmpstr (record_string (record, "event"), ==, "heartbeat");
+    g_assert_cmpint (record_int (record, "remaining"), ==, 540);
+    g_assert_cmpint (record_int (record, "output_bytes"), ==, 1024);
+    // Less than a second since the start record, still bytes per second
+    g_assert_cmpint (record_int (record, "output_rate"), >, 1024);
+
+    record = record_at (object, 2);
+    g_assert_cmpstr (record_string (record, "event"), ==, "adjust");
+    g_assert_cmpint (record_int (record, "adjusted"), ==, 1200);
+    g_assert_cmpint (record_int (record, "output_bytes"), ==, 0);
+
+    json_object_put (object);
+    g_remove (path);
+    g_free (path);
+}
+
+/* Only the newest records are kept, and a reboot carries on counting */
+static void
+test_lwd_telemetry_wrap (void)
+{
+    RstrntLwdTelemetry *telemetry;
+    json_object *object;
+    json_object *records;
+    GError *error = NULL;
+    gint64 start;
+    gchar *path;
+
+    path = rstrnt_lwd_telemetry_path (tmp_test_dir, "wrap");
+    telemetry = rstrnt_lwd_telemetry_open (path, 4, &error);
+    g_assert_no_error (error);
+    start = telemetry->start;
+    for (gint64 i = 0; i < 3; i++) {
+        g_assert_true (rstrnt_lwd_telemetry_record (telemetry, LWD_EVENT_HEARTBEAT, i, 0, &error));
+    }
+    rstrnt_lwd_telemetry_close (telemetry);
+
+    // The capacity of the file wins over the one asked for
+    telemetry = rstrnt_lwd_telemetry_open (path, 100, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (telemetry->count, ==, 3);
+    g_assert_cmpuint (telemetry->capacity, ==, 4);
+    g_assert_cmpint (telemetry->start, ==, start);
+    for (gint64 i = 3; i < 6; i++) {
+        g_assert_true (rstrnt_lwd_telemetry_record (telemetry, LWD_EVENT_HEARTBEAT, i, 0, &error));
+    }
+    rstrnt_lwd_telemetry_close (telemetry);
+
+    object = rstrnt_lwd_telemetry_read (path, &error);
+    g_assert_no_error (error);
+    g_assert_cmpint (record_int (object, "count"), ==, 6);
+    g_assert_true (json_object_object_get_ex (object, "records", &records));
+    g_assert_cmpuint (json_object_array_length (records), ==, 4);
+    for (gsize i = 0; i < 4; i++) {
+        g_assert_cmpint (record_int (record_at (object, i), "remaining"), ==, i + 2);
+    }
+
+    json_object_put (object);
+    g_remove (path);
+    g_free (path);
+}
+
+static void
+test_lwd_telemetry_invalid (void)
+{
+    RstrntLwdTelemetry *telemetry;
+    json_object *object;
+    GError *error = NULL;
+    gchar *path;
+
+    path = rstrnt_lwd_telemetry_path (tmp_test_dir, "invalid");
+
+    object = rstrnt_lwd_telemetry_read (path, &error);
+    g_assert_null (object);
+    g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+    g_clear_error (&error);
+
+    g_assert_true (g_file_set_contents (path, "remaining_time=600\n", -1, NULL));
+    object = rstrnt_lwd_telemetry_read (path, &error);
+    g_assert_null (object);
+    g_assert_error (error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX);
+    g_clear_error (&error);
+
+    // Started over on open
+    telemetry = rstrnt_lwd_telemetry_open (path, 8, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (telemetry->count, ==, 0);
+    g_assert_true (rstrnt_lwd_telemetry_record (telemetry, LWD_EVENT_FINISH, 0, 0, &error));
+    rstrnt_lwd_telemetry_close (telemetry);
+
+    object = rstrnt_lwd_telemetry_read (path, &error);
+    g_assert_no_error (error);
+    g_assert_cmpstr (record_string (record_at (object, 0), "event"), ==, "finish");
+    json_object_put (object);
+
+    g_remove (path);
+    g_free (path);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    int retval;
+
+    g_test_init (&argc, &argv, NULL);
+
+    tmp_test_dir = g_dir_make_tmp ("test_lwd_telemetry_XXXXXX", NULL);
+
+    g_test_add_func ("/lwd_telemetry/records", test_lwd_telemetry_records);
+    g_test_add_func ("/lwd_telemetry/wrap", test_lwd_telemetry_wrap);
+    g_test_add_func ("/lwd_telemetry/invalid", test_lwd_telemetry_invalid);
+
+    retval = g_test_run ();
+
+    g_remove (tmp_test_dir);
+    g_free (tmp_test_dir);
+
+    return retval;
+}
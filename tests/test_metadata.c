@@ -16,7 +16,9 @@
 */
 
 
+#include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 
 #include "metadata.h"
@@ -437,6 +439,384 @@ static void test_metadata_environment(void) {
     restraint_metadata_free (metadata);
 }
 
+static void test_testinfo_dedup(void) {
+    GError *error = NULL;
+    MetaData *metadata;
+    gchar *data = g_strdup("Requires: gcc make, gcc\n"
+                           "RhtsRequires: make\n"
+                           "RepoRequires: /kernel/include /kernel/include\n");
+
+    metadata = restraint_parse_testinfo_data(data, strlen(data), &error);
+    g_assert_no_error(error);
+    g_assert_cmpuint(g_slist_length(metadata->dependencies), ==, 2);
+    g_assert_cmpstr(g_slist_nth_data(metadata->dependencies, 0), ==, "make");
+    g_assert_cmpstr(g_slist_nth_data(metadata->dependencies, 1), ==, "gcc");
+    g_assert_cmpuint(g_slist_length(metadata->repodeps), ==, 1);
+    // Names are interned
+    g_assert_true(g_slist_nth_data(metadata->dependencies, 1) ==
+                  g_intern_static_string("gcc"));
+    restraint_metadata_free(metadata);
+    g_free(data);
+}
+
+static void test_metadata_dedup(void) {
+    GError *error = NULL;
+    MetaData *metadata;
+    gchar *data = g_strdup("[General]\n"
+                           "name= /dedup \n"
+                           "[restraint]\n"
+                           "dependencies=gcc;make;gcc;\n"
+                           "softDependencies=with\\;semicolon;with\\sspace\n"
+                           "dependencies[Fedora40]=clang;clang\n");
+
+    metadata = restraint_parse_metadata_data(data, strlen(data), "Fedora40",
+                                             &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(metadata->name, ==, "/dedup");
+    g_assert_cmpuint(g_slist_length(metadata->dependencies), ==, 1);
+    g_assert_cmpstr(g_slist_nth_data(metadata->dependencies, 0), ==, "clang");
+    g_assert_cmpstr(g_slist_nth_data(metadata->softdependencies, 0), ==, "with space");
+    g_assert_cmpstr(g_slist_nth_data(metadata->softdependencies, 1), ==, "with;semicolon");
+    restraint_metadata_free(metadata);
+    g_free(data);
+}
+
+static void test_metadata_missing_group(void) {
+    GError *error = NULL;
+    MetaData *metadata;
+    gchar *data = g_strdup("[General]\nname=/no/restraint/group\n");
+
+    metadata = restraint_parse_metadata_data(data, strlen(data), NULL, &error);
+    g_assert_null(metadata);
+    g_assert_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND);
+    g_clear_error(&error);
+    g_free(data);
+}
+
+/*
+ * Fuzz and benchmark helpers.  Every file below test-data/parse_metadata
+ * and test-data/parse_testinfo (Makefiles aside) is used as a seed.
+ */
+typedef MetaData *(*ParseFunc) (gchar *data, gsize length, GError **error);
+
+static MetaData *
+parse_metadata_data(gchar *data, gsize length, GError **error) {
+    return restraint_parse_metadata_data(data, length, "RedHatEnterpriseLinux6",
+                                         error);
+}
+
+static void
+collect_seeds(const gchar *path, GPtrArray *seeds) {
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const gchar *name;
+
+    g_assert_nonnull(dir);
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        gchar *filename = g_build_filename(path, name, NULL);
+        if (g_file_test(filename, G_FILE_TEST_IS_DIR)) {
+            collect_seeds(filename, seeds);
+            g_free(filename);
+        } else if (g_strcmp0(name, "Makefile") == 0) {
+            g_free(filename);
+        } else {
+            g_ptr_array_add(seeds, filename);
+        }
+    }
+    g_dir_close(dir);
+}
+
+static void
+fuzz_parser(const gchar *path, ParseFunc parse) {
+    static const gchar interesting[] = "\n\r\\;=:[] ,#";
+    GPtrArray *seeds = g_ptr_array_new_with_free_func(g_free);
+    guint iterations = g_test_thorough() ? 5000 : 200;
+
+    collect_seeds(path, seeds);
+    g_assert_cmpuint(seeds->len, >, 0);
+
+    for (guint i = 0; i < seeds->len; i++) {
+        gchar *seed;
+        gsize seed_length;
+
+        g_assert_true(g_file_get_contents(g_ptr_array_index(seeds, i),
+                                          &seed, &seed_length, NULL));
+        for (guint n = 0; n < iterations; n++) {
+            GError *error = NULL;
+            gsize length = seed_length;
+            // room for one duplicated slice plus the terminator
+            gchar *data = g_malloc(seed_length * 2 + 2);
+            memcpy(data, seed, seed_length);
+
+            for (gint m = g_test_rand_int_range(1, 8); m > 0 && length > 0; m--) {
+                gsize pos = g_test_rand_int_range(0, length);
+                switch (g_test_rand_int_range(0, 4)) {
+                    case 0:
+                        data[pos] = (gchar) g_test_rand_int_range(0, 256);
+                        break;
+                    case 1:
+                        data[pos] = interesting[g_test_rand_int_range(0, sizeof(interesting) - 1)];
+                        break;
+                    case 2:
+                        length = pos;
+                        break;
+                    default:
+                        if (length + (length - pos) <= seed_length * 2) {
+                            memmove(data + length, data + pos, length - pos);
+                            length += length - pos;
+                        }
+                        break;
+                }
+            }
+            data[length] = '\0';
+
+            MetaData *metadata = parse(data, length, &error);
+            // Either a result or an error, never both
+            g_assert_true((metadata == NULL) != (error == NULL));
+            restraint_metadata_free(metadata);
+            g_clear_error(&error);
+            g_free(data);
+        }
+        g_free(seed);
+    }
+    g_ptr_array_free(seeds, TRUE);
+}
+
+static void test_metadata_fuzz(void) {
+    fuzz_parser("test-data/parse_metadata", parse_metadata_data);
+}
+
+static void test_testinfo_fuzz(void) {
+    fuzz_parser("test-data/parse_testinfo", restraint_parse_testinfo_data);
+}
+
+static void
+benchmark_parser(const gchar *path, ParseFunc parse, const gchar *what) {
+    GPtrArray *seeds = g_ptr_array_new_with_free_func(g_free);
+    guint iterations = 10000;
+    guint parsed = 0;
+    GTimer *timer = g_timer_new();
+
+    collect_seeds(path, seeds);
+    g_timer_stop(timer);
+    g_timer_reset(timer);
+
+    for (guint i = 0; i < seeds->len; i++) {
+        gchar *seed;
+        gsize seed_length;
+
+        g_assert_true(g_file_get_contents(g_ptr_array_index(seeds, i),
+                                          &seed, &seed_length, NULL));
+        gchar *data = g_malloc(seed_length + 1);
+        for (guint n = 0; n < iterations; n++) {
+            GError *error = NULL;
+            memcpy(data, seed, seed_length + 1);
+
+            g_timer_continue(timer);
+            MetaData *metadata = parse(data, seed_length, &error);
+            g_timer_stop(timer);
+
+            restraint_metadata_free(metadata);
+            g_clear_error(&error);
+            parsed++;
+        }
+        g_free(data);
+        g_free(seed);
+    }
+
+    gdouble elapsed = g_timer_elapsed(timer, NULL);
+    g_test_minimized_result(elapsed * G_USEC_PER_SEC / parsed,
+                            "%s: %.2f usec per file", what,
+                            elapsed * G_USEC_PER_SEC / parsed);
+    g_timer_destroy(timer);
+    g_ptr_array_free(seeds, TRUE);
+}
+
+static void test_metadata_benchmark(void) {
+    benchmark_parser("test-data/parse_metadata", parse_metadata_data,
+                     "metadata");
+}
+
+static void test_testinfo_benchmark(void) {
+    benchmark_parser("test-data/parse_testinfo", restraint_parse_testinfo_data,
+                     "testinfo.desc");
+}
+
+static void rm_dir_contents(const gchar *path) {
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const gchar *name;
+
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        gchar *filename = g_build_filename(path, name, NULL);
+        g_unlink(filename);
+        g_free(filename);
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+    g_rmdir(path);
+}
+
+typedef struct {
+    GMainLoop *loop;
+    GError *error;
+    gboolean finished;
+} CacheRunData;
+
+static gboolean
+cache_io_cb (GIOChannel *io, GIOCondition condition, gpointer user_data)
+{
+    gchar buf[1024];
+    gsize bytes_read;
+
+    if (condition & G_IO_IN) {
+        if (g_io_channel_read_chars(io, buf, sizeof(buf), &bytes_read,
+                                    NULL) == G_IO_STATUS_NORMAL) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void
+cache_finish_cb (gpointer user_data, GError *error)
+{
+    CacheRunData *run_data = (CacheRunData *) user_data;
+
+    if (error) {
+        g_propagate_error(&run_data->error, g_error_copy(error));
+    }
+    run_data->finished = TRUE;
+    if (run_data->loop) {
+        g_main_loop_quit(run_data->loop);
+    }
+}
+
+static gint
+count_cache_entries (const gchar *cache_dir)
+{
+    GDir *dir = g_dir_open(cache_dir, 0, NULL);
+    gint count = 0;
+
+    g_assert_nonnull(dir);
+    while (g_dir_read_name(dir) != NULL) {
+        count++;
+    }
+    g_dir_close(dir);
+    return count;
+}
+
+static void test_metadata_cache(void) {
+    gboolean rhts_compat;
+    CacheRunData run_data = { NULL, NULL, FALSE };
+    MetaData *metadata = NULL;
+    gchar *osmajor = "RedHatEnterpriseLinux6";
+    gchar *task_dir = g_dir_make_tmp("test_metadata_cache_task_XXXXXX", NULL);
+    gchar *cache_dir = g_dir_make_tmp("test_metadata_cache_XXXXXX", NULL);
+    gchar *metadata_file = g_build_filename(task_dir, "metadata", NULL);
+    gchar *contents = NULL;
+
+    g_assert_true(g_file_get_contents("test-data/parse_metadata/environment/metadata",
+                                      &contents, NULL, NULL));
+    g_assert_true(g_file_set_contents(metadata_file, contents, -1, NULL));
+    g_free(contents);
+
+    restraint_metadata_cache_set_dir(cache_dir);
+
+    // First lookup parses the file and fills the cache
+    rhts_compat = restraint_get_metadata(task_dir, osmajor, &metadata, NULL,
+                                         cache_finish_cb, NULL, &run_data);
+    g_assert_no_error(run_data.error);
+    g_assert_false(rhts_compat);
+    g_assert_cmpint(count_cache_entries(cache_dir), ==, 1);
+    restraint_metadata_free(metadata);
+    metadata = NULL;
+
+    // Second one is served from the cache, including the list order
+    rhts_compat = restraint_get_metadata(task_dir, osmajor, &metadata, NULL,
+                                         cache_finish_cb, NULL, &run_data);
+    g_assert_no_error(run_data.error);
+    g_assert_false(rhts_compat);
+    check_metadata_envvars(metadata->envvars);
+    restraint_metadata_free(metadata);
+    metadata = NULL;
+
+    // Changed content invalidates the entry
+    g_assert_true(g_file_set_contents(metadata_file,
+                                      "[restraint]\nmax_time=10m\n", -1, NULL));
+    rhts_compat = restraint_get_metadata(task_dir, osmajor, &metadata, NULL,
+                                         cache_finish_cb, NULL, &run_data);
+    g_assert_no_error(run_data.error);
+    g_assert_null(metadata->envvars);
+    g_assert_cmpuint(metadata->max_time, ==, 60 * 10);
+    restraint_metadata_free(metadata);
+
+    restraint_metadata_cache_set_dir(NULL);
+    g_unlink(metadata_file);
+    g_rmdir(task_dir);
+    rm_dir_contents(cache_dir);
+    g_free(metadata_file);
+    g_free(task_dir);
+    g_free(cache_dir);
+}
+
+static void test_metadata_cache_make(void) {
+    gboolean rhts_compat;
+    CacheRunData run_data = { NULL, NULL, FALSE };
+    MetaData *metadata = NULL;
+    gchar *task_dir = g_dir_make_tmp("test_metadata_cache_task_XXXXXX", NULL);
+    gchar *cache_dir = g_dir_make_tmp("test_metadata_cache_XXXXXX", NULL);
+    gchar *makefile = g_build_filename(task_dir, "Makefile", NULL);
+    gchar *testinfo_file = g_build_filename(task_dir, "testinfo.desc", NULL);
+
+    g_assert_true(g_file_set_contents(makefile,
+                                      "testinfo.desc:\n"
+                                      "\t@echo 'Name: /cache/make' > $@\n"
+                                      "\t@echo 'TestTime: 5m' >> $@\n",
+                                      -1, NULL));
+
+    restraint_metadata_cache_set_dir(cache_dir);
+
+    // No metadata at all, make has to generate testinfo.desc
+    run_data.loop = g_main_loop_new(NULL, TRUE);
+    rhts_compat = restraint_get_metadata(task_dir, NULL, &metadata, NULL,
+                                         cache_finish_cb, cache_io_cb,
+                                         &run_data);
+    g_assert_true(rhts_compat);
+    if (!run_data.finished) {
+        g_main_loop_run(run_data.loop);
+    }
+    g_main_loop_unref(run_data.loop);
+    run_data.loop = NULL;
+    g_assert_no_error(run_data.error);
+    g_assert_cmpstr(metadata->name, ==, "/cache/make");
+    restraint_metadata_free(metadata);
+    metadata = NULL;
+
+    // A fresh copy of the tree doesn't need make any more, the result is
+    // available straight away.
+    g_unlink(testinfo_file);
+    run_data.finished = FALSE;
+    rhts_compat = restraint_get_metadata(task_dir, NULL, &metadata, NULL,
+                                         cache_finish_cb, cache_io_cb,
+                                         &run_data);
+    g_assert_true(run_data.finished);
+    g_assert_no_error(run_data.error);
+    g_assert_true(rhts_compat);
+    g_assert_cmpstr(metadata->name, ==, "/cache/make");
+    g_assert_cmpuint(metadata->max_time, ==, 60 * 5);
+    g_assert_false(g_file_test(testinfo_file, G_FILE_TEST_EXISTS));
+    restraint_metadata_free(metadata);
+
+    restraint_metadata_cache_set_dir(NULL);
+    g_unlink(makefile);
+    g_rmdir(task_dir);
+    rm_dir_contents(cache_dir);
+    g_free(makefile);
+    g_free(testinfo_file);
+    g_free(task_dir);
+    g_free(cache_dir);
+}
+
 int main(int argc, char *argv[]) {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/testinfo.desc/testtime/day", test_testinfo_testtime_day);
@@ -460,5 +840,16 @@ int main(int argc, char *argv[]) {
     g_test_add_func("/metadata/use_pty", test_metadata_use_pty);
     g_test_add_func("/metadata/no_localwatchdog", test_metadata_no_localwatchdog);
     g_test_add_func("/metadata/environment", test_metadata_environment);
+    g_test_add_func("/metadata/dedup", test_metadata_dedup);
+    g_test_add_func("/metadata/missing_group", test_metadata_missing_group);
+    g_test_add_func("/testinfo.desc/dedup", test_testinfo_dedup);
+    g_test_add_func("/metadata/fuzz", test_metadata_fuzz);
+    g_test_add_func("/testinfo.desc/fuzz", test_testinfo_fuzz);
+    if (g_test_perf()) {
+        g_test_add_func("/metadata/benchmark", test_metadata_benchmark);
+        g_test_add_func("/testinfo.desc/benchmark", test_testinfo_benchmark);
+    }
+    g_test_add_func("/metadata/cache", test_metadata_cache);
+    g_test_add_func("/metadata/cache/make", test_metadata_cache_make);
     return g_test_run();
 }
@@ -0,0 +1,176 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+static void
+test_metrics_buckets (void)
+{
+    gint64 values[] = { 0, 1, 15, 16, 17, 31, 32, 33, 1000, 999999, 1000000,
+                        G_GINT64_CONSTANT (3600000000) };
+    guint last = 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS (values); i++) {
+        guint bucket = rstrnt_metrics_bucket (values[i]);
+        gint64 upper = rstrnt_metrics_bucket_upper (bucket);
+
+        // The value falls in its bucket, within 1/16th of the upper end
+        g_assert_cmpint (upper, >, values[i]);
+        g_assert_cmpint (upper - 1 - values[i], <=, values[i] / METRICS_SUB_BUCKETS);
+        g_assert_cmpuint (bucket, >=, last);
+        g_assert_cmpuint (bucket, <, METRICS_BUCKETS);
+        last = bucket;
+    }
+
+    // Small values are exact
+    g_assert_cmpuint (rstrnt_metrics_bucket (7), ==, 7);
+    g_assert_cmpuint (rstrnt_metrics_bucket (16), ==, 16);
+    g_assert_cmpuint (rstrnt_metrics_bucket (-5), ==, 0);
+
+    // Each bucket starts where the previous one ends
+    for (guint bucket = 1; bucket < METRICS_BUCKETS; bucket++) {
+        g_assert_cmpuint (rstrnt_metrics_bucket (rstrnt_metrics_bucket_upper (bucket - 1)),
+                          ==, bucket);
+    }
+
+    // Anything larger lands in the last one
+    g_assert_cmpuint (rstrnt_metrics_bucket (G_MAXINT64), ==, METRICS_BUCKETS - 1);
+}
+
+static void
+test_metrics_values (void)
+{
+    rstrnt_metrics_reset ();
+
+    rstrnt_metrics_inc (METRIC_MESSAGES_QUEUED);
+    rstrnt_metrics_add (METRIC_MESSAGES_QUEUED, 4);
+    g_assert_cmpint (rstrnt_metrics_value (METRIC_MESSAGES_QUEUED), ==, 5);
+
+    rstrnt_metrics_set (METRIC_MESSAGE_QUEUE_DEPTH, 7);
+    rstrnt_metrics_set (METRIC_MESSAGE_QUEUE_DEPTH, 3);
+    g_assert_cmpint (rstrnt_metrics_value (METRIC_MESSAGE_QUEUE_DEPTH), ==, 3);
+
+    rstrnt_metrics_reset ();
+    g_assert_cmpint (rstrnt_metrics_value (METRIC_MESSAGES_QUEUED), ==, 0);
+    g_assert_cmpint (rstrnt_metrics_value (METRIC_MESSAGE_QUEUE_DEPTH), ==, 0);
+}
+
+static void
+test_metrics_quantile (void)
+{
+    rstrnt_metrics_reset ();
+
+    g_assert_cmpint (rstrnt_metrics_quantile (METRIC_MESSAGE_LATENCY, 0.5), ==, 0);
+
+    // 1ms to 100ms
+    for (gint64 i = 1; i <= 100; i++) {
+        rstrnt_metrics_observe (METRIC_MESSAGE_LATENCY, i * 1000);
+    }
+    g_assert_cmpuint (rstrnt_metrics_count (METRIC_MESSAGE_LATENCY), ==, 100);
+
+    g_assert_cmpint (rstrnt_metrics_quantile (METRIC_MESSAGE_LATENCY, 0.5), >=, 50000);
+    g_assert_cmpint (rstrnt_metrics_quantile (METRIC_MESSAGE_LATENCY, 0.5), <=,
+                     50000 + 50000 / METRICS_SUB_BUCKETS);
+    g_assert_cmpint (rstrnt_metrics_quantile (METRIC_MESSAGE_LATENCY, 0.99), >=, 99000);
+    // Never above the largest value seen
+    g_assert_cmpint (rstrnt_metrics_quantile (METRIC_MESSAGE_LATENCY, 1.0), ==, 100000);
+
+    // The other histograms are left alone
+    g_assert_cmpuint (rstrnt_metrics_count (METRIC_MESSAGE_RETRY_DELAY), ==, 0);
+
+    rstrnt_metrics_reset ();
+    g_assert_cmpuint (rstrnt_metrics_count (METRIC_MESSAGE_LATENCY), ==, 0);
+}
+
+static void
+test_metrics_prometheus (void)
+{
+    gchar *text;
+
+    rstrnt_metrics_reset ();
+
+    rstrnt_metrics_add (METRIC_FETCH_GIT_BYTES, 2048);
+    rstrnt_metrics_observe (METRIC_FETCH_URI_DURATION, 2000);
+    rstrnt_metrics_observe (METRIC_FETCH_URI_DURATION, 2 * G_USEC_PER_SEC);
+
+    text = rstrnt_metrics_to_prometheus ();
+
+    // One HELP and TYPE for both methods
+    g_assert_nonnull (strstr (text, "# TYPE restraintd_fetch_bytes_total counter\n"));
+    g_assert_null (strstr (strstr (text, "# TYPE restraintd_fetch_bytes_total") + 1,
+                           "# TYPE restraintd_fetch_bytes_total"));
+    g_assert_nonnull (strstr (text, "restraintd_fetch_bytes_total{method=\"uri\"} 0\n"));
+    g_assert_nonnull (strstr (text, "restraintd_fetch_bytes_total{method=\"git\"} 2048\n"));
+
+    g_assert_nonnull (strstr (text, "# TYPE restraintd_fetch_seconds histogram\n"));
+    g_assert_nonnull (strstr (text,
+        "restraintd_fetch_seconds_bucket{method=\"uri\",le=\"0.001\"} 0\n"));
+    g_assert_nonnull (strstr (text,
+        "restraintd_fetch_seconds_bucket{method=\"uri\",le=\"0.005\"} 1\n"));
+    g_assert_nonnull (strstr (text,
+        "restraintd_fetch_seconds_bucket{method=\"uri\",le=\"5\"} 2\n"));
+    g_assert_nonnull (strstr (text,
+        "restraintd_fetch_seconds_bucket{method=\"uri\",le=\"+Inf\"} 2\n"));
+    g_assert_nonnull (strstr (text, "restraintd_fetch_seconds_sum{method=\"uri\"} 2.002\n"));
+    g_assert_nonnull (strstr (text, "restraintd_fetch_seconds_count{method=\"uri\"} 2\n"));
+    g_assert_nonnull (strstr (text, "restraintd_fetch_seconds_count{method=\"git\"} 0\n"));
+
+    g_assert_nonnull (strstr (text, "# TYPE restraintd_message_queue_depth gauge\n"));
+    g_assert_nonnull (strstr (text, "restraintd_message_queue_depth 0\n"));
+    g_free (text);
+
+    rstrnt_metrics_reset ();
+}
+
+static void
+test_metrics_summary (void)
+{
+    gchar *summary;
+
+    rstrnt_metrics_reset ();
+
+    rstrnt_metrics_inc (METRIC_CONFIG_WRITES);
+    rstrnt_metrics_observe (METRIC_CONFIG_WRITE_DURATION, 500);
+
+    summary = rstrnt_metrics_summary ();
+    g_assert_true (g_str_has_prefix (summary, "*** restraintd metrics\n"));
+    g_assert_nonnull (strstr (summary, "    restraintd_config_writes_total 1\n"));
+    g_assert_nonnull (strstr (summary,
+        "    restraintd_config_write_seconds count=1 p50=0.0005 p90=0.0005 p99=0.0005 max=0.0005\n"));
+    g_assert_nonnull (strstr (summary, "    restraintd_processes_total{launcher=\"fork\"} 0\n"));
+    g_free (summary);
+
+    rstrnt_metrics_reset ();
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/metrics/buckets", test_metrics_buckets);
+    g_test_add_func ("/metrics/values", test_metrics_values);
+    g_test_add_func ("/metrics/quantile", test_metrics_quantile);
+    g_test_add_func ("/metrics/prometheus", test_metrics_prometheus);
+    g_test_add_func ("/metrics/summary", test_metrics_summary);
+
+    return g_test_run ();
+}
@@ -0,0 +1,191 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "package_cache.h"
+#include "param.h"
+
+static const gchar *rpm_output =
+    "bash (none) 5.1.8 6.el9 x86_64\n"
+    "glibc (none) 2.34 60.el9 x86_64\n"
+    "glibc (none) 2.34 60.el9 i686\n"
+    "perl-Carp 0 1.50 460.el9 noarch\n"
+    "restraint-rhts 2 0.4.4 1.el9 x86_64\n"
+    "garbage\n"
+    "\n";
+
+static void test_package_cache_lookup (void)
+{
+    RstrntPackageCache *cache = rstrnt_package_cache_new ();
+    rstrnt_package_cache_parse (cache, rpm_output);
+
+    g_assert_true (cache->loaded);
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash.x86_64"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash-5.1.8"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash-5.1.8-6.el9"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash-5.1.8-6.el9.x86_64"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash-0:5.1.8-6.el9"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "glibc.i686"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "perl-Carp-0:1.50-460.el9.noarch"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "restraint-rhts-2:0.4.4-1.el9"));
+
+    // Other versions and things only the package manager can resolve
+    g_assert_false (rstrnt_package_cache_contains (cache, "bash-5.2.0-1.el9"));
+    g_assert_false (rstrnt_package_cache_contains (cache, "bash.i686"));
+    g_assert_false (rstrnt_package_cache_contains (cache, "restraint-rhts-0:0.4.4-1.el9"));
+    g_assert_false (rstrnt_package_cache_contains (cache, "/usr/bin/bash"));
+    g_assert_false (rstrnt_package_cache_contains (cache, "garbage"));
+
+    rstrnt_package_cache_free (cache);
+}
+
+static void test_package_cache_update (void)
+{
+    RstrntPackageCache *cache = rstrnt_package_cache_new ();
+    rstrnt_package_cache_parse (cache, rpm_output);
+
+    rstrnt_package_cache_add (cache, "tmux");
+    g_assert_true (rstrnt_package_cache_contains (cache, "tmux"));
+
+    // Removing a package forgets every spelling of it
+    rstrnt_package_cache_remove (cache, "glibc-2.34-60.el9.i686");
+    g_assert_false (rstrnt_package_cache_contains (cache, "glibc"));
+    g_assert_false (rstrnt_package_cache_contains (cache, "glibc.x86_64"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash"));
+
+    // Installed under one spelling, removed under another
+    rstrnt_package_cache_add (cache, "foo-1.0");
+    rstrnt_package_cache_add (cache, "bash-5.1.8");
+    g_assert_true (rstrnt_package_cache_contains (cache, "foo-1.0"));
+    rstrnt_package_cache_remove (cache, "foo");
+    g_assert_false (rstrnt_package_cache_contains (cache, "foo-1.0"));
+    rstrnt_package_cache_remove (cache, "bash");
+    g_assert_false (rstrnt_package_cache_contains (cache, "bash-5.1.8"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "tmux"));
+
+    rstrnt_package_cache_remove (cache, "not-installed");
+    rstrnt_package_cache_free (cache);
+}
+
+static void test_package_cache_unavailable (void)
+{
+    RstrntPackageCache *cache = rstrnt_package_cache_new ();
+
+    // The rpmdb could not be read, nothing may be reported as installed
+    cache->loaded = TRUE;
+    rstrnt_package_cache_add (cache, "tmux");
+    g_assert_false (rstrnt_package_cache_contains (cache, "tmux"));
+    g_assert_false (rstrnt_package_cache_contains (NULL, "tmux"));
+
+    rstrnt_package_cache_free (cache);
+}
+
+static void
+package_cache_loaded (gpointer user_data)
+{
+    g_main_loop_quit (user_data);
+}
+
+static void
+package_cache_counted (gpointer user_data)
+{
+    (*(guint *) user_data)++;
+}
+
+/* rpm is queried from the main loop, only once */
+static void test_package_cache_load (void)
+{
+    gchar *path = g_build_filename (g_get_tmp_dir (), "test_package_cache.rpmqa", NULL);
+    const gchar *query[] = { "cat", path, NULL };
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+    RstrntPackageCache *cache = rstrnt_package_cache_new ();
+    guint called = 0;
+
+    g_assert_true (g_file_set_contents (path, rpm_output, -1, NULL));
+    cache->query = query;
+    g_assert_false (rstrnt_package_cache_contains (cache, "bash"));
+    rstrnt_package_cache_load (cache, NULL, package_cache_loaded, loop);
+    g_assert_true (cache->loaded);
+    g_main_loop_run (loop);
+    g_assert_true (cache->available);
+    g_assert_true (rstrnt_package_cache_contains (cache, "bash-5.1.8-6.el9.x86_64"));
+    g_assert_true (rstrnt_package_cache_contains (cache, "restraint-rhts"));
+    g_assert_false (rstrnt_package_cache_contains (cache, "garbage"));
+
+    // Loaded already, called back right away
+    cache->query = NULL;
+    rstrnt_package_cache_load (cache, NULL, package_cache_counted, &called);
+    g_assert_cmpuint (called, ==, 1);
+
+    rstrnt_package_cache_free (cache);
+    g_main_loop_unref (loop);
+    g_remove (path);
+    g_free (path);
+}
+
+static void test_package_cache_load_failed (void)
+{
+    const gchar *query[] = { "false", NULL };
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+    RstrntPackageCache *cache = rstrnt_package_cache_new ();
+
+    cache->query = query;
+    g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*installed packages returned*");
+    rstrnt_package_cache_load (cache, NULL, package_cache_loaded, loop);
+    g_main_loop_run (loop);
+    g_test_assert_expected_messages ();
+    g_assert_false (cache->available);
+    rstrnt_package_cache_add (cache, "tmux");
+    g_assert_false (rstrnt_package_cache_contains (cache, "tmux"));
+
+    rstrnt_package_cache_free (cache);
+    g_main_loop_unref (loop);
+}
+
+static void test_package_force_reinstall (void)
+{
+    Param recipe_param = { .name = PACKAGE_FORCE_REINSTALL, .value = "true" };
+    Param task_param = { .name = PACKAGE_FORCE_REINSTALL, .value = "0" };
+    Param other = { .name = "RSTRNT_USE_PTY", .value = "TRUE" };
+    GList *recipe_params = g_list_append (NULL, &recipe_param);
+    GList *task_params = g_list_append (NULL, &other);
+
+    g_assert_false (rstrnt_package_force_reinstall (NULL, NULL));
+    g_assert_true (rstrnt_package_force_reinstall (recipe_params, NULL));
+    g_assert_true (rstrnt_package_force_reinstall (recipe_params, task_params));
+
+    // The task param wins over the recipe one
+    task_params = g_list_append (task_params, &task_param);
+    g_assert_false (rstrnt_package_force_reinstall (recipe_params, task_params));
+
+    g_list_free (recipe_params);
+    g_list_free (task_params);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/package_cache/lookup", test_package_cache_lookup);
+    g_test_add_func("/package_cache/update", test_package_cache_update);
+    g_test_add_func("/package_cache/unavailable", test_package_cache_unavailable);
+    g_test_add_func("/package_cache/load", test_package_cache_load);
+    g_test_add_func("/package_cache/load_failed", test_package_cache_load_failed);
+    g_test_add_func("/package_cache/force_reinstall", test_package_force_reinstall);
+    return g_test_run();
+}
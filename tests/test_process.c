@@ -17,7 +17,10 @@
 
 #include <glib.h>
 #include <string.h>
+#include <sys/wait.h>
 
+#include "cgroup.h"
+#include "common.h"
 #include "process.h"
 #include "errors.h"
 
@@ -472,6 +475,167 @@ test_process_read_empty_stdin_pty (void)
     g_slice_free (RunData, run_data);
 }
 
+static void
+run_argv_cgroup (const gchar *const *argv, const gchar *path, RstrntCgroup *cgroup,
+                 RunData *run_data)
+{
+    run_data->loop = g_main_loop_new (NULL, TRUE);
+    run_data->output = g_string_new (NULL);
+
+    process_run_argv (argv,
+                      NULL,
+                      path,
+                      cgroup,
+                      NULL,
+                      FALSE,
+                      NULL,
+                      NULL,
+                      test_process_io_cb,
+                      test_process_finish_cb,
+                      NULL,
+                      0,
+                      FALSE,
+                      NULL,
+                      run_data);
+
+    g_main_loop_run (run_data->loop);
+}
+
+static void
+run_argv (const gchar *const *argv, const gchar *path, RunData *run_data)
+{
+    run_argv_cgroup (argv, path, NULL, run_data);
+}
+
+static void
+test_process_argv (void)
+{
+    RunData *run_data;
+    const gchar *command[] = { "printf", "[%s]", "a b", NULL };
+
+    run_data = g_slice_new0 (RunData);
+    run_argv (command, NULL, run_data);
+
+    // "a b" reaches printf as a single argument
+    g_assert_no_error (run_data->error);
+    g_assert_cmpstr (run_data->output->str, ==,
+                     "use_pty:FALSE printf [%s] a b\n[a b]");
+    g_assert_cmpint (run_data->pid_result, ==, 0);
+    g_string_free (run_data->output, TRUE);
+    g_slice_free (RunData, run_data);
+}
+
+static void
+test_process_missing_command (void)
+{
+    RunData *run_data;
+    const gchar *command[] = { "rstrnt-no-such-command", NULL };
+
+    run_data = g_slice_new0 (RunData);
+    run_argv (command, NULL, run_data);
+
+    g_assert_no_error (run_data->error);
+    g_assert_nonnull (strstr (run_data->output->str,
+                              "Failed to exec() rstrnt-no-such-command"));
+    g_assert_true (WIFEXITED (run_data->pid_result));
+    g_assert_cmpint (WEXITSTATUS (run_data->pid_result), ==, SPAWN_COMMAND_FAILED);
+    g_string_free (run_data->output, TRUE);
+    g_slice_free (RunData, run_data);
+}
+
+static void
+test_process_bad_path (void)
+{
+    RunData *run_data;
+    const gchar *command[] = { "true", NULL };
+
+    run_data = g_slice_new0 (RunData);
+    run_argv (command, "/rstrnt/no/such/dir", run_data);
+
+    g_assert_no_error (run_data->error);
+    g_assert_true (WIFEXITED (run_data->pid_result));
+    g_assert_cmpint (WEXITSTATUS (run_data->pid_result), ==, INVALID_COMMAND_PATH);
+    g_string_free (run_data->output, TRUE);
+    g_slice_free (RunData, run_data);
+}
+
+static gdouble
+time_launcher (ProcessLauncher launcher, RstrntCgroup *cgroup, guint runs)
+{
+    const gchar *command[] = { "true", NULL };
+    GTimer *timer = g_timer_new ();
+    gdouble elapsed;
+
+    process_set_launcher (launcher);
+    for (guint i = 0; i < runs; i++) {
+        RunData *run_data = g_slice_new0 (RunData);
+        run_argv_cgroup (command, NULL, cgroup, run_data);
+        g_assert_cmpint (run_data->pid_result, ==, 0);
+        g_string_free (run_data->output, TRUE);
+        g_slice_free (RunData, run_data);
+    }
+    process_set_launcher (PROCESS_LAUNCHER_SPAWN);
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    return elapsed;
+}
+
+/*
+ * fork() has to copy the page tables of restraintd, so it slows
+ * down as the daemon grows.  posix_spawn() should stay flat, also when
+ * the child is started in a cgroup, as long as clone3() can do it.
+ */
+static void
+test_process_launcher_perf (void)
+{
+    const gsize sizes[] = { 0, 256, 1024 };
+    const guint runs = 200;
+    RstrntCgroup *cgroup = NULL;
+    GError *error = NULL;
+
+    if (rstrnt_cgroup_init (&error)) {
+        cgroup = rstrnt_cgroup_new ("launcher-perf", &error);
+    }
+    if (cgroup == NULL) {
+        g_test_message ("skipping the cgroup launchers: %s", error->message);
+        g_clear_error (&error);
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS (sizes); i++) {
+        gsize bytes = sizes[i] * 1024 * 1024;
+        gchar *ballast = NULL;
+
+        if (bytes) {
+            ballast = g_try_malloc (bytes);
+            if (ballast == NULL) {
+                g_test_message ("skipping %" G_GSIZE_FORMAT " MiB, out of memory",
+                                sizes[i]);
+                continue;
+            }
+            memset (ballast, 1, bytes);
+        }
+
+        gdouble spawn = time_launcher (PROCESS_LAUNCHER_SPAWN, NULL, runs);
+        gdouble forked = time_launcher (PROCESS_LAUNCHER_FORK, NULL, runs);
+        g_test_message ("rss +%4" G_GSIZE_FORMAT " MiB: spawn %.1f us, fork %.1f us per child",
+                        sizes[i], spawn * 1e6 / runs, forked * 1e6 / runs);
+        if (cgroup != NULL) {
+            gdouble spawn_cgroup = time_launcher (PROCESS_LAUNCHER_SPAWN, cgroup, runs);
+            gdouble forked_cgroup = time_launcher (PROCESS_LAUNCHER_FORK, cgroup, runs);
+            g_test_message ("rss +%4" G_GSIZE_FORMAT " MiB in %s: spawn %.1f us, fork %.1f us per child",
+                            sizes[i], cgroup->path, spawn_cgroup * 1e6 / runs,
+                            forked_cgroup * 1e6 / runs);
+        }
+        if (i == G_N_ELEMENTS (sizes) - 1)
+            g_test_minimized_result (spawn * 1e6 / runs,
+                                     "posix_spawn %.1f us per child",
+                                     spawn * 1e6 / runs);
+        g_free (ballast);
+    }
+    rstrnt_cgroup_unref (cgroup);
+}
+
 int main(int argc, char *argv[]) {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/process/success", test_process_success);
@@ -486,5 +650,11 @@ int main(int argc, char *argv[]) {
     g_test_add_func ("/process/read_empty_stdin", test_process_read_empty_stdin);
     g_test_add_func ("/process/read_empty_stdin_pty", test_process_read_empty_stdin_pty);
 
+    g_test_add_func ("/process/argv", test_process_argv);
+    g_test_add_func ("/process/missing_command", test_process_missing_command);
+    g_test_add_func ("/process/bad_path", test_process_bad_path);
+    if (g_test_perf ())
+        g_test_add_func ("/process/launcher_perf", test_process_launcher_perf);
+
     return g_test_run();
 }
@@ -0,0 +1,149 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "report_plugin.h"
+
+static void test_dmesg_scan (void)
+{
+    GRegex *failure = g_regex_new ("Oops|BUG|NMI appears to be stuck|Badness at",
+                                   0, 0, NULL);
+    GRegex *false_strings = g_regex_new ("BIOS BUG|DEBUG", 0, 0, NULL);
+    const gchar *dmesg =
+        "[    0.000000] Linux version 4.18.0\n"
+        "[    1.000000] BIOS BUG: ignored\n"
+        "[    2.000000] ------------[ cut here ]------------\n"
+        "[    2.000001] WARNING: at kernel/fake.c:1\n"
+        "[    2.000002] ---[ end trace 1234 ]---\n"
+        "[    3.000000] ------------[ cut here ]------------\n"
+        "[    3.000001] DEBUG: harmless\n"
+        "[    3.000002] ---[ end trace 5678 ]---\n"
+        "[    4.000000] BUG: soft lockup - CPU#0 stuck\n";
+
+    gchar *found = rstrnt_dmesg_scan (dmesg, failure, false_strings);
+    g_assert_cmpstr (found, ==,
+        "[    2.000000] ------------[ cut here ]------------\n"
+        "[    2.000001] WARNING: at kernel/fake.c:1\n"
+        "[    2.000002] ---[ end trace 1234 ]---\n"
+        "[    4.000000] BUG: soft lockup - CPU#0 stuck\n");
+    g_free (found);
+
+    found = rstrnt_dmesg_scan ("[    1.000000] BIOS BUG: ignored\n", failure,
+                               false_strings);
+    g_assert_null (found);
+
+    g_regex_unref (failure);
+    g_regex_unref (false_strings);
+}
+
+static void test_kmsg_record (void)
+{
+    const gchar *record = "4,1234,5678901,-;BUG: bad\\x0athing \\x5c\n"
+                          " SUBSYSTEM=pci\n";
+    GString *out = g_string_new (NULL);
+    guint64 seq = 0;
+
+    g_assert_true (rstrnt_kmsg_record (record, strlen (record), &seq, out));
+    g_assert_cmpuint (seq, ==, 1234);
+    g_assert_cmpstr (out->str, ==, "[    5.678901] BUG: bad\nthing \\\n");
+
+    g_string_truncate (out, 0);
+    record = "6,1235,10000000,c;short\n";
+    g_assert_true (rstrnt_kmsg_record (record, strlen (record), &seq, out));
+    g_assert_cmpuint (seq, ==, 1235);
+    g_assert_cmpstr (out->str, ==, "[   10.000000] short\n");
+
+    record = "not a record\n";
+    g_assert_false (rstrnt_kmsg_record (record, strlen (record), &seq, NULL));
+    g_string_free (out, TRUE);
+}
+
+static void test_avc_scan (void)
+{
+    const gchar *audit_log =
+        "type=AVC msg=audit(1500000000.100:10): avc:  denied  { read } for pid=1 comm=\"old\"\n"
+        "type=AVC msg=audit(1600000000.100:11): avc:  denied  { read } for pid=2 comm=\"new\"\n"
+        "type=AVC msg=audit(1600000000.200:12): avc:  denied  { open } for pid=3 permissive=1\n"
+        "type=USER_AVC msg=audit(1600000000.300:13): avc:  granted  { status } for pid=4\n"
+        "type=SYSCALL msg=audit(1600000000.400:14): arch=c000003e denied\n"
+        "type=SELINUX_ERR msg=audit(1600000000.500:15): op=security_compute_sid invalid_context\n";
+
+    gchar *found = rstrnt_avc_scan (audit_log, 1600000000);
+    g_assert_cmpstr (found, ==,
+        "----\n"
+        "type=AVC msg=audit(1600000000.100:11): avc:  denied  { read } for pid=2 comm=\"new\"\n"
+        "----\n"
+        "type=SELINUX_ERR msg=audit(1600000000.500:15): op=security_compute_sid invalid_context\n");
+    g_free (found);
+
+    found = rstrnt_avc_scan (audit_log, 1700000000);
+    g_assert_null (found);
+}
+
+static void
+shell_only_cb (const gchar *shell_disabled, gpointer user_data)
+{
+    gchar **result = user_data;
+
+    *result = g_strdup (shell_disabled != NULL ? shell_disabled : "<none>");
+}
+
+static void test_plugins_shell_only (void)
+{
+    gchar *plugin_dir = g_dir_make_tmp ("test_report_plugin_XXXXXX", NULL);
+    gchar *custom = g_build_filename (plugin_dir, "50_custom", NULL);
+    gchar *other = g_build_filename (plugin_dir, "60_other", NULL);
+    gchar *result = NULL;
+
+    g_file_set_contents (custom, "#!/bin/sh\n", -1, NULL);
+    g_file_set_contents (other, "#!/bin/sh\n", -1, NULL);
+
+    // No native plugins, the callback runs straight away
+    rstrnt_report_plugins_run (plugin_dir, "/distribution/check-install",
+                               "http://localhost/results/1", NULL, "60_other",
+                               shell_only_cb, &result);
+    g_assert_cmpstr (result, ==, "60_other");
+    g_free (result);
+    result = NULL;
+
+    // Nothing left for the shell
+    rstrnt_report_plugins_run (plugin_dir, "/distribution/check-install",
+                               "http://localhost/results/1", NULL,
+                               "50_custom 60_other", shell_only_cb, &result);
+    g_assert_cmpstr (result, ==, "<none>");
+    g_free (result);
+
+    g_remove (custom);
+    g_remove (other);
+    g_remove (plugin_dir);
+    g_free (custom);
+    g_free (other);
+    g_free (plugin_dir);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/report_plugin/dmesg_scan", test_dmesg_scan);
+    g_test_add_func("/report_plugin/kmsg_record", test_kmsg_record);
+    g_test_add_func("/report_plugin/avc_scan", test_avc_scan);
+    g_test_add_func("/report_plugin/shell_only", test_plugins_shell_only);
+    return g_test_run();
+}
@@ -0,0 +1,381 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#include "spool.h"
+
+#define RESULTS_URL "http://lab.example.com:8000/recipes/1/tasks/2/results/"
+
+typedef struct {
+    SoupMessage *msg;
+    MessageFinishCallback callback;
+    gpointer user_data;
+} QueuedMessage;
+
+static gchar *tmp_test_dir;
+static GQueue *queued;
+
+/* Stands in for restraint_queue_message(), the test answers for the lab controller */
+static void
+test_queue_message (SoupSession *session, SoupMessage *msg, gpointer msg_data,
+                    MessageFinishCallback callback, GCancellable *cancellable,
+                    gpointer user_data)
+{
+    QueuedMessage *queued_msg = g_slice_new (QueuedMessage);
+
+    queued_msg->msg = msg;
+    queued_msg->callback = callback;
+    queued_msg->user_data = user_data;
+    g_queue_push_tail (queued, queued_msg);
+}
+
+static void
+lab_controller_answer (guint status, const gchar *location, const gchar *body)
+{
+    QueuedMessage *queued_msg = g_queue_pop_head (queued);
+    SoupMessage *msg;
+    SoupBuffer *request;
+
+    g_assert_nonnull (queued_msg);
+    msg = queued_msg->msg;
+    g_assert_cmpstr (msg->method, ==, "POST");
+    request = soup_message_body_flatten (msg->request_body);
+    g_assert_cmpstr (request->data, ==, body);
+    soup_buffer_free (request);
+    soup_message_set_status (msg, status);
+    if (location != NULL) {
+        soup_message_headers_append (msg->response_headers, "Location", location);
+    }
+    queued_msg->callback (NULL, msg, queued_msg->user_data);
+    g_object_unref (msg);
+    g_slice_free (QueuedMessage, queued_msg);
+}
+
+/* Answers a log PUT the spool replays, checking where it goes */
+static void
+lab_controller_log (guint status, const gchar *url, const gchar *range, const gchar *body)
+{
+    QueuedMessage *queued_msg = g_queue_pop_head (queued);
+    SoupMessage *msg;
+    SoupBuffer *request;
+    gchar *msg_url;
+
+    g_assert_nonnull (queued_msg);
+    msg = queued_msg->msg;
+    g_assert_cmpstr (msg->method, ==, "PUT");
+    msg_url = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
+    g_assert_cmpstr (msg_url, ==, url);
+    g_free (msg_url);
+    g_assert_cmpstr (soup_message_headers_get_one (msg->request_headers, "Content-Range"),
+                     ==, range);
+    request = soup_message_body_flatten (msg->request_body);
+    g_assert_cmpmem (request->data, request->length, body, strlen (body));
+    soup_buffer_free (request);
+    soup_message_set_status (msg, status);
+    queued_msg->callback (NULL, msg, queued_msg->user_data);
+    g_object_unref (msg);
+    g_slice_free (QueuedMessage, queued_msg);
+}
+
+/* A restraintd that went away before the lab controller answered */
+static void
+lab_controller_lost (void)
+{
+    while (!g_queue_is_empty (queued)) {
+        QueuedMessage *queued_msg = g_queue_pop_head (queued);
+
+        g_object_unref (queued_msg->msg);
+        g_slice_free (QueuedMessage, queued_msg);
+    }
+}
+
+static void
+spool_remove (const gchar *path)
+{
+    gchar *logs_dir = g_strconcat (path, ".logs", NULL);
+
+    g_remove (logs_dir);
+    g_remove (path);
+    g_free (logs_dir);
+}
+
+static void
+spool_ready (RstrntSpoolState state, const gchar *location, gpointer user_data)
+{
+    gchar **ready = user_data;
+
+    g_assert_cmpint (state, ==, SPOOL_FORWARDED);
+    *ready = g_strdup (location);
+}
+
+static gsize
+spool_size (const gchar *path)
+{
+    GStatBuf st;
+
+    g_assert_cmpint (g_stat (path, &st), ==, 0);
+    return st.st_size;
+}
+
+static void
+test_spool_forward (void)
+{
+    const gchar *location;
+    RstrntSpoolState state;
+    RstrntSpool *spool;
+    GError *error = NULL;
+    gchar *ready = NULL;
+    guint64 first, second;
+    gchar *path;
+
+    path = g_build_filename (tmp_test_dir, "forward.spool", NULL);
+    spool = rstrnt_spool_open (path, test_queue_message, NULL, &error);
+    g_assert_no_error (error);
+
+    first = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fa&result=PASS", &error);
+    g_assert_no_error (error);
+    second = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fb&result=FAIL", &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (first, >, 0);
+    g_assert_cmpuint (second, >, first);
+    g_assert_cmpuint (rstrnt_spool_pending (spool), ==, 2);
+    g_assert_cmpuint (g_queue_get_length (queued), ==, 2);
+    g_assert_cmpuint (spool_size (path), >, 0);
+
+    g_assert_true (rstrnt_spool_lookup (spool, second, &state, &location));
+    g_assert_cmpint (state, ==, SPOOL_PENDING);
+    g_assert_null (location);
+    rstrnt_spool_wait (spool, second, spool_ready, &ready);
+    g_assert_false (rstrnt_spool_lookup (spool, second + 1, NULL, NULL));
+
+    // In the order they were added, a relative Location is made absolute
+    lab_controller_answer (SOUP_STATUS_CREATED, "/recipes/1/tasks/2/results/41",
+                           "path=%2Fa&result=PASS");
+    g_assert_true (rstrnt_spool_lookup (spool, first, &state, &location));
+    g_assert_cmpint (state, ==, SPOOL_FORWARDED);
+    g_assert_cmpstr (location, ==, "http://lab.example.com:8000/recipes/1/tasks/2/results/41");
+    g_assert_null (ready);
+
+    lab_controller_answer (SOUP_STATUS_CREATED, RESULTS_URL "42", "path=%2Fb&result=FAIL");
+    g_assert_cmpstr (ready, ==, RESULTS_URL "42");
+    g_assert_cmpuint (rstrnt_spool_pending (spool), ==, 0);
+
+    // Nothing left to forward, only the mappings in memory remain
+    g_assert_cmpuint (spool_size (path), ==, 0);
+    g_assert_true (rstrnt_spool_lookup (spool, first, &state, NULL));
+
+    rstrnt_spool_free (spool);
+    spool_remove (path);
+    g_free (ready);
+    g_free (path);
+}
+
+/* What a restraintd killed or rebooted left behind is forwarded again */
+static void
+test_spool_reopen (void)
+{
+    const gchar *location;
+    RstrntSpoolState state;
+    RstrntSpool *spool;
+    GError *error = NULL;
+    guint64 first, second, third;
+    gchar *contents;
+    gchar *path;
+
+    path = g_build_filename (tmp_test_dir, "reopen.spool", NULL);
+    spool = rstrnt_spool_open (path, test_queue_message, NULL, &error);
+    g_assert_no_error (error);
+    first = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fa&result=PASS", &error);
+    second = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fb&result=PASS", &error);
+    third = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fc&result=WARN", &error);
+    g_assert_no_error (error);
+    lab_controller_answer (SOUP_STATUS_CREATED, RESULTS_URL "41", "path=%2Fa&result=PASS");
+    rstrnt_spool_free (spool);
+
+    // The second answer never made it, and the last line was torn
+    lab_controller_lost ();
+    g_assert_true (g_file_get_contents (path, &contents, NULL, &error));
+    contents = g_realloc (contents, strlen (contents) + 32);
+    strcat (contents, "{\"id\":1,\"url\":\"http://lab");
+    g_assert_true (g_file_set_contents (path, contents, -1, &error));
+    g_free (contents);
+
+    spool = rstrnt_spool_open (path, test_queue_message, NULL, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (rstrnt_spool_pending (spool), ==, 2);
+    g_assert_true (rstrnt_spool_lookup (spool, first, &state, &location));
+    g_assert_cmpint (state, ==, SPOOL_FORWARDED);
+    g_assert_cmpstr (location, ==, RESULTS_URL "41");
+
+    lab_controller_answer (SOUP_STATUS_CREATED, RESULTS_URL "42", "path=%2Fb&result=PASS");
+    lab_controller_answer (SOUP_STATUS_CREATED, RESULTS_URL "43", "path=%2Fc&result=WARN");
+    g_assert_true (rstrnt_spool_lookup (spool, second, &state, &location));
+    g_assert_cmpstr (location, ==, RESULTS_URL "42");
+    g_assert_true (rstrnt_spool_lookup (spool, third, &state, &location));
+    g_assert_cmpstr (location, ==, RESULTS_URL "43");
+    g_assert_cmpuint (rstrnt_spool_pending (spool), ==, 0);
+
+    // New ids never reuse the ones handed out before
+    g_assert_cmpuint (rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fd&result=PASS", &error),
+                      >, third);
+    g_assert_no_error (error);
+    lab_controller_answer (SOUP_STATUS_CREATED, RESULTS_URL "44", "path=%2Fd&result=PASS");
+
+    rstrnt_spool_free (spool);
+    spool_remove (path);
+    g_free (path);
+}
+
+static void
+test_spool_rejected (void)
+{
+    const gchar *location;
+    RstrntSpoolState state;
+    RstrntSpool *spool;
+    GError *error = NULL;
+    guint64 id;
+    gchar *path;
+
+    path = g_build_filename (tmp_test_dir, "rejected.spool", NULL);
+    spool = rstrnt_spool_open (path, test_queue_message, NULL, &error);
+    g_assert_no_error (error);
+    id = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fa&result=BOGUS", &error);
+    g_assert_no_error (error);
+
+    g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*was rejected*");
+    lab_controller_answer (SOUP_STATUS_BAD_REQUEST, NULL, "path=%2Fa&result=BOGUS");
+    g_test_assert_expected_messages ();
+
+    g_assert_true (rstrnt_spool_lookup (spool, id, &state, &location));
+    g_assert_cmpint (state, ==, SPOOL_REJECTED);
+    g_assert_null (location);
+    g_assert_cmpuint (rstrnt_spool_pending (spool), ==, 0);
+
+    rstrnt_spool_free (spool);
+    spool_remove (path);
+    g_free (path);
+}
+
+/*
+ * A report plugin PUTs its log while the lab controller is still busy
+ * with the result, the PUTs are answered right away and replayed once
+ * the result has a location.
+ */
+static void
+test_spool_logs (void)
+{
+    RstrntSpool *spool;
+    GError *error = NULL;
+    guint64 id;
+    gchar *path;
+
+    path = g_build_filename (tmp_test_dir, "logs.spool", NULL);
+    spool = rstrnt_spool_open (path, test_queue_message, NULL, &error);
+    g_assert_no_error (error);
+    id = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fa&result=FAIL", &error);
+    g_assert_no_error (error);
+
+    g_assert_true (rstrnt_spool_holds_logs (spool, id));
+    g_assert_true (rstrnt_spool_add_log (spool, id, "avc.log", "bytes 0-4/10",
+                                         "hello", 5, &error));
+    g_assert_true (rstrnt_spool_add_log (spool, id, "avc.log", "bytes 5-9/10",
+                                         "world", 5, &error));
+    g_assert_no_error (error);
+    g_assert_cmpuint (g_queue_get_length (queued), ==, 1);
+
+    lab_controller_answer (SOUP_STATUS_CREATED, RESULTS_URL "42/", "path=%2Fa&result=FAIL");
+    g_assert_true (rstrnt_spool_holds_logs (spool, id));
+
+    // One at a time and in the order they came
+    g_assert_cmpuint (g_queue_get_length (queued), ==, 1);
+    lab_controller_log (SOUP_STATUS_NO_CONTENT, RESULTS_URL "42/logs/avc.log",
+                        "bytes 0-4/10", "hello");
+    g_assert_cmpuint (g_queue_get_length (queued), ==, 1);
+    lab_controller_log (SOUP_STATUS_NO_CONTENT, RESULTS_URL "42/logs/avc.log",
+                        "bytes 5-9/10", "world");
+
+    // Later logs go straight to the lab controller
+    g_assert_false (rstrnt_spool_holds_logs (spool, id));
+    g_assert_true (g_queue_is_empty (queued));
+    g_assert_cmpuint (spool_size (path), ==, 0);
+
+    rstrnt_spool_free (spool);
+    spool_remove (path);
+    g_free (path);
+}
+
+/* Logs kept when restraintd went away are replayed after the restart */
+static void
+test_spool_logs_reopen (void)
+{
+    RstrntSpool *spool;
+    GError *error = NULL;
+    guint64 id;
+    gchar *path;
+
+    path = g_build_filename (tmp_test_dir, "logs_reopen.spool", NULL);
+    spool = rstrnt_spool_open (path, test_queue_message, NULL, &error);
+    g_assert_no_error (error);
+    id = rstrnt_spool_add (spool, RESULTS_URL, "path=%2Fa&result=PASS", &error);
+    g_assert_true (rstrnt_spool_add_log (spool, id, "dmesg.log", NULL, "oops", 4, &error));
+    g_assert_no_error (error);
+    rstrnt_spool_free (spool);
+    lab_controller_lost ();
+
+    spool = rstrnt_spool_open (path, test_queue_message, NULL, &error);
+    g_assert_no_error (error);
+    g_assert_true (rstrnt_spool_holds_logs (spool, id));
+    lab_controller_answer (SOUP_STATUS_CREATED, RESULTS_URL "42", "path=%2Fa&result=PASS");
+    lab_controller_log (SOUP_STATUS_NO_CONTENT, RESULTS_URL "42/logs/dmesg.log",
+                        NULL, "oops");
+    g_assert_false (rstrnt_spool_holds_logs (spool, id));
+    g_assert_cmpuint (spool_size (path), ==, 0);
+
+    rstrnt_spool_free (spool);
+    spool_remove (path);
+    g_free (path);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    int retval;
+
+    g_test_init (&argc, &argv, NULL);
+
+    tmp_test_dir = g_dir_make_tmp ("test_spool_XXXXXX", NULL);
+    queued = g_queue_new ();
+
+    g_test_add_func ("/spool/forward", test_spool_forward);
+    g_test_add_func ("/spool/reopen", test_spool_reopen);
+    g_test_add_func ("/spool/rejected", test_spool_rejected);
+    g_test_add_func ("/spool/logs", test_spool_logs);
+    g_test_add_func ("/spool/logs_reopen", test_spool_logs_reopen);
+
+    retval = g_test_run ();
+
+    g_queue_free (queued);
+    g_remove (tmp_test_dir);
+    g_free (tmp_test_dir);
+
+    return retval;
+}
@@ -0,0 +1,185 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "sync_server.h"
+
+#define LOAD_EVENTS 1000
+#define LOAD_OWNERS 2500
+#define LOAD_PER_OWNER 4
+#define SOCKET_WAITERS 200
+
+static void
+count_notify (gpointer owner, const gchar *event, gpointer user_data)
+{
+    guint *notified = user_data;
+
+    (*notified)++;
+}
+
+static void test_table_load (void)
+{
+    guint notified = 0;
+    RstrntSyncTable *table = rstrnt_sync_table_new (count_notify, &notified);
+    gchar event[32];
+    guint dropped = 0;
+
+    // Owners are only compared, any distinct pointer will do
+    for (guint owner = 1; owner <= LOAD_OWNERS; owner++) {
+        for (guint i = 0; i < LOAD_PER_OWNER; i++) {
+            g_snprintf (event, sizeof (event), "event_%u",
+                        (owner * 7 + i) % LOAD_EVENTS);
+            g_assert_false (rstrnt_sync_table_block (table,
+                            GUINT_TO_POINTER (owner), event));
+        }
+    }
+    g_assert_cmpuint (table->n_waiters, ==, LOAD_OWNERS * LOAD_PER_OWNER);
+
+    // Gone before anything was set
+    for (guint owner = 5; owner <= LOAD_OWNERS; owner += 5) {
+        rstrnt_sync_table_drop (table, GUINT_TO_POINTER (owner));
+        dropped++;
+    }
+    g_assert_cmpuint (table->n_waiters, ==,
+                      (LOAD_OWNERS - dropped) * LOAD_PER_OWNER);
+
+    for (guint i = 0; i < LOAD_EVENTS; i++) {
+        g_snprintf (event, sizeof (event), "event_%u", i);
+        rstrnt_sync_table_set (table, event);
+    }
+    g_assert_cmpuint (notified, ==, (LOAD_OWNERS - dropped) * LOAD_PER_OWNER);
+    g_assert_cmpuint (table->n_waiters, ==, 0);
+    g_assert_cmpuint (g_hash_table_size (table->waiters), ==, 0);
+    g_assert_cmpuint (g_hash_table_size (table->owners), ==, 0);
+
+    // Already set, nothing to wait for
+    notified = 0;
+    rstrnt_sync_table_set (table, "event_0");
+    g_assert_cmpuint (notified, ==, 0);
+    g_assert_true (rstrnt_sync_table_block (table, GUINT_TO_POINTER (1),
+                                            "event_0"));
+    g_assert_cmpuint (table->n_waiters, ==, 0);
+
+    rstrnt_sync_table_free (table);
+}
+
+static void test_table_drop (void)
+{
+    guint notified = 0;
+    RstrntSyncTable *table = rstrnt_sync_table_new (count_notify, &notified);
+
+    rstrnt_sync_table_block (table, GUINT_TO_POINTER (1), "a");
+    rstrnt_sync_table_block (table, GUINT_TO_POINTER (1), "b");
+    rstrnt_sync_table_block (table, GUINT_TO_POINTER (2), "a");
+
+    rstrnt_sync_table_drop (table, GUINT_TO_POINTER (1));
+    g_assert_cmpuint (table->n_waiters, ==, 1);
+    g_assert_false (g_hash_table_contains (table->waiters, "b"));
+
+    rstrnt_sync_table_set (table, "b");
+    g_assert_cmpuint (notified, ==, 0);
+    rstrnt_sync_table_set (table, "a");
+    g_assert_cmpuint (notified, ==, 1);
+
+    // Unknown owners are fine
+    rstrnt_sync_table_drop (table, GUINT_TO_POINTER (3));
+
+    rstrnt_sync_table_free (table);
+}
+
+static void
+iterate_until_waiters (RstrntSyncServer *server, guint waiters)
+{
+    for (guint i = 0; i < 1000 && server->table->n_waiters != waiters; i++) {
+        while (g_main_context_iteration (NULL, FALSE));
+        g_usleep (1000);
+    }
+    g_assert_cmpuint (server->table->n_waiters, ==, waiters);
+}
+
+static void test_server_sockets (void)
+{
+    RstrntSyncServer *server;
+    GError *error = NULL;
+    gint clients[SOCKET_WAITERS];
+    gint setter[2];
+    GString *sets = g_string_new (NULL);
+    gchar event[32];
+    gchar buf[64];
+
+    server = rstrnt_sync_server_new (&error);
+    g_assert_no_error (error);
+
+    for (guint i = 0; i < SOCKET_WAITERS; i++) {
+        gint pair[2];
+        g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, pair), ==, 0);
+        rstrnt_sync_server_add_conn (server, pair[1], FALSE);
+        clients[i] = pair[0];
+
+        // Frames split across writes still make one event
+        g_snprintf (event, sizeof (event), "event_%u", i % 10);
+        g_assert_cmpint (send (clients[i], event, 3, 0), ==, 3);
+        g_assert_cmpint (send (clients[i], event + 3, strlen (event) - 2, 0),
+                         ==, strlen (event) - 2);
+    }
+    iterate_until_waiters (server, SOCKET_WAITERS);
+
+    // Hanging up is noticed without anything being sent
+    for (guint i = 0; i < SOCKET_WAITERS; i += 10) {
+        close (clients[i]);
+        clients[i] = -1;
+    }
+    iterate_until_waiters (server, SOCKET_WAITERS - SOCKET_WAITERS / 10);
+
+    // One connection setting every event at once
+    for (guint i = 0; i < 10; i++) {
+        g_snprintf (event, sizeof (event), "event_%u", i);
+        g_string_append_len (sets, event, strlen (event) + 1);
+    }
+    g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, setter), ==, 0);
+    rstrnt_sync_server_add_conn (server, setter[1], TRUE);
+    g_assert_cmpint (send (setter[0], sets->str, sets->len, 0), ==, sets->len);
+    close (setter[0]);
+    iterate_until_waiters (server, 0);
+
+    for (guint i = 0; i < SOCKET_WAITERS; i++) {
+        if (clients[i] < 0) {
+            continue;
+        }
+        g_snprintf (event, sizeof (event), "event_%u", i % 10);
+        g_assert_cmpint (recv (clients[i], buf, sizeof (buf), MSG_DONTWAIT),
+                         ==, strlen (event) + 1);
+        g_assert_cmpstr (buf, ==, event);
+        close (clients[i]);
+    }
+
+    g_string_free (sets, TRUE);
+    rstrnt_sync_server_free (server);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/sync_server/table/load", test_table_load);
+    g_test_add_func("/sync_server/table/drop", test_table_drop);
+    g_test_add_func("/sync_server/sockets", test_server_sockets);
+    return g_test_run();
+}
@@ -353,6 +353,190 @@ test_param_override_use_pty (gconstpointer user_data)
     g_assert_true (metadata.use_pty == test_case->expected);
 }
 
+static void
+test_recipe_update_roles_from_memory (void)
+{
+    const gchar *xml =
+        "<job><recipeSet><recipe id=\"1\">"
+        "<roles><role value=\"SERVERS\"><system value=\"a\"/>"
+        "<system value=\"b\"/></role></roles>"
+        "<task id=\"11\" name=\"/a\"><params><param name=\"X\" value=\"y\"/>"
+        "</params><roles><role value=\"CLIENTS\"><system value=\"c\"/>"
+        "</role></roles></task>"
+        "<task id=\"12\" name=\"/b\"/>"
+        "</recipe></recipeSet></job>";
+    const gchar *bad =
+        "<job><recipeSet><recipe id=\"1\"><task id=\"11\" name=\"/a\">"
+        "<roles><role/></roles></task></recipe></recipeSet></job>";
+    Recipe *recipe = g_slice_new0 (Recipe);
+    Task *first = restraint_task_new ();
+    Task *second = restraint_task_new ();
+    GError *error = NULL;
+    Role *role;
+
+    first->task_id = g_strdup ("11");
+    second->task_id = g_strdup ("12");
+    recipe->recipe_id = g_strdup ("1");
+    recipe->tasks = g_list_append (recipe->tasks, first);
+    recipe->tasks = g_list_append (recipe->tasks, second);
+
+    g_assert_true (restraint_recipe_update_roles_from_memory (recipe, xml,
+                   strlen (xml), "http://localhost/recipes/1/", &error));
+    g_assert_no_error (error);
+    g_assert_cmpuint (g_list_length (recipe->roles), ==, 1);
+    role = recipe->roles->data;
+    g_assert_cmpstr (role->value, ==, "SERVERS");
+    g_assert_cmpstr (role->systems, ==, "a b");
+    g_assert_cmpuint (g_list_length (first->roles), ==, 1);
+    role = first->roles->data;
+    g_assert_cmpstr (role->value, ==, "CLIENTS");
+    g_assert_cmpstr (role->systems, ==, "c");
+    g_assert_null (second->roles);
+
+    g_assert_false (restraint_recipe_update_roles_from_memory (recipe, bad,
+                    strlen (bad), "http://localhost/recipes/1/", &error));
+    g_assert_error (error, RESTRAINT_RECIPE_PARSE_ERROR,
+                    RESTRAINT_RECIPE_PARSE_ERROR_UNRECOGNISED);
+    g_assert_cmpstr (error->message, ==,
+                     "Task 11 has 'role' element without 'value' attribute");
+    g_clear_error (&error);
+    // Left alone on error
+    g_assert_cmpuint (g_list_length (first->roles), ==, 1);
+
+    g_list_free_full (recipe->tasks, (GDestroyNotify) restraint_task_free);
+    g_list_free_full (recipe->roles, (GDestroyNotify) restraint_role_free);
+    g_free (recipe->recipe_id);
+    g_slice_free (Recipe, recipe);
+}
+
+/*
+ * A generated recipe with a recipe param and role and the given number
+ * of tasks, each one with a param of its own.
+ */
+static GBytes *
+synthetic_recipe_new (guint tasks, const gchar *bad_task)
+{
+    GString *xml = g_string_new ("<job owner=\"user@example.com\">"
+                                 "<recipeSet><recipe id=\"1\" job_id=\"2\" "
+                                 "recipe_set_id=\"3\" family=\"Fedora39\">"
+                                 "<params><param name=\"GLOBAL\" value=\"foo\"/>"
+                                 "</params><roles><role value=\"SERVERS\">"
+                                 "<system value=\"a\"/></role></roles>");
+
+    for (guint i = 1; i <= tasks; i++) {
+        g_string_append_printf (xml, "<task id=\"%u\" name=\"/distribution/%u\">"
+                                "<rpm name=\"task-%u\" path=\"/mnt/tests/%u\"/>"
+                                "<params><param name=\"N\" value=\"%u\"/></params>"
+                                "</task>", i, i, i, i, i);
+    }
+    if (bad_task != NULL) {
+        g_string_append (xml, bad_task);
+    }
+    g_string_append (xml, "</recipe></recipeSet></job>");
+
+    return g_string_free_to_bytes (xml);
+}
+
+static void
+test_recipe_parse_lazy (void)
+{
+    GBytes *xml = synthetic_recipe_new (10000, NULL);
+    GError *error = NULL;
+    Recipe *recipe;
+    GList *tasks = NULL;
+    Param *param;
+    Task *task;
+    gint64 start;
+    guint count = 0;
+
+    start = g_get_monotonic_time ();
+    recipe = restraint_recipe_parse (xml, soup_uri_new ("http://localhost/recipes/1/"),
+                                     &error, NULL);
+    g_test_message ("Loaded 10000 tasks in %" G_GINT64_FORMAT " us",
+                    g_get_monotonic_time () - start);
+    g_bytes_unref (xml);
+    g_assert_no_error (error);
+    g_assert_nonnull (recipe);
+
+    g_assert_cmpstr (recipe->recipe_id, ==, "1");
+    g_assert_cmpstr (recipe->job_id, ==, "2");
+    g_assert_cmpstr (recipe->recipe_set_id, ==, "3");
+    g_assert_cmpstr (recipe->osmajor, ==, "Fedora39");
+    g_assert_cmpstr (recipe->owner, ==, "user@example.com");
+    g_assert_cmpuint (g_list_length (recipe->params), ==, 1);
+    g_assert_cmpuint (g_list_length (recipe->roles), ==, 1);
+    g_assert_cmpuint (recipe->task_count, ==, 10000);
+    // Nothing built until asked for
+    g_assert_null (recipe->tasks);
+
+    while ((tasks = restraint_recipe_next_task (recipe, tasks, &error)) != NULL) {
+        task = tasks->data;
+        count++;
+        g_assert_cmpint (task->order, ==, (count - 1) * 2);
+        g_assert_true (task->recipe == recipe);
+        g_assert_cmpuint (g_list_length (task->params), ==, 1);
+        // Only the tasks reached so far
+        g_assert_cmpuint (g_queue_get_length (recipe->task_xml), ==, 10000 - count);
+    }
+    g_assert_no_error (error);
+    g_assert_cmpuint (count, ==, 10000);
+
+    task = g_list_last (recipe->tasks)->data;
+    g_assert_cmpstr (task->task_id, ==, "10000");
+    g_assert_cmpstr (task->fetch.package_name, ==, "task-10000");
+    g_assert_cmpstr (task->path, ==, "/mnt/tests/10000");
+    g_assert_true (g_str_has_suffix (soup_uri_get_path (task->task_uri),
+                                     "/tasks/10000/"));
+    param = task->params->data;
+    g_assert_cmpstr (param->name, ==, "N");
+    g_assert_cmpstr (param->value, ==, "10000");
+
+    // Going over the list again builds nothing
+    tasks = restraint_recipe_next_task (recipe, NULL, &error);
+    g_assert_true (tasks == recipe->tasks);
+
+    restraint_recipe_free (recipe);
+}
+
+static void
+test_recipe_parse_bad_task (void)
+{
+    GBytes *xml;
+    GError *error = NULL;
+    Recipe *recipe;
+    GList *tasks;
+
+    // Found while loading
+    xml = synthetic_recipe_new (2, "<task name=\"/no/id\"/>");
+    recipe = restraint_recipe_parse (xml, soup_uri_new ("http://localhost/recipes/1/"),
+                                     &error, NULL);
+    g_assert_null (recipe);
+    g_assert_error (error, RESTRAINT_RECIPE_PARSE_ERROR,
+                    RESTRAINT_RECIPE_PARSE_ERROR_UNRECOGNISED);
+    g_assert_cmpstr (error->message, ==, "<task/> without id");
+    g_clear_error (&error);
+    g_bytes_unref (xml);
+
+    // Only found when the task is reached
+    xml = synthetic_recipe_new (1, "<task id=\"2\"><rpm name=\"b\" path=\"/b\"/>"
+                                   "<params><param value=\"x\"/></params></task>");
+    recipe = restraint_recipe_parse (xml, soup_uri_new ("http://localhost/recipes/1/"),
+                                     &error, NULL);
+    g_assert_no_error (error);
+    g_assert_cmpuint (recipe->task_count, ==, 2);
+    tasks = restraint_recipe_next_task (recipe, NULL, &error);
+    g_assert_no_error (error);
+    g_assert_nonnull (tasks);
+    g_assert_null (restraint_recipe_next_task (recipe, tasks, &error));
+    g_assert_error (error, RESTRAINT_RECIPE_PARSE_ERROR,
+                    RESTRAINT_RECIPE_PARSE_ERROR_UNRECOGNISED);
+    g_assert_cmpstr (error->message, ==,
+                     "Task 2 has 'param' element without 'name' attribute");
+    g_clear_error (&error);
+    restraint_recipe_free (recipe);
+    g_bytes_unref (xml);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -364,6 +548,9 @@ main (int   argc,
     g_test_init (&argc, &argv, NULL);
 
     g_test_add_func ("/task/restraint_task_new", test_restraint_task_new);
+    g_test_add_func ("/task/recipe_update_roles_from_memory", test_recipe_update_roles_from_memory);
+    g_test_add_func ("/task/recipe_parse/lazy", test_recipe_parse_lazy);
+    g_test_add_func ("/task/recipe_parse/bad_task", test_recipe_parse_bad_task);
     g_test_add_func ("/task/restraint_task_free", test_restraint_task_free);
     g_test_add_func ("/task/parse_task_config/no_file", test_parse_task_config_no_file);
     g_test_add_func ("/task/parse_task_config/file_exists", test_parse_task_config_file_exists);
@@ -0,0 +1,300 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "task_plugin.h"
+
+static void
+test_host_osmajor (void)
+{
+    gchar *osmajor;
+
+    osmajor = rstrnt_host_osmajor ("Fedora release 39 (Thirty Nine)\n");
+    g_assert_cmpstr (osmajor, ==, "Fedora39");
+    g_free (osmajor);
+
+    osmajor = rstrnt_host_osmajor ("Red Hat Enterprise Linux release 9.2 (Plow)\n");
+    g_assert_cmpstr (osmajor, ==, "RedHatEnterpriseLinux9");
+    g_free (osmajor);
+
+    // Nothing to match, sed only drops the blanks
+    osmajor = rstrnt_host_osmajor ("Some Linux 1.0\n");
+    g_assert_cmpstr (osmajor, ==, "SomeLinux1.0");
+    g_free (osmajor);
+}
+
+static void
+test_host_unconfined_context (void)
+{
+    gchar *context;
+
+    context = rstrnt_host_unconfined_context ("NAME=\"Red Hat Enterprise Linux\"\n"
+                                              "ID=\"rhel\"\n"
+                                              "VERSION_ID=\"9.2\"\n");
+    g_assert_cmpstr (context, ==, "unconfined_u:unconfined_r:unconfined_t:s0-s0:c0.c1023");
+    g_free (context);
+
+    context = rstrnt_host_unconfined_context ("ID=fedora\nVERSION_ID=39\n");
+    g_assert_cmpstr (context, ==, "unconfined_u:unconfined_r:unconfined_t:s0-s0:c0.c1023");
+    g_free (context);
+
+    // VERSION_ID must not be taken for ID
+    context = rstrnt_host_unconfined_context ("VERSION_ID=8\nID=\"centos\"\n");
+    g_assert_cmpstr (context, ==, "root:system_r:unconfined_t:s0");
+    g_free (context);
+
+    context = rstrnt_host_unconfined_context ("");
+    g_assert_cmpstr (context, ==, "root:system_r:unconfined_t:s0");
+    g_free (context);
+}
+
+static void
+test_host_login_env (void)
+{
+    const gchar *envp[] = { "HOME=/root", "PATH=/usr/bin:/bin", NULL };
+    const gchar login_env[] = "HOME=/root\0PATH=/usr/bin:/bin:/root/bin\0"
+                              "SHLVL=1\0HOSTNAME=box\0_=/usr/bin/env\0";
+    gchar **vars;
+
+    vars = rstrnt_host_login_env (envp, login_env, sizeof (login_env) - 1);
+    g_assert_cmpuint (g_strv_length (vars), ==, 2);
+    g_assert_cmpstr (vars[0], ==, "PATH=/usr/bin:/bin:/root/bin");
+    g_assert_cmpstr (vars[1], ==, "HOSTNAME=box");
+    g_strfreev (vars);
+}
+
+static void
+host_facts_cb (RstrntHostFacts *facts, gpointer user_data)
+{
+    RstrntHostFacts **found = user_data;
+
+    *found = facts;
+}
+
+static void
+test_host_facts_lookup (void)
+{
+    const gchar *envp[] = { "HOME=/", "PATH=/usr/bin:/bin", NULL };
+    RstrntHostFacts *facts = NULL;
+
+    rstrnt_host_facts_lookup (envp, NULL, host_facts_cb, &facts);
+    // The login shell runs from the main loop
+    g_assert_null (facts);
+    while (facts == NULL) {
+        g_main_context_iteration (NULL, TRUE);
+    }
+    g_assert_cmpstr (facts->hostname, ==, g_get_host_name ());
+    g_assert_nonnull (facts->login_env);
+    rstrnt_host_facts_free (facts);
+}
+
+typedef struct {
+    gchar *plugin_dir;
+    RstrntEnvMap *env;
+    RstrntHostFacts *facts;
+} PluginFixture;
+
+/*
+ * A task_run.d with the shipped scripts and two custom ones, and what
+ * rstrnt_host_facts_lookup() could find without looking at this host.
+ */
+static PluginFixture *
+plugin_fixture_new (void)
+{
+    PluginFixture *fixture = g_new0 (PluginFixture, 1);
+    const gchar *scripts[] = {
+        "05_linger", "10_bash_login", "12_custom", "15_beakerlib", "20_unconfined",
+        "25_environment", "30_restore_events", "35_oom_adj", "40_custom", ".hidden",
+    };
+    GError *error = NULL;
+
+    fixture->plugin_dir = g_dir_make_tmp ("test_task_plugin_XXXXXX", &error);
+    g_assert_no_error (error);
+    for (guint i = 0; i < G_N_ELEMENTS (scripts); i++) {
+        gchar *path = g_build_filename (fixture->plugin_dir, scripts[i], NULL);
+        g_assert_true (g_file_set_contents (path, "#!/bin/sh\nexec \"$@\"\n", -1, NULL));
+        g_free (path);
+    }
+
+    fixture->env = rstrnt_env_map_new (NULL);
+    rstrnt_env_map_set (fixture->env, ENV_LAYER_HARNESS, "PATH", "/usr/bin:/bin");
+    rstrnt_env_map_set (fixture->env, ENV_LAYER_HARNESS, "RSTRNT_NOPLUGINS", "1");
+
+    fixture->facts = g_slice_new0 (RstrntHostFacts);
+    fixture->facts->login_env = g_strsplit ("PATH=/usr/bin:/bin:/root/bin", " ", -1);
+    fixture->facts->hostname = g_strdup ("box.example.com");
+    fixture->facts->osarch = g_strdup ("x86_64");
+    fixture->facts->osmajor = g_strdup ("Fedora39");
+    fixture->facts->exec_context = g_strdup ("unconfined_u:unconfined_r:unconfined_t:s0");
+
+    return fixture;
+}
+
+static void
+plugin_fixture_free (PluginFixture *fixture)
+{
+    GDir *dir = g_dir_open (fixture->plugin_dir, 0, NULL);
+    const gchar *name;
+
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        gchar *path = g_build_filename (fixture->plugin_dir, name, NULL);
+        g_remove (path);
+        g_free (path);
+    }
+    g_dir_close (dir);
+    g_rmdir (fixture->plugin_dir);
+    g_free (fixture->plugin_dir);
+    rstrnt_env_map_unref (fixture->env);
+    rstrnt_host_facts_free (fixture->facts);
+    g_free (fixture);
+}
+
+static void
+test_task_plugins_native (void)
+{
+    PluginFixture *fixture = plugin_fixture_new ();
+    const gchar *command[] = { "make", "run", NULL };
+    RstrntTaskPlugins *plugins;
+    gchar *custom12, *custom40;
+
+    plugins = rstrnt_task_plugins_new (fixture->plugin_dir, command,
+                                       fixture->env, fixture->facts);
+
+    // Only the unknown scripts are left to exec
+    custom12 = g_build_filename (fixture->plugin_dir, "12_custom", NULL);
+    custom40 = g_build_filename (fixture->plugin_dir, "40_custom", NULL);
+    g_assert_cmpuint (g_strv_length (plugins->argv), ==, 4);
+    g_assert_cmpstr (plugins->argv[0], ==, custom12);
+    g_assert_cmpstr (plugins->argv[1], ==, custom40);
+    g_assert_cmpstr (plugins->argv[2], ==, "make");
+    g_assert_cmpstr (plugins->argv[3], ==, "run");
+    g_free (custom40);
+    g_free (custom12);
+
+    // No loginctl in the facts, 05_linger had nothing to do either
+    g_assert_cmpuint (plugins->steps, ==, TASK_PLUGIN_LINGER | TASK_PLUGIN_LOGIN |
+                                          TASK_PLUGIN_BEAKERLIB | TASK_PLUGIN_UNCONFINED |
+                                          TASK_PLUGIN_ENVIRONMENT |
+                                          TASK_PLUGIN_RESTORE_EVENTS | TASK_PLUGIN_OOM_ADJ);
+    g_assert_true (plugins->noplugins);
+    g_assert_cmpstr (plugins->attrs.exec_context, ==, fixture->facts->exec_context);
+    g_assert_true (plugins->attrs.setsid);
+    // Plugin runs keep restraintd's protection from the OOM killer
+    g_assert_null (plugins->attrs.oom_score_adj);
+    g_assert_null (rstrnt_env_map_get (plugins->env, "XDG_RUNTIME_DIR"));
+
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "RSTRNT_TASK_PLUGINS_DIR"), ==,
+                     fixture->plugin_dir);
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "PATH"), ==, "/usr/bin:/bin:/root/bin");
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "BEAKERLIB_COMMAND_REPORT_RESULT"), ==,
+                     "/usr/bin/rstrnt-report-result --rhts");
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "HOSTNAME"), ==, "box.example.com");
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "RSTRNT_OSARCH"), ==, "x86_64");
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "RSTRNT_OSMAJOR"), ==, "Fedora39");
+
+    // The task environment itself is left alone
+    g_assert_cmpstr (rstrnt_env_map_get (fixture->env, "PATH"), ==, "/usr/bin:/bin");
+    g_assert_null (rstrnt_env_map_get (fixture->env, "HOSTNAME"));
+
+    rstrnt_task_plugins_free (plugins);
+    plugin_fixture_free (fixture);
+}
+
+static void
+test_task_plugins_params (void)
+{
+    PluginFixture *fixture = plugin_fixture_new ();
+    const gchar *command[] = { "make", "run", NULL };
+    RstrntTaskPlugins *plugins;
+
+    // Parameters win over the login shell, host facts lose to anything
+    rstrnt_env_map_set (fixture->env, ENV_LAYER_TASK_PARAM, "PATH", "/opt/bin");
+    rstrnt_env_map_set (fixture->env, ENV_LAYER_METADATA, "HOSTNAME", "alias");
+
+    plugins = rstrnt_task_plugins_new (fixture->plugin_dir, command,
+                                       fixture->env, fixture->facts);
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "PATH"), ==, "/opt/bin");
+    g_assert_cmpstr (rstrnt_env_map_get (plugins->env, "HOSTNAME"), ==, "alias");
+    rstrnt_task_plugins_free (plugins);
+    plugin_fixture_free (fixture);
+}
+
+static void
+test_task_plugins_removed (void)
+{
+    PluginFixture *fixture = plugin_fixture_new ();
+    const gchar *command[] = { "make", "run", NULL };
+    RstrntTaskPlugins *plugins;
+    gchar *path;
+
+    // Removing a script still disables the step
+    path = g_build_filename (fixture->plugin_dir, "20_unconfined", NULL);
+    g_remove (path);
+    g_free (path);
+
+    plugins = rstrnt_task_plugins_new (fixture->plugin_dir, command,
+                                       fixture->env, fixture->facts);
+    g_assert_false (plugins->steps & TASK_PLUGIN_UNCONFINED);
+    g_assert_null (plugins->attrs.exec_context);
+    rstrnt_task_plugins_free (plugins);
+    plugin_fixture_free (fixture);
+}
+
+static void
+test_task_plugins_scripts (void)
+{
+    PluginFixture *fixture = plugin_fixture_new ();
+    const gchar *command[] = { "make", "run", NULL };
+    RstrntTaskPlugins *plugins;
+    gchar *first;
+
+    rstrnt_env_map_set (fixture->env, ENV_LAYER_RECIPE_PARAM, "RSTRNT_SCRIPT_PLUGINS", "1");
+    plugins = rstrnt_task_plugins_new (fixture->plugin_dir, command,
+                                       fixture->env, fixture->facts);
+
+    // Every script, as run_task_plugins did
+    first = g_build_filename (fixture->plugin_dir, "05_linger", NULL);
+    g_assert_cmpuint (plugins->steps, ==, 0);
+    g_assert_cmpuint (g_strv_length (plugins->argv), ==, 11);
+    g_assert_cmpstr (plugins->argv[0], ==, first);
+    g_assert_cmpstr (plugins->argv[9], ==, "make");
+    g_assert_null (rstrnt_env_map_get (plugins->env, "HOSTNAME"));
+    g_free (first);
+
+    rstrnt_task_plugins_free (plugins);
+    plugin_fixture_free (fixture);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/host/osmajor", test_host_osmajor);
+    g_test_add_func ("/host/unconfined_context", test_host_unconfined_context);
+    g_test_add_func ("/host/login_env", test_host_login_env);
+    g_test_add_func ("/host/facts_lookup", test_host_facts_lookup);
+    g_test_add_func ("/task_plugins/native", test_task_plugins_native);
+    g_test_add_func ("/task_plugins/params", test_task_plugins_params);
+    g_test_add_func ("/task_plugins/removed", test_task_plugins_removed);
+    g_test_add_func ("/task_plugins/scripts", test_task_plugins_scripts);
+
+    return g_test_run ();
+}
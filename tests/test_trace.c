@@ -0,0 +1,240 @@
+/*
+    This file is part of Restraint.
+
+    Restraint is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Restraint is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#include "errors.h"
+#include "trace.h"
+
+static gchar *tmp_test_dir;
+
+static SoupMessage *
+trace_message_new (const gchar *method, const gchar *uri, const gchar *body,
+                   guint status, const gchar *response)
+{
+    SoupMessage *msg = soup_message_new (method, uri);
+
+    if (body != NULL) {
+        soup_message_set_request (msg, "application/x-www-form-urlencoded",
+                                  SOUP_MEMORY_STATIC, body, strlen (body));
+    }
+    soup_message_set_status (msg, status);
+    if (response != NULL) {
+        soup_message_body_append (msg->response_body, SOUP_MEMORY_STATIC,
+                                  response, strlen (response));
+    }
+    return msg;
+}
+
+static void
+test_trace_records (void)
+{
+    const gchar *body = "path=%2Ftest&result=PASS";
+    RstrntTraceEntry *entry;
+    GPtrArray *entries;
+    GError *error = NULL;
+    SoupMessage *msg;
+    gint64 started;
+    gint64 start;
+    gchar *path;
+
+    path = g_build_filename (tmp_test_dir, "records.trace", NULL);
+    g_assert_true (rstrnt_trace_open (path, &error));
+    g_assert_no_error (error);
+    g_assert_true (rstrnt_trace_enabled ());
+
+    started = g_get_monotonic_time ();
+    msg = trace_message_new ("POST", "http://lab.example.com:8000/recipes/1/tasks/2/results/",
+                             body, SOUP_STATUS_SERVICE_UNAVAILABLE, NULL);
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, started, 1);
+    soup_message_set_status (msg, SOUP_STATUS_CREATED);
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, started + 10, 2);
+    g_object_unref (msg);
+
+    msg = trace_message_new ("GET", "http://localhost:8081/recipes/1/watchdog",
+                             NULL, SOUP_STATUS_OK, "{\"remaining\": 600}");
+    rstrnt_trace_message (TRACE_INBOUND, msg, started, 1);
+    g_object_unref (msg);
+    rstrnt_trace_close ();
+    g_assert_false (rstrnt_trace_enabled ());
+
+    entries = rstrnt_trace_read (path, &start, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (entries->len, ==, 3);
+    g_assert_cmpint (start, >, 0);
+
+    entry = g_ptr_array_index (entries, 0);
+    g_assert_cmpstr (entry->path, ==, "/recipes/1/tasks/2/results/");
+    g_assert_cmpuint (entry->record.direction, ==, TRACE_OUTBOUND);
+    g_assert_cmpstr (rstrnt_trace_method_name (entry->record.method), ==, "POST");
+    g_assert_cmpuint (entry->record.status, ==, SOUP_STATUS_SERVICE_UNAVAILABLE);
+    g_assert_cmpuint (entry->record.attempt, ==, 1);
+    g_assert_cmpuint (entry->record.request_bytes, ==, strlen (body));
+    g_assert_cmpuint (entry->record.response_bytes, ==, 0);
+    g_assert_cmpint (entry->record.latency, >=, 0);
+
+    entry = g_ptr_array_index (entries, 1);
+    g_assert_cmpuint (entry->record.status, ==, SOUP_STATUS_CREATED);
+    g_assert_cmpuint (entry->record.attempt, ==, 2);
+    g_assert_cmpint (entry->record.timestamp,
+                     ==, ((RstrntTraceEntry *) g_ptr_array_index (entries, 0))->record.timestamp + 10);
+
+    entry = g_ptr_array_index (entries, 2);
+    g_assert_cmpstr (entry->path, ==, "/recipes/1/watchdog");
+    g_assert_cmpuint (entry->record.direction, ==, TRACE_INBOUND);
+    g_assert_cmpstr (rstrnt_trace_direction_name (entry->record.direction), ==, "in");
+    g_assert_cmpstr (rstrnt_trace_method_name (entry->record.method), ==, "GET");
+    g_assert_cmpuint (entry->record.request_bytes, ==, 0);
+    g_assert_cmpuint (entry->record.response_bytes, ==, strlen ("{\"remaining\": 600}"));
+
+    g_ptr_array_unref (entries);
+    g_remove (path);
+    g_free (path);
+}
+
+/* Nothing is recorded without a trace, and a record cut short is dropped */
+static void
+test_trace_truncated (void)
+{
+    GPtrArray *entries;
+    GError *error = NULL;
+    SoupMessage *msg;
+    gchar *contents;
+    gsize length;
+    gchar *path;
+
+    msg = trace_message_new ("PUT", "http://lab.example.com:8000/recipes/1/tasks/2/logs/taskout.log",
+                             "output", SOUP_STATUS_NO_CONTENT, NULL);
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, g_get_monotonic_time (), 1);
+
+    path = g_build_filename (tmp_test_dir, "truncated.trace", NULL);
+    g_assert_true (rstrnt_trace_open (path, &error));
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, g_get_monotonic_time (), 1);
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, g_get_monotonic_time (), 1);
+    rstrnt_trace_close ();
+    g_object_unref (msg);
+
+    g_assert_true (g_file_get_contents (path, &contents, &length, &error));
+    g_assert_true (g_file_set_contents (path, contents, length - 3, &error));
+    g_free (contents);
+
+    entries = rstrnt_trace_read (path, NULL, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (entries->len, ==, 1);
+    g_assert_cmpstr (((RstrntTraceEntry *) g_ptr_array_index (entries, 0))->path,
+                     ==, "/recipes/1/tasks/2/logs/taskout.log");
+
+    g_ptr_array_unref (entries);
+    g_remove (path);
+    g_free (path);
+}
+
+/* A restart appends to the trace, dropping what was cut short */
+static void
+test_trace_segments (void)
+{
+    RstrntTraceEntry *first, *second;
+    GPtrArray *entries;
+    GError *error = NULL;
+    SoupMessage *msg;
+    gchar *contents;
+    gsize length;
+    gchar *path;
+
+    msg = trace_message_new ("POST", "http://lab.example.com:8000/recipes/1/tasks/2/status",
+                             "status=Running", SOUP_STATUS_NO_CONTENT, NULL);
+    path = g_build_filename (tmp_test_dir, "segments.trace", NULL);
+    g_assert_true (rstrnt_trace_open (path, &error));
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, g_get_monotonic_time (), 1);
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, g_get_monotonic_time (), 1);
+    rstrnt_trace_close ();
+
+    g_assert_true (g_file_get_contents (path, &contents, &length, &error));
+    g_assert_true (g_file_set_contents (path, contents, length - 3, &error));
+    g_free (contents);
+
+    g_assert_true (rstrnt_trace_open (path, &error));
+    g_assert_no_error (error);
+    rstrnt_trace_message (TRACE_OUTBOUND, msg, g_get_monotonic_time (), 1);
+    rstrnt_trace_close ();
+    g_object_unref (msg);
+
+    entries = rstrnt_trace_read (path, NULL, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (entries->len, ==, 2);
+    first = g_ptr_array_index (entries, 0);
+    second = g_ptr_array_index (entries, 1);
+    g_assert_cmpuint (first->segment, ==, 0);
+    g_assert_cmpuint (second->segment, ==, 1);
+    g_assert_cmpstr (second->path, ==, "/recipes/1/tasks/2/status");
+    g_assert_cmpint (second->record.timestamp, >=, first->record.timestamp);
+
+    g_ptr_array_unref (entries);
+    g_remove (path);
+    g_free (path);
+}
+
+static void
+test_trace_invalid (void)
+{
+    GPtrArray *entries;
+    GError *error = NULL;
+    gchar *path;
+
+    path = g_build_filename (tmp_test_dir, "invalid.trace", NULL);
+    g_assert_true (g_file_set_contents (path, "not a trace file at all", -1, &error));
+
+    entries = rstrnt_trace_read (path, NULL, &error);
+    g_assert_null (entries);
+    g_assert_error (error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX);
+    g_clear_error (&error);
+
+    // Some other file is never appended to
+    g_assert_false (rstrnt_trace_open (path, &error));
+    g_assert_error (error, RESTRAINT_ERROR, RESTRAINT_PARSE_ERROR_BAD_SYNTAX);
+    g_clear_error (&error);
+    g_assert_false (rstrnt_trace_enabled ());
+
+    g_remove (path);
+    g_free (path);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    int retval;
+
+    g_test_init (&argc, &argv, NULL);
+
+    tmp_test_dir = g_dir_make_tmp ("test_trace_XXXXXX", NULL);
+
+    g_test_add_func ("/trace/records", test_trace_records);
+    g_test_add_func ("/trace/truncated", test_trace_truncated);
+    g_test_add_func ("/trace/segments", test_trace_segments);
+    g_test_add_func ("/trace/invalid", test_trace_invalid);
+
+    retval = g_test_run ();
+
+    g_remove (tmp_test_dir);
+    g_free (tmp_test_dir);
+
+    return retval;
+}
@@ -15,11 +15,16 @@
   along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <libsoup/soup.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "upload.h"
+#include "utils.h"
 
 gchar *tmp_test_dir = NULL;
 SoupSession *soup_session = NULL;
@@ -115,6 +120,324 @@ test_upload_file_no_file (void)
     g_assert_false (success);
 }
 
+/*
+ * Several ranges in flight and the chunk size adapting on the way.
+ */
+static void
+test_upload_file_pipelined (void)
+{
+    gboolean             success;
+    gsize                log_size;
+    GStatBuf             st;
+    UploadStats          stats = { 0 };
+    UploadOptions        options = { .inflight = 4, .retries = 1 };
+    g_autofree gchar    *log_path = NULL;
+    g_autoptr (GError)   err = NULL;
+    g_autoptr (SoupURI)  uri = NULL;
+
+    log_path = g_build_filename (tmp_test_dir, "pipelined.log", NULL);
+
+    mk_dummy_log (log_path, 4 * 1024 * 1024 + 17);
+    g_assert_cmpint (g_stat (log_path, &st), ==, 0);
+    log_size = st.st_size;
+
+    uri = soup_uri_new ("http://localhost:8000/");
+
+    success = upload_file_full (soup_session, log_path, "pipelined.log", uri,
+                                &options, &stats, &err);
+
+    g_assert_no_error (err);
+    g_assert_true (success);
+    g_assert_cmpuint (stats.sent, ==, log_size);
+    g_assert_cmpuint (stats.skipped, ==, 0);
+    g_assert_cmpuint (stats.chunks, >, 1);
+    g_assert_cmpuint (stats.chunk_size, >=, UPLOAD_CHUNK_MIN);
+    g_assert_cmpuint (stats.chunk_size, <=, UPLOAD_CHUNK_MAX);
+
+    g_remove (log_path);
+}
+
+/*
+ * The test server hands out files from its working directory, so HEAD
+ * reports the part of the log written there.
+ */
+static void
+test_upload_file_resume (void)
+{
+    gboolean             success;
+    gsize                log_size;
+    gsize                partial = UPLOAD_RESUME_WINDOW + 100000;
+    UploadStats          stats = { 0 };
+    UploadOptions        options = { .inflight = 2, .retries = 1, .resume = TRUE };
+    g_autofree gchar    *log_path = NULL;
+    g_autofree gchar    *contents = NULL;
+    g_autoptr (GError)   err = NULL;
+    g_autoptr (SoupURI)  uri = NULL;
+
+    log_path = g_build_filename (tmp_test_dir, "resume.log", NULL);
+
+    mk_dummy_log (log_path, UPLOAD_RESUME_WINDOW + 300000);
+    g_assert_true (g_file_get_contents (log_path, &contents, &log_size, NULL));
+    g_assert_true (g_file_set_contents ("test_upload_resume.log", contents,
+                                        partial, NULL));
+
+    uri = soup_uri_new ("http://localhost:8000/");
+
+    success = upload_file_full (soup_session, log_path, "test_upload_resume.log",
+                                uri, &options, &stats, &err);
+
+    g_assert_no_error (err);
+    g_assert_true (success);
+    g_assert_cmpuint (stats.skipped, ==, partial - UPLOAD_RESUME_WINDOW);
+    g_assert_cmpuint (stats.sent, ==, log_size - stats.skipped);
+
+    g_remove ("test_upload_resume.log");
+    g_remove (log_path);
+}
+
+/* Lab controller stand-in writing each range at its offset */
+typedef struct {
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+    SoupServer *server;
+    gchar *path;
+    gint hold;  /* Never answer the first range */
+} RangeServer;
+
+static RangeServer range_server;
+
+static void
+range_callback (SoupServer *server, SoupMessage *msg,
+                const char *path, GHashTable *query,
+                SoupClientContext *context, gpointer data)
+{
+    goffset start, end, total;
+    gchar *contents = NULL;
+    gsize length = 0;
+    gint fd;
+
+    if (msg->method == SOUP_METHOD_HEAD) {
+        if (g_file_get_contents (range_server.path, &contents, &length, NULL)) {
+            soup_message_set_response (msg, "text/plain", SOUP_MEMORY_TAKE,
+                                       contents, length);
+            soup_message_set_status (msg, SOUP_STATUS_OK);
+        } else {
+            soup_message_set_status (msg, SOUP_STATUS_NOT_FOUND);
+        }
+        return;
+    }
+    g_assert_true (soup_message_headers_get_content_range (msg->request_headers,
+                                                           &start, &end, &total));
+    if (start == 0 && g_atomic_int_get (&range_server.hold)) {
+        soup_server_pause_message (server, msg);
+        return;
+    }
+    fd = g_open (range_server.path, O_WRONLY | O_CREAT, 0644);
+    g_assert_cmpint (fd, >=, 0);
+    g_assert_cmpint (pwrite (fd, msg->request_body->data, msg->request_body->length, start),
+                     ==, msg->request_body->length);
+    close (fd);
+    soup_message_set_status (msg, SOUP_STATUS_OK);
+}
+
+static gpointer
+range_server_thread (gpointer data)
+{
+    g_main_loop_run (range_server.loop);
+    return NULL;
+}
+
+static guint
+range_server_start (const gchar *path)
+{
+    GError *error = NULL;
+    GSList *uris;
+    guint port;
+
+    range_server.path = g_strdup (path);
+    range_server.hold = TRUE;
+    range_server.context = g_main_context_new ();
+    range_server.loop = g_main_loop_new (range_server.context, FALSE);
+
+    // The listening sources go to the thread default context
+    g_main_context_push_thread_default (range_server.context);
+    range_server.server = soup_server_new (NULL, NULL);
+    soup_server_add_handler (range_server.server, "/", range_callback, NULL, NULL);
+    soup_server_listen_local (range_server.server, 0,
+                              SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+    g_assert_no_error (error);
+    g_main_context_pop_thread_default (range_server.context);
+
+    uris = soup_server_get_uris (range_server.server);
+    port = ((SoupURI *) uris->data)->port;
+    g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+
+    range_server.thread = g_thread_new ("range-server", range_server_thread, NULL);
+    return port;
+}
+
+static void
+range_server_stop (void)
+{
+    g_main_loop_quit (range_server.loop);
+    g_thread_join (range_server.thread);
+    soup_server_disconnect (range_server.server);
+    g_object_unref (range_server.server);
+    g_main_loop_unref (range_server.loop);
+    g_main_context_unref (range_server.context);
+    g_free (range_server.path);
+}
+
+/*
+ * rstrnt-report-log is killed while its first range hangs and the later
+ * ones are written already.  The server then reports the full length
+ * with a hole at the start, resuming must fill it.
+ */
+static void
+test_upload_file_resume_hole (void)
+{
+    gboolean             success;
+    gsize                log_size;
+    gsize                stored_size;
+    guint                port;
+    UploadStats          stats = { 0 };
+    UploadOptions        options = { .inflight = 4, .retries = 1, .resume = TRUE };
+    g_autofree gchar    *contents = NULL;
+    g_autofree gchar    *log_path = NULL;
+    g_autofree gchar    *server_path = NULL;
+    g_autofree gchar    *stored = NULL;
+    g_autofree gchar    *url = NULL;
+    g_autoptr (GError)   err = NULL;
+    g_autoptr (SoupURI)  uri = NULL;
+
+    if (g_test_subprocess ()) {
+        options.resume = FALSE;
+        uri = soup_uri_new (g_getenv ("TEST_UPLOAD_URL"));
+        upload_file_full (soup_session, (gchar *) g_getenv ("TEST_UPLOAD_LOG"),
+                          "resume_hole.log", uri, &options, NULL, NULL);
+        return;
+    }
+
+    log_path = g_build_filename (tmp_test_dir, "resume_hole.log", NULL);
+    server_path = g_build_filename (tmp_test_dir, "resume_hole.server", NULL);
+    mk_dummy_log (log_path, 1024 * 1024 + 5);
+    g_assert_true (g_file_get_contents (log_path, &contents, &log_size, NULL));
+
+    port = range_server_start (server_path);
+    url = g_strdup_printf ("http://127.0.0.1:%u/", port);
+    g_setenv ("TEST_UPLOAD_URL", url, TRUE);
+    g_setenv ("TEST_UPLOAD_LOG", log_path, TRUE);
+
+    // Killed on the timeout, waiting for the first range
+    g_test_trap_subprocess (NULL, 2 * G_USEC_PER_SEC, G_TEST_SUBPROCESS_DEFAULT);
+    g_test_trap_assert_failed ();
+
+    g_assert_true (g_file_get_contents (server_path, &stored, &stored_size, NULL));
+    g_assert_cmpuint (stored_size, ==, log_size);
+    g_assert_cmpint (stored[0], ==, '\0');
+    g_clear_pointer (&stored, g_free);
+
+    g_atomic_int_set (&range_server.hold, FALSE);
+    uri = soup_uri_new (url);
+    success = upload_file_full (soup_session, log_path, "resume_hole.log",
+                                uri, &options, &stats, &err);
+
+    g_assert_no_error (err);
+    g_assert_true (success);
+    g_assert_cmpuint (stats.skipped + stats.sent, ==, log_size);
+    g_assert_true (g_file_get_contents (server_path, &stored, &stored_size, NULL));
+    g_assert_cmpmem (stored, stored_size, contents, log_size);
+
+    range_server_stop ();
+    g_unsetenv ("TEST_UPLOAD_URL");
+    g_unsetenv ("TEST_UPLOAD_LOG");
+    g_remove (server_path);
+    g_remove (log_path);
+}
+
+/*
+ * A socket file left behind by a restraintd that is gone, nothing accepts
+ * on it.  The HEAD and the ranges go over TCP and a session is made for
+ * them.
+ */
+static void
+test_upload_file_stale_socket (void)
+{
+    gboolean             success;
+    gsize                log_size;
+    gsize                partial;
+    gint                 fd;
+    UploadStats          stats = { 0 };
+    UploadOptions        options = { .resume = TRUE };
+    struct sockaddr_un   addr = { .sun_family = AF_UNIX };
+    g_autofree gchar    *contents = NULL;
+    g_autofree gchar    *log_path = NULL;
+    g_autofree gchar    *socket_path = NULL;
+    g_autoptr (GError)   err = NULL;
+    g_autoptr (SoupURI)  uri = NULL;
+
+    socket_path = get_local_socket_filename (8000);
+    if (g_file_test (socket_path, G_FILE_TEST_EXISTS)) {
+        g_test_skip ("A local socket for port 8000 exists already");
+        return;
+    }
+    g_strlcpy (addr.sun_path, socket_path, sizeof (addr.sun_path));
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    g_assert_cmpint (fd, >=, 0);
+    g_assert_cmpint (bind (fd, (struct sockaddr *) &addr, sizeof (addr)), ==, 0);
+    close (fd);
+
+    log_path = g_build_filename (tmp_test_dir, "stale_socket.log", NULL);
+
+    mk_dummy_log (log_path, 512 * 1024 + 3);
+    g_assert_true (g_file_get_contents (log_path, &contents, &log_size, NULL));
+    partial = log_size / 2;
+    g_assert_true (g_file_set_contents ("test_upload_stale_socket.log", contents,
+                                        partial, NULL));
+
+    uri = soup_uri_new ("http://localhost:8000/");
+
+    success = upload_file_full (NULL, log_path, "test_upload_stale_socket.log",
+                                uri, &options, &stats, &err);
+
+    g_assert_no_error (err);
+    g_assert_true (success);
+    g_assert_cmpuint (stats.skipped, ==, 0);
+    g_assert_cmpuint (stats.sent, ==, log_size);
+
+    g_remove ("test_upload_stale_socket.log");
+    g_remove (socket_path);
+    g_remove (log_path);
+}
+
+static void
+test_upload_chunk_size (void)
+{
+    gsize size;
+
+    /* 1 MiB in 0.1 s, grows towards 10 MiB a second */
+    size = upload_chunk_size (UPLOAD_CHUNK_START, 1024 * 1024, G_USEC_PER_SEC / 10);
+    g_assert_cmpuint (size, >, UPLOAD_CHUNK_START);
+    g_assert_cmpuint (size % UPLOAD_CHUNK_MIN, ==, 0);
+
+    /* Never above the maximum however fast */
+    size = upload_chunk_size (UPLOAD_CHUNK_MAX, UPLOAD_CHUNK_MAX, 1);
+    g_assert_cmpuint (size, ==, UPLOAD_CHUNK_MAX);
+
+    /* 1 MiB in 10 s shrinks */
+    size = upload_chunk_size (1024 * 1024, 1024 * 1024, 10 * G_USEC_PER_SEC);
+    g_assert_cmpuint (size, <, 1024 * 1024);
+
+    /* Nor below the minimum */
+    size = upload_chunk_size (UPLOAD_CHUNK_MIN, 1, 60 * G_USEC_PER_SEC);
+    g_assert_cmpuint (size, ==, UPLOAD_CHUNK_MIN);
+
+    /* A clock that did not move counts as very fast */
+    size = upload_chunk_size (UPLOAD_CHUNK_START, UPLOAD_CHUNK_START, 0);
+    g_assert_cmpuint (size, ==, UPLOAD_CHUNK_MAX);
+}
+
 int
 main (int    argc,
       char **argv)
@@ -129,6 +452,11 @@ main (int    argc,
     g_test_add_func ("/upload/upload_file/dummy_log", test_upload_file_dummy_log);
     g_test_add_func ("/upload/upload_file/no_file", test_upload_file_no_file);
     g_test_add_func ("/upload/upload_file/bad_host", test_upload_file_bad_host);
+    g_test_add_func ("/upload/upload_file/pipelined", test_upload_file_pipelined);
+    g_test_add_func ("/upload/upload_file/resume", test_upload_file_resume);
+    g_test_add_func ("/upload/upload_file/resume_hole", test_upload_file_resume_hole);
+    g_test_add_func ("/upload/upload_file/stale_socket", test_upload_file_stale_socket);
+    g_test_add_func ("/upload/chunk_size", test_upload_chunk_size);
 
     retval = g_test_run ();
 
@@ -0,0 +1,172 @@
+/*
+  This file is part of Restraint.
+
+  Restraint is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Restraint is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Restraint.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+
+#include "watchdog.h"
+
+typedef struct {
+    GMainLoop *loop;
+    guint fired;
+    gint64 fired_at;
+} WatchData;
+
+static void
+watch_cb (gpointer user_data)
+{
+    WatchData *data = (WatchData *) user_data;
+
+    data->fired++;
+    data->fired_at = g_get_monotonic_time ();
+    g_main_loop_quit (data->loop);
+}
+
+static gboolean
+quit_cb (gpointer user_data)
+{
+    g_main_loop_quit (user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+test_watchdog_expire (void)
+{
+    WatchData data = { g_main_loop_new (NULL, FALSE), 0, 0 };
+    RstrntWatchdog *watchdog;
+    GError *error = NULL;
+    gint64 start;
+
+    watchdog = rstrnt_watchdog_new (&error);
+    g_assert_no_error (error);
+    g_assert_false (rstrnt_watchdog_armed (watchdog));
+    rstrnt_watchdog_watch (watchdog, watch_cb, &data);
+
+    start = g_get_monotonic_time ();
+    g_assert_true (rstrnt_watchdog_set (watchdog, 1, &error));
+    g_assert_no_error (error);
+    g_assert_true (rstrnt_watchdog_armed (watchdog));
+    g_assert_cmpint (rstrnt_watchdog_remaining (watchdog), ==, 1);
+
+    g_main_loop_run (data.loop);
+    g_assert_cmpuint (data.fired, ==, 1);
+    // On time, not on the next tick of a seconds timer
+    g_assert_cmpint (data.fired_at - start, >=, G_USEC_PER_SEC);
+    g_assert_cmpint (data.fired_at - start, <, G_USEC_PER_SEC + 250000);
+    g_assert_cmpint (rstrnt_watchdog_remaining (watchdog), ==, 0);
+
+    rstrnt_watchdog_unref (watchdog);
+    g_main_loop_unref (data.loop);
+}
+
+static void
+test_watchdog_adjust (void)
+{
+    WatchData data = { g_main_loop_new (NULL, FALSE), 0, 0 };
+    RstrntWatchdog *watchdog;
+    GError *error = NULL;
+
+    watchdog = rstrnt_watchdog_new (&error);
+    g_assert_no_error (error);
+    rstrnt_watchdog_watch (watchdog, watch_cb, &data);
+
+    // Moving the deadline replaces the old one
+    g_assert_true (rstrnt_watchdog_set (watchdog, 1, NULL));
+    g_assert_true (rstrnt_watchdog_set (watchdog, 600, NULL));
+    g_assert_cmpint (rstrnt_watchdog_remaining (watchdog), ==, 600);
+    g_timeout_add (1500, quit_cb, data.loop);
+    g_main_loop_run (data.loop);
+    g_assert_cmpuint (data.fired, ==, 0);
+
+    // 0 expires right away
+    g_assert_true (rstrnt_watchdog_set (watchdog, 0, NULL));
+    g_main_loop_run (data.loop);
+    g_assert_cmpuint (data.fired, ==, 1);
+
+    rstrnt_watchdog_unref (watchdog);
+    g_main_loop_unref (data.loop);
+}
+
+static void
+test_watchdog_disarm (void)
+{
+    WatchData data = { g_main_loop_new (NULL, FALSE), 0, 0 };
+    RstrntWatchdog *watchdog;
+    GError *error = NULL;
+
+    watchdog = rstrnt_watchdog_new (&error);
+    g_assert_no_error (error);
+    rstrnt_watchdog_watch (watchdog, watch_cb, &data);
+
+    g_assert_true (rstrnt_watchdog_set (watchdog, 1, NULL));
+    rstrnt_watchdog_disarm (watchdog);
+    g_assert_false (rstrnt_watchdog_armed (watchdog));
+    g_assert_cmpint (rstrnt_watchdog_remaining (watchdog), ==, 0);
+    g_timeout_add (1500, quit_cb, data.loop);
+    g_main_loop_run (data.loop);
+    g_assert_cmpuint (data.fired, ==, 0);
+
+    rstrnt_watchdog_unref (watchdog);
+    g_main_loop_unref (data.loop);
+}
+
+/* Without a timerfd the deadline is still enforced */
+static void
+test_watchdog_timeout (void)
+{
+    WatchData data = { g_main_loop_new (NULL, FALSE), 0, 0 };
+    RstrntWatchdog *watchdog;
+    gint64 start;
+
+    watchdog = rstrnt_watchdog_new_timeout ();
+    g_assert_false (rstrnt_watchdog_armed (watchdog));
+    rstrnt_watchdog_watch (watchdog, watch_cb, &data);
+
+    // A disarmed deadline doesn't fire, nor does one that was moved
+    g_assert_true (rstrnt_watchdog_set (watchdog, 1, NULL));
+    rstrnt_watchdog_disarm (watchdog);
+    g_assert_false (rstrnt_watchdog_armed (watchdog));
+    g_assert_true (rstrnt_watchdog_set (watchdog, 1, NULL));
+    g_assert_true (rstrnt_watchdog_set (watchdog, 600, NULL));
+    g_assert_cmpint (rstrnt_watchdog_remaining (watchdog), ==, 600);
+    g_timeout_add (1500, quit_cb, data.loop);
+    g_main_loop_run (data.loop);
+    g_assert_cmpuint (data.fired, ==, 0);
+
+    start = g_get_monotonic_time ();
+    g_assert_true (rstrnt_watchdog_set (watchdog, 1, NULL));
+    g_main_loop_run (data.loop);
+    g_assert_cmpuint (data.fired, ==, 1);
+    g_assert_cmpint (data.fired_at - start, >=, G_USEC_PER_SEC);
+    g_assert_cmpint (rstrnt_watchdog_remaining (watchdog), ==, 0);
+
+    rstrnt_watchdog_unref (watchdog);
+    g_main_loop_unref (data.loop);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/watchdog/expire", test_watchdog_expire);
+    g_test_add_func ("/watchdog/adjust", test_watchdog_adjust);
+    g_test_add_func ("/watchdog/disarm", test_watchdog_disarm);
+    g_test_add_func ("/watchdog/timeout", test_watchdog_timeout);
+
+    return g_test_run ();
+}